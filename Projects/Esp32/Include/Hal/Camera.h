@@ -36,6 +36,8 @@ public:
 	void DeInit();
 	
 	const camera_fb_t * GetFrameBuffer();
+
+	const camera_exposure_stats_t * GetExposureStats();
 	
 	bool Capture();
 
@@ -0,0 +1,85 @@
+/*
+ * BlockChangeDetector.h
+ *
+ *  Finds the 16x16 blocks of a frame that changed since they were last sent.
+ */
+
+#ifndef HAL_CAMERA_ANALYTICS_BLOCKCHANGEDETECTOR_H_
+#define HAL_CAMERA_ANALYTICS_BLOCKCHANGEDETECTOR_H_
+
+#include <cstdint>
+#include "esp_camera.h"
+
+namespace Hal
+{
+
+/// @brief	Keeps four 8x8 luma sums per block as reference signature.
+/// @note	JPEG frames are decoded at 1/8 scale like FrameFingerprint does, the DC value of
+///			every 8x8 block stands for the sum of its quadrant. The reference only moves when
+///			a block is committed, so slow drifts add up until they cross the threshold instead
+///			of getting lost frame by frame.
+class BlockChangeDetector
+{
+public:
+	static constexpr uint16_t BlockSize = 16;
+
+	BlockChangeDetector() = default;
+	~BlockChangeDetector();
+
+	/// @brief	Mean absolute luma change of an 8x8 quadrant that marks the block as changed.
+	void SetThreshold(uint8_t threshold) { _threshold = threshold; }
+
+	/// @brief	Compares the frame against the reference, supports GRAYSCALE, YUV422, RGB565 and JPEG.
+	/// @return	Number of changed blocks, or -1 if the frame can not be compared.
+	///			After a size or format change every block is reported as changed.
+	int32_t Update(const camera_fb_t* frame);
+
+	bool IsChanged(uint16_t column, uint16_t row) const { return _changed[row * _columns + column] != 0; }
+
+	/// @brief	Takes the signature of the last Update as reference for the given blocks.
+	void Commit(uint16_t column, uint16_t row, uint16_t count);
+
+	/// @brief	Takes the whole last frame as reference, e.g. after a keyframe.
+	void CommitAll();
+
+	/// @brief	Drops the reference, the next Update reports every block as changed.
+	void Invalidate() { _valid = false; }
+
+	uint16_t GetColumns() const { return _columns; }
+	uint16_t GetRows() const { return _rows; }
+
+	/// @brief	Hide Copy constructor.
+	BlockChangeDetector(const BlockChangeDetector&) = delete;
+
+	/// @brief	Hide Assignment operator.
+	BlockChangeDetector& operator=(const BlockChangeDetector&) = delete;
+
+	/// @brief	Hide Move constructor.
+	BlockChangeDetector(BlockChangeDetector&&) = delete;
+
+	/// @brief	Hide Move Assignment Operator.
+	BlockChangeDetector& operator=(BlockChangeDetector&&) = delete;
+
+private:
+	static constexpr uint8_t Quadrants = 4;
+
+	bool resize(uint16_t width, uint16_t height, pixformat_t format);
+	bool sumRaw(const camera_fb_t* frame);
+	bool sumJpeg(const camera_fb_t* frame);
+	void release();
+
+	uint16_t* _reference = nullptr;
+	uint16_t* _current = nullptr;
+	uint8_t* _changed = nullptr;
+	uint16_t _width = 0;
+	uint16_t _height = 0;
+	uint16_t _columns = 0;
+	uint16_t _rows = 0;
+	pixformat_t _format = PIXFORMAT_JPEG;
+	uint8_t _threshold = 6;
+	bool _valid = false;
+};
+
+} // namespace Hal
+
+#endif /* HAL_CAMERA_ANALYTICS_BLOCKCHANGEDETECTOR_H_ */
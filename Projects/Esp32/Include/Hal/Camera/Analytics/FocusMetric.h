@@ -0,0 +1,65 @@
+/*
+ * FocusMetric.h
+ *
+ *  Tenengrad sharpness score on the centre of the frame, used while the lens is adjusted.
+ */
+
+#ifndef HAL_CAMERA_ANALYTICS_FOCUSMETRIC_H_
+#define HAL_CAMERA_ANALYTICS_FOCUSMETRIC_H_
+
+#include <cstdint>
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+
+namespace Hal
+{
+
+struct FocusReading
+{
+	uint32_t Score;
+	uint32_t Peak;
+	uint32_t FrameCount;
+	uint32_t Timestamp;
+	uint16_t RoiWidth;
+	uint16_t RoiHeight;
+};
+
+class FocusMetric
+{
+public:
+	FocusMetric() = default;
+
+	/// @brief	Size of the centre region of interest as a percentage of the frame width and height.
+	void SetRegion(uint8_t percent);
+
+	/// @brief	Scores a GRAYSCALE or YUV422 frame, other formats are ignored.
+	/// @return	True if the reading was updated.
+	bool Measure(const camera_fb_t* frame);
+
+	/// @brief	Snapshot of the last reading, safe to call from another task.
+	FocusReading GetReading();
+
+	/// @brief	Forgets the best score seen so far, e.g. when the technician starts over.
+	void ResetPeak();
+
+	/// @brief	Hide Copy constructor.
+	FocusMetric(const FocusMetric&) = delete;
+
+	/// @brief	Hide Assignment operator.
+	FocusMetric& operator=(const FocusMetric&) = delete;
+
+	/// @brief	Hide Move constructor.
+	FocusMetric(FocusMetric&&) = delete;
+
+	/// @brief	Hide Move Assignment Operator.
+	FocusMetric& operator=(FocusMetric&&) = delete;
+
+private:
+	FocusReading _reading = {};
+	portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+	uint8_t _regionPercent = 50;
+};
+
+} // namespace Hal
+
+#endif /* HAL_CAMERA_ANALYTICS_FOCUSMETRIC_H_ */
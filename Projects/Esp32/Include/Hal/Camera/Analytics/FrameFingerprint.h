@@ -0,0 +1,57 @@
+/*
+ * FrameFingerprint.h
+ *
+ *  Small luma grid of a frame, used to tell if two frames look the same.
+ */
+
+#ifndef HAL_CAMERA_ANALYTICS_FRAMEFINGERPRINT_H_
+#define HAL_CAMERA_ANALYTICS_FRAMEFINGERPRINT_H_
+
+#include <cstdint>
+#include <array>
+#include "esp_camera.h"
+
+namespace Hal
+{
+using std::array;
+
+/// @brief	Mean luma of a 16x12 grid over the frame.
+/// @note	Raw frames are sampled directly. JPEG frames are decoded at 1/8 scale,
+///			which only needs the DC coefficient of every block.
+class FrameFingerprint
+{
+public:
+	static constexpr uint8_t GridWidth = 16;
+	static constexpr uint8_t GridHeight = 12;
+
+	FrameFingerprint() = default;
+
+	/// @return	False if the frame format is not supported or the JPEG is broken.
+	bool Compute(const camera_fb_t* frame);
+
+	/// @brief	Mean absolute luma difference of the grid cells in hundredths of a luma level.
+	///			Returns UINT32_MAX if one of the fingerprints is not valid.
+	uint32_t Difference(const FrameFingerprint& other) const;
+
+	bool IsValid() const { return _valid; }
+
+	void Invalidate() { _valid = false; }
+
+	/// @brief	Copying is how the last sent frame is remembered.
+	FrameFingerprint(const FrameFingerprint&) = default;
+	FrameFingerprint& operator=(const FrameFingerprint&) = default;
+
+private:
+	static constexpr uint16_t Cells = GridWidth * GridHeight;
+	static constexpr uint8_t SamplesPerCell = 4;
+
+	bool computeRaw(const camera_fb_t* frame);
+	bool computeJpeg(const camera_fb_t* frame);
+
+	array<uint8_t, Cells> _grid = {};
+	bool _valid = false;
+};
+
+} // namespace Hal
+
+#endif /* HAL_CAMERA_ANALYTICS_FRAMEFINGERPRINT_H_ */
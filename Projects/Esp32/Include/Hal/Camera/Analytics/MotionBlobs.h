@@ -0,0 +1,236 @@
+/*
+ * MotionBlobs.h
+ *
+ *  Blob extraction, tracking and zone counting on a binary motion mask.
+ *  All buffers are fixed size, nothing is allocated after construction.
+ */
+
+#ifndef HAL_CAMERA_ANALYTICS_MOTIONBLOBS_H_
+#define HAL_CAMERA_ANALYTICS_MOTIONBLOBS_H_
+
+#include <cstdint>
+#include <array>
+
+namespace Hal
+{
+using std::array;
+
+struct Blob
+{
+	uint32_t Area;
+	uint16_t CentroidX;
+	uint16_t CentroidY;
+	uint16_t Left;
+	uint16_t Top;
+	uint16_t Right;
+	uint16_t Bottom;
+};
+
+/// @brief	Single pass connected components labeller working on horizontal runs.
+/// @note	Runs of the previous row are merged with overlapping runs of the current row
+///			(8-connectivity) through a union-find table, so the mask is read exactly once.
+///			Runs, parents and accumulators take about 60 KB, keep the labeller out of the stack.
+class BlobLabeller
+{
+public:
+	static constexpr uint16_t MaxRuns = 2048;
+	static constexpr uint8_t MaxBlobs = 32;
+
+	BlobLabeller() = default;
+
+	/// @brief	Labels the mask, non zero bytes are motion.
+	/// @param	stride distance in bytes between two rows of the mask.
+	/// @return	Number of blobs found with an area of at least minArea.
+	uint8_t Label(const uint8_t* mask, uint16_t width, uint16_t height, uint16_t stride, uint32_t minArea);
+
+	const Blob& GetBlob(uint8_t index) const { return _blobs[index]; }
+	uint8_t GetBlobCount() const { return _blobCount; }
+	uint16_t GetRunCount() const { return _runCount; }
+
+	/// @brief	True if the last mask had more runs or blobs than the fixed buffers hold.
+	bool IsTruncated() const { return _truncated; }
+
+	/// @brief	Hide Copy constructor.
+	BlobLabeller(const BlobLabeller&) = delete;
+
+	/// @brief	Hide Assignment operator.
+	BlobLabeller& operator=(const BlobLabeller&) = delete;
+
+	/// @brief	Hide Move constructor.
+	BlobLabeller(BlobLabeller&&) = delete;
+
+	/// @brief	Hide Move Assignment Operator.
+	BlobLabeller& operator=(BlobLabeller&&) = delete;
+
+private:
+	static constexpr uint16_t NoLabel = 0xFFFF;
+
+	struct Run
+	{
+		uint16_t Row;
+		uint16_t Start;
+		uint16_t End;
+		uint16_t Label;
+	};
+
+	struct Accumulator
+	{
+		uint32_t Area;
+		uint32_t SumX;
+		uint32_t SumY;
+		uint16_t Left;
+		uint16_t Top;
+		uint16_t Right;
+		uint16_t Bottom;
+	};
+
+	uint16_t find(uint16_t label);
+	void unite(uint16_t a, uint16_t b);
+
+	array<Run, MaxRuns> _runs = {};
+	array<uint16_t, MaxRuns> _parent = {};
+	array<Accumulator, MaxRuns> _accumulators = {};
+	array<Blob, MaxBlobs> _blobs = {};
+	uint16_t _runCount = 0;
+	uint8_t _blobCount = 0;
+	bool _truncated = false;
+};
+
+struct TrackedBlob
+{
+	uint16_t Id;
+	uint16_t X;
+	uint16_t Y;
+	uint32_t Area;
+	uint16_t Age;
+	uint8_t Missed;
+	uint8_t ZoneMask;
+};
+
+/// @brief	Gives blobs stable ids across frames by greedy nearest neighbour matching.
+class BlobTracker
+{
+public:
+	static constexpr uint8_t MaxTracks = 16;
+
+	BlobTracker() = default;
+
+	/// @param	maxDistance blobs further away than this (in pixels) never match an existing track.
+	/// @param	maxMissed frames a track survives without a matching blob.
+	void Configure(uint16_t maxDistance, uint8_t maxMissed);
+
+	void Update(const BlobLabeller& labeller);
+
+	void Reset();
+
+	uint8_t GetTrackCount() const { return _trackCount; }
+	const TrackedBlob& GetTrack(uint8_t index) const { return _tracks[index]; }
+	TrackedBlob& GetTrack(uint8_t index) { return _tracks[index]; }
+
+	/// @brief	Tracks dropped during the last Update, valid until the next Update.
+	uint8_t GetLostCount() const { return _lostCount; }
+	const TrackedBlob& GetLost(uint8_t index) const { return _lost[index]; }
+
+	/// @brief	Hide Copy constructor.
+	BlobTracker(const BlobTracker&) = delete;
+
+	/// @brief	Hide Assignment operator.
+	BlobTracker& operator=(const BlobTracker&) = delete;
+
+	/// @brief	Hide Move constructor.
+	BlobTracker(BlobTracker&&) = delete;
+
+	/// @brief	Hide Move Assignment Operator.
+	BlobTracker& operator=(BlobTracker&&) = delete;
+
+private:
+	array<TrackedBlob, MaxTracks> _tracks = {};
+	array<TrackedBlob, MaxTracks> _lost = {};
+	uint32_t _maxDistanceSquared = 48 * 48;
+	uint16_t _nextId = 1;
+	uint8_t _maxMissed = 3;
+	uint8_t _trackCount = 0;
+	uint8_t _lostCount = 0;
+};
+
+enum class ZoneEventType : uint8_t
+{
+	Enter,
+	Leave
+};
+
+struct ZoneEvent
+{
+	ZoneEventType Type;
+	uint8_t Zone;
+	uint16_t TrackId;
+};
+
+struct ZonePoint
+{
+	uint16_t X;
+	uint16_t Y;
+};
+
+/// @brief	Polygon zones, reports when a tracked centroid enters or leaves one of them.
+class ZoneMonitor
+{
+public:
+	static constexpr uint8_t MaxZones = 8;
+	static constexpr uint8_t MaxVertices = 8;
+	static constexpr uint8_t MaxEvents = 32;
+
+	ZoneMonitor() = default;
+
+	/// @brief	Sets the polygon of a zone, vertices in frame pixel coordinates.
+	/// @note	Tracks inside the previous polygon are forgotten on the next Update without a
+	///			Leave event, the ones inside the new polygon enter it again.
+	bool SetZone(uint8_t zone, const ZonePoint* vertices, uint8_t count);
+
+	/// @brief	Removes a zone, its tracks are forgotten on the next Update without a Leave event.
+	void ClearZone(uint8_t zone);
+
+	/// @brief	Updates the zone membership of every track and collects the events.
+	/// @return	Number of events generated, see GetEvent.
+	uint8_t Update(BlobTracker& tracker);
+
+	const ZoneEvent& GetEvent(uint8_t index) const { return _events[index]; }
+	uint32_t GetEnterCount(uint8_t zone) const { return _zones[zone].EnterCount; }
+	uint32_t GetLeaveCount(uint8_t zone) const { return _zones[zone].LeaveCount; }
+	uint8_t GetOccupancy(uint8_t zone) const { return _zones[zone].Occupancy; }
+
+	/// @brief	Hide Copy constructor.
+	ZoneMonitor(const ZoneMonitor&) = delete;
+
+	/// @brief	Hide Assignment operator.
+	ZoneMonitor& operator=(const ZoneMonitor&) = delete;
+
+	/// @brief	Hide Move constructor.
+	ZoneMonitor(ZoneMonitor&&) = delete;
+
+	/// @brief	Hide Move Assignment Operator.
+	ZoneMonitor& operator=(ZoneMonitor&&) = delete;
+
+private:
+	struct Zone
+	{
+		array<ZonePoint, MaxVertices> Vertices;
+		uint8_t VertexCount;
+		uint8_t Occupancy;
+		uint32_t EnterCount;
+		uint32_t LeaveCount;
+	};
+
+	static bool contains(const Zone& zone, uint16_t x, uint16_t y);
+	void pushEvent(ZoneEventType type, uint8_t zone, uint16_t trackId);
+
+	array<Zone, MaxZones> _zones = {};
+	array<ZoneEvent, MaxEvents> _events = {};
+	uint8_t _eventCount = 0;
+	// zones redefined or cleared since the last Update, their bits are dropped from every track
+	uint8_t _staleZones = 0;
+};
+
+} // namespace Hal
+
+#endif /* HAL_CAMERA_ANALYTICS_MOTIONBLOBS_H_ */
@@ -41,6 +41,28 @@ typedef struct {
     size_t fb_count;                /*!< Number of frame buffers to be allocated. If more than one, then each frame will be acquired (double speed)  */
 } camera_config_t;
 
+#define CAMERA_EXPOSURE_HISTOGRAM_BINS  64   /*!< Luma histogram bins, each bin covers 4 luma levels */
+#define CAMERA_EXPOSURE_CLIP_LOW        4    /*!< Luma at or below this value is counted as clipped to black */
+#define CAMERA_EXPOSURE_CLIP_HIGH       251  /*!< Luma at or above this value is counted as clipped to white */
+
+/**
+ * @brief Luma statistics of a frame, accumulated while the DMA buffers are filtered
+ *
+ * Only filled for PIXFORMAT_GRAYSCALE and PIXFORMAT_YUV422 frames,
+ * for other formats valid is false.
+ */
+typedef struct {
+    uint32_t histogram[CAMERA_EXPOSURE_HISTOGRAM_BINS];  /*!< Luma histogram, bin = Y >> 2 */
+    uint32_t pixel_count;       /*!< Number of luma samples accumulated */
+    uint32_t clipped_low;       /*!< Samples at or below CAMERA_EXPOSURE_CLIP_LOW */
+    uint32_t clipped_high;      /*!< Samples at or above CAMERA_EXPOSURE_CLIP_HIGH */
+    uint64_t sum;               /*!< Sum of all luma samples */
+    uint8_t min;                /*!< Darkest luma sample */
+    uint8_t max;                /*!< Brightest luma sample */
+    uint8_t mean;               /*!< Mean luma, set when the frame is done */
+    bool valid;                 /*!< True if the statistics belong to this frame */
+} camera_exposure_stats_t;
+
 /**
  * @brief Data structure of camera frame buffer
  */
@@ -50,6 +72,7 @@ typedef struct {
     size_t width;               /*!< Width of the buffer in pixels */
     size_t height;              /*!< Height of the buffer in pixels */
     pixformat_t format;         /*!< Format of the pixel data */
+    camera_exposure_stats_t exposure; /*!< Luma statistics of the frame (YUV422 and GRAYSCALE only) */
 } camera_fb_t;
 
 #define ESP_ERR_CAMERA_BASE 0x20000
@@ -59,6 +59,14 @@ const camera_fb_t *Camera::GetFrameBuffer()
     return _frameBuffer;
 }
 
+const camera_exposure_stats_t *Camera::GetExposureStats()
+{
+    if (_frameBuffer == nullptr || !_frameBuffer->exposure.valid)
+        return nullptr;
+
+    return &_frameBuffer->exposure;
+}
+
 bool Camera::SetFrameBufferCount(uint8_t frameCount)
 {
     if (initialized || frameCount == 0 || frameCount > 10)
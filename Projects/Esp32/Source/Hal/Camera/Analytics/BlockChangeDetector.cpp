@@ -0,0 +1,211 @@
+
+#include <cstdlib>
+#include <cstring>
+#include "BlockChangeDetector.h"
+#include "esp_jpg_decode.h"
+
+namespace Hal
+{
+
+namespace
+{
+
+struct JpegSums
+{
+	const uint8_t* Input;
+	uint16_t* Sums;
+	uint16_t Width;
+	uint16_t Height;
+	uint16_t Columns;
+};
+
+size_t jpegRead(void* arg, size_t index, uint8_t* buf, size_t len)
+{
+	JpegSums* sums = static_cast<JpegSums*>(arg);
+	if (buf)
+		memcpy(buf, sums->Input + index, len);
+	return len;
+}
+
+bool jpegWrite(void* arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t* data)
+{
+	// start and end markers, the size is known from the frame already
+	if (data == nullptr)
+		return true;
+
+	// every BGR888 pixel of the 1/8 scale output is the mean of one 8x8 quadrant
+	JpegSums* sums = static_cast<JpegSums*>(arg);
+	constexpr uint16_t Quadrant = BlockChangeDetector::BlockSize / 2;
+	for (uint16_t row = 0; row < h; row++)
+	{
+		uint32_t top = static_cast<uint32_t>(y + row) * Quadrant;
+		if (top >= sums->Height)
+			break;
+		uint32_t quadrantHeight = sums->Height - top < Quadrant ? sums->Height - top : Quadrant;
+		// four sums per block, the lower quadrants follow the upper ones
+		uint16_t* line = sums->Sums + ((y + row) / 2) * sums->Columns * 4 + ((y + row) & 1) * 2;
+
+		for (uint16_t column = 0; column < w; column++, data += 3)
+		{
+			uint32_t left = static_cast<uint32_t>(x + column) * Quadrant;
+			if (left >= sums->Width)
+				continue;
+			uint32_t quadrantWidth = sums->Width - left < Quadrant ? sums->Width - left : Quadrant;
+			uint32_t luma = (data[0] + 2 * data[1] + data[2]) >> 2;
+			line[((x + column) / 2) * 4 + ((x + column) & 1)] = luma * quadrantWidth * quadrantHeight;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+BlockChangeDetector::~BlockChangeDetector()
+{
+	release();
+}
+
+void BlockChangeDetector::release()
+{
+	free(_reference);
+	free(_current);
+	free(_changed);
+	_reference = nullptr;
+	_current = nullptr;
+	_changed = nullptr;
+	_columns = 0;
+	_rows = 0;
+	_valid = false;
+}
+
+bool BlockChangeDetector::resize(uint16_t width, uint16_t height, pixformat_t format)
+{
+	if (_reference != nullptr && width == _width && height == _height && format == _format)
+		return true;
+
+	release();
+	_width = width;
+	_height = height;
+	_format = format;
+	_columns = (width + BlockSize - 1) / BlockSize;
+	_rows = (height + BlockSize - 1) / BlockSize;
+
+	size_t blocks = static_cast<size_t>(_columns) * _rows;
+	_reference = static_cast<uint16_t*>(malloc(blocks * Quadrants * sizeof(uint16_t)));
+	_current = static_cast<uint16_t*>(malloc(blocks * Quadrants * sizeof(uint16_t)));
+	_changed = static_cast<uint8_t*>(malloc(blocks));
+	if (_reference == nullptr || _current == nullptr || _changed == nullptr)
+	{
+		release();
+		return false;
+	}
+	return true;
+}
+
+int32_t BlockChangeDetector::Update(const camera_fb_t* frame)
+{
+	if (frame == nullptr || frame->buf == nullptr)
+		return -1;
+
+	if (frame->format != PIXFORMAT_JPEG && frame->format != PIXFORMAT_GRAYSCALE &&
+		frame->format != PIXFORMAT_YUV422 && frame->format != PIXFORMAT_RGB565)
+		return -1;
+
+	if (!resize(frame->width, frame->height, frame->format))
+		return -1;
+
+	memset(_current, 0, static_cast<size_t>(_columns) * _rows * Quadrants * sizeof(uint16_t));
+
+	if (!(frame->format == PIXFORMAT_JPEG ? sumJpeg(frame) : sumRaw(frame)))
+		return -1;
+
+	int32_t changedCount = 0;
+	for (uint16_t row = 0; row < _rows; row++)
+	{
+		uint32_t blockHeight = (row == _rows - 1) ? _height - row * BlockSize : BlockSize;
+
+		for (uint16_t column = 0; column < _columns; column++)
+		{
+			uint32_t block = row * _columns + column;
+			uint8_t changed = 1;
+
+			if (_valid)
+			{
+				uint32_t blockWidth = (column == _columns - 1) ? _width - column * BlockSize : BlockSize;
+				changed = 0;
+				for (uint8_t q = 0; q < Quadrants; q++)
+				{
+					uint32_t quadrantWidth = (q & 1) ? (blockWidth > BlockSize / 2 ? blockWidth - BlockSize / 2 : 0) : (blockWidth < BlockSize / 2 ? blockWidth : BlockSize / 2);
+					uint32_t quadrantHeight = (q & 2) ? (blockHeight > BlockSize / 2 ? blockHeight - BlockSize / 2 : 0) : (blockHeight < BlockSize / 2 ? blockHeight : BlockSize / 2);
+					int32_t difference = static_cast<int32_t>(_current[block * Quadrants + q]) - _reference[block * Quadrants + q];
+					if (static_cast<uint32_t>(abs(difference)) > _threshold * quadrantWidth * quadrantHeight)
+					{
+						changed = 1;
+						break;
+					}
+				}
+			}
+
+			_changed[block] = changed;
+			changedCount += changed;
+		}
+	}
+
+	return changedCount;
+}
+
+bool BlockChangeDetector::sumRaw(const camera_fb_t* frame)
+{
+	uint32_t bytesPerPixel = frame->format == PIXFORMAT_GRAYSCALE ? 1 : 2;
+	if (frame->len < frame->width * frame->height * bytesPerPixel)
+		return false;
+
+	for (uint32_t y = 0; y < _height; y++)
+	{
+		const uint8_t* line = frame->buf + y * _width * bytesPerPixel;
+		uint16_t* sums = _current + (y / BlockSize) * _columns * Quadrants + ((y % BlockSize) >= BlockSize / 2 ? 2 : 0);
+
+		for (uint32_t x = 0; x < _width; x++)
+		{
+			uint32_t luma;
+			if (frame->format == PIXFORMAT_RGB565)
+			{
+				// green carries most of the luma, good enough for change detection
+				luma = (((line[0] & 0x07) << 3) | (line[1] >> 5)) << 2;
+			}
+			else
+			{
+				luma = line[0];
+			}
+			line += bytesPerPixel;
+			sums[(x / BlockSize) * Quadrants + ((x % BlockSize) >= BlockSize / 2 ? 1 : 0)] += luma;
+		}
+	}
+	return true;
+}
+
+bool BlockChangeDetector::sumJpeg(const camera_fb_t* frame)
+{
+	JpegSums sums = {frame->buf, _current, _width, _height, _columns};
+	return esp_jpg_decode(frame->len, JPG_SCALE_8X, jpegRead, jpegWrite, &sums) == ESP_OK;
+}
+
+void BlockChangeDetector::Commit(uint16_t column, uint16_t row, uint16_t count)
+{
+	if (_reference == nullptr || row >= _rows || column + count > _columns)
+		return;
+
+	uint32_t block = row * _columns + column;
+	memcpy(_reference + block * Quadrants, _current + block * Quadrants, count * Quadrants * sizeof(uint16_t));
+}
+
+void BlockChangeDetector::CommitAll()
+{
+	if (_reference == nullptr)
+		return;
+
+	memcpy(_reference, _current, static_cast<size_t>(_columns) * _rows * Quadrants * sizeof(uint16_t));
+	_valid = true;
+}
+
+} // namespace Hal
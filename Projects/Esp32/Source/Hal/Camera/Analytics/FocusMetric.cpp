@@ -0,0 +1,90 @@
+
+#include "FocusMetric.h"
+#include "freertos/task.h"
+
+namespace Hal
+{
+
+void FocusMetric::SetRegion(uint8_t percent)
+{
+	if (percent < 10)
+		percent = 10;
+	if (percent > 100)
+		percent = 100;
+	_regionPercent = percent;
+}
+
+bool FocusMetric::Measure(const camera_fb_t* frame)
+{
+	if (frame == nullptr || frame->buf == nullptr)
+		return false;
+
+	// luma only, YUYV has it in every second byte
+	uint32_t step;
+	if (frame->format == PIXFORMAT_GRAYSCALE)
+		step = 1;
+	else if (frame->format == PIXFORMAT_YUV422)
+		step = 2;
+	else
+		return false;
+
+	uint32_t roiWidth = frame->width * _regionPercent / 100;
+	uint32_t roiHeight = frame->height * _regionPercent / 100;
+	if (roiWidth < 3 || roiHeight < 3 || frame->len < frame->width * frame->height * step)
+		return false;
+
+	uint32_t left = (frame->width - roiWidth) / 2;
+	uint32_t top = (frame->height - roiHeight) / 2;
+	uint32_t stride = frame->width * step;
+
+	// Tenengrad, mean of the squared Sobel gradient magnitude over the region
+	uint64_t energy = 0;
+	for (uint32_t y = top + 1; y < top + roiHeight - 1; y++)
+	{
+		const uint8_t* above = frame->buf + (y - 1) * stride + left * step;
+		const uint8_t* line = above + stride;
+		const uint8_t* below = line + stride;
+		uint32_t rowEnergy = 0;
+
+		for (uint32_t x = step; x < (roiWidth - 1) * step; x += step)
+		{
+			int32_t gx = (above[x + step] + 2 * line[x + step] + below[x + step])
+					   - (above[x - step] + 2 * line[x - step] + below[x - step]);
+			int32_t gy = (below[x - step] + 2 * below[x] + below[x + step])
+					   - (above[x - step] + 2 * above[x] + above[x + step]);
+			// gradients are below 1024, so one row cannot overflow 32 bits
+			rowEnergy += static_cast<uint32_t>(gx * gx + gy * gy) >> 4;
+		}
+		energy += rowEnergy;
+	}
+
+	uint32_t score = static_cast<uint32_t>(energy / ((roiWidth - 2) * (roiHeight - 2)));
+
+	portENTER_CRITICAL(&_lock);
+	_reading.Score = score;
+	if (score > _reading.Peak)
+		_reading.Peak = score;
+	_reading.FrameCount++;
+	_reading.Timestamp = xTaskGetTickCount() * portTICK_PERIOD_MS;
+	_reading.RoiWidth = roiWidth;
+	_reading.RoiHeight = roiHeight;
+	portEXIT_CRITICAL(&_lock);
+	return true;
+}
+
+FocusReading FocusMetric::GetReading()
+{
+	portENTER_CRITICAL(&_lock);
+	FocusReading reading = _reading;
+	portEXIT_CRITICAL(&_lock);
+	return reading;
+}
+
+void FocusMetric::ResetPeak()
+{
+	portENTER_CRITICAL(&_lock);
+	_reading.Peak = _reading.Score;
+	portEXIT_CRITICAL(&_lock);
+}
+
+} // namespace Hal
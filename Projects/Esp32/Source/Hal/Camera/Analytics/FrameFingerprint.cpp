@@ -0,0 +1,149 @@
+
+#include <cstdlib>
+#include <cstring>
+#include "FrameFingerprint.h"
+#include "esp_jpg_decode.h"
+
+namespace Hal
+{
+
+namespace
+{
+
+struct JpegGrid
+{
+	const uint8_t* Input;
+	uint16_t Width;
+	uint16_t Height;
+	uint32_t Sums[FrameFingerprint::GridWidth * FrameFingerprint::GridHeight];
+	uint16_t Counts[FrameFingerprint::GridWidth * FrameFingerprint::GridHeight];
+};
+
+size_t jpegRead(void* arg, size_t index, uint8_t* buf, size_t len)
+{
+	JpegGrid* grid = static_cast<JpegGrid*>(arg);
+	if (buf)
+		memcpy(buf, grid->Input + index, len);
+	return len;
+}
+
+bool jpegWrite(void* arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t* data)
+{
+	JpegGrid* grid = static_cast<JpegGrid*>(arg);
+	if (data == nullptr)
+	{
+		// start and end markers, the start one carries the scaled size
+		if (x == 0 && y == 0)
+		{
+			grid->Width = w;
+			grid->Height = h;
+		}
+		return grid->Width > 0 && grid->Height > 0;
+	}
+
+	// the decoder hands out BGR888 rectangles
+	for (uint16_t row = 0; row < h; row++)
+	{
+		uint32_t cellRow = static_cast<uint32_t>(y + row) * FrameFingerprint::GridHeight / grid->Height;
+		for (uint16_t column = 0; column < w; column++, data += 3)
+		{
+			uint32_t cell = cellRow * FrameFingerprint::GridWidth + static_cast<uint32_t>(x + column) * FrameFingerprint::GridWidth / grid->Width;
+			grid->Sums[cell] += (data[0] + 2 * data[1] + data[2]) >> 2;
+			grid->Counts[cell]++;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+bool FrameFingerprint::Compute(const camera_fb_t* frame)
+{
+	_valid = false;
+	if (frame == nullptr || frame->buf == nullptr || frame->width < GridWidth || frame->height < GridHeight)
+		return false;
+
+	if (frame->format == PIXFORMAT_JPEG)
+		_valid = computeJpeg(frame);
+	else
+		_valid = computeRaw(frame);
+	return _valid;
+}
+
+bool FrameFingerprint::computeRaw(const camera_fb_t* frame)
+{
+	uint32_t bytesPerPixel;
+	if (frame->format == PIXFORMAT_GRAYSCALE)
+		bytesPerPixel = 1;
+	else if (frame->format == PIXFORMAT_YUV422 || frame->format == PIXFORMAT_RGB565)
+		bytesPerPixel = 2;
+	else if (frame->format == PIXFORMAT_RGB888)
+		bytesPerPixel = 3;
+	else
+		return false;
+
+	if (frame->len < frame->width * frame->height * bytesPerPixel)
+		return false;
+
+	uint32_t cellWidth = frame->width / GridWidth;
+	uint32_t cellHeight = frame->height / GridHeight;
+
+	// a few samples spread over every cell, not the whole frame
+	for (uint8_t cellY = 0; cellY < GridHeight; cellY++)
+	{
+		for (uint8_t cellX = 0; cellX < GridWidth; cellX++)
+		{
+			uint32_t sum = 0;
+			for (uint8_t sy = 0; sy < SamplesPerCell; sy++)
+			{
+				uint32_t y = cellY * cellHeight + (2 * sy + 1) * cellHeight / (2 * SamplesPerCell);
+				const uint8_t* line = frame->buf + y * frame->width * bytesPerPixel;
+				for (uint8_t sx = 0; sx < SamplesPerCell; sx++)
+				{
+					uint32_t x = cellX * cellWidth + (2 * sx + 1) * cellWidth / (2 * SamplesPerCell);
+					const uint8_t* pixel = line + x * bytesPerPixel;
+					if (frame->format == PIXFORMAT_RGB565)
+						sum += (((pixel[0] & 0x07) << 3) | (pixel[1] >> 5)) << 2;
+					else if (frame->format == PIXFORMAT_RGB888)
+						sum += (pixel[0] + 2 * pixel[1] + pixel[2]) >> 2;
+					else
+						sum += pixel[0]; // grayscale, YUYV has Y first in every pixel
+				}
+			}
+			_grid[cellY * GridWidth + cellX] = sum / (SamplesPerCell * SamplesPerCell);
+		}
+	}
+	return true;
+}
+
+bool FrameFingerprint::computeJpeg(const camera_fb_t* frame)
+{
+	JpegGrid* grid = static_cast<JpegGrid*>(calloc(1, sizeof(JpegGrid)));
+	if (grid == nullptr)
+		return false;
+
+	grid->Input = frame->buf;
+	bool decoded = esp_jpg_decode(frame->len, JPG_SCALE_8X, jpegRead, jpegWrite, grid) == ESP_OK;
+	if (decoded)
+	{
+		for (uint16_t cell = 0; cell < Cells; cell++)
+			_grid[cell] = grid->Counts[cell] ? grid->Sums[cell] / grid->Counts[cell] : 0;
+	}
+
+	free(grid);
+	return decoded;
+}
+
+uint32_t FrameFingerprint::Difference(const FrameFingerprint& other) const
+{
+	if (!_valid || !other._valid)
+		return UINT32_MAX;
+
+	uint32_t sum = 0;
+	for (uint16_t cell = 0; cell < Cells; cell++)
+		sum += abs(static_cast<int32_t>(_grid[cell]) - other._grid[cell]);
+
+	return sum * 100 / Cells;
+}
+
+} // namespace Hal
@@ -0,0 +1,363 @@
+
+#include "MotionBlobs.h"
+
+namespace Hal
+{
+
+uint16_t BlobLabeller::find(uint16_t label)
+{
+	uint16_t root = label;
+	while (_parent[root] != root)
+		root = _parent[root];
+
+	// path compression, keeps the later lookups flat
+	while (_parent[label] != root)
+	{
+		uint16_t next = _parent[label];
+		_parent[label] = root;
+		label = next;
+	}
+	return root;
+}
+
+void BlobLabeller::unite(uint16_t a, uint16_t b)
+{
+	a = find(a);
+	b = find(b);
+	if (a == b)
+		return;
+
+	// the lower label becomes the root, so roots always precede their members
+	if (a < b)
+		_parent[b] = a;
+	else
+		_parent[a] = b;
+}
+
+uint8_t BlobLabeller::Label(const uint8_t* mask, uint16_t width, uint16_t height, uint16_t stride, uint32_t minArea)
+{
+	_runCount = 0;
+	_blobCount = 0;
+	_truncated = false;
+
+	uint16_t previousFirst = 0;
+	uint16_t previousEnd = 0;
+
+	for (uint16_t row = 0; row < height && !_truncated; row++)
+	{
+		const uint8_t* line = mask + static_cast<uint32_t>(row) * stride;
+		uint16_t currentFirst = _runCount;
+		uint16_t scan = previousFirst;
+
+		uint16_t x = 0;
+		while (x < width)
+		{
+			while (x < width && line[x] == 0)
+				x++;
+			if (x == width)
+				break;
+
+			uint16_t start = x;
+			while (x < width && line[x] != 0)
+				x++;
+
+			if (_runCount == MaxRuns)
+			{
+				_truncated = true;
+				break;
+			}
+
+			Run& run = _runs[_runCount];
+			run.Row = row;
+			run.Start = start;
+			run.End = x - 1;
+			run.Label = _runCount;
+			_parent[_runCount] = _runCount;
+
+			// skip previous row runs that end before this one can touch them
+			while (scan < previousEnd && _runs[scan].End + 1 < run.Start)
+				scan++;
+
+			// merge with every overlapping run, the last one may also touch the next run
+			uint16_t overlap = scan;
+			while (overlap < previousEnd && _runs[overlap].Start <= run.End + 1)
+			{
+				unite(_runs[overlap].Label, run.Label);
+				overlap++;
+			}
+			if (overlap > scan)
+				scan = overlap - 1;
+
+			_runCount++;
+		}
+
+		previousFirst = currentFirst;
+		previousEnd = _runCount;
+	}
+
+	// accumulate statistics per root, this works on runs only, not on pixels
+	for (uint16_t i = 0; i < _runCount; i++)
+	{
+		const Run& run = _runs[i];
+		uint16_t root = find(run.Label);
+		Accumulator& acc = _accumulators[root];
+		uint32_t length = run.End - run.Start + 1;
+		if (root == i)
+		{
+			acc.Area = 0;
+			acc.SumX = 0;
+			acc.SumY = 0;
+			acc.Left = run.Start;
+			acc.Right = run.End;
+			acc.Top = run.Row;
+			acc.Bottom = run.Row;
+		}
+		acc.Area += length;
+		acc.SumX += (static_cast<uint32_t>(run.Start) + run.End) * length / 2;
+		acc.SumY += static_cast<uint32_t>(run.Row) * length;
+		if (run.Start < acc.Left)
+			acc.Left = run.Start;
+		if (run.End > acc.Right)
+			acc.Right = run.End;
+		acc.Bottom = run.Row;
+	}
+
+	for (uint16_t i = 0; i < _runCount; i++)
+	{
+		if (_parent[i] != i)
+			continue;
+
+		const Accumulator& acc = _accumulators[i];
+		if (acc.Area < minArea)
+			continue;
+
+		if (_blobCount == MaxBlobs)
+		{
+			_truncated = true;
+			break;
+		}
+
+		Blob& blob = _blobs[_blobCount++];
+		blob.Area = acc.Area;
+		blob.CentroidX = static_cast<uint16_t>(acc.SumX / acc.Area);
+		blob.CentroidY = static_cast<uint16_t>(acc.SumY / acc.Area);
+		blob.Left = acc.Left;
+		blob.Top = acc.Top;
+		blob.Right = acc.Right;
+		blob.Bottom = acc.Bottom;
+	}
+
+	return _blobCount;
+}
+
+void BlobTracker::Configure(uint16_t maxDistance, uint8_t maxMissed)
+{
+	_maxDistanceSquared = static_cast<uint32_t>(maxDistance) * maxDistance;
+	_maxMissed = maxMissed;
+}
+
+void BlobTracker::Reset()
+{
+	_trackCount = 0;
+	_lostCount = 0;
+}
+
+void BlobTracker::Update(const BlobLabeller& labeller)
+{
+	uint8_t blobCount = labeller.GetBlobCount();
+	uint32_t trackMatched = 0;
+	uint32_t blobMatched = 0;
+	_lostCount = 0;
+
+	// greedy matching, always take the closest remaining pair inside the gate
+	while (true)
+	{
+		uint32_t best = _maxDistanceSquared + 1;
+		uint8_t bestTrack = 0;
+		uint8_t bestBlob = 0;
+
+		for (uint8_t t = 0; t < _trackCount; t++)
+		{
+			if (trackMatched & (1u << t))
+				continue;
+
+			for (uint8_t b = 0; b < blobCount; b++)
+			{
+				if (blobMatched & (1u << b))
+					continue;
+
+				const Blob& blob = labeller.GetBlob(b);
+				int32_t dx = static_cast<int32_t>(blob.CentroidX) - _tracks[t].X;
+				int32_t dy = static_cast<int32_t>(blob.CentroidY) - _tracks[t].Y;
+				uint32_t distance = static_cast<uint32_t>(dx * dx + dy * dy);
+				if (distance < best)
+				{
+					best = distance;
+					bestTrack = t;
+					bestBlob = b;
+				}
+			}
+		}
+
+		if (best > _maxDistanceSquared)
+			break;
+
+		const Blob& blob = labeller.GetBlob(bestBlob);
+		TrackedBlob& track = _tracks[bestTrack];
+		track.X = blob.CentroidX;
+		track.Y = blob.CentroidY;
+		track.Area = blob.Area;
+		track.Missed = 0;
+		if (track.Age < UINT16_MAX)
+			track.Age++;
+		trackMatched |= 1u << bestTrack;
+		blobMatched |= 1u << bestBlob;
+	}
+
+	// age out unmatched tracks, compact the list in place
+	uint8_t kept = 0;
+	for (uint8_t t = 0; t < _trackCount; t++)
+	{
+		if (!(trackMatched & (1u << t)) && ++_tracks[t].Missed > _maxMissed)
+		{
+			_lost[_lostCount++] = _tracks[t];
+			continue;
+		}
+		if (kept != t)
+			_tracks[kept] = _tracks[t];
+		kept++;
+	}
+	_trackCount = kept;
+
+	for (uint8_t b = 0; b < blobCount && _trackCount < MaxTracks; b++)
+	{
+		if (blobMatched & (1u << b))
+			continue;
+
+		const Blob& blob = labeller.GetBlob(b);
+		TrackedBlob& track = _tracks[_trackCount++];
+		track.Id = _nextId++;
+		if (_nextId == 0)
+			_nextId = 1;
+		track.X = blob.CentroidX;
+		track.Y = blob.CentroidY;
+		track.Area = blob.Area;
+		track.Age = 1;
+		track.Missed = 0;
+		track.ZoneMask = 0;
+	}
+}
+
+bool ZoneMonitor::SetZone(uint8_t zone, const ZonePoint* vertices, uint8_t count)
+{
+	if (zone >= MaxZones || count < 3 || count > MaxVertices)
+		return false;
+
+	Zone& target = _zones[zone];
+	for (uint8_t i = 0; i < count; i++)
+		target.Vertices[i] = vertices[i];
+	target.VertexCount = count;
+	target.Occupancy = 0;
+	_staleZones |= 1u << zone;
+	return true;
+}
+
+void ZoneMonitor::ClearZone(uint8_t zone)
+{
+	if (zone >= MaxZones)
+		return;
+
+	_zones[zone] = {};
+	_staleZones |= 1u << zone;
+}
+
+bool ZoneMonitor::contains(const Zone& zone, uint16_t x, uint16_t y)
+{
+	// even-odd ray casting towards +x
+	bool inside = false;
+	for (uint8_t i = 0, j = zone.VertexCount - 1; i < zone.VertexCount; j = i++)
+	{
+		int32_t xi = zone.Vertices[i].X, yi = zone.Vertices[i].Y;
+		int32_t xj = zone.Vertices[j].X, yj = zone.Vertices[j].Y;
+		if ((yi > y) == (yj > y))
+			continue;
+
+		// x < xi + (y - yi) * (xj - xi) / (yj - yi), kept in integers
+		int32_t lhs = (static_cast<int32_t>(x) - xi) * (yj - yi);
+		int32_t rhs = (static_cast<int32_t>(y) - yi) * (xj - xi);
+		if ((yj > yi) ? (lhs < rhs) : (lhs > rhs))
+			inside = !inside;
+	}
+	return inside;
+}
+
+void ZoneMonitor::pushEvent(ZoneEventType type, uint8_t zone, uint16_t trackId)
+{
+	Zone& target = _zones[zone];
+	if (type == ZoneEventType::Enter)
+	{
+		target.EnterCount++;
+		target.Occupancy++;
+	}
+	else
+	{
+		target.LeaveCount++;
+		if (target.Occupancy > 0)
+			target.Occupancy--;
+	}
+
+	if (_eventCount < MaxEvents)
+		_events[_eventCount++] = {type, zone, trackId};
+}
+
+uint8_t ZoneMonitor::Update(BlobTracker& tracker)
+{
+	_eventCount = 0;
+
+	// tracks that disappeared leave every zone they were in, unless it is gone already
+	for (uint8_t l = 0; l < tracker.GetLostCount(); l++)
+	{
+		const TrackedBlob& lost = tracker.GetLost(l);
+		uint8_t zones = lost.ZoneMask & ~_staleZones;
+		for (uint8_t z = 0; z < MaxZones; z++)
+		{
+			if (zones & (1u << z))
+				pushEvent(ZoneEventType::Leave, z, lost.Id);
+		}
+	}
+
+	for (uint8_t t = 0; t < tracker.GetTrackCount(); t++)
+	{
+		TrackedBlob& track = tracker.GetTrack(t);
+		track.ZoneMask &= ~_staleZones;
+		if (track.Missed)
+			continue;
+
+		for (uint8_t z = 0; z < MaxZones; z++)
+		{
+			if (_zones[z].VertexCount == 0)
+				continue;
+
+			bool wasInside = track.ZoneMask & (1u << z);
+			bool isInside = contains(_zones[z], track.X, track.Y);
+			if (isInside == wasInside)
+				continue;
+
+			if (isInside)
+			{
+				track.ZoneMask |= 1u << z;
+				pushEvent(ZoneEventType::Enter, z, track.Id);
+			}
+			else
+			{
+				track.ZoneMask &= ~(1u << z);
+				pushEvent(ZoneEventType::Leave, z, track.Id);
+			}
+		}
+	}
+
+	_staleZones = 0;
+	return _eventCount;
+}
+
+} // namespace Hal
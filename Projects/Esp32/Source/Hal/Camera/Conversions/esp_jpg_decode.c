@@ -13,6 +13,7 @@
 // limitations under the License.
 #include "esp_jpg_decode.h"
 
+#include <stdlib.h>
 #include "esp_system.h"
 #ifdef ESP_IDF_VERSION_MAJOR // IDF 4+
 #if CONFIG_IDF_TARGET_ESP32 // ESP32/PICO-D4
@@ -87,7 +88,12 @@ static uint32_t _jpg_read(JDEC *decoder, uint8_t *buf, uint32_t len)
 
 esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void * arg)
 {
-    static uint8_t work[3100];
+    // every call gets its own work area, the decoder runs on more than one task at a time
+    uint8_t * work = (uint8_t *)malloc(3100);
+    if (!work) {
+        ESP_LOGE(TAG, "JPG work area allocation failed");
+        return ESP_ERR_NO_MEM;
+    }
     JDEC decoder;
     esp_jpg_decoder_t jpeg;
 
@@ -101,6 +107,7 @@ esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jp
     JRESULT jres = jd_prepare(&decoder, _jpg_read, work, 3100, &jpeg);
     if(jres != JDR_OK){
         ESP_LOGE(TAG, "JPG Header Parse Failed! %s", jd_errors[jres]);
+        free(work);
         return ESP_FAIL;
     }
 
@@ -113,6 +120,7 @@ esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jp
     jres = jd_decomp(&decoder, _jpg_write, (uint8_t)jpeg.scale);
     //output end
     writer(arg, output_width, output_height, output_width, output_height, NULL);
+    free(work);
 
     if (jres != JDR_OK) {
         ESP_LOGE(TAG, "JPG Decompression Failed! %s", jd_errors[jres]);
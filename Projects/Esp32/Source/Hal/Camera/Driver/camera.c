@@ -85,6 +85,7 @@ typedef struct camera_fb_s {
     size_t width;
     size_t height;
     pixformat_t format;
+    camera_exposure_stats_t exposure;
     size_t size;
     uint8_t ref;
     uint8_t bad;
@@ -147,6 +148,9 @@ static void dma_filter_yuyv(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t*
 static void dma_filter_yuyv_highspeed(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst);
 static void dma_filter_jpeg(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst);
 static void i2s_stop(bool* need_yield);
+static void exposure_stats_reset(camera_exposure_stats_t* stats);
+static void exposure_stats_accumulate(camera_exposure_stats_t* stats, const uint8_t* src, size_t len);
+static void exposure_stats_finish(camera_exposure_stats_t* stats);
 
 static bool is_hs_mode()
 {
@@ -676,6 +680,7 @@ static void IRAM_ATTR dma_finish_frame()
             }
         } else {
             s_state->fb->len = s_state->dma_filtered_count * buf_len;
+            exposure_stats_finish(&s_state->fb->exposure);
             if(s_state->fb->len) {
                 //find the end marker for JPEG. Data after that can be discarded
                 if(s_state->fb->format == PIXFORMAT_JPEG){
@@ -708,6 +713,55 @@ static void IRAM_ATTR dma_finish_frame()
     s_state->dma_filtered_count = 0;
 }
 
+static void IRAM_ATTR exposure_stats_reset(camera_exposure_stats_t* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->min = 0xFF;
+    stats->valid = s_state->sensor.pixformat == PIXFORMAT_GRAYSCALE
+                || s_state->sensor.pixformat == PIXFORMAT_YUV422;
+}
+
+static void IRAM_ATTR exposure_stats_accumulate(camera_exposure_stats_t* stats, const uint8_t* src, size_t len)
+{
+    // the data was just written by the DMA filter, so it is still in cache.
+    // YUYV keeps the luma in every second byte, grayscale in every byte
+    size_t step = (s_state->sensor.pixformat == PIXFORMAT_YUV422) ? 2 : 1;
+    uint32_t* histogram = stats->histogram;
+    uint32_t sum = 0, low = 0, high = 0;
+    uint8_t min = stats->min, max = stats->max;
+    for (size_t i = 0; i < len; i += step) {
+        uint8_t y = src[i];
+        histogram[y >> 2]++;
+        sum += y;
+        if (y <= CAMERA_EXPOSURE_CLIP_LOW) {
+            low++;
+        } else if (y >= CAMERA_EXPOSURE_CLIP_HIGH) {
+            high++;
+        }
+        if (y < min) {
+            min = y;
+        }
+        if (y > max) {
+            max = y;
+        }
+    }
+    stats->sum += sum;
+    stats->pixel_count += len / step;
+    stats->clipped_low += low;
+    stats->clipped_high += high;
+    stats->min = min;
+    stats->max = max;
+}
+
+static void IRAM_ATTR exposure_stats_finish(camera_exposure_stats_t* stats)
+{
+    if (!stats->valid || !stats->pixel_count) {
+        stats->valid = false;
+        return;
+    }
+    stats->mean = (uint8_t)(stats->sum / stats->pixel_count);
+}
+
 static void IRAM_ATTR dma_filter_buffer(size_t buf_idx)
 {
     //no need to process the data if frame is in use or is bad
@@ -729,6 +783,7 @@ static void IRAM_ATTR dma_filter_buffer(size_t buf_idx)
 
     //first frame buffer
     if(!s_state->dma_filtered_count) {
+        exposure_stats_reset(&s_state->fb->exposure);
         //check for correct JPEG header
         if(s_state->sensor.pixformat == PIXFORMAT_JPEG) {
             uint32_t sig = *((uint32_t *)s_state->fb->buf) & 0xFFFFFF;
@@ -743,6 +798,9 @@ static void IRAM_ATTR dma_filter_buffer(size_t buf_idx)
         s_state->fb->height = resolution[s_state->sensor.status.framesize][1];
         s_state->fb->format = s_state->sensor.pixformat;
     }
+    if(s_state->fb->exposure.valid) {
+        exposure_stats_accumulate(&s_state->fb->exposure, s_state->fb->buf + fb_pos, buf_len);
+    }
     s_state->dma_filtered_count++;
 }
 
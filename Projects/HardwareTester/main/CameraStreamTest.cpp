@@ -1,7 +1,16 @@
 
 #include "CameraStreamTest.h"
+#include "sdkconfig.h"
 #include "esp_http_server.h"
 #include "Camera.h"
+#include "FocusMetric.h"
+#include "Spiffs.h"
+#include "StreamBroadcaster.h"
+#include "RtspServer.h"
+#include "SnapshotCache.h"
+#include "TileStreamer.h"
+#include "StaticAssets.h"
+#include "TokenBucket.h"
 
 using Hal::Dwt;
 using Hal::Hardware;
@@ -10,10 +19,27 @@ using Hal::TimeLimit;
 using namespace std;
 using Hal::Camera;
 using Hal::Hardware;
+using Hal::FocusMetric;
+using Hal::FocusReading;
+using Utilities::TokenBucket;
 
 httpd_handle_t stream_httpd = NULL;
 httpd_handle_t camera_httpd = NULL;
 static ra_filter_t ra_filter;
+static FocusMetric focus_metric;
+static stream_skip_policy_t skip_policy = {100, 5000};
+static StreamBroadcaster broadcaster;
+static RtspServer rtsp_server;
+static SnapshotCache snapshot_cache;
+static TileStreamer tile_streamer;
+static StaticAssets static_assets;
+
+// a reading older than this is refreshed by the /focus handler itself
+static const uint32_t FOCUS_STALE_MS = 250;
+// how long a snapshot waits for the first frame of a stream that just started
+static const uint32_t SNAPSHOT_WAIT_MS = 1000;
+// seconds a client refused for bandwidth is told to wait
+static const uint32_t RETRY_AFTER_S = 1;
 
 static ra_filter_t *ra_filter_init(ra_filter_t *filter, size_t sample_size);
 static int ra_filter_run(ra_filter_t *filter, int value);
@@ -23,6 +49,9 @@ static esp_err_t web_stream_handler(httpd_req_t *req);
 static esp_err_t cmd_handler(httpd_req_t *req);
 static esp_err_t status_handler(httpd_req_t *req);
 static esp_err_t index_handler(httpd_req_t *req);
+static esp_err_t focus_handler(httpd_req_t *req);
+static esp_err_t tile_stream_handler(httpd_req_t *req);
+static esp_err_t tile_page_handler(httpd_req_t *req);
 
 static ra_filter_t *ra_filter_init(ra_filter_t *filter, size_t sample_size)
 {
@@ -74,12 +103,140 @@ static size_t jpg_encode_stream(void *arg, size_t index, const void *data, size_
     return len;
 }
 
+static esp_err_t send_over_budget(httpd_req_t *req)
+{
+    // a snapshot is sent whole or not at all, the client is told when to come back
+    char retry_after[12];
+    snprintf(retry_after, sizeof(retry_after), "%u", RETRY_AFTER_S);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", retry_after);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+static esp_err_t tile_stream_handler(httpd_req_t *req)
+{
+    // like /stream the connection is handed over, the tiles are made from the broadcaster's frames
+    if (!tile_streamer.AddViewer(req))
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t tile_page_handler(httpd_req_t *req)
+{
+    Hal::Spiffs &spiffs = Hardware::Instance()->GetSpiffs();
+    if (!spiffs.IsMounted() && !spiffs.Mount())
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    FILE *file = fopen("/spiffs/tiles.html", "r");
+    if (file == NULL)
+    {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "text/html");
+    char chunk[512];
+    size_t read_len;
+    while ((read_len = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        if (httpd_resp_send_chunk(req, chunk, read_len) != ESP_OK)
+        {
+            fclose(file);
+            return ESP_FAIL;
+        }
+    }
+    fclose(file);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t focus_handler(httpd_req_t *req)
+{
+    char query[32] = {
+        0,
+    };
+    char value[8] = {
+        0,
+    };
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "reset", value, sizeof(value)) == ESP_OK && atoi(value))
+    {
+        focus_metric.ResetPeak();
+    }
+
+    // without a running stream nobody feeds the metric, grab a frame here,
+    // while one runs its capture task owns the camera and keeps the reading fresh
+    FocusReading reading = focus_metric.GetReading();
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    if (!broadcaster.IsCapturing() && (reading.FrameCount == 0 || now - reading.Timestamp > FOCUS_STALE_MS))
+    {
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (fb)
+        {
+            focus_metric.Measure(fb);
+            esp_camera_fb_return(fb);
+            reading = focus_metric.GetReading();
+        }
+    }
+
+    char json_response[160];
+    int len = snprintf(json_response, sizeof(json_response),
+                       "{\"score\":%u,\"peak\":%u,\"frames\":%u,\"age\":%u,\"roi\":[%u,%u]}",
+                       reading.Score, reading.Peak, reading.FrameCount, now - reading.Timestamp,
+                       reading.RoiWidth, reading.RoiHeight);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    return httpd_resp_send(req, json_response, len);
+}
+
 static esp_err_t capture_handler(httpd_req_t *req)
 {
     camera_fb_t *fb = NULL;
     esp_err_t res = ESP_OK;
     int64_t fr_start = esp_timer_get_time();
 
+    // plain snapshots are shared by every poller within the freshness window,
+    // and while streaming they are taken from the stream instead of the camera
+    if (broadcaster.IsCapturing() || resolution[esp_camera_sensor_get()->status.framesize][0] > 400)
+    {
+        SnapshotCache::Snapshot snapshot;
+        if (!snapshot_cache.Acquire(snapshot))
+        {
+            printf("Camera capture failed");
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+        if (!TokenBucket::Device().Admit(snapshot.Length))
+        {
+            snapshot_cache.Release(snapshot);
+            return send_over_budget(req);
+        }
+
+        char timestamp[32];
+        snprintf(timestamp, sizeof(timestamp), "%lld.%06ld", snapshot.Timestamp / 1000000, (long)(snapshot.Timestamp % 1000000));
+        httpd_resp_set_type(req, "image/jpeg");
+        httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+        httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+        httpd_resp_set_hdr(req, "X-Timestamp", timestamp);
+        res = httpd_resp_send(req, (const char *)snapshot.Data, snapshot.Length);
+
+        static const char *sources[] = {"", " cached", " coalesced"};
+        size_t length = snapshot.Length;
+        const char *source = sources[static_cast<uint8_t>(snapshot.From)];
+        snapshot_cache.Release(snapshot);
+        int64_t fr_end = esp_timer_get_time();
+        printf("JPG: %uB %ums%s\n", (uint32_t)(length), (uint32_t)((fr_end - fr_start) / 1000), source);
+        return res;
+    }
+
     fb = esp_camera_fb_get();
     if (!fb)
     {
@@ -87,6 +244,12 @@ static esp_err_t capture_handler(httpd_req_t *req)
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
+    // the re-encode is sent as it is made, the camera's frame stands in for its size
+    if (!TokenBucket::Device().Admit(fb->len))
+    {
+        esp_camera_fb_return(fb);
+        return send_over_budget(req);
+    }
 
     httpd_resp_set_type(req, "image/jpeg");
     httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
@@ -97,26 +260,6 @@ static esp_err_t capture_handler(httpd_req_t *req)
     bool s;
     bool detected = false;
     int face_id = 0;
-    if (fb->width > 400)
-    {
-        size_t fb_len = 0;
-        if (fb->format == PIXFORMAT_JPEG)
-        {
-            fb_len = fb->len;
-            res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-        }
-        else
-        {
-            jpg_chunking_t jchunk = {req, 0};
-            res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk) ? ESP_OK : ESP_FAIL;
-            httpd_resp_send_chunk(req, NULL, 0);
-            fb_len = jchunk.len;
-        }
-        esp_camera_fb_return(fb);
-        int64_t fr_end = esp_timer_get_time();
-        printf("JPG: %uB %ums\n", (uint32_t)(fb_len), (uint32_t)((fr_end - fr_start) / 1000));
-        return res;
-    }
 
     out_buf = fb->buf;
     out_len = fb->width * fb->height * 3;
@@ -145,153 +288,54 @@ static esp_err_t capture_handler(httpd_req_t *req)
     return res;
 }
 
-static esp_err_t web_stream_handler(httpd_req_t *req)
+static bool stream_frame_hook(camera_fb_t *fb, void *arg)
 {
-    camera_fb_t *fb = NULL;
-    esp_err_t res = ESP_OK;
-    size_t _jpg_buf_len = 0;
-    uint8_t *_jpg_buf = NULL;
-    char *part_buf[64];
-    bool detected = false;
-    int face_id = 0;
-    int64_t fr_start = 0;
-    int64_t fr_ready = 0;
-    int64_t fr_face = 0;
-    int64_t fr_recognize = 0;
-    int64_t fr_encode = 0;
-
     static int64_t last_frame = 0;
+
+    int64_t fr_start = esp_timer_get_time();
+    // score before any conversion
+    focus_metric.Measure(fb);
+    tile_streamer.Offer(fb);
+
+    // every frame is published, RTSP and /capture must not freeze on a still scene,
+    // the broadcaster leaves near-duplicates out per MJPEG viewer
     if (!last_frame)
     {
-        last_frame = esp_timer_get_time();
+        last_frame = fr_start;
+        return true;
     }
+    uint32_t frame_time = (fr_start - last_frame) / 1000;
+    last_frame = fr_start;
+    uint32_t avg_frame_time = ra_filter_run(&ra_filter, frame_time);
+    printf("MJPG: %uB %ums (%.1ffps), AVG: %ums (%.1ffps), viewers %u\n",
+           (uint32_t)fb->len, frame_time, 1000.0 / frame_time, avg_frame_time, 1000.0 / avg_frame_time,
+           broadcaster.GetViewerCount());
+    return true;
+}
 
-    res = httpd_resp_set_type(req, WEB_STREAM_CONTENT_TYPE);
-    if (res != ESP_OK)
+static bool snapshot_frame_source(uint8_t *&data, size_t &length, int64_t &timestamp, void *arg)
+{
+    if (!broadcaster.IsCapturing())
     {
-        return res;
+        return false;
     }
-
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-
-    while (true)
+    if (!broadcaster.CopyLatest(data, length, timestamp, SNAPSHOT_WAIT_MS))
     {
-        detected = false;
-        face_id = 0;
-        fb = esp_camera_fb_get();
-        if (!fb)
-        {
-            printf("Camera capture failed");
-            res = ESP_FAIL;
-        }
-        else
-        {
-            fr_start = esp_timer_get_time();
-            fr_ready = fr_start;
-            fr_face = fr_start;
-            fr_encode = fr_start;
-            fr_recognize = fr_start;
-            if (fb->width > 400)
-            {
-                if (fb->format != PIXFORMAT_JPEG)
-                {
-                    bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-                    esp_camera_fb_return(fb);
-                    fb = NULL;
-                    if (!jpeg_converted)
-                    {
-                        printf("JPEG compression failed");
-                        res = ESP_FAIL;
-                    }
-                }
-                else
-                {
-                    _jpg_buf_len = fb->len;
-                    _jpg_buf = fb->buf;
-                }
-            }
-            else
-            {
-
-                if (!fmt2rgb888(fb->buf, fb->len, fb->format, fb->buf))
-                {
-                    printf("fmt2rgb888 failed");
-                    res = ESP_FAIL;
-                }
-                else
-                {
-                    fr_ready = esp_timer_get_time();
-                    fr_face = esp_timer_get_time();
-                    fr_recognize = fr_face;
-                    if (fb->format != PIXFORMAT_JPEG)
-                    {
-                        if (!fmt2jpg(fb->buf, fb->width * fb->height * 3, fb->width, fb->height, PIXFORMAT_RGB888, 90, &_jpg_buf, &_jpg_buf_len))
-                        {
-                            printf("fmt2jpg failed");
-                            res = ESP_FAIL;
-                        }
-                        esp_camera_fb_return(fb);
-                        fb = NULL;
-                    }
-                    else
-                    {
-                        _jpg_buf = fb->buf;
-                        _jpg_buf_len = fb->len;
-                    }
-                    fr_encode = esp_timer_get_time();
-                }
-            }
-        }
-        if (res == ESP_OK)
-        {
-            size_t hlen = snprintf((char *)part_buf, 64, WEB_STREAM_PART, _jpg_buf_len);
-            res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
-        }
-        if (res == ESP_OK)
-        {
-            res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
-        }
-        if (res == ESP_OK)
-        {
-            res = httpd_resp_send_chunk(req, WEB_STREAM_BOUNDARY, strlen(WEB_STREAM_BOUNDARY));
-        }
-        if (fb)
-        {
-            esp_camera_fb_return(fb);
-            fb = NULL;
-            _jpg_buf = NULL;
-        }
-        else if (_jpg_buf)
-        {
-            free(_jpg_buf);
-            _jpg_buf = NULL;
-        }
-        if (res != ESP_OK)
-        {
-            break;
-        }
-        int64_t fr_end = esp_timer_get_time();
-
-        int64_t ready_time = (fr_ready - fr_start) / 1000;
-        int64_t face_time = (fr_face - fr_ready) / 1000;
-        int64_t recognize_time = (fr_recognize - fr_face) / 1000;
-        int64_t encode_time = (fr_encode - fr_recognize) / 1000;
-        int64_t process_time = (fr_encode - fr_start) / 1000;
-
-        int64_t frame_time = fr_end - last_frame;
-        last_frame = fr_end;
-        frame_time /= 1000;
-        uint32_t avg_frame_time = ra_filter_run(&ra_filter, frame_time);
-        printf("MJPG: %uB %ums (%.1ffps), AVG: %ums (%.1ffps), %u+%u+%u+%u=%u %s%d\n",
-               (uint32_t)(_jpg_buf_len),
-               (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time,
-               avg_frame_time, 1000.0 / avg_frame_time,
-               (uint32_t)ready_time, (uint32_t)face_time, (uint32_t)recognize_time, (uint32_t)encode_time, (uint32_t)process_time,
-               (detected) ? "DETECTED " : "", face_id);
+        data = NULL;
     }
+    return true;
+}
 
-    last_frame = 0;
-    return res;
+static esp_err_t web_stream_handler(httpd_req_t *req)
+{
+    // the broadcaster takes the connection over, this returns right away so
+    // the stream server stays free for further viewers
+    if (!broadcaster.AddViewer(req))
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    return ESP_OK;
 }
 
 static esp_err_t cmd_handler(httpd_req_t *req)
@@ -345,7 +389,19 @@ static esp_err_t cmd_handler(httpd_req_t *req)
     sensor_t *s = esp_camera_sensor_get();
     int res = 0;
     Camera &camera = Hardware::Instance()->GetCamera();
-    if (!strcmp(variable, "framesize"))
+    if (!strcmp(variable, "skip_threshold"))
+    {
+        skip_policy.threshold = val;
+        broadcaster.SetSkipPolicy(skip_policy.threshold, skip_policy.keepalive_ms);
+    }
+    else if (!strcmp(variable, "keepalive"))
+    {
+        skip_policy.keepalive_ms = (val > 0) ? val * 1000 : 0;
+        broadcaster.SetSkipPolicy(skip_policy.threshold, skip_policy.keepalive_ms);
+    }
+    else if (!strcmp(variable, "snapshot_fresh"))
+        snapshot_cache.SetFreshness((val > 0) ? val : 0);
+    else if (!strcmp(variable, "framesize"))
     {
         if (s->pixformat == PIXFORMAT_JPEG)
             res = camera.SetResolution(static_cast<Hal::CameraFrameSize>(val));
@@ -406,13 +462,16 @@ static esp_err_t cmd_handler(httpd_req_t *req)
         return httpd_resp_send_500(req);
     }
 
+    // a snapshot taken with the old settings must not be handed out any more
+    snapshot_cache.Invalidate();
+
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
     return httpd_resp_send(req, NULL, 0);
 }
 
 static esp_err_t status_handler(httpd_req_t *req)
 {
-    static char json_response[1024];
+    static char json_response[2560];
 
     sensor_t *s = esp_camera_sensor_get();
     char *p = json_response;
@@ -442,6 +501,39 @@ static esp_err_t status_handler(httpd_req_t *req)
     p += sprintf(p, "\"vflip\":%u,", s->status.vflip);
     p += sprintf(p, "\"hmirror\":%u,", s->status.hmirror);
     p += sprintf(p, "\"dcw\":%u,", s->status.dcw);
+    p += sprintf(p, "\"skip_threshold\":%d,", skip_policy.threshold);
+    p += sprintf(p, "\"keepalive\":%u,", skip_policy.keepalive_ms / 1000);
+
+    stream_viewer_stats_t viewers[StreamBroadcaster::MaxViewers];
+    uint8_t viewer_count = broadcaster.GetViewerStats(viewers, StreamBroadcaster::MaxViewers);
+    p += sprintf(p, "\"viewers\":[");
+    for (uint8_t i = 0; i < viewer_count; i++)
+    {
+        p += sprintf(p, "%s{\"fps\":%.1f,\"kbps\":%.0f,\"rendition\":%u,\"switches\":%u,\"delivery_ms\":%u,\"link_kbps\":%.0f,"
+                        "\"frames\":%u,\"dropped\":%u,\"shaped\":%u,\"skipped\":%u,\"bytes\":%u,\"sends\":%u}",
+                     i ? "," : "", viewers[i].fps, viewers[i].kbps, viewers[i].rendition, viewers[i].switches, viewers[i].delivery_ms,
+                     viewers[i].link_kbps, viewers[i].frames_sent, viewers[i].frames_dropped, viewers[i].frames_shaped, viewers[i].frames_skipped,
+                     viewers[i].bytes_sent, viewers[i].send_calls);
+    }
+    p += sprintf(p, "],");
+    p += sprintf(p, "\"rtsp_clients\":%u,", rtsp_server.GetPlayingCount());
+    p += sprintf(p, "\"rtsp_shaped\":%u,", rtsp_server.GetShapedFrames());
+    TokenBucket::Statistics bandwidth = TokenBucket::Device().GetStatistics();
+    p += sprintf(p, "\"bandwidth\":{\"rate\":%u,\"passed\":%u,\"dropped\":%u,\"bytes\":%u},",
+                 bandwidth.Rate, bandwidth.Passed, bandwidth.Dropped, bandwidth.Bytes);
+
+    snapshot_cache_stats_t snapshot;
+    snapshot_cache.GetStats(snapshot);
+    p += sprintf(p, "\"snapshot_fresh\":%u,", snapshot_cache.GetFreshness());
+    p += sprintf(p, "\"snapshot\":{\"requests\":%u,\"hits\":%u,\"coalesced\":%u,\"hit_ratio\":%.2f,"
+                    "\"captures\":%u,\"failures\":%u,\"encodes\":%u,\"encodes_saved\":%u,\"saved_ms\":%u,\"capture_ms\":%u},",
+                 snapshot.requests, snapshot.hits, snapshot.coalesced,
+                 snapshot.requests ? (float)(snapshot.hits + snapshot.coalesced) / snapshot.requests : 0.0f,
+                 snapshot.captures, snapshot.failures, snapshot.encodes, snapshot.encodes_saved, snapshot.saved_ms, snapshot.capture_ms);
+    static_asset_stats_t assets;
+    static_assets.GetStats(assets);
+    p += sprintf(p, "\"static\":{\"served\":%u,\"not_modified\":%u,\"hashed\":%u,\"bytes\":%u},",
+                 assets.served, assets.not_modified, assets.hashed, assets.bytes);
     p += sprintf(p, "\"colorbar\":%u", s->status.colorbar);
     *p++ = '}';
     *p++ = 0;
@@ -452,14 +544,28 @@ static esp_err_t status_handler(httpd_req_t *req)
 
 static esp_err_t index_handler(httpd_req_t *req)
 {
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
-    return httpd_resp_send(req, (const char *)index_ov2640_html_gz, sizeof(index_ov2640_html_gz));
+    // a page on SPIFFS takes precedence, so the UI can change without reflashing the application
+    esp_err_t res = static_assets.Serve(req, "/index.html");
+    if (res != ESP_ERR_NOT_FOUND)
+        return res;
+    return static_assets.ServeEmbedded(req, "/", index_ov2640_html_gz, sizeof(index_ov2640_html_gz));
+}
+
+static esp_err_t static_handler(httpd_req_t *req)
+{
+    esp_err_t res = static_assets.Serve(req, req->uri + strlen("/static"));
+    if (res == ESP_ERR_NOT_FOUND)
+    {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    return res;
 }
 
 void startCameraServer()
 {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.uri_match_fn = httpd_uri_match_wildcard;
 
     httpd_uri_t index_uri = {
         .uri = "/",
@@ -479,6 +585,24 @@ void startCameraServer()
         .handler = cmd_handler,
         .user_ctx = NULL};
 
+    httpd_uri_t focus_uri = {
+        .uri = "/focus",
+        .method = HTTP_GET,
+        .handler = focus_handler,
+        .user_ctx = NULL};
+
+    httpd_uri_t tiles_page_uri = {
+        .uri = "/tiles.html",
+        .method = HTTP_GET,
+        .handler = tile_page_handler,
+        .user_ctx = NULL};
+
+    httpd_uri_t static_uri = {
+        .uri = "/static/*",
+        .method = HTTP_GET,
+        .handler = static_handler,
+        .user_ctx = NULL};
+
     httpd_uri_t capture_uri = {
         .uri = "/capture",
         .method = HTTP_GET,
@@ -491,8 +615,20 @@ void startCameraServer()
         .handler = web_stream_handler,
         .user_ctx = NULL};
 
+    httpd_uri_t tiles_uri = {
+        .uri = "/tiles",
+        .method = HTTP_GET,
+        .handler = tile_stream_handler,
+        .user_ctx = NULL};
+
     ra_filter_init(&ra_filter, 20);
 
+    // a rate of 0 leaves that budget unlimited, the traffic is still counted
+    const uint32_t burst = CONFIG_STREAM_BURST_KB * 1024;
+    TokenBucket::Device().Configure(CONFIG_STREAM_DEVICE_KBPS * 1000 / 8, burst);
+    broadcaster.SetBandwidth(CONFIG_STREAM_VIEWER_KBPS * 1000 / 8, burst);
+    rtsp_server.SetBandwidth(CONFIG_STREAM_VIEWER_KBPS * 1000 / 8, burst);
+
     printf("Starting web server on port: '%d'\n", config.server_port);
     if (httpd_start(&camera_httpd, &config) == ESP_OK)
     {
@@ -500,6 +636,9 @@ void startCameraServer()
         httpd_register_uri_handler(camera_httpd, &cmd_uri);
         httpd_register_uri_handler(camera_httpd, &status_uri);
         httpd_register_uri_handler(camera_httpd, &capture_uri);
+        httpd_register_uri_handler(camera_httpd, &focus_uri);
+        httpd_register_uri_handler(camera_httpd, &tiles_page_uri);
+        httpd_register_uri_handler(camera_httpd, &static_uri);
     }
 
     config.server_port += 1;
@@ -508,5 +647,14 @@ void startCameraServer()
     if (httpd_start(&stream_httpd, &config) == ESP_OK)
     {
         httpd_register_uri_handler(stream_httpd, &stream_uri);
+        httpd_register_uri_handler(stream_httpd, &tiles_uri);
+        broadcaster.SetFrameHook(stream_frame_hook, NULL);
+        broadcaster.SetSkipPolicy(skip_policy.threshold, skip_policy.keepalive_ms);
+        broadcaster.Start(stream_httpd);
+        tile_streamer.Start(stream_httpd, broadcaster);
+        snapshot_cache.SetFrameSource(snapshot_frame_source, NULL);
+
+        printf("Starting RTSP server on port: '%d'\n", RtspServer::DefaultPort);
+        rtsp_server.Start(broadcaster);
     }
 }
\ No newline at end of file
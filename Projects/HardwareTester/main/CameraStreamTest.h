@@ -56,10 +56,44 @@ typedef struct
     size_t len;
 } jpg_chunking_t;
 
+typedef struct
+{
+    int32_t threshold;     //fingerprint difference in 1/100 luma levels up to which an MJPEG viewer skips a frame, negative disables skipping
+    uint32_t keepalive_ms; //a frame is sent at least this often even if nothing changed
+} stream_skip_policy_t;
+
 #define PART_BOUNDARY "123456789000000000000987654321"
 static const char *WEB_STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
 static const char *WEB_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
 static const char *WEB_STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
 
+// Differential tile stream, a binary response made of frame records that runs until the connection closes.
+// Each record is a tile_frame_header_t followed by `tiles` times a tile_header_t
+// and `length` bytes of a standalone JPEG covering the tile. Positions are in
+// 16x16 blocks. A keyframe carries one tile with the whole frame.
+#define TILE_STREAM_MAGIC 0x3154 // "T1"
+#define TILE_STREAM_FLAG_KEYFRAME 0x01
+static const char *TILE_STREAM_CONTENT_TYPE = "application/octet-stream";
+
+typedef struct __attribute__((packed))
+{
+    uint16_t magic;
+    uint8_t flags;
+    uint8_t reserved;
+    uint16_t width;
+    uint16_t height;
+    uint16_t tiles;
+    uint16_t sequence;
+} tile_frame_header_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t column;
+    uint8_t row;
+    uint8_t columns;
+    uint8_t rows;
+    uint32_t length;
+} tile_header_t;
+
 void startCameraServer();
 #endif /* CAMERA_TESTS_H_ */
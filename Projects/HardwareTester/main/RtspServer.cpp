@@ -0,0 +1,833 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <sys/time.h>
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "RtspServer.h"
+
+namespace
+{
+
+void put16(uint8_t *data, uint16_t value)
+{
+    data[0] = value >> 8;
+    data[1] = value;
+}
+
+void put24(uint8_t *data, uint32_t value)
+{
+    data[0] = value >> 16;
+    data[1] = value >> 8;
+    data[2] = value;
+}
+
+void put32(uint8_t *data, uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+uint16_t get16(const uint8_t *data)
+{
+    return (data[0] << 8) | data[1];
+}
+
+/// @brief	Copies the value of a request header, empty if it is missing or too long.
+bool getHeader(const char *request, const char *name, char *value, size_t size)
+{
+    size_t nameLength = strlen(name);
+    for (const char *line = strstr(request, "\r\n"); line != nullptr; line = strstr(line, "\r\n"))
+    {
+        line += 2;
+        if (strncasecmp(line, name, nameLength) != 0 || line[nameLength] != ':')
+            continue;
+
+        const char *start = line + nameLength + 1;
+        while (*start == ' ')
+            start++;
+        const char *end = strstr(start, "\r\n");
+        size_t length = end ? end - start : strlen(start);
+        if (length >= size)
+            break;
+
+        memcpy(value, start, length);
+        value[length] = '\0';
+        return true;
+    }
+    value[0] = '\0';
+    return false;
+}
+
+const char *statusText(uint16_t status)
+{
+    switch (status)
+    {
+    case 200:
+        return "OK";
+    case 400:
+        return "Bad Request";
+    case 454:
+        return "Session Not Found";
+    case 413:
+        return "Request Entity Too Large";
+    case 461:
+        return "Unsupported Transport";
+    case 501:
+        return "Not Implemented";
+    }
+    return "Internal Server Error";
+}
+
+bool sameEndpoint(const struct sockaddr_in &a, const struct sockaddr_in &b)
+{
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+} // namespace
+
+bool RtspServer::Start(StreamBroadcaster &source, uint16_t port)
+{
+    _source = &source;
+    _port = port;
+    if (!openSockets())
+        return false;
+
+    source.SetJpegListener(jpegListener, this);
+    return _thread.Start();
+}
+
+void RtspServer::SetBandwidth(uint32_t bytesPerSecond, uint32_t burst)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    _bandwidthRate = bytesPerSecond;
+    _bandwidthBurst = burst;
+    for (Client &client : _clients)
+        client.Bandwidth.Configure(bytesPerSecond, burst);
+}
+
+bool RtspServer::openSockets()
+{
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    _listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    _rtpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    _rtcpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (_listenSocket < 0 || _rtpSocket < 0 || _rtcpSocket < 0)
+    {
+        printf("RTSP: socket creation failed, errno %d\n", errno);
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(_listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    address.sin_port = htons(_port);
+    if (bind(_listenSocket, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(_listenSocket, MaxClients) != 0)
+    {
+        printf("RTSP: unable to listen on port %u, errno %d\n", _port, errno);
+        return false;
+    }
+
+    // all clients share the server ports, they are told apart by their own address
+    address.sin_port = htons(RtpPort);
+    bool rtpBound = bind(_rtpSocket, (struct sockaddr *)&address, sizeof(address)) == 0;
+    address.sin_port = htons(RtpPort + 1);
+    bool rtcpBound = bind(_rtcpSocket, (struct sockaddr *)&address, sizeof(address)) == 0;
+    if (!rtpBound || !rtcpBound)
+    {
+        printf("RTSP: unable to bind RTP ports %u-%u, errno %d\n", RtpPort, RtpPort + 1, errno);
+        return false;
+    }
+    return true;
+}
+
+void RtspServer::serverLoop()
+{
+    for (;;)
+    {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(_listenSocket, &readSet);
+        FD_SET(_rtpSocket, &readSet);
+        FD_SET(_rtcpSocket, &readSet);
+        int maxSocket = _listenSocket > _rtpSocket ? _listenSocket : _rtpSocket;
+        if (_rtcpSocket > maxSocket)
+            maxSocket = _rtcpSocket;
+
+        // reports and session timeouts are checked at least once a second
+        struct timeval timeout = {1, 0};
+        for (Client &client : _clients)
+        {
+            if (client.Control < 0)
+                continue;
+
+            // a full request buffer is only read again once process() has taken a request out of it
+            if (client.RequestLength < RequestSize - 1)
+                FD_SET(client.Control, &readSet);
+            if (client.Control > maxSocket)
+                maxSocket = client.Control;
+
+            // requests left behind for want of reply space are served right after the replies went out
+            if (client.Deferred)
+                timeout.tv_sec = 0;
+        }
+
+        int ready = select(maxSocket + 1, &readSet, NULL, NULL, &timeout);
+
+        {
+            cpp_freertos::LockGuard guard(_lock);
+            if (ready > 0)
+            {
+                if (FD_ISSET(_listenSocket, &readSet))
+                    acceptClient();
+                if (FD_ISSET(_rtpSocket, &readSet))
+                    receiveRtcp(_rtpSocket);
+                if (FD_ISSET(_rtcpSocket, &readSet))
+                    receiveRtcp(_rtcpSocket);
+            }
+
+            for (Client &client : _clients)
+            {
+                if (client.Control < 0)
+                    continue;
+                if (ready > 0 && FD_ISSET(client.Control, &readSet))
+                    receive(client);
+                else
+                    process(client);
+            }
+            checkClients(esp_timer_get_time());
+        }
+
+        sendResponses();
+    }
+}
+
+void RtspServer::sendResponses()
+{
+    // only this task touches the replies and the control sockets, frames keep going out meanwhile
+    bool closing = false;
+    for (Client &client : _clients)
+    {
+        if (client.Control < 0)
+            continue;
+
+        const char *next = client.Response;
+        while (client.ResponseLength > 0)
+        {
+            int sent = send(client.Control, next, client.ResponseLength, 0);
+            if (sent <= 0)
+            {
+                client.Closing = true;
+                break;
+            }
+            next += sent;
+            client.ResponseLength -= sent;
+        }
+        client.ResponseLength = 0;
+        closing = closing || client.Closing;
+    }
+
+    if (!closing)
+        return;
+
+    cpp_freertos::LockGuard guard(_lock);
+    for (Client &client : _clients)
+    {
+        if (client.Closing)
+            closeClient(client);
+    }
+}
+
+void RtspServer::acceptClient()
+{
+    int socket = accept(_listenSocket, NULL, NULL);
+    if (socket < 0)
+        return;
+
+    for (Client &client : _clients)
+    {
+        if (client.Control >= 0)
+            continue;
+
+        // replies are sent without the lock, the timeout only bounds how long other clients wait
+        struct timeval sendTimeout = {1, 0};
+        setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+        client.Control = socket;
+        client.RequestLength = 0;
+        client.Request[0] = '\0';
+        client.ResponseLength = 0;
+        client.Deferred = false;
+        client.Closing = false;
+        client.Session = 0;
+        client.Playing = false;
+        client.Bandwidth.Configure(_bandwidthRate, _bandwidthBurst);
+        client.LastActivity = esp_timer_get_time();
+        return;
+    }
+
+    printf("RTSP: no free client slot\n");
+    close(socket);
+}
+
+void RtspServer::receive(Client &client)
+{
+    // a zero length read would look like the peer closing
+    if (client.RequestLength >= RequestSize - 1)
+    {
+        process(client);
+        return;
+    }
+
+    int length = recv(client.Control, client.Request + client.RequestLength, RequestSize - 1 - client.RequestLength, 0);
+    if (length <= 0)
+    {
+        closeClient(client);
+        return;
+    }
+    client.RequestLength += length;
+    client.Request[client.RequestLength] = '\0';
+    process(client);
+}
+
+void RtspServer::process(Client &client)
+{
+    for (;;)
+    {
+        // a request is only taken once its longest reply fits behind those not sent yet
+        client.Deferred = client.ResponseLength + MaxResponseSize > ResponseSize;
+        if (client.Closing || client.Deferred)
+            return;
+
+        char *end = strstr(client.Request, "\r\n\r\n");
+        if (end == nullptr)
+        {
+            if (client.RequestLength >= RequestSize - 1)
+            {
+                printf("RTSP: request too long\n");
+                rejectTooLarge(client);
+            }
+            return;
+        }
+
+        // cut behind the last header line, a body such as GET_PARAMETER's is skipped
+        end[2] = '\0';
+        char contentLength[12];
+        getHeader(client.Request, "Content-Length", contentLength, sizeof(contentLength));
+        size_t total = end + 4 - client.Request + strtoul(contentLength, NULL, 10);
+        if (total > RequestSize - 1)
+        {
+            end[2] = '\r';
+            rejectTooLarge(client);
+            return;
+        }
+        if (client.RequestLength < total)
+        {
+            end[2] = '\r';
+            return;
+        }
+
+        if (!handleRequest(client, client.Request))
+        {
+            // the error reply still goes out first
+            client.Closing = true;
+            return;
+        }
+
+        client.RequestLength -= total;
+        memmove(client.Request, client.Request + total, client.RequestLength);
+        client.Request[client.RequestLength] = '\0';
+    }
+}
+
+bool RtspServer::handleRequest(Client &client, char *request)
+{
+    int64_t now = esp_timer_get_time();
+    client.LastActivity = now;
+
+    char method[16];
+    char url[128];
+    char cseq[12];
+    char headers[256];
+    getHeader(request, "CSeq", cseq, sizeof(cseq));
+    if (sscanf(request, "%15s %127s", method, url) != 2)
+    {
+        reply(client, 400, cseq, "");
+        return false;
+    }
+
+    if (strcmp(method, "OPTIONS") == 0)
+    {
+        reply(client, 200, cseq, "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, GET_PARAMETER\r\n");
+        return true;
+    }
+
+    if (strcmp(method, "DESCRIBE") == 0)
+    {
+        struct sockaddr_in local;
+        socklen_t localLength = sizeof(local);
+        getsockname(client.Control, (struct sockaddr *)&local, &localLength);
+
+        char sdp[256];
+        snprintf(sdp, sizeof(sdp),
+                 "v=0\r\n"
+                 "o=- %u 1 IN IP4 %s\r\n"
+                 "s=ESP32 Camera\r\n"
+                 "c=IN IP4 0.0.0.0\r\n"
+                 "t=0 0\r\n"
+                 "m=video 0 RTP/AVP %u\r\n"
+                 "a=control:track1\r\n",
+                 esp_random(), inet_ntoa(local.sin_addr), PayloadType);
+        snprintf(headers, sizeof(headers), "Content-Base: %s%s\r\nContent-Type: application/sdp\r\n",
+                 url, url[strlen(url) - 1] == '/' ? "" : "/");
+        reply(client, 200, cseq, headers, sdp);
+        return true;
+    }
+
+    if (strcmp(method, "SETUP") == 0)
+    {
+        char transport[128];
+        getHeader(request, "Transport", transport, sizeof(transport));
+        const char *ports = strstr(transport, "client_port=");
+        unsigned rtpPort = 0;
+        unsigned rtcpPort = 0;
+        int portCount = ports ? sscanf(ports + 12, "%u-%u", &rtpPort, &rtcpPort) : 0;
+        if (portCount < 1 || strstr(transport, "TCP") || strstr(transport, "multicast"))
+        {
+            reply(client, 461, cseq, "");
+            return true;
+        }
+        if (portCount == 1)
+            rtcpPort = rtpPort + 1;
+
+        if (client.Session == 0)
+        {
+            client.Session = esp_random() | 1;
+            client.Ssrc = esp_random();
+            client.Sequence = esp_random();
+            client.TimestampOffset = esp_random();
+            client.PacketCount = 0;
+            client.OctetCount = 0;
+        }
+
+        socklen_t addressLength = sizeof(client.RtpAddress);
+        getpeername(client.Control, (struct sockaddr *)&client.RtpAddress, &addressLength);
+        client.RtcpAddress = client.RtpAddress;
+        client.RtpAddress.sin_port = htons(rtpPort);
+        client.RtcpAddress.sin_port = htons(rtcpPort);
+
+        snprintf(headers, sizeof(headers),
+                 "Transport: RTP/AVP;unicast;client_port=%u-%u;server_port=%u-%u;ssrc=%08X\r\n"
+                 "Session: %08X;timeout=%u\r\n",
+                 rtpPort, rtcpPort, RtpPort, RtpPort + 1, client.Ssrc, client.Session, SessionTimeoutMs / 1000);
+        reply(client, 200, cseq, headers);
+        return true;
+    }
+
+    bool playControl = strcmp(method, "PLAY") == 0 || strcmp(method, "PAUSE") == 0 || strcmp(method, "TEARDOWN") == 0;
+    if (playControl || strcmp(method, "GET_PARAMETER") == 0)
+    {
+        char session[20];
+        bool hasSession = getHeader(request, "Session", session, sizeof(session));
+        if ((playControl || hasSession) && (client.Session == 0 || strtoul(session, NULL, 16) != client.Session))
+        {
+            reply(client, 454, cseq, "");
+            return true;
+        }
+
+        snprintf(headers, sizeof(headers), "Session: %08X\r\n", client.Session);
+        if (strcmp(method, "PLAY") == 0)
+        {
+            size_t length = strlen(headers);
+            snprintf(headers + length, sizeof(headers) - length, "Range: npt=0.000-\r\nRTP-Info: url=%s%s;seq=%u;rtptime=%u\r\n",
+                     url, strstr(url, "track1") ? "" : "/track1", client.Sequence, rtpClock(now) + client.TimestampOffset);
+            client.Playing = true;
+            client.LastReport = now;
+        }
+        else if (strcmp(method, "PAUSE") == 0)
+        {
+            client.Playing = false;
+        }
+        else if (strcmp(method, "TEARDOWN") == 0)
+        {
+            client.Playing = false;
+            client.Session = 0;
+        }
+        reply(client, 200, cseq, headers);
+        updateDemand();
+        return true;
+    }
+
+    reply(client, 501, cseq, "");
+    return true;
+}
+
+void RtspServer::rejectTooLarge(Client &client)
+{
+    char cseq[12];
+    getHeader(client.Request, "CSeq", cseq, sizeof(cseq));
+    reply(client, 413, cseq, "");
+
+    // the rest of the request can not be told apart from the next one
+    client.RequestLength = 0;
+    client.Request[0] = '\0';
+    client.Closing = true;
+}
+
+void RtspServer::reply(Client &client, uint16_t status, const char *cseq, const char *headers, const char *body)
+{
+    // process() leaves room for the longest reply
+    char *response = client.Response + client.ResponseLength;
+    int length = snprintf(response, MaxResponseSize, "RTSP/1.0 %u %s\r\nCSeq: %s\r\nServer: ESP32 Camera\r\n%s",
+                          status, statusText(status), cseq, headers);
+    if (length < MaxResponseSize && body != nullptr)
+        length += snprintf(response + length, MaxResponseSize - length, "Content-Length: %u\r\n\r\n%s", (unsigned)strlen(body), body);
+    else if (length < MaxResponseSize)
+        length += snprintf(response + length, MaxResponseSize - length, "\r\n");
+
+    // sent by sendResponses() once the lock is released
+    if (length < MaxResponseSize)
+        client.ResponseLength += length;
+}
+
+void RtspServer::receiveRtcp(int socket)
+{
+    // receiver reports only matter as a sign of life
+    uint8_t packet[256];
+    struct sockaddr_in source;
+    socklen_t sourceLength = sizeof(source);
+    if (recvfrom(socket, packet, sizeof(packet), MSG_DONTWAIT, (struct sockaddr *)&source, &sourceLength) <= 0)
+        return;
+
+    for (Client &client : _clients)
+    {
+        if (client.Session != 0 && (sameEndpoint(source, client.RtcpAddress) || sameEndpoint(source, client.RtpAddress)))
+            client.LastActivity = esp_timer_get_time();
+    }
+}
+
+void RtspServer::closeClient(Client &client)
+{
+    if (client.Control < 0)
+        return;
+
+    close(client.Control);
+    client.Control = -1;
+    client.Session = 0;
+    client.Playing = false;
+    client.RequestLength = 0;
+    client.Request[0] = '\0';
+    client.ResponseLength = 0;
+    client.Deferred = false;
+    client.Closing = false;
+    updateDemand();
+}
+
+void RtspServer::checkClients(int64_t now)
+{
+    for (Client &client : _clients)
+    {
+        if (client.Control < 0)
+            continue;
+
+        if (now - client.LastActivity > (int64_t)SessionTimeoutMs * 1000)
+        {
+            printf("RTSP: session %08X timed out\n", client.Session);
+            closeClient(client);
+        }
+        else if (client.Playing && now - client.LastReport >= (int64_t)ReportPeriodMs * 1000)
+        {
+            sendReport(client, now);
+        }
+    }
+}
+
+void RtspServer::sendReport(Client &client, int64_t now)
+{
+    static constexpr char Cname[] = "esp32cam";
+    constexpr uint8_t cnameLength = sizeof(Cname) - 1;
+    // header, SSRC, CNAME item and the end marker, padded to 32 bits
+    constexpr uint8_t sdesLength = (4 + 4 + 2 + cnameLength + 1 + 3) & ~3;
+    uint8_t packet[28 + sdesLength];
+
+    struct timeval wallClock;
+    gettimeofday(&wallClock, NULL);
+
+    // sender report, NTP time counts from 1900
+    packet[0] = 0x80;
+    packet[1] = 200;
+    put16(packet + 2, 6);
+    put32(packet + 4, client.Ssrc);
+    put32(packet + 8, wallClock.tv_sec + 2208988800UL);
+    put32(packet + 12, ((uint64_t)wallClock.tv_usec << 32) / 1000000);
+    put32(packet + 16, rtpClock(now) + client.TimestampOffset);
+    put32(packet + 20, client.PacketCount);
+    put32(packet + 24, client.OctetCount);
+
+    // a compound packet always carries the CNAME
+    uint8_t *sdes = packet + 28;
+    memset(sdes, 0, sdesLength);
+    sdes[0] = 0x81;
+    sdes[1] = 202;
+    put16(sdes + 2, sdesLength / 4 - 1);
+    put32(sdes + 4, client.Ssrc);
+    sdes[8] = 1;
+    sdes[9] = cnameLength;
+    memcpy(sdes + 10, Cname, cnameLength);
+
+    sendto(_rtcpSocket, packet, sizeof(packet), MSG_DONTWAIT, (struct sockaddr *)&client.RtcpAddress, sizeof(client.RtcpAddress));
+    client.LastReport = now;
+}
+
+void RtspServer::updateDemand()
+{
+    uint8_t playing = 0;
+    for (Client &client : _clients)
+    {
+        if (client.Playing)
+            playing++;
+    }
+    _playingCount = playing;
+    _source->SetExternalDemand(StreamBroadcaster::DemandRtsp, playing > 0);
+}
+
+void RtspServer::jpegListener(const uint8_t *jpeg, size_t length, void *arg)
+{
+    static_cast<RtspServer *>(arg)->PushFrame(jpeg, length);
+}
+
+uint32_t RtspServer::rtpClock(int64_t microseconds)
+{
+    return microseconds * (ClockRate / 10000) / 100;
+}
+
+bool RtspServer::PushFrame(const uint8_t *jpeg, size_t length)
+{
+    if (_playingCount == 0)
+        return true;
+
+    cpp_freertos::LockGuard guard(_lock);
+    if (!parseJpeg(jpeg, length, _frame))
+    {
+        printf("RTSP: frame can not be sent as RFC 2435\n");
+        return false;
+    }
+
+    // the budget is asked for the whole frame, with one lost packet the rest is wasted anyway
+    const size_t frameLength = wireLength(_frame);
+    bool admitted = false;
+    for (Client &client : _clients)
+    {
+        client.Admitted = client.Playing && client.Bandwidth.Admit(frameLength);
+        if (client.Playing && !client.Admitted)
+            _shapedFrames++;
+        admitted = admitted || client.Admitted;
+    }
+    if (!admitted)
+        return true;
+
+    const uint32_t timestamp = rtpClock(esp_timer_get_time());
+    uint8_t header[RtpHeaderSize + JpegHeaderSize + RestartHeaderSize + QuantizationHeaderSize + sizeof(_frame.Tables)];
+    size_t offset = 0;
+    while (offset < _frame.ScanLength)
+    {
+        // the RTP header in front is filled in per client
+        uint8_t *position = header + RtpHeaderSize;
+        position[0] = 0;
+        put24(position + 1, offset);
+        position[4] = _frame.Type | (_frame.RestartInterval ? 64 : 0);
+        position[5] = 255; // tables in-band, they follow the camera's quality setting
+        position[6] = _frame.Width;
+        position[7] = _frame.Height;
+        position += JpegHeaderSize;
+
+        if (_frame.RestartInterval)
+        {
+            // whole frames only, so one restart count covers every packet
+            put16(position, _frame.RestartInterval);
+            position[2] = 0xFF;
+            position[3] = 0xFF;
+            position += RestartHeaderSize;
+        }
+
+        if (offset == 0)
+        {
+            const uint16_t tablesLength = _frame.TableCount * 64;
+            position[0] = 0;
+            position[1] = 0;
+            put16(position + 2, tablesLength);
+            memcpy(position + QuantizationHeaderSize, _frame.Tables, tablesLength);
+            position += QuantizationHeaderSize + tablesLength;
+        }
+
+        size_t headerLength = position - header;
+        size_t chunk = _frame.ScanLength - offset;
+        if (chunk > MaxPacketSize - headerLength)
+            chunk = MaxPacketSize - headerLength;
+
+        sendPacket(header, headerLength, _frame.Scan + offset, chunk, timestamp, offset + chunk == _frame.ScanLength);
+        offset += chunk;
+    }
+    return true;
+}
+
+void RtspServer::sendPacket(uint8_t *rtp, size_t headerLength, const uint8_t *payload, size_t payloadLength,
+                            uint32_t timestamp, bool last)
+{
+    for (Client &client : _clients)
+    {
+        if (!client.Admitted)
+            continue;
+
+        rtp[0] = 0x80;
+        rtp[1] = (last ? 0x80 : 0) | PayloadType;
+        put16(rtp + 2, client.Sequence++);
+        put32(rtp + 4, timestamp + client.TimestampOffset);
+        put32(rtp + 8, client.Ssrc);
+
+        // the scan data is sent from the frame buffer, only the headers are built here
+        struct iovec vectors[2] = {{rtp, headerLength}, {(void *)payload, payloadLength}};
+        struct msghdr message = {};
+        message.msg_name = &client.RtpAddress;
+        message.msg_namelen = sizeof(client.RtpAddress);
+        message.msg_iov = vectors;
+        message.msg_iovlen = 2;
+
+        // a lost packet costs one frame, never wait for buffers here
+        if (sendmsg(_rtpSocket, &message, MSG_DONTWAIT) < 0)
+            continue;
+
+        client.PacketCount++;
+        client.OctetCount += headerLength - RtpHeaderSize + payloadLength;
+    }
+}
+
+size_t RtspServer::wireLength(const JpegFrame &frame)
+{
+    // the same cut as PushFrame(), only the first packet carries the tables
+    const size_t headerLength = RtpHeaderSize + JpegHeaderSize + (frame.RestartInterval ? RestartHeaderSize : 0);
+    const size_t tablesLength = QuantizationHeaderSize + frame.TableCount * 64;
+    size_t length = 0;
+    for (size_t offset = 0; offset < frame.ScanLength;)
+    {
+        size_t header = headerLength + (offset == 0 ? tablesLength : 0);
+        size_t chunk = frame.ScanLength - offset;
+        if (chunk > MaxPacketSize - header)
+            chunk = MaxPacketSize - header;
+        length += header + chunk;
+        offset += chunk;
+    }
+    return length;
+}
+
+bool RtspServer::parseJpeg(const uint8_t *jpeg, size_t length, JpegFrame &frame)
+{
+    if (length < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8)
+        return false;
+
+    frame.TableCount = 0;
+    frame.RestartInterval = 0;
+    bool haveFrame = false;
+    size_t position = 2;
+    while (position + 4 <= length)
+    {
+        if (jpeg[position] != 0xFF)
+            return false;
+
+        uint8_t marker = jpeg[position + 1];
+        if (marker == 0xFF)
+        {
+            position++; // fill byte
+            continue;
+        }
+
+        uint16_t segmentLength = get16(jpeg + position + 2);
+        size_t segmentEnd = position + 2 + segmentLength;
+        const uint8_t *segment = jpeg + position + 4;
+        if (segmentLength < 2 || segmentEnd > length)
+            return false;
+
+        switch (marker)
+        {
+        case 0xDB: // DQT, RFC 2435 knows 8 bit tables 0 and 1 only
+            for (const uint8_t *table = segment; table + 65 <= jpeg + segmentEnd; table += 65)
+            {
+                uint8_t id = table[0] & 0x0F;
+                if ((table[0] >> 4) != 0 || id > 1)
+                    return false;
+                memcpy(frame.Tables + id * 64, table + 1, 64);
+                if (id >= frame.TableCount)
+                    frame.TableCount = id + 1;
+            }
+            break;
+
+        case 0xC0: // baseline
+        {
+            if (segmentLength < 17 || segment[0] != 8 || segment[5] != 3)
+                return false;
+
+            uint16_t height = get16(segment + 1);
+            uint16_t width = get16(segment + 3);
+            if (width == 0 || height == 0 || width > 2040 || height > 2040 || (width & 7) || (height & 7))
+                return false;
+
+            // luma 2x1 is type 0 (4:2:2), 2x2 type 1 (4:2:0), chroma 1x1 on table 1
+            const uint8_t *components = segment + 6;
+            if (components[2] != 0 || components[4] != 0x11 || components[5] != 1 || components[7] != 0x11 || components[8] != 1)
+                return false;
+            if (components[1] == 0x21)
+                frame.Type = 0;
+            else if (components[1] == 0x22)
+                frame.Type = 1;
+            else
+                return false;
+
+            frame.Width = width / 8;
+            frame.Height = height / 8;
+            haveFrame = true;
+            break;
+        }
+
+        case 0xC1:
+        case 0xC2:
+        case 0xC3:
+        case 0xC9:
+        case 0xCA:
+        case 0xCB:
+            return false; // not baseline
+
+        case 0xDD: // DRI
+            if (segmentLength != 4)
+                return false;
+            frame.RestartInterval = get16(segment);
+            break;
+
+        case 0xDA: // SOS, the entropy coded data runs up to EOI
+        {
+            if (!haveFrame || frame.TableCount != 2)
+                return false;
+
+            // encoders may pad behind EOI
+            size_t end = length;
+            while (end >= segmentEnd + 2 && !(jpeg[end - 2] == 0xFF && jpeg[end - 1] == 0xD9))
+                end--;
+            if (end < segmentEnd + 2)
+                return false;
+
+            frame.Scan = jpeg + segmentEnd;
+            frame.ScanLength = end - 2 - segmentEnd;
+            return frame.ScanLength > 0;
+        }
+
+        default: // APPn, COM and the Huffman tables, RFC 2435 receivers use the standard ones
+            break;
+        }
+        position = segmentEnd;
+    }
+    return false;
+}
@@ -0,0 +1,171 @@
+/*
+ * RtspServer.h
+ *
+ *  RTSP control with RTP/JPEG (RFC 2435) over UDP, fed by the StreamBroadcaster.
+ */
+
+#ifndef RTSP_SERVER_H_
+#define RTSP_SERVER_H_
+
+#include <cstdint>
+#include <array>
+#include "freertos/FreeRTOS.h"
+#include "thread.hpp"
+#include "mutex.hpp"
+#include "lwip/sockets.h"
+#include "TokenBucket.h"
+#include "StreamBroadcaster.h"
+
+using std::array;
+
+/// @brief	Serves the camera to RTSP clients such as NVRs, one video track of JPEG frames.
+/// @note	Only unicast UDP transport is offered. Frames are packetized once and sent to every
+///			playing client, the JFIF headers are replaced by the RFC 2435 main header and the
+///			quantization tables travel in-band with every frame (Q = 255).
+class RtspServer
+{
+public:
+    static constexpr uint16_t DefaultPort = 554;
+    static constexpr uint8_t MaxClients = 4;
+
+    RtspServer() : _thread(*this)
+    {
+    }
+
+    /// @param source	Capture to take the frames from, kept running while a client plays.
+    bool Start(StreamBroadcaster &source, uint16_t port = DefaultPort);
+
+    /// @brief	Packetizes one JPEG and sends it to every playing client.
+    /// @return	False if the JPEG can not be carried by RFC 2435.
+    bool PushFrame(const uint8_t *jpeg, size_t length);
+
+    /// @brief	Budget of every client, on top of the device wide one of TokenBucket::Device().
+    ///			A frame over budget is not sent to that client at all, a partial frame is lost anyway.
+    /// @param bytesPerSecond	0 leaves only the device wide budget.
+    void SetBandwidth(uint32_t bytesPerSecond, uint32_t burst);
+
+    uint8_t GetPlayingCount() const { return _playingCount; }
+
+    /// @brief	Frames left out for all clients together to stay within the bandwidth budget.
+    uint32_t GetShapedFrames() const { return _shapedFrames; }
+
+    /// @brief	Hide Copy constructor.
+    RtspServer(const RtspServer &) = delete;
+
+    /// @brief	Hide Assignment operator.
+    RtspServer &operator=(const RtspServer &) = delete;
+
+    /// @brief	Hide Move constructor.
+    RtspServer(RtspServer &&) = delete;
+
+    /// @brief	Hide Move Assignment Operator.
+    RtspServer &operator=(RtspServer &&) = delete;
+
+private:
+    static constexpr uint16_t RtpPort = 6970; // RTCP on the next port
+    static constexpr uint8_t PayloadType = 26;
+    static constexpr uint32_t ClockRate = 90000;
+    static constexpr uint16_t MaxPacketSize = 1400;
+    static constexpr uint16_t RequestSize = 1024;
+    static constexpr uint16_t MaxResponseSize = 640;
+    // room for the replies to two pipelined requests, more wait in Request until these are out
+    static constexpr uint16_t ResponseSize = 2 * MaxResponseSize;
+    static constexpr uint32_t SessionTimeoutMs = 60000;
+    static constexpr uint32_t ReportPeriodMs = 5000;
+    static constexpr uint16_t StackDepth = 4096;
+
+    static constexpr uint8_t RtpHeaderSize = 12;
+    static constexpr uint8_t JpegHeaderSize = 8;
+    static constexpr uint8_t RestartHeaderSize = 4;
+    static constexpr uint8_t QuantizationHeaderSize = 4;
+
+    /// @brief	What RFC 2435 needs from a baseline JFIF image.
+    struct JpegFrame
+    {
+        uint8_t Type;
+        uint8_t Width;  // in 8 pixel units
+        uint8_t Height; // in 8 pixel units
+        uint16_t RestartInterval;
+        uint8_t Tables[128];
+        uint8_t TableCount;
+        const uint8_t *Scan;
+        size_t ScanLength;
+    };
+
+    struct Client
+    {
+        int Control = -1;
+        char Request[RequestSize];
+        size_t RequestLength = 0;
+        // replies are sent once the lock is released, a stalled client never holds up PushFrame()
+        char Response[ResponseSize];
+        size_t ResponseLength = 0;
+        bool Deferred = false;
+        // closed after the pending replies went out
+        bool Closing = false;
+        uint32_t Session = 0;
+        bool Playing = false;
+        // set per frame by PushFrame(), the packets of a frame over budget are not sent
+        bool Admitted = false;
+        Utilities::TokenBucket Bandwidth;
+        struct sockaddr_in RtpAddress;
+        struct sockaddr_in RtcpAddress;
+        uint32_t Ssrc = 0;
+        uint16_t Sequence = 0;
+        uint32_t TimestampOffset = 0;
+        uint32_t PacketCount = 0;
+        uint32_t OctetCount = 0;
+        int64_t LastActivity = 0;
+        int64_t LastReport = 0;
+    };
+
+    class ServerThread : public cpp_freertos::Thread
+    {
+    public:
+        ServerThread(RtspServer &owner) : cpp_freertos::Thread("RTSPSRV", StackDepth, 5), _owner(owner) {}
+
+    protected:
+        void Run() override { _owner.serverLoop(); }
+
+    private:
+        RtspServer &_owner;
+    };
+
+    void serverLoop();
+    bool openSockets();
+    void acceptClient();
+    void receive(Client &client);
+    void process(Client &client);
+    void sendResponses();
+    void receiveRtcp(int socket);
+    bool handleRequest(Client &client, char *request);
+    void rejectTooLarge(Client &client);
+    void reply(Client &client, uint16_t status, const char *cseq, const char *headers, const char *body = nullptr);
+    void closeClient(Client &client);
+    void checkClients(int64_t now);
+    void sendReport(Client &client, int64_t now);
+    void updateDemand();
+    void sendPacket(uint8_t *rtp, size_t headerLength, const uint8_t *payload, size_t payloadLength,
+                    uint32_t timestamp, bool last);
+
+    static bool parseJpeg(const uint8_t *jpeg, size_t length, JpegFrame &frame);
+    static size_t wireLength(const JpegFrame &frame);
+    static uint32_t rtpClock(int64_t microseconds);
+    static void jpegListener(const uint8_t *jpeg, size_t length, void *arg);
+
+    ServerThread _thread;
+    cpp_freertos::MutexStandard _lock;
+    StreamBroadcaster *_source = nullptr;
+    uint16_t _port = DefaultPort;
+    int _listenSocket = -1;
+    int _rtpSocket = -1;
+    int _rtcpSocket = -1;
+    array<Client, MaxClients> _clients;
+    volatile uint8_t _playingCount = 0;
+    volatile uint32_t _shapedFrames = 0;
+    uint32_t _bandwidthRate = 0;
+    uint32_t _bandwidthBurst = 0;
+    JpegFrame _frame;
+};
+
+#endif /* RTSP_SERVER_H_ */
@@ -0,0 +1,205 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "SnapshotCache.h"
+#include "esp_timer.h"
+#include "img_converters.h"
+
+bool SnapshotCache::Acquire(Snapshot &snapshot)
+{
+    uint32_t seen;
+    {
+        cpp_freertos::LockGuard guard(_lock);
+        _stats.requests++;
+        if (_latest != nullptr && esp_timer_get_time() - _latest->Timestamp < (int64_t)_freshnessMs * 1000)
+        {
+            share(snapshot, Source::Cached);
+            return true;
+        }
+        seen = _sequence;
+    }
+
+    cpp_freertos::LockGuard capturing(_captureLock);
+    {
+        // a capture finished while this request was queued behind it, so the frame
+        // is not older than the request by more than one capture
+        cpp_freertos::LockGuard guard(_lock);
+        if (_latest != nullptr && _sequence != seen)
+        {
+            share(snapshot, Source::Coalesced);
+            return true;
+        }
+    }
+    return capture(snapshot);
+}
+
+void SnapshotCache::SetFrameSource(snapshot_source_t source, void *arg)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    _source = source;
+    _sourceArg = arg;
+}
+
+void SnapshotCache::Release(Snapshot &snapshot)
+{
+    if (snapshot.Data == nullptr)
+        return;
+
+    cpp_freertos::LockGuard guard(_lock);
+    for (Slot &slot : _slots)
+    {
+        if (slot.References != 0 && slot.Data == snapshot.Data)
+        {
+            Slot *held = &slot;
+            releaseSlot(held);
+            snapshot = {};
+            return;
+        }
+    }
+
+    // taken while every slot was busy, nobody else knows about it
+    free((void *)snapshot.Data);
+    snapshot = {};
+}
+
+void SnapshotCache::Invalidate()
+{
+    cpp_freertos::LockGuard guard(_lock);
+    releaseSlot(_latest);
+}
+
+void SnapshotCache::GetStats(snapshot_cache_stats_t &stats)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    stats = _stats;
+    stats.capture_ms = _stats.captures ? (uint32_t)(_captureMsTotal / _stats.captures) : 0;
+}
+
+bool SnapshotCache::capture(Snapshot &snapshot)
+{
+    int64_t start = esp_timer_get_time();
+    uint8_t *data = NULL;
+    size_t length = 0;
+    int64_t taken = 0;
+    bool encoded = false;
+    bool captured = take(data, length, taken, encoded);
+    uint32_t cost = (uint32_t)((esp_timer_get_time() - start) / 1000);
+
+    cpp_freertos::LockGuard guard(_lock);
+    if (!captured)
+    {
+        _stats.failures++;
+        return false;
+    }
+
+    _stats.captures++;
+    _captureMsTotal += cost;
+    if (encoded)
+        _stats.encodes++;
+
+    Slot *slot = nullptr;
+    for (Slot &candidate : _slots)
+    {
+        if (candidate.References == 0)
+        {
+            slot = &candidate;
+            break;
+        }
+    }
+
+    snapshot.Data = data;
+    snapshot.Length = length;
+    snapshot.Timestamp = taken;
+    snapshot.From = Source::Captured;
+    if (slot == nullptr)
+    {
+        // every slot is still being sent, this frame goes to its own request only
+        return true;
+    }
+
+    slot->Data = data;
+    slot->Length = length;
+    slot->Timestamp = taken;
+    slot->CostMs = cost;
+    slot->Encoded = encoded;
+    // one reference for the cache, one for this request
+    slot->References = 2;
+    releaseSlot(_latest);
+    _latest = slot;
+    _sequence++;
+    return true;
+}
+
+bool SnapshotCache::take(uint8_t *&data, size_t &length, int64_t &taken, bool &encoded)
+{
+    snapshot_source_t source;
+    void *sourceArg;
+    {
+        cpp_freertos::LockGuard guard(_lock);
+        source = _source;
+        sourceArg = _sourceArg;
+    }
+
+    // a running stream owns the camera, its frames are newer than anything a capture here would wait for
+    if (source && source(data, length, taken, sourceArg))
+        return data != NULL;
+
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (!fb)
+        return false;
+
+    taken = esp_timer_get_time();
+    encoded = fb->format != PIXFORMAT_JPEG;
+    if (!encoded)
+    {
+        data = (uint8_t *)malloc(fb->len);
+        if (data)
+        {
+            memcpy(data, fb->buf, fb->len);
+            length = fb->len;
+        }
+    }
+    else if (!frame2jpg(fb, JpegQuality, &data, &length))
+    {
+        data = NULL;
+    }
+    esp_camera_fb_return(fb);
+
+    if (!data)
+    {
+        printf("Snapshot JPEG compression failed\n");
+        return false;
+    }
+    return true;
+}
+
+void SnapshotCache::share(Snapshot &snapshot, Source from)
+{
+    _latest->References++;
+    snapshot.Data = _latest->Data;
+    snapshot.Length = _latest->Length;
+    snapshot.Timestamp = _latest->Timestamp;
+    snapshot.From = from;
+
+    if (from == Source::Cached)
+        _stats.hits++;
+    else
+        _stats.coalesced++;
+    _stats.saved_ms += _latest->CostMs;
+    if (_latest->Encoded)
+        _stats.encodes_saved++;
+}
+
+void SnapshotCache::releaseSlot(Slot *&slot)
+{
+    if (slot == nullptr)
+        return;
+
+    if (--slot->References == 0)
+    {
+        free(slot->Data);
+        slot->Data = nullptr;
+        slot->Length = 0;
+    }
+    slot = nullptr;
+}
@@ -0,0 +1,127 @@
+/*
+ * SnapshotCache.h
+ *
+ *  Most recent /capture JPEG, shared by all requests within a freshness window.
+ */
+
+#ifndef SNAPSHOT_CACHE_H_
+#define SNAPSHOT_CACHE_H_
+
+#include <cstdint>
+#include <array>
+#include "freertos/FreeRTOS.h"
+#include "mutex.hpp"
+#include "esp_camera.h"
+
+using std::array;
+
+typedef struct
+{
+    uint32_t requests;
+    uint32_t hits;          //served a snapshot that was still fresh
+    uint32_t coalesced;     //waited for a capture another request had started
+    uint32_t captures;
+    uint32_t failures;
+    uint32_t encodes;       //captures that had to be converted to JPEG
+    uint32_t encodes_saved; //requests served without the conversion they would have needed
+    uint32_t saved_ms;      //capture and conversion time requests did not have to spend
+    uint32_t capture_ms;    //average capture and conversion time
+} snapshot_cache_stats_t;
+
+/// @brief	Hands out a frame another task already captured.
+/// @param data	Allocated with malloc, set to NULL if no frame could be had.
+/// @return	False if that task is not running, the cache reads the camera itself then.
+typedef bool (*snapshot_source_t)(uint8_t *&data, size_t &length, int64_t &timestamp, void *arg);
+
+/// @brief	Hands out the most recent JPEG while it is younger than the freshness window and
+///			captures a new one otherwise.
+/// @note	Misses arriving while a capture is running wait for it instead of starting their own,
+///			so any number of pollers costs at most one capture per window. Snapshots are reference
+///			counted, a slow client keeps its own while newer ones are taken.
+class SnapshotCache
+{
+public:
+    static constexpr uint32_t DefaultFreshnessMs = 200;
+
+    enum class Source : uint8_t
+    {
+        Captured,
+        Cached,
+        Coalesced
+    };
+
+    struct Snapshot
+    {
+        const uint8_t *Data = nullptr;
+        size_t Length = 0;
+        int64_t Timestamp = 0; // esp_timer_get_time() when the frame was taken
+        Source From = Source::Captured;
+    };
+
+    SnapshotCache() = default;
+
+    /// @param milliseconds	0 takes a new frame for every request that did not wait on another one.
+    void SetFreshness(uint32_t milliseconds) { _freshnessMs = milliseconds; }
+
+    uint32_t GetFreshness() const { return _freshnessMs; }
+
+    /// @brief	Asked before every capture, so the camera is not read behind a running stream's back.
+    void SetFrameSource(snapshot_source_t source, void *arg);
+
+    /// @brief	A snapshot returned has to be given back with Release() once it was sent.
+    /// @return	False if no frame could be captured.
+    bool Acquire(Snapshot &snapshot);
+
+    void Release(Snapshot &snapshot);
+
+    /// @brief	Drops the current snapshot, for example after the sensor settings changed.
+    void Invalidate();
+
+    void GetStats(snapshot_cache_stats_t &stats);
+
+    /// @brief	Hide Copy constructor.
+    SnapshotCache(const SnapshotCache &) = delete;
+
+    /// @brief	Hide Assignment operator.
+    SnapshotCache &operator=(const SnapshotCache &) = delete;
+
+    /// @brief	Hide Move constructor.
+    SnapshotCache(SnapshotCache &&) = delete;
+
+    /// @brief	Hide Move Assignment Operator.
+    SnapshotCache &operator=(SnapshotCache &&) = delete;
+
+private:
+    // the current snapshot and one per request still sending an older one
+    static constexpr uint8_t SlotCount = 4;
+    static constexpr uint8_t JpegQuality = 80;
+
+    struct Slot
+    {
+        uint8_t *Data = nullptr;
+        size_t Length = 0;
+        int64_t Timestamp = 0;
+        uint32_t CostMs = 0; // what taking this snapshot again would cost
+        bool Encoded = false;
+        uint8_t References = 0;
+    };
+
+    bool capture(Snapshot &snapshot);
+    bool take(uint8_t *&data, size_t &length, int64_t &taken, bool &encoded);
+    void share(Snapshot &snapshot, Source from);
+    void releaseSlot(Slot *&slot);
+
+    cpp_freertos::MutexStandard _lock;
+    // held by the one request capturing, the others queue on it
+    cpp_freertos::MutexStandard _captureLock;
+    array<Slot, SlotCount> _slots;
+    Slot *_latest = nullptr;
+    snapshot_source_t _source = nullptr;
+    void *_sourceArg = nullptr;
+    uint32_t _sequence = 0;
+    volatile uint32_t _freshnessMs = DefaultFreshnessMs;
+    snapshot_cache_stats_t _stats = {};
+    uint64_t _captureMsTotal = 0;
+};
+
+#endif /* SNAPSHOT_CACHE_H_ */
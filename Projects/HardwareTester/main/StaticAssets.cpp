@@ -0,0 +1,216 @@
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include "StaticAssets.h"
+#include "Hardware.h"
+
+using Hal::Hardware;
+
+esp_err_t StaticAssets::Serve(httpd_req_t *req, const char *path)
+{
+    char name[MaxPathLength];
+    char file[MaxPathLength];
+    int nameLength = (int)strcspn(path, "?#");
+    if (path[0] != '/' || nameLength >= (int)sizeof(name) || strstr(path, "..") != nullptr ||
+        snprintf(file, sizeof(file), "%s%.*s.gz", BasePath, nameLength, path) >= (int)sizeof(file))
+        return ESP_ERR_NOT_FOUND;
+    memcpy(name, path, nameLength);
+    name[nameLength] = 0;
+
+    Hal::Spiffs &spiffs = Hardware::Instance()->GetSpiffs();
+    struct stat st;
+    if ((!spiffs.IsMounted() && !spiffs.Mount()) || stat(file, &st) != 0 || !S_ISREG(st.st_mode))
+        return ESP_ERR_NOT_FOUND;
+
+    uint8_t chunk[ChunkSize];
+    size_t length;
+    FILE *f = NULL;
+    uint64_t digest;
+    if (!lookup(file, st.st_size, st.st_mtime, digest))
+    {
+        f = fopen(file, "r");
+        if (f == NULL)
+            return ESP_ERR_NOT_FOUND;
+
+        digest = HashSeed;
+        while ((length = fread(chunk, 1, sizeof(chunk), f)) > 0)
+            digest = hash(chunk, length, digest);
+        rewind(f);
+        remember(file, st.st_size, st.st_mtime, digest);
+    }
+
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)digest);
+    if (notModified(req, etag))
+    {
+        if (f != NULL)
+            fclose(f);
+        return ESP_OK;
+    }
+
+    if (f == NULL && (f = fopen(file, "r")) == NULL)
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    setHeaders(req, name, etag);
+    size_t sent = 0;
+    while ((length = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    {
+        if (httpd_resp_send_chunk(req, (const char *)chunk, length) != ESP_OK)
+        {
+            fclose(f);
+            return ESP_FAIL;
+        }
+        sent += length;
+    }
+    fclose(f);
+
+    cpp_freertos::LockGuard guard(_lock);
+    _stats.served++;
+    _stats.bytes += sent;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+esp_err_t StaticAssets::ServeEmbedded(httpd_req_t *req, const char *path, const uint8_t *data, size_t length)
+{
+    // keyed by the request path, which never collides with a file under BasePath
+    uint64_t digest;
+    if (!lookup(path, length, 0, digest))
+    {
+        digest = hash(data, length);
+        remember(path, length, 0, digest);
+    }
+
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)digest);
+    if (notModified(req, etag))
+        return ESP_OK;
+
+    setHeaders(req, path, etag);
+    {
+        cpp_freertos::LockGuard guard(_lock);
+        _stats.served++;
+        _stats.bytes += length;
+    }
+    return httpd_resp_send(req, (const char *)data, length);
+}
+
+void StaticAssets::GetStats(static_asset_stats_t &stats)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    stats = _stats;
+}
+
+bool StaticAssets::lookup(const char *file, long size, time_t modified, uint64_t &hash)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    for (Entry &entry : _entries)
+    {
+        if (entry.Size == size && entry.Modified == modified && strcmp(entry.Path, file) == 0)
+        {
+            entry.LastUsed = ++_uses;
+            hash = entry.Hash;
+            return true;
+        }
+    }
+    return false;
+}
+
+void StaticAssets::remember(const char *file, long size, time_t modified, uint64_t hash)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    _stats.hashed++;
+
+    // the same file with a stale hash, else the one used longest ago
+    Entry *slot = &_entries[0];
+    for (Entry &entry : _entries)
+    {
+        if (strcmp(entry.Path, file) == 0)
+        {
+            slot = &entry;
+            break;
+        }
+        if (entry.LastUsed < slot->LastUsed)
+            slot = &entry;
+    }
+
+    strncpy(slot->Path, file, sizeof(slot->Path) - 1);
+    slot->Size = size;
+    slot->Modified = modified;
+    slot->Hash = hash;
+    slot->LastUsed = ++_uses;
+}
+
+bool StaticAssets::notModified(httpd_req_t *req, const char *etag)
+{
+    // a list too long for the buffer is answered in full, which is always correct
+    char header[128];
+    size_t length = httpd_req_get_hdr_value_len(req, "If-None-Match");
+    if (length == 0 || length >= sizeof(header) ||
+        httpd_req_get_hdr_value_str(req, "If-None-Match", header, sizeof(header)) != ESP_OK)
+        return false;
+
+    // If-None-Match uses the weak comparison, W/"x" matches "x"
+    if (strcmp(header, "*") != 0 && strstr(header, etag) == nullptr)
+        return false;
+
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", CacheControl);
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    httpd_resp_send(req, NULL, 0);
+
+    cpp_freertos::LockGuard guard(_lock);
+    _stats.not_modified++;
+    return true;
+}
+
+void StaticAssets::setHeaders(httpd_req_t *req, const char *path, const char *etag)
+{
+    httpd_resp_set_type(req, contentType(path));
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", CacheControl);
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+}
+
+uint64_t StaticAssets::hash(const uint8_t *data, size_t length, uint64_t hash)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+const char *StaticAssets::contentType(const char *path)
+{
+    static const struct
+    {
+        const char *extension;
+        const char *type;
+    } types[] = {
+        {".html", "text/html"},
+        {".js", "application/javascript"},
+        {".css", "text/css"},
+        {".json", "application/json"},
+        {".svg", "image/svg+xml"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".ico", "image/x-icon"},
+    };
+
+    const char *extension = strrchr(path, '.');
+    if (extension == nullptr || strchr(extension, '/') != nullptr)
+        return "text/html";
+
+    for (const auto &entry : types)
+    {
+        if (strcmp(extension, entry.extension) == 0)
+            return entry.type;
+    }
+    return "application/octet-stream";
+}
@@ -0,0 +1,91 @@
+/*
+ * StaticAssets.h
+ *
+ *  Precompressed web assets served from the SPIFFS partition.
+ */
+
+#ifndef STATIC_ASSETS_H_
+#define STATIC_ASSETS_H_
+
+#include <cstdint>
+#include <array>
+#include <ctime>
+#include "freertos/FreeRTOS.h"
+#include "mutex.hpp"
+#include "esp_http_server.h"
+
+using std::array;
+
+typedef struct
+{
+    uint32_t served;       //complete responses
+    uint32_t not_modified; //answered with 304, the client's copy was still current
+    uint32_t hashed;       //files read to compute their ETag
+    uint32_t bytes;        //gzip bytes sent
+} static_asset_stats_t;
+
+/// @brief	Serves the asset at path from BasePath with ".gz" appended, gzip encoded as stored.
+/// @note	The ETag is a hash of the stored bytes, computed once per file and kept while the
+///			file's size and modification time stay the same. A request whose If-None-Match lists
+///			it gets a 304 without the file being opened. Files are sent in ChunkSize pieces, they
+///			are never held in memory as a whole.
+class StaticAssets
+{
+public:
+    static constexpr const char *BasePath = "/spiffs";
+    static constexpr size_t ChunkSize = 1024;
+
+    StaticAssets() = default;
+
+    /// @param path	Request path, for example "/index.html". A query string is ignored.
+    /// @return	ESP_ERR_NOT_FOUND without having sent anything if there is no such asset.
+    esp_err_t Serve(httpd_req_t *req, const char *path);
+
+    /// @brief	Same as Serve() for gzip data compiled into the application.
+    esp_err_t ServeEmbedded(httpd_req_t *req, const char *path, const uint8_t *data, size_t length);
+
+    void GetStats(static_asset_stats_t &stats);
+
+    /// @brief	Hide Copy constructor.
+    StaticAssets(const StaticAssets &) = delete;
+
+    /// @brief	Hide Assignment operator.
+    StaticAssets &operator=(const StaticAssets &) = delete;
+
+    /// @brief	Hide Move constructor.
+    StaticAssets(StaticAssets &&) = delete;
+
+    /// @brief	Hide Move Assignment Operator.
+    StaticAssets &operator=(StaticAssets &&) = delete;
+
+private:
+    static constexpr uint8_t MaxEntries = 8;
+    static constexpr uint16_t MaxPathLength = 48;
+    static constexpr const char *CacheControl = "public, no-cache";
+
+    struct Entry
+    {
+        char Path[MaxPathLength] = {};
+        long Size = 0;
+        time_t Modified = 0;
+        uint64_t Hash = 0;
+        uint32_t LastUsed = 0;
+    };
+
+    bool lookup(const char *file, long size, time_t modified, uint64_t &hash);
+    void remember(const char *file, long size, time_t modified, uint64_t hash);
+    bool notModified(httpd_req_t *req, const char *etag);
+    void setHeaders(httpd_req_t *req, const char *path, const char *etag);
+
+    static uint64_t hash(const uint8_t *data, size_t length, uint64_t hash = HashSeed);
+    static const char *contentType(const char *path);
+
+    static constexpr uint64_t HashSeed = 0xcbf29ce484222325ULL; // FNV-1a
+
+    cpp_freertos::MutexStandard _lock;
+    array<Entry, MaxEntries> _entries;
+    uint32_t _uses = 0;
+    static_asset_stats_t _stats = {};
+};
+
+#endif /* STATIC_ASSETS_H_ */
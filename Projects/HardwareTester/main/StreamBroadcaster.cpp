@@ -0,0 +1,699 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "StreamBroadcaster.h"
+#include "CameraStreamTest.h"
+#include "esp_jpg_decode.h"
+#include "esp_heap_caps.h"
+#include "lwip/sockets.h"
+
+static const char *RENDITION_NAMES[] = {"full", "reduced", "half"};
+
+bool StreamBroadcaster::Start(httpd_handle_t server)
+{
+    _server = server;
+    for (Viewer &viewer : _viewers)
+        viewer.Owner = this;
+
+    return _sendThread.Start() && _encodeThread.Start() && _captureThread.Start();
+}
+
+void StreamBroadcaster::SetFrameHook(stream_frame_hook_t hook, void *arg)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    _hook = hook;
+    _hookArg = arg;
+}
+
+void StreamBroadcaster::SetJpegListener(stream_jpeg_listener_t listener, void *arg)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    _listener = listener;
+    _listenerArg = arg;
+}
+
+void StreamBroadcaster::SetBandwidth(uint32_t bytesPerSecond, uint32_t burst)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    _bandwidthRate = bytesPerSecond;
+    _bandwidthBurst = burst;
+    for (Viewer &viewer : _viewers)
+        viewer.Bandwidth.Configure(bytesPerSecond, burst);
+}
+
+void StreamBroadcaster::SetSkipPolicy(int32_t threshold, uint32_t keepaliveMs)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    _skipThreshold = threshold;
+    _skipKeepaliveMs = keepaliveMs;
+}
+
+void StreamBroadcaster::SetExternalDemand(uint8_t consumer, bool demand)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    if (demand)
+        _externalDemand |= consumer;
+    else
+        _externalDemand &= ~consumer;
+}
+
+bool StreamBroadcaster::CopyLatest(uint8_t *&data, size_t &length, int64_t &timestamp, uint32_t waitMs)
+{
+    for (uint32_t waited = 0;; waited += 10)
+    {
+        {
+            cpp_freertos::LockGuard guard(_lock);
+            const RenditionState &state = _renditions[Full];
+            if (state.Latest != nullptr)
+            {
+                data = (uint8_t *)malloc(state.Latest->Length);
+                if (data == nullptr)
+                    return false;
+                memcpy(data, state.Latest->Data, state.Latest->Length);
+                length = state.Latest->Length;
+                timestamp = state.LastPublished;
+                return true;
+            }
+        }
+
+        if (waited >= waitMs)
+            return false;
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+}
+
+bool StreamBroadcaster::AddViewer(httpd_req_t *req)
+{
+    Viewer *viewer = nullptr;
+    {
+        cpp_freertos::LockGuard guard(_lock);
+        for (Viewer &candidate : _viewers)
+        {
+            if (candidate.Socket < 0)
+            {
+                viewer = &candidate;
+                break;
+            }
+        }
+        if (viewer == nullptr)
+            return false;
+
+        // claimed here, the sender task skips it until the headers are out
+        viewer->Socket = httpd_req_to_sockfd(req);
+        viewer->Closing = true;
+    }
+
+    // the frames are written to the socket directly, so the response can not be chunked
+    char header[256];
+    int length = snprintf(header, sizeof(header),
+                          "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: %s\r\n"
+                          "Access-Control-Allow-Origin: *\r\n"
+                          "Cache-Control: no-cache\r\n"
+                          "Connection: close\r\n\r\n",
+                          WEB_STREAM_CONTENT_TYPE);
+    if (httpd_send(req, header, length) != length)
+    {
+        cpp_freertos::LockGuard guard(_lock);
+        viewer->Socket = -1;
+        return false;
+    }
+
+    // the server calls sessionClosed() for this session when the connection goes away
+    req->sess_ctx = viewer;
+    req->free_ctx = sessionClosed;
+
+    cpp_freertos::LockGuard guard(_lock);
+    viewer->Closing = false;
+    viewer->Frame = nullptr;
+    viewer->Offset = 0;
+    viewer->LastSequence = 0;
+    viewer->LastFingerprint.Invalidate();
+    viewer->LastAttached = 0;
+    viewer->Stats = {};
+    viewer->Stats.socket = viewer->Socket;
+    viewer->Bandwidth.Configure(_bandwidthRate, _bandwidthBurst);
+    viewer->PeriodFrames = 0;
+    viewer->PeriodSends = 0;
+    viewer->PeriodBytes = 0;
+    viewer->PeriodStart = esp_timer_get_time();
+    // everybody starts on the camera's own JPEG and is moved down only if the link demands it
+    viewer->Rendition = Full;
+    viewer->DeliveryMs = 0;
+    viewer->LinkKbps = 0;
+    viewer->WindowFrames = 0;
+    viewer->WindowDropped = 0;
+    viewer->WindowBlocked = 0;
+    viewer->WindowBytes = 0;
+    viewer->WindowStart = viewer->PeriodStart;
+    _renditions[Full].Viewers++;
+    _viewerCount++;
+    _frameReady.Give();
+    printf("Stream viewer %d joined, %u watching\n", viewer->Socket, _viewerCount);
+    return true;
+}
+
+void StreamBroadcaster::sessionClosed(void *context)
+{
+    Viewer &viewer = *static_cast<Viewer *>(context);
+    StreamBroadcaster &owner = *viewer.Owner;
+
+    cpp_freertos::LockGuard guard(owner._lock);
+    owner.releaseFrame(viewer.Frame);
+    owner.leaveRendition(viewer.Rendition);
+    printf("Stream viewer %d left after %u frames, %u dropped, %u rendition switches\n", viewer.Socket,
+           viewer.Stats.frames_sent, viewer.Stats.frames_dropped, viewer.Stats.switches);
+    viewer.Socket = -1;
+    viewer.Closing = false;
+    owner._viewerCount--;
+}
+
+uint8_t StreamBroadcaster::GetViewerStats(stream_viewer_stats_t *stats, uint8_t count)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    uint8_t written = 0;
+    for (Viewer &viewer : _viewers)
+    {
+        if (viewer.Socket < 0 || written >= count)
+            continue;
+        stats[written++] = viewer.Stats;
+    }
+    return written;
+}
+
+void StreamBroadcaster::captureLoop()
+{
+    for (;;)
+    {
+        if (_viewerCount == 0 && !_externalDemand)
+        {
+            // nobody watching, do not keep an old frame around for the next viewer
+            {
+                cpp_freertos::LockGuard guard(_lock);
+                for (RenditionState &rendition : _renditions)
+                    releaseFrame(rendition.Latest);
+            }
+            vTaskDelay(100 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (!fb)
+        {
+            printf("Camera capture failed\n");
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        if (_hook && !_hook(fb, _hookArg))
+        {
+            esp_camera_fb_return(fb);
+            continue;
+        }
+
+        // taken before any conversion, the viewers decide on their own if the frame is worth sending
+        Hal::FrameFingerprint fingerprint;
+        if (_skipThreshold >= 0)
+            fingerprint.Compute(fb);
+
+        // the frame buffer goes back to the driver right away, viewers may hold
+        // on to a frame far longer than the driver can wait for it
+        uint8_t *jpg_buf = NULL;
+        size_t jpg_len = 0;
+        if (fb->format == PIXFORMAT_JPEG)
+        {
+            jpg_buf = (uint8_t *)malloc(fb->len);
+            if (jpg_buf)
+            {
+                memcpy(jpg_buf, fb->buf, fb->len);
+                jpg_len = fb->len;
+            }
+        }
+        else if (!frame2jpg(fb, JpegQuality, &jpg_buf, &jpg_len))
+        {
+            jpg_buf = NULL;
+        }
+        esp_camera_fb_return(fb);
+
+        if (!jpg_buf)
+        {
+            printf("JPEG compression failed\n");
+            continue;
+        }
+
+        if (_listener)
+            _listener(jpg_buf, jpg_len, _listenerArg);
+
+        if (!publish(Full, jpg_buf, jpg_len, fingerprint))
+        {
+            free(jpg_buf);
+            continue;
+        }
+        _frameReady.Give();
+        if (_renditions[Reduced].Viewers || _renditions[Downscaled].Viewers)
+            _encodeReady.Give();
+    }
+}
+
+void StreamBroadcaster::encodeLoop()
+{
+    for (;;)
+    {
+        if (!_encodeReady.Take(100 / portTICK_PERIOD_MS))
+            continue;
+
+        FrameSlot *source;
+        Hal::FrameFingerprint fingerprint;
+        bool reduced, downscaled;
+        {
+            cpp_freertos::LockGuard guard(_lock);
+            source = _renditions[Full].Latest;
+            reduced = _renditions[Reduced].Viewers != 0;
+            downscaled = _renditions[Downscaled].Viewers != 0;
+            if (source == nullptr || (!reduced && !downscaled))
+                continue;
+            source->References++;
+            fingerprint = source->Fingerprint;
+        }
+
+        // one decode serves both, the half size image is averaged down from the full one
+        uint16_t width, height;
+        if (decode(*source, reduced, width, height))
+        {
+            if (reduced)
+                encode(Reduced, width, height, ReducedQuality, fingerprint);
+
+            if (downscaled && reduced)
+            {
+                uint16_t halfWidth = width / 2;
+                uint16_t halfHeight = height / 2;
+                const size_t stride = width * 3;
+                // in place, no output pixel is written before the input pixels it still needs were read
+                for (uint16_t y = 0; y < halfHeight; y++)
+                {
+                    const uint8_t *top = _rgb + 2 * y * stride;
+                    uint8_t *out = _rgb + y * halfWidth * 3;
+                    for (uint16_t x = 0; x < halfWidth * 3; x += 3)
+                    {
+                        const uint8_t *pixel = top + 2 * x;
+                        for (uint8_t c = 0; c < 3; c++)
+                            out[x + c] = (pixel[c] + pixel[c + 3] + pixel[stride + c] + pixel[stride + c + 3] + 2) / 4;
+                    }
+                }
+                width = halfWidth;
+                height = halfHeight;
+            }
+
+            if (downscaled)
+                encode(Downscaled, width, height, DownscaledQuality, fingerprint);
+        }
+
+        cpp_freertos::LockGuard guard(_lock);
+        releaseFrame(source);
+    }
+}
+
+bool StreamBroadcaster::decode(const FrameSlot &source, bool fullSize, uint16_t &width, uint16_t &height)
+{
+    _decodeSource = source.Data;
+    _decodeWidth = 0;
+    _decodeHeight = 0;
+    if (esp_jpg_decode(source.Length, fullSize ? JPG_SCALE_NONE : JPG_SCALE_2X, jpegRead, rgbWrite, this) != ESP_OK)
+    {
+        printf("Rendition decode failed\n");
+        return false;
+    }
+    width = _decodeWidth;
+    height = _decodeHeight;
+    return true;
+}
+
+void StreamBroadcaster::encode(Rendition rendition, uint16_t width, uint16_t height, uint8_t quality, const Hal::FrameFingerprint &fingerprint)
+{
+    uint8_t *jpg_buf = NULL;
+    size_t jpg_len = 0;
+    if (!fmt2jpg(_rgb, width * height * 3, width, height, PIXFORMAT_RGB888, quality, &jpg_buf, &jpg_len))
+    {
+        printf("Rendition %s compression failed\n", RENDITION_NAMES[rendition]);
+        return;
+    }
+
+    if (publish(rendition, jpg_buf, jpg_len, fingerprint))
+        _frameReady.Give();
+    else
+        free(jpg_buf);
+}
+
+size_t StreamBroadcaster::jpegRead(void *arg, size_t index, uint8_t *buffer, size_t length)
+{
+    StreamBroadcaster &owner = *static_cast<StreamBroadcaster *>(arg);
+    if (buffer)
+        memcpy(buffer, owner._decodeSource + index, length);
+    return length;
+}
+
+bool StreamBroadcaster::rgbWrite(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    StreamBroadcaster &owner = *static_cast<StreamBroadcaster *>(arg);
+    if (!data)
+    {
+        if (x != 0 || y != 0)
+            return true;
+
+        // start of the image, w and h are its size
+        size_t size = (size_t)w * h * 3;
+        if (size > owner._rgbSize)
+        {
+            heap_caps_free(owner._rgb);
+            owner._rgb = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            owner._rgbSize = owner._rgb ? size : 0;
+            if (!owner._rgb)
+                return false;
+        }
+        owner._decodeWidth = w;
+        owner._decodeHeight = h;
+        return true;
+    }
+
+    // the decoder hands out BGR blocks
+    const size_t stride = owner._decodeWidth * 3;
+    for (uint16_t row = 0; row < h; row++)
+    {
+        uint8_t *out = owner._rgb + (y + row) * stride + x * 3;
+        for (uint16_t column = 0; column < w * 3; column += 3)
+        {
+            out[column] = data[column + 2];
+            out[column + 1] = data[column + 1];
+            out[column + 2] = data[column];
+        }
+        data += w * 3;
+    }
+    return true;
+}
+
+bool StreamBroadcaster::publish(Rendition rendition, uint8_t *data, size_t length, const Hal::FrameFingerprint &fingerprint)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    RenditionState &state = _renditions[rendition];
+    // nobody left to watch it while it was encoded
+    if (rendition != Full && state.Viewers == 0)
+        return false;
+
+    for (FrameSlot &slot : _slots)
+    {
+        if (slot.References != 0)
+            continue;
+
+        slot.Data = data;
+        slot.Length = length;
+        slot.Sequence = ++state.Sequence;
+        slot.References = 1;
+        slot.Fingerprint = fingerprint;
+
+        // viewers still sending the previous frame keep their own reference
+        releaseFrame(state.Latest);
+        state.Latest = &slot;
+
+        int64_t now = esp_timer_get_time();
+        uint32_t interval = state.LastPublished ? (uint32_t)((now - state.LastPublished) / 1000) : 0;
+        state.IntervalMs = state.IntervalMs ? (state.IntervalMs * 3 + interval) / 4 : interval;
+        state.Length = state.Length ? (state.Length * 3 + length) / 4 : length;
+        state.LastPublished = now;
+        return true;
+    }
+    return false;
+}
+
+void StreamBroadcaster::releaseFrame(FrameSlot *&frame)
+{
+    if (frame == nullptr)
+        return;
+
+    if (--frame->References == 0)
+    {
+        free(frame->Data);
+        frame->Data = nullptr;
+        frame->Length = 0;
+    }
+    frame = nullptr;
+}
+
+bool StreamBroadcaster::attachLatest(Viewer &viewer)
+{
+    FrameSlot *latest = _renditions[viewer.Rendition].Latest;
+    if (latest == nullptr || latest->Sequence == viewer.LastSequence)
+        return false;
+
+    if (viewer.LastSequence != 0)
+    {
+        viewer.Stats.frames_dropped += latest->Sequence - viewer.LastSequence - 1;
+        viewer.WindowDropped += latest->Sequence - viewer.LastSequence - 1;
+    }
+
+    viewer.LastSequence = latest->Sequence;
+
+    // nothing new to see, but a frame now and then keeps the viewer from timing out
+    int64_t now = esp_timer_get_time();
+    if (_skipThreshold >= 0 && latest->Fingerprint.Difference(viewer.LastFingerprint) <= (uint32_t)_skipThreshold &&
+        (now - viewer.LastAttached) / 1000 < _skipKeepaliveMs)
+    {
+        viewer.Stats.frames_skipped++;
+        return false;
+    }
+
+    // the budget is asked for the whole part, a viewer never gets half a frame
+    size_t partHeaderLength = snprintf(viewer.PartHeader, sizeof(viewer.PartHeader), WEB_STREAM_PART, latest->Length);
+    if (!viewer.Bandwidth.Admit(partHeaderLength + latest->Length + strlen(WEB_STREAM_BOUNDARY)))
+    {
+        viewer.Stats.frames_dropped++;
+        viewer.Stats.frames_shaped++;
+        return false;
+    }
+    viewer.LastFingerprint = latest->Fingerprint;
+    viewer.LastAttached = now;
+
+    viewer.Frame = latest;
+    viewer.Frame->References++;
+    viewer.Offset = 0;
+    viewer.FrameStart = now;
+    viewer.FrameBlocked = false;
+    viewer.PartHeaderLength = partHeaderLength;
+    return true;
+}
+
+bool StreamBroadcaster::sendPending(Viewer &viewer)
+{
+    // part header, JPEG and boundary go out as one write, the JPEG is not copied
+    const uint8_t *pieces[3] = {(const uint8_t *)viewer.PartHeader, viewer.Frame->Data, (const uint8_t *)WEB_STREAM_BOUNDARY};
+    const size_t lengths[3] = {viewer.PartHeaderLength, viewer.Frame->Length, strlen(WEB_STREAM_BOUNDARY)};
+    const size_t total = lengths[0] + lengths[1] + lengths[2];
+
+    while (viewer.Offset < total)
+    {
+        // only what earlier partial writes left over
+        struct iovec vectors[3];
+        int count = 0;
+        size_t skip = viewer.Offset;
+        for (int i = 0; i < 3; i++)
+        {
+            if (skip >= lengths[i])
+            {
+                skip -= lengths[i];
+                continue;
+            }
+            vectors[count].iov_base = (void *)(pieces[i] + skip);
+            vectors[count].iov_len = lengths[i] - skip;
+            count++;
+            skip = 0;
+        }
+
+        struct msghdr message = {};
+        message.msg_iov = vectors;
+        message.msg_iovlen = count;
+        int sent = sendmsg(viewer.Socket, &message, MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            viewer.FrameBlocked = true;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        // a short write means the socket buffer is full, the link is what limits this viewer
+        if (viewer.Offset + sent < total)
+            viewer.FrameBlocked = true;
+        viewer.Offset += sent;
+        viewer.Stats.bytes_sent += sent;
+        viewer.Stats.send_calls++;
+        viewer.PeriodBytes += sent;
+        viewer.WindowBytes += sent;
+        viewer.PeriodSends++;
+    }
+
+    releaseFrame(viewer.Frame);
+    viewer.Stats.frames_sent++;
+    viewer.PeriodFrames++;
+    frameSent(viewer, esp_timer_get_time());
+    return true;
+}
+
+void StreamBroadcaster::frameSent(Viewer &viewer, int64_t now)
+{
+    const size_t length = viewer.Offset;
+    uint32_t delivery = (uint32_t)((now - viewer.FrameStart) / 1000);
+    viewer.DeliveryMs = viewer.DeliveryMs ? (viewer.DeliveryMs * 3 + delivery) / 4 : delivery;
+    viewer.Stats.delivery_ms = viewer.DeliveryMs;
+    viewer.WindowFrames++;
+    if (!viewer.FrameBlocked)
+        return;
+
+    // only a frame that had to wait for the socket buffer tells how fast the link drains it
+    viewer.WindowBlocked++;
+    if (delivery != 0)
+    {
+        float kbps = length * 8.0f / delivery;
+        viewer.LinkKbps = viewer.LinkKbps > 0 ? (viewer.LinkKbps * 3 + kbps) / 4 : kbps;
+        viewer.Stats.link_kbps = viewer.LinkKbps;
+    }
+}
+
+void StreamBroadcaster::adapt(Viewer &viewer, int64_t now)
+{
+    if (now - viewer.WindowStart < (int64_t)AdaptPeriodMs * 1000)
+        return;
+
+    const uint32_t frames = viewer.WindowFrames;
+    const uint32_t dropped = viewer.WindowDropped;
+    const uint32_t blocked = viewer.WindowBlocked;
+    const float kbps = viewer.WindowBytes * 8000.0f / (now - viewer.WindowStart);
+    viewer.WindowFrames = 0;
+    viewer.WindowDropped = 0;
+    viewer.WindowBlocked = 0;
+    viewer.WindowBytes = 0;
+    viewer.WindowStart = now;
+
+    // missing a quarter of the frames while the socket buffer ran full, or stuck on one frame for the whole period
+    bool congested = (blocked != 0 && dropped * 4 > frames + dropped) || (frames == 0 && viewer.Frame != nullptr);
+    if (congested)
+    {
+        // the link was saturated, so what got through is what it carries
+        if (kbps > 0)
+            viewer.LinkKbps = viewer.Stats.link_kbps = kbps;
+        if (viewer.Rendition + 1 < RenditionCount)
+            setRendition(viewer, viewer.Rendition + 1);
+        return;
+    }
+
+    if (blocked == 0 && viewer.LinkKbps > 0)
+    {
+        viewer.LinkKbps += viewer.LinkKbps * LinkProbePercent / 100;
+        viewer.Stats.link_kbps = viewer.LinkKbps;
+    }
+
+    if (viewer.Rendition == Full || dropped != 0)
+        return;
+
+    // step up once the link looks fast enough for the better rendition at its current frame rate
+    const RenditionState &better = _renditions[viewer.Rendition - 1];
+    float needed = better.IntervalMs ? better.Length * 8.0f / better.IntervalMs : 0;
+    if (viewer.LinkKbps == 0 || viewer.LinkKbps >= needed * 1.25f)
+        setRendition(viewer, viewer.Rendition - 1);
+}
+
+void StreamBroadcaster::setRendition(Viewer &viewer, uint8_t rendition)
+{
+    printf("Stream viewer %d: %s -> %s, %.0fkbit/s link, %ums delivery\n", viewer.Socket, RENDITION_NAMES[viewer.Rendition],
+           RENDITION_NAMES[rendition], viewer.LinkKbps, viewer.DeliveryMs);
+    leaveRendition(viewer.Rendition);
+    viewer.Rendition = rendition;
+    _renditions[rendition].Viewers++;
+    viewer.Stats.rendition = rendition;
+    viewer.Stats.switches++;
+    // the sequence numbers of another rendition do not tell about dropped frames
+    viewer.LastSequence = 0;
+    if (rendition != Full)
+        _encodeReady.Give();
+}
+
+void StreamBroadcaster::leaveRendition(uint8_t rendition)
+{
+    // a rendition nobody watches is not kept around, the next viewer gets a fresh one
+    if (--_renditions[rendition].Viewers == 0 && rendition != Full)
+        releaseFrame(_renditions[rendition].Latest);
+}
+
+void StreamBroadcaster::report(Viewer &viewer, int64_t now)
+{
+    int64_t elapsed = now - viewer.PeriodStart;
+    if (elapsed < (int64_t)ReportPeriodMs * 1000)
+        return;
+
+    viewer.Stats.fps = viewer.PeriodFrames * 1000000.0f / elapsed;
+    viewer.Stats.kbps = viewer.PeriodBytes * 8000.0f / elapsed;
+    float sendsPerFrame = viewer.PeriodFrames ? (float)viewer.PeriodSends / viewer.PeriodFrames : 0;
+    printf("MJPG viewer %d: %s, %.1ffps, %.0fkbit/s, %.2f sends/frame, %ums delivery, %u frames, %u dropped, %u shaped\n",
+           viewer.Socket, RENDITION_NAMES[viewer.Rendition], viewer.Stats.fps, viewer.Stats.kbps, sendsPerFrame,
+           viewer.DeliveryMs, viewer.Stats.frames_sent, viewer.Stats.frames_dropped, viewer.Stats.frames_shaped);
+    viewer.PeriodFrames = 0;
+    viewer.PeriodSends = 0;
+    viewer.PeriodBytes = 0;
+    viewer.PeriodStart = now;
+}
+
+void StreamBroadcaster::sendLoop()
+{
+    for (;;)
+    {
+        fd_set writeSet;
+        FD_ZERO(&writeSet);
+        int maxSocket = -1;
+        int64_t now = esp_timer_get_time();
+
+        _lock.Lock();
+        for (Viewer &viewer : _viewers)
+        {
+            if (viewer.Socket < 0 || viewer.Closing)
+                continue;
+
+            report(viewer, now);
+            adapt(viewer, now);
+            if (viewer.Frame == nullptr && !attachLatest(viewer))
+                continue;
+
+            FD_SET(viewer.Socket, &writeSet);
+            if (viewer.Socket > maxSocket)
+                maxSocket = viewer.Socket;
+        }
+        _lock.Unlock();
+
+        if (maxSocket < 0)
+        {
+            _frameReady.Take(100 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        // short timeout, viewers waiting for a new frame are not in the set
+        struct timeval timeout = {0, 10 * 1000};
+        int ready = select(maxSocket + 1, NULL, &writeSet, NULL, &timeout);
+
+        cpp_freertos::LockGuard guard(_lock);
+        for (Viewer &viewer : _viewers)
+        {
+            if (viewer.Socket < 0 || viewer.Closing || viewer.Frame == nullptr)
+                continue;
+
+            // waiting for the socket buffer to drain counts against the link like a short write
+            if (ready <= 0 || !FD_ISSET(viewer.Socket, &writeSet))
+            {
+                viewer.FrameBlocked = true;
+                continue;
+            }
+
+            if (!sendPending(viewer))
+            {
+                // the server owns the socket, it calls sessionClosed() once it is closed
+                viewer.Closing = true;
+                releaseFrame(viewer.Frame);
+                httpd_sess_trigger_close(_server, viewer.Socket);
+            }
+        }
+    }
+}
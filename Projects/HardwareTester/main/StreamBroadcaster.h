@@ -0,0 +1,284 @@
+/*
+ * StreamBroadcaster.h
+ *
+ *  One capture and encode per frame, fanned out to every MJPEG viewer.
+ */
+
+#ifndef STREAM_BROADCASTER_H_
+#define STREAM_BROADCASTER_H_
+
+#include <cstdint>
+#include <array>
+#include "freertos/FreeRTOS.h"
+#include "thread.hpp"
+#include "mutex.hpp"
+#include "semaphore.hpp"
+#include "esp_camera.h"
+#include "esp_http_server.h"
+#include "TokenBucket.h"
+#include "FrameFingerprint.h"
+
+using std::array;
+
+typedef struct
+{
+    int socket;
+    uint32_t frames_sent;
+    uint32_t frames_dropped; //frames replaced by a newer one before this viewer got to them
+    uint32_t bytes_sent;
+    uint32_t send_calls;     //one per write of a part or of the rest of a partially sent one
+    float fps;               //over the last report period
+    float kbps;              //over the last report period
+    uint8_t rendition;       //rung of the ladder the viewer is on, 0 is the camera's own JPEG
+    uint32_t switches;       //rendition changes since the viewer joined
+    uint32_t delivery_ms;    //average time from a frame being picked up until its last byte was written
+    float link_kbps;         //estimated from frames that filled the socket buffer, 0 while none did
+    uint32_t frames_shaped;  //frames left out to stay within the bandwidth budget, also counted as dropped
+    uint32_t frames_skipped; //frames left out because they looked like the last one this viewer got
+} stream_viewer_stats_t;
+
+/// @brief	Called with every captured frame before it is encoded.
+/// @return	False to leave the frame out of the stream.
+typedef bool (*stream_frame_hook_t)(camera_fb_t *fb, void *arg);
+
+/// @brief	Called on the capture task with every JPEG before it is handed to the viewers.
+typedef void (*stream_jpeg_listener_t)(const uint8_t *jpeg, size_t length, void *arg);
+
+/// @brief	Captures frames on its own task and pushes the same JPEG buffer to all viewers.
+/// @note	Each viewer has its own send cursor and always continues with the newest frame,
+///			frames it was too slow for are counted as dropped instead of queued.
+///			Viewers whose link can not keep up are moved down a ladder of renditions, a full size
+///			re-encode at lower quality and a half size one. Those are made from the newest frame
+///			by a task of their own and only while a viewer is on them, so the capture loop and
+///			the viewers on the camera's own JPEG never wait for them.
+class StreamBroadcaster
+{
+public:
+    static constexpr uint8_t MaxViewers = 4;
+    static constexpr uint8_t RenditionCount = 3;
+
+    /// Consumers keeping the capture running without MJPEG viewers.
+    enum Demand : uint8_t
+    {
+        DemandRtsp = 0x01,
+        DemandTiles = 0x02
+    };
+
+    StreamBroadcaster() : _captureThread(*this), _sendThread(*this), _encodeThread(*this)
+    {
+    }
+
+    /// @param server	Server owning the viewer sockets, used to close them after a send error.
+    bool Start(httpd_handle_t server);
+
+    void SetFrameHook(stream_frame_hook_t hook, void *arg);
+
+    void SetJpegListener(stream_jpeg_listener_t listener, void *arg);
+
+    /// @brief	Budget of every viewer, on top of the device wide one of TokenBucket::Device().
+    ///			A frame over budget is skipped as a whole, the viewer continues with a later one.
+    /// @param bytesPerSecond	0 leaves only the device wide budget.
+    void SetBandwidth(uint32_t bytesPerSecond, uint32_t burst);
+
+    /// @brief	Leaves a frame out for an MJPEG viewer if it looks like the last one that viewer got.
+    ///			Frames are still published, the hook, the listener and CopyLatest() see every one.
+    /// @param threshold	FrameFingerprint difference up to which a frame is skipped, negative disables skipping.
+    /// @param keepaliveMs	A viewer gets a frame at least this often even if nothing changed.
+    void SetSkipPolicy(int32_t threshold, uint32_t keepaliveMs);
+
+    /// @brief	Keeps capturing without MJPEG viewers, for consumers fed through the hook or the listener.
+    /// @param consumer	One of Demand, capturing goes on while any of them asks for it.
+    void SetExternalDemand(uint8_t consumer, bool demand);
+
+    /// @brief	True while the capture task owns the camera, nobody else may take frames from it then.
+    bool IsCapturing() const { return _viewerCount != 0 || _externalDemand != 0; }
+
+    /// @brief	Copies the newest full size JPEG, waiting up to waitMs for the first one after capturing started.
+    /// @param data	Allocated with malloc, the caller frees it.
+    /// @param timestamp	esp_timer_get_time() when the frame was published.
+    bool CopyLatest(uint8_t *&data, size_t &length, int64_t &timestamp, uint32_t waitMs);
+
+    /// @brief	Sends the response headers and hands the connection over to the sender task.
+    ///			The handler returns right away, the viewer is removed when the session closes.
+    /// @return	False if all viewer slots are taken.
+    bool AddViewer(httpd_req_t *req);
+
+    /// @return	Number of viewers written to stats.
+    uint8_t GetViewerStats(stream_viewer_stats_t *stats, uint8_t count);
+
+    uint8_t GetViewerCount() const { return _viewerCount; }
+
+    /// @brief	Hide Copy constructor.
+    StreamBroadcaster(const StreamBroadcaster &) = delete;
+
+    /// @brief	Hide Assignment operator.
+    StreamBroadcaster &operator=(const StreamBroadcaster &) = delete;
+
+    /// @brief	Hide Move constructor.
+    StreamBroadcaster(StreamBroadcaster &&) = delete;
+
+    /// @brief	Hide Move Assignment Operator.
+    StreamBroadcaster &operator=(StreamBroadcaster &&) = delete;
+
+private:
+    // every viewer holds at most one slot, the newest frame of every rendition holds one and
+    // the encoder one more, so a task publishing a frame always finds a free one
+    static constexpr uint8_t SlotCount = MaxViewers + RenditionCount + 2;
+    static constexpr uint8_t JpegQuality = 80;
+    static constexpr uint32_t ReportPeriodMs = 5000;
+    static constexpr uint16_t CaptureStackDepth = 4096;
+    static constexpr uint16_t SendStackDepth = 3072;
+    static constexpr uint16_t EncodeStackDepth = 4096;
+
+    static constexpr uint8_t ReducedQuality = 40;
+    static constexpr uint8_t DownscaledQuality = 50;
+    // a viewer is moved at most once per period, and only after a whole period on its rung
+    static constexpr uint32_t AdaptPeriodMs = 2000;
+    // the link estimate grows by this many percent per period without a full socket buffer,
+    // so a viewer that stepped down probes the better rendition again after a while
+    static constexpr uint8_t LinkProbePercent = 25;
+
+    enum Rendition : uint8_t
+    {
+        Full,
+        Reduced,
+        Downscaled
+    };
+
+    struct FrameSlot
+    {
+        uint8_t *Data = nullptr;
+        size_t Length = 0;
+        uint32_t Sequence = 0;
+        uint8_t References = 0;
+        // of the captured frame, renditions made from it share it
+        Hal::FrameFingerprint Fingerprint;
+    };
+
+    struct RenditionState
+    {
+        FrameSlot *Latest = nullptr;
+        uint32_t Sequence = 0;
+        uint8_t Viewers = 0;
+        int64_t LastPublished = 0;
+        uint32_t IntervalMs = 0; // averaged time between frames
+        uint32_t Length = 0;     // averaged frame size
+    };
+
+    struct Viewer
+    {
+        StreamBroadcaster *Owner = nullptr;
+        int Socket = -1;
+        bool Closing = false;
+        FrameSlot *Frame = nullptr;
+        size_t Offset = 0;
+        uint32_t LastSequence = 0;
+        Hal::FrameFingerprint LastFingerprint;
+        int64_t LastAttached = 0;
+        char PartHeader[64];
+        size_t PartHeaderLength = 0;
+        Utilities::TokenBucket Bandwidth;
+        stream_viewer_stats_t Stats = {};
+        uint32_t PeriodFrames = 0;
+        uint32_t PeriodSends = 0;
+        uint32_t PeriodBytes = 0;
+        int64_t PeriodStart = 0;
+
+        uint8_t Rendition = Full;
+        int64_t FrameStart = 0;
+        bool FrameBlocked = false;
+        uint32_t DeliveryMs = 0;
+        float LinkKbps = 0;
+        uint32_t WindowFrames = 0;
+        uint32_t WindowDropped = 0;
+        uint32_t WindowBlocked = 0;
+        uint32_t WindowBytes = 0;
+        int64_t WindowStart = 0;
+    };
+
+    class CaptureThread : public cpp_freertos::Thread
+    {
+    public:
+        CaptureThread(StreamBroadcaster &owner) : cpp_freertos::Thread("STREAMCAP", CaptureStackDepth, 5), _owner(owner) {}
+
+    protected:
+        void Run() override { _owner.captureLoop(); }
+
+    private:
+        StreamBroadcaster &_owner;
+    };
+
+    class SendThread : public cpp_freertos::Thread
+    {
+    public:
+        SendThread(StreamBroadcaster &owner) : cpp_freertos::Thread("STREAMTX", SendStackDepth, 5), _owner(owner) {}
+
+    protected:
+        void Run() override { _owner.sendLoop(); }
+
+    private:
+        StreamBroadcaster &_owner;
+    };
+
+    // below the capture and send tasks, a re-encode must never hold up the full stream
+    class EncodeThread : public cpp_freertos::Thread
+    {
+    public:
+        EncodeThread(StreamBroadcaster &owner) : cpp_freertos::Thread("STREAMENC", EncodeStackDepth, 4), _owner(owner) {}
+
+    protected:
+        void Run() override { _owner.encodeLoop(); }
+
+    private:
+        StreamBroadcaster &_owner;
+    };
+
+    void captureLoop();
+    void sendLoop();
+    void encodeLoop();
+    bool decode(const FrameSlot &source, bool fullSize, uint16_t &width, uint16_t &height);
+    void encode(Rendition rendition, uint16_t width, uint16_t height, uint8_t quality, const Hal::FrameFingerprint &fingerprint);
+    bool publish(Rendition rendition, uint8_t *data, size_t length, const Hal::FrameFingerprint &fingerprint);
+    bool attachLatest(Viewer &viewer);
+    bool sendPending(Viewer &viewer);
+    void releaseFrame(FrameSlot *&frame);
+    void report(Viewer &viewer, int64_t now);
+    void frameSent(Viewer &viewer, int64_t now);
+    void adapt(Viewer &viewer, int64_t now);
+    void setRendition(Viewer &viewer, uint8_t rendition);
+    void leaveRendition(uint8_t rendition);
+
+    static void sessionClosed(void *context);
+    static bool rgbWrite(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data);
+    static size_t jpegRead(void *arg, size_t index, uint8_t *buffer, size_t length);
+
+    CaptureThread _captureThread;
+    SendThread _sendThread;
+    EncodeThread _encodeThread;
+    cpp_freertos::MutexStandard _lock;
+    cpp_freertos::BinarySemaphore _frameReady;
+    cpp_freertos::BinarySemaphore _encodeReady;
+    httpd_handle_t _server = nullptr;
+    stream_frame_hook_t _hook = nullptr;
+    void *_hookArg = nullptr;
+    stream_jpeg_listener_t _listener = nullptr;
+    void *_listenerArg = nullptr;
+    volatile uint8_t _externalDemand = 0;
+    uint32_t _bandwidthRate = 0;
+    uint32_t _bandwidthBurst = 0;
+    volatile int32_t _skipThreshold = -1;
+    uint32_t _skipKeepaliveMs = 0;
+    array<FrameSlot, SlotCount> _slots;
+    array<Viewer, MaxViewers> _viewers;
+    array<RenditionState, RenditionCount> _renditions;
+    volatile uint8_t _viewerCount = 0;
+
+    // decoded frame the renditions are encoded from, only touched by the encoder task
+    uint8_t *_rgb = nullptr;
+    size_t _rgbSize = 0;
+    const uint8_t *_decodeSource = nullptr;
+    uint16_t _decodeWidth = 0;
+    uint16_t _decodeHeight = 0;
+};
+
+#endif /* STREAM_BROADCASTER_H_ */
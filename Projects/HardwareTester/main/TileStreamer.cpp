@@ -0,0 +1,377 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "TileStreamer.h"
+#include "esp_heap_caps.h"
+#include "lwip/sockets.h"
+
+using Hal::BlockChangeDetector;
+
+bool TileStreamer::Start(httpd_handle_t server, StreamBroadcaster &source)
+{
+    _server = server;
+    _source = &source;
+    return _thread.Start();
+}
+
+bool TileStreamer::AddViewer(httpd_req_t *req)
+{
+    {
+        cpp_freertos::LockGuard guard(_lock);
+        if (_socket >= 0)
+            return false;
+
+        // claimed here, Offer() skips it until the headers are out
+        _socket = httpd_req_to_sockfd(req);
+        _viewer++;
+        _closing = true;
+    }
+
+    // the records are written to the socket directly, so the response can not be chunked
+    char header[192];
+    int length = snprintf(header, sizeof(header),
+                          "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: %s\r\n"
+                          "Access-Control-Allow-Origin: *\r\n"
+                          "Cache-Control: no-cache\r\n"
+                          "Connection: close\r\n\r\n",
+                          TILE_STREAM_CONTENT_TYPE);
+    if (httpd_send(req, header, length) != length)
+    {
+        cpp_freertos::LockGuard guard(_lock);
+        _socket = -1;
+        _closing = false;
+        return false;
+    }
+
+    // the server calls sessionClosed() for this session when the connection goes away
+    req->sess_ctx = this;
+    req->free_ctx = sessionClosed;
+
+    {
+        cpp_freertos::LockGuard guard(_lock);
+        _closing = false;
+        _restart = true;
+    }
+    _source->SetExternalDemand(StreamBroadcaster::DemandTiles, true);
+    printf("Tile viewer %d joined\n", httpd_req_to_sockfd(req));
+    return true;
+}
+
+void TileStreamer::sessionClosed(void *context)
+{
+    TileStreamer &owner = *static_cast<TileStreamer *>(context);
+    {
+        cpp_freertos::LockGuard guard(owner._lock);
+        printf("Tile viewer %d left after %u frames\n", owner._socket, owner._sequence);
+        owner._socket = -1;
+        owner._closing = false;
+    }
+    owner._source->SetExternalDemand(StreamBroadcaster::DemandTiles, false);
+}
+
+void TileStreamer::Offer(const camera_fb_t *fb)
+{
+    cpp_freertos::LockGuard guard(_lock);
+    if (_socket < 0 || _closing || _busy)
+        return;
+
+    if (fb->len > _frameSize)
+    {
+        heap_caps_free(_frame.buf);
+        _frame.buf = (uint8_t *)heap_caps_malloc(fb->len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        _frameSize = _frame.buf ? fb->len : 0;
+        if (!_frame.buf)
+            return;
+    }
+
+    // the driver gets its buffer back right after the hook, the copy is what gets compared and encoded
+    memcpy(_frame.buf, fb->buf, fb->len);
+    _frame.len = fb->len;
+    _frame.width = fb->width;
+    _frame.height = fb->height;
+    _frame.format = fb->format;
+    _frame.exposure = fb->exposure;
+    _busy = true;
+    _frameReady.Give();
+}
+
+void TileStreamer::streamLoop()
+{
+    for (;;)
+    {
+        if (!_frameReady.Take(100 / portTICK_PERIOD_MS))
+            continue;
+
+        int socket;
+        {
+            cpp_freertos::LockGuard guard(_lock);
+            socket = _closing ? -1 : _socket;
+            _streamed = _viewer;
+            if (_restart)
+            {
+                // a new viewer has nothing yet, it starts with a keyframe
+                _restart = false;
+                _sinceKeyframe = KeyframeInterval;
+                _sequence = 0;
+            }
+        }
+
+        if (socket >= 0 && !sendFrame(socket))
+            closeViewer();
+
+        cpp_freertos::LockGuard guard(_lock);
+        _busy = false;
+    }
+}
+
+void TileStreamer::closeViewer()
+{
+    cpp_freertos::LockGuard guard(_lock);
+    if (_socket < 0 || _closing || _viewer != _streamed)
+        return;
+
+    // the server owns the socket, it calls sessionClosed() once it is closed
+    _closing = true;
+    httpd_sess_trigger_close(_server, _socket);
+}
+
+bool TileStreamer::sendFrame(int socket)
+{
+    int64_t fr_start = esp_timer_get_time();
+    size_t bytes_per_pixel = (_frame.format == PIXFORMAT_GRAYSCALE) ? 1 : 2;
+    size_t strip_size = _frame.width * BlockChangeDetector::BlockSize * bytes_per_pixel;
+
+    int32_t changed = _detector.Update(&_frame);
+    uint32_t blocks = _detector.GetColumns() * _detector.GetRows();
+
+    // JPEG frames can only go out whole, one that looks like what the viewer has is not sent at all
+    if (_frame.format == PIXFORMAT_JPEG && changed == 0 && _sinceKeyframe < KeyframeInterval)
+    {
+        _sinceKeyframe++;
+        return true;
+    }
+
+    bool keyframe = changed < 0 || _frame.format == PIXFORMAT_JPEG || _sinceKeyframe >= KeyframeInterval ||
+                    (uint32_t)changed * 2 > blocks || !reserve(strip_size);
+
+    tile_frame_header_t header = {
+        TILE_STREAM_MAGIC, (uint8_t)(keyframe ? TILE_STREAM_FLAG_KEYFRAME : 0), 0,
+        (uint16_t)_frame.width, (uint16_t)_frame.height, 0, _sequence};
+    size_t length = sizeof(header);
+
+    bool sent = keyframe ? sendKeyframe(socket, header, length) : sendTiles(socket, header, length);
+    if (sent)
+        _sequence++;
+
+    int64_t fr_end = esp_timer_get_time();
+    printf("TILES: %s %d/%u blocks %u tiles %uB %ums\n", keyframe ? "key" : "diff", changed, blocks,
+           header.tiles, (uint32_t)length, (uint32_t)((fr_end - fr_start) / 1000));
+    return sent;
+}
+
+bool TileStreamer::sendKeyframe(int socket, tile_frame_header_t &header, size_t &length)
+{
+    uint8_t *jpg_buf = NULL;
+    size_t jpg_len = 0;
+    bool converted = false;
+    if (_frame.format == PIXFORMAT_JPEG)
+    {
+        jpg_buf = _frame.buf;
+        jpg_len = _frame.len;
+    }
+    else if (frame2jpg(&_frame, JpegQuality, &jpg_buf, &jpg_len))
+    {
+        converted = true;
+    }
+    else
+    {
+        // nothing was written yet, the next frame is a keyframe again
+        printf("JPEG compression failed\n");
+        return true;
+    }
+
+    tile_header_t tile = {
+        0, 0,
+        (uint8_t)((_frame.width + BlockChangeDetector::BlockSize - 1) / BlockChangeDetector::BlockSize),
+        (uint8_t)((_frame.height + BlockChangeDetector::BlockSize - 1) / BlockChangeDetector::BlockSize),
+        (uint32_t)jpg_len};
+    header.tiles = 1;
+    bool sent = sendAll(socket, &header, sizeof(header)) && sendAll(socket, &tile, sizeof(tile)) &&
+                sendAll(socket, jpg_buf, jpg_len);
+    length += sizeof(tile) + jpg_len;
+    if (converted)
+    {
+        free(jpg_buf);
+    }
+    if (sent)
+    {
+        _detector.CommitAll();
+        _sinceKeyframe = 0;
+    }
+    return sent;
+}
+
+bool TileStreamer::sendTiles(int socket, tile_frame_header_t &header, size_t &length)
+{
+    uint16_t row = 0, column = 0, count = 0;
+    while (nextRun(row, column, count))
+    {
+        header.tiles++;
+        column += count;
+    }
+    if (!sendAll(socket, &header, sizeof(header)))
+        return false;
+
+    const size_t bytes_per_pixel = (_frame.format == PIXFORMAT_GRAYSCALE) ? 1 : 2;
+    row = 0;
+    column = 0;
+    while (nextRun(row, column, count))
+    {
+        size_t x = column * BlockChangeDetector::BlockSize;
+        size_t y = row * BlockChangeDetector::BlockSize;
+        size_t tile_width = count * BlockChangeDetector::BlockSize;
+        size_t tile_height = BlockChangeDetector::BlockSize;
+        if (x + tile_width > _frame.width)
+        {
+            tile_width = _frame.width - x;
+        }
+        if (y + tile_height > _frame.height)
+        {
+            tile_height = _frame.height - y;
+        }
+
+        // the encoder wants a contiguous image, cut the run out of the frame
+        size_t line_len = tile_width * bytes_per_pixel;
+        for (size_t line = 0; line < tile_height; line++)
+        {
+            memcpy(_strip.Data + line * line_len, _frame.buf + ((y + line) * _frame.width + x) * bytes_per_pixel, line_len);
+        }
+
+        _out.Length = sizeof(tile_header_t);
+        bool encoded = fmt2jpg_cb(_strip.Data, line_len * tile_height, tile_width, tile_height, _frame.format,
+                                  JpegQuality, bufferWrite, &_out);
+        if (!encoded)
+        {
+            // an empty tile keeps the record consistent, the next frame resyncs with a keyframe
+            _out.Length = sizeof(tile_header_t);
+            _detector.Invalidate();
+        }
+        else
+        {
+            _detector.Commit(column, row, count);
+        }
+
+        tile_header_t tile = {(uint8_t)column, (uint8_t)row, (uint8_t)count, 1, (uint32_t)(_out.Length - sizeof(tile_header_t))};
+        memcpy(_out.Data, &tile, sizeof(tile));
+        if (!sendAll(socket, _out.Data, _out.Length))
+            return false;
+        length += _out.Length;
+        column += count;
+    }
+    _sinceKeyframe++;
+    return true;
+}
+
+bool TileStreamer::nextRun(uint16_t &row, uint16_t &column, uint16_t &count) const
+{
+    for (; row < _detector.GetRows(); row++, column = 0)
+    {
+        for (; column < _detector.GetColumns(); column++)
+        {
+            if (!_detector.IsChanged(column, row))
+            {
+                continue;
+            }
+
+            uint16_t last = column;
+            for (uint16_t next = column + 1; next < _detector.GetColumns() && next - last <= RunGap + 1; next++)
+            {
+                if (_detector.IsChanged(next, row))
+                {
+                    last = next;
+                }
+            }
+            count = last - column + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TileStreamer::reserve(size_t stripSize)
+{
+    if (_strip.Size >= stripSize)
+    {
+        return true;
+    }
+
+    free(_strip.Data);
+    free(_out.Data);
+    _strip = {};
+    _out = {};
+
+    // a strip of noisy blocks can encode larger than its raw size, leave room for the JPEG headers too
+    size_t outSize = stripSize + 1024 + sizeof(tile_header_t);
+    _strip.Data = (uint8_t *)malloc(stripSize);
+    _out.Data = (uint8_t *)malloc(outSize);
+    if (!_strip.Data || !_out.Data)
+    {
+        free(_strip.Data);
+        free(_out.Data);
+        _strip = {};
+        _out = {};
+        return false;
+    }
+    _strip.Size = stripSize;
+    _out.Size = outSize;
+    return true;
+}
+
+bool TileStreamer::sendAll(int socket, const void *data, size_t length)
+{
+    const uint8_t *next = (const uint8_t *)data;
+    int64_t deadline = esp_timer_get_time() + SendTimeout * 1000LL;
+    while (length > 0)
+    {
+        // written under the lock and never blocking, so sessionClosed() can not let the server
+        // reuse the descriptor while a write to it is under way
+        int sent;
+        {
+            cpp_freertos::LockGuard guard(_lock);
+            if (_socket != socket || _closing || _viewer != _streamed)
+                return false;
+            sent = send(socket, next, length, MSG_DONTWAIT);
+        }
+
+        if (sent > 0)
+        {
+            next += sent;
+            length -= sent;
+            continue;
+        }
+        if (sent == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || esp_timer_get_time() > deadline)
+            return false;
+
+        // the viewer may leave meanwhile, the next write checks again
+        fd_set writeSet;
+        FD_ZERO(&writeSet);
+        FD_SET(socket, &writeSet);
+        struct timeval timeout = {0, 100 * 1000};
+        select(socket + 1, NULL, &writeSet, NULL, &timeout);
+    }
+    return true;
+}
+
+size_t TileStreamer::bufferWrite(void *arg, size_t index, const void *data, size_t len)
+{
+    Buffer *out = (Buffer *)arg;
+    if (out->Length + len > out->Size)
+    {
+        return 0;
+    }
+    memcpy(out->Data + out->Length, data, len);
+    out->Length += len;
+    return len;
+}
@@ -0,0 +1,125 @@
+/*
+ * TileStreamer.h
+ *
+ *  Differential tile stream for /tiles, fed with the frames the broadcaster captures.
+ */
+
+#ifndef TILE_STREAMER_H_
+#define TILE_STREAMER_H_
+
+#include <cstdint>
+#include "freertos/FreeRTOS.h"
+#include "thread.hpp"
+#include "mutex.hpp"
+#include "semaphore.hpp"
+#include "esp_camera.h"
+#include "esp_http_server.h"
+#include "BlockChangeDetector.h"
+#include "CameraStreamTest.h"
+#include "StreamBroadcaster.h"
+
+/// @brief	Encodes the blocks that changed since the last frame and writes them to one viewer.
+/// @note	The camera is never read here, Offer() is called from the broadcaster's frame hook and
+///			copies the frame while the task is idle. Frames arriving while the previous one is
+///			still encoded or sent are skipped, the detector compares against what the viewer has,
+///			so a skipped frame only makes the next difference larger. JPEG frames can not be cut
+///			into tiles, they go out whole and only once a block changed.
+class TileStreamer
+{
+public:
+    TileStreamer() : _thread(*this)
+    {
+    }
+
+    /// @param server	Server owning the viewer socket, used to close it after a send error.
+    /// @param source	Broadcaster asked to keep capturing while a viewer is attached.
+    bool Start(httpd_handle_t server, StreamBroadcaster &source);
+
+    /// @brief	Sends the response headers and hands the connection over to the tile task.
+    /// @return	False if a viewer is already attached.
+    bool AddViewer(httpd_req_t *req);
+
+    /// @brief	Takes a copy of the frame if the tile task is waiting for one, called on the capture task.
+    void Offer(const camera_fb_t *fb);
+
+    /// @brief	Hide Copy constructor.
+    TileStreamer(const TileStreamer &) = delete;
+
+    /// @brief	Hide Assignment operator.
+    TileStreamer &operator=(const TileStreamer &) = delete;
+
+    /// @brief	Hide Move constructor.
+    TileStreamer(TileStreamer &&) = delete;
+
+    /// @brief	Hide Move Assignment Operator.
+    TileStreamer &operator=(TileStreamer &&) = delete;
+
+private:
+    static constexpr uint32_t KeyframeInterval = 100;
+    static constexpr uint8_t JpegQuality = 80;
+    // unchanged blocks bridged inside one tile, every tile pays for a full JPEG header
+    static constexpr uint16_t RunGap = 2;
+    static constexpr uint16_t StackDepth = 4096;
+    // a viewer that takes no data for this long is dropped
+    static constexpr uint32_t SendTimeout = 5000;
+
+    struct Buffer
+    {
+        uint8_t *Data = nullptr;
+        size_t Length = 0;
+        size_t Size = 0;
+    };
+
+    class TileThread : public cpp_freertos::Thread
+    {
+    public:
+        TileThread(TileStreamer &owner) : cpp_freertos::Thread("STREAMTILE", StackDepth, 4), _owner(owner) {}
+
+    protected:
+        void Run() override { _owner.streamLoop(); }
+
+    private:
+        TileStreamer &_owner;
+    };
+
+    void streamLoop();
+    bool sendFrame(int socket);
+    bool sendKeyframe(int socket, tile_frame_header_t &header, size_t &length);
+    bool sendTiles(int socket, tile_frame_header_t &header, size_t &length);
+    bool nextRun(uint16_t &row, uint16_t &column, uint16_t &count) const;
+    bool reserve(size_t stripSize);
+    void closeViewer();
+    bool sendAll(int socket, const void *data, size_t length);
+
+    static size_t bufferWrite(void *arg, size_t index, const void *data, size_t len);
+    static void sessionClosed(void *context);
+
+    TileThread _thread;
+    cpp_freertos::MutexStandard _lock;
+    cpp_freertos::BinarySemaphore _frameReady;
+    httpd_handle_t _server = nullptr;
+    StreamBroadcaster *_source = nullptr;
+    int _socket = -1;
+    // bumped for every viewer, the server may hand a closed viewer's descriptor to the next one
+    uint32_t _viewer = 0;
+    bool _closing = false;
+    // a viewer joined, the task starts over with a keyframe
+    bool _restart = false;
+    // set while the task owns _frame, Offer() leaves it alone then
+    bool _busy = false;
+
+    // copy of the frame being streamed, the buffer is kept for the next one
+    camera_fb_t _frame = {};
+    size_t _frameSize = 0;
+
+    // only touched by the tile task
+    Hal::BlockChangeDetector _detector;
+    Buffer _strip;
+    Buffer _out;
+    // viewer the frame being sent is meant for
+    uint32_t _streamed = 0;
+    uint32_t _sinceKeyframe = KeyframeInterval;
+    uint16_t _sequence = 0;
+};
+
+#endif /* TILE_STREAMER_H_ */
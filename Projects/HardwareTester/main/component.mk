@@ -13,21 +13,31 @@ COMPONENT_SRCDIRS           +=  ../../Esp32/Source/Hal
                                 ../../Esp32/Source/Hal/Camera/Conversions                  \
                                 ../../Esp32/Source/Hal/Camera/Driver                       \
                                 ../../Esp32/Source/Hal/Camera/Sensors                      \
+                                ../../Esp32/Source/Hal/Camera/Analytics                    \
                                 ../../Esp32/Source/Hal/Wifi                                \
                                 ../../Esp32/Source/Middleware/Utils                        \
                                 ../../Esp32/Source/Middleware/Configuration                \
                                 ../../Esp32/Source/Middleware/Protocol                     \
                                 ../System/Source/Application                               \
+                                ../../WebCamera/System/Source/Utils                        \
                                 ../System/Libraries/freertos-addons/Source
 COMPONENT_ADD_INCLUDEDIRS   +=  ${IDF_PATH}/components/                                    \
                                 ../../Esp32/Include/Hal                                    \
                                 ../../Esp32/Include/Hal/Camera/Conversions                 \
                                 ../../Esp32/Include/Hal/Camera/Driver                      \
                                 ../../Esp32/Include/Hal/Camera/Sensors                     \
+                                ../../Esp32/Include/Hal/Camera/Analytics                   \
                                 ../../Esp32/Include/Hal/Wifi                               \
                                 ../../Esp32/Include/Middleware/Utils                       \
                                 ../../Esp32/Include/Middleware/Configuration               \
                                 ../../Esp32/Include/Middleware/Common                      \
                                 ../../Esp32//Include/Middleware/Protocol                   \
                                 ../System/Include/Application                              \
-                                ../System/Libraries/freertos-addons/Source/include
\ No newline at end of file
+                                ../../WebCamera/System/Include/Utils                       \
+                                ../System/Libraries/freertos-addons/Source/include
+
+# Only TokenBucket is shared with the camera firmware, the rest of its Utils directory
+# duplicates what Middleware/Utils already provides.
+COMPONENT_OBJEXCLUDE        +=  $(patsubst $(COMPONENT_PATH)/%.cpp,%.o,                              \
+                                    $(filter-out %/TokenBucket.cpp,                                \
+                                        $(wildcard $(COMPONENT_PATH)/../../WebCamera/System/Source/Utils/*.cpp)))
\ No newline at end of file
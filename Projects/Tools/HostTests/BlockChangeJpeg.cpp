@@ -0,0 +1,169 @@
+// BlockChangeDetector on JPEG frames against the same frames as raw grayscale: the DC values
+// of a 1/8 scale decode have to mark the same blocks as the sums over the pixels, also for the
+// partial blocks at the right and bottom edge. A JPEG that does not decode can not be compared.
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <jpeglib.h>
+#include "HostTest.h"
+#include "BlockChangeDetector.h"
+
+using Hal::BlockChangeDetector;
+
+namespace
+{
+
+typedef std::vector<uint8_t> Bytes;
+
+struct Image
+{
+	int Width;
+	int Height;
+	Bytes Luma;
+
+	Image(int width, int height) : Width(width), Height(height), Luma(width * height)
+	{
+		// smooth, so the JPEG keeps the block means close to the pixels
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++)
+				Luma[y * width + x] = 40 + x * 100 / width + y * 60 / height;
+	}
+
+	void Paint(int left, int top, int width, int height, int delta)
+	{
+		for (int y = top; y < top + height && y < Height; y++)
+			for (int x = left; x < left + width && x < Width; x++)
+				Luma[y * Width + x] += delta;
+	}
+};
+
+/// @brief	4:2:2 like the camera sends.
+Bytes encode(const Image &image)
+{
+	jpeg_compress_struct compress;
+	jpeg_error_mgr error;
+	compress.err = jpeg_std_error(&error);
+	jpeg_create_compress(&compress);
+	unsigned char *output = nullptr;
+	unsigned long outputLength = 0;
+	jpeg_mem_dest(&compress, &output, &outputLength);
+
+	compress.image_width = image.Width;
+	compress.image_height = image.Height;
+	compress.input_components = 3;
+	compress.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&compress);
+	jpeg_set_quality(&compress, 90, TRUE);
+	compress.comp_info[0].h_samp_factor = 2;
+	compress.comp_info[0].v_samp_factor = 1;
+
+	jpeg_start_compress(&compress, TRUE);
+	Bytes row(image.Width * 3);
+	for (int y = 0; y < image.Height; y++)
+	{
+		for (int x = 0; x < image.Width; x++)
+			row[x * 3] = row[x * 3 + 1] = row[x * 3 + 2] = image.Luma[y * image.Width + x];
+		JSAMPROW line = row.data();
+		jpeg_write_scanlines(&compress, &line, 1);
+	}
+	jpeg_finish_compress(&compress);
+
+	Bytes jpeg(output, output + outputLength);
+	free(output);
+	jpeg_destroy_compress(&compress);
+	return jpeg;
+}
+
+camera_fb_t frame(Bytes &data, const Image &image, pixformat_t format)
+{
+	camera_fb_t fb = {};
+	fb.buf = data.data();
+	fb.len = data.size();
+	fb.width = image.Width;
+	fb.height = image.Height;
+	fb.format = format;
+	return fb;
+}
+
+/// @brief	Runs both detectors on the image, they must agree on every block.
+/// @return	Changed blocks, -1 if they disagree.
+int32_t update(BlockChangeDetector &jpeg, BlockChangeDetector &raw, const Image &image)
+{
+	Bytes encoded = encode(image);
+	Bytes luma = image.Luma;
+	camera_fb_t jpegFrame = frame(encoded, image, PIXFORMAT_JPEG);
+	camera_fb_t rawFrame = frame(luma, image, PIXFORMAT_GRAYSCALE);
+	int32_t jpegChanged = jpeg.Update(&jpegFrame);
+	int32_t rawChanged = raw.Update(&rawFrame);
+	CHECK(jpegChanged == rawChanged);
+	if (jpegChanged != rawChanged || jpeg.GetColumns() != raw.GetColumns() || jpeg.GetRows() != raw.GetRows())
+		return -1;
+
+	for (uint16_t row = 0; row < jpeg.GetRows(); row++)
+	{
+		for (uint16_t column = 0; column < jpeg.GetColumns(); column++)
+		{
+			if (jpeg.IsChanged(column, row) != raw.IsChanged(column, row))
+			{
+				printf("block %u,%u: jpeg %d raw %d\n", column, row, jpeg.IsChanged(column, row), raw.IsChanged(column, row));
+				return -1;
+			}
+		}
+	}
+	return jpegChanged;
+}
+
+void testChanges(int width, int height)
+{
+	BlockChangeDetector jpeg;
+	BlockChangeDetector raw;
+	Image image(width, height);
+	const int32_t columns = (width + 15) / 16;
+	const int32_t rows = (height + 15) / 16;
+
+	// no reference yet
+	CHECK(update(jpeg, raw, image) == columns * rows);
+	jpeg.CommitAll();
+	raw.CommitAll();
+	CHECK(update(jpeg, raw, image) == 0);
+
+	// single quadrants of two inner blocks, and the partial block in the corner
+	image.Paint(40, 24, 8, 8, 70);
+	image.Paint(64, 0, 8, 8, -60);
+	image.Paint((columns - 1) * 16, (rows - 1) * 16, 16, 16, -35);
+	CHECK(update(jpeg, raw, image) == 3);
+	CHECK(jpeg.IsChanged(2, 1) && jpeg.IsChanged(4, 0) && jpeg.IsChanged(columns - 1, rows - 1));
+
+	// only the inner blocks are taken over, the corner stays changed
+	jpeg.Commit(2, 1, 1);
+	raw.Commit(2, 1, 1);
+	jpeg.Commit(4, 0, 1);
+	raw.Commit(4, 0, 1);
+	CHECK(update(jpeg, raw, image) == 1);
+	CHECK(jpeg.IsChanged(columns - 1, rows - 1));
+}
+
+void testBroken()
+{
+	BlockChangeDetector detector;
+	Image image(64, 48);
+	Bytes encoded = encode(image);
+	camera_fb_t fb = frame(encoded, image, PIXFORMAT_JPEG);
+	CHECK(detector.Update(&fb) == 12);
+	detector.CommitAll();
+
+	Bytes broken(encoded.begin(), encoded.begin() + 20);
+	fb = frame(broken, image, PIXFORMAT_JPEG);
+	CHECK(detector.Update(&fb) < 0);
+}
+
+} // namespace
+
+int main()
+{
+	testChanges(160, 120);
+	testChanges(100, 76);
+	testBroken();
+	return HostTest::Finish("BlockChangeJpeg");
+}
@@ -0,0 +1,246 @@
+// DnsClient against the lwIP resolver stand-in, whose answers arrive late on the tcpip thread:
+// callers asking for the same name share queries, answers and failures are cached until they
+// expire, the least recently used name makes room, and a blocking Resolve() that timed out is
+// not written to by the answer that arrives after it. Built with AddressSanitizer for that.
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "HostTest.h"
+#include "DnsClient.h"
+
+using namespace Protocol;
+using HostLwip::Dns;
+using HostLwip::Tcpip;
+using Result = DnsClient::DnsResolveResult;
+
+namespace
+{
+
+class Waiter
+{
+public:
+	std::atomic<int> Answers{0};
+	std::atomic<int> Failures{0};
+	std::atomic<uint32_t> Last{0};
+
+	void Resolved(const ip_addr_t *address, void *context)
+	{
+		if (address != nullptr)
+		{
+			Last = address->u_addr.ip4.addr;
+			Answers++;
+		}
+		else
+		{
+			Failures++;
+		}
+	}
+
+	/// @brief	Waits until count callbacks came in, at most 2 s.
+	bool Wait(int count)
+	{
+		for (int i = 0; i < 2000 && Answers + Failures < count; i++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return Answers + Failures == count;
+	}
+};
+
+uint32_t address(const char *text)
+{
+	ip_addr_t parsed;
+	ipaddr_aton(text, &parsed);
+	return parsed.u_addr.ip4.addr;
+}
+
+uint32_t lookups()
+{
+	std::lock_guard<std::mutex> lock(Dns::Instance().Lock);
+	return Dns::Instance().Lookups;
+}
+
+void setDelay(uint32_t milliseconds)
+{
+	std::lock_guard<std::mutex> lock(Dns::Instance().Lock);
+	Dns::Instance().Delay = milliseconds;
+}
+
+Result resolve(const char *name, Waiter &waiter, ip_addr_t &result)
+{
+	return DnsClient::Instance()->ResolveAsync(name, fastdelegate::MakeDelegate(&waiter, &Waiter::Resolved), &waiter, result);
+}
+
+/// @brief	Resolves a name that is not cached and waits for the answer.
+bool lookUp(const char *name)
+{
+	Waiter waiter;
+	ip_addr_t result = {};
+	return resolve(name, waiter, result) == Result::Processing && waiter.Wait(1);
+}
+
+void testLiteral()
+{
+	const uint32_t before = lookups();
+	ip_addr_t result = {};
+	CHECK(DnsClient::Instance()->Resolve("192.168.1.20", result) == Result::Done);
+	CHECK(result.u_addr.ip4.addr == address("192.168.1.20"));
+	CHECK(lookups() == before);
+}
+
+void testCoalescing()
+{
+	setDelay(200);
+	const uint32_t before = lookups();
+	const DnsClient::DnsStatistics statistics = DnsClient::Instance()->GetStatistics();
+
+	// four callers share a query, 20 of them need five
+	Waiter waiter;
+	for (int i = 0; i < 20; i++)
+	{
+		ip_addr_t result = {};
+		CHECK(resolve("camera.example", waiter, result) == Result::Processing);
+	}
+	CHECK(DnsClient::Instance()->GetStatistics().InFlight == 5);
+	CHECK(waiter.Wait(20));
+	CHECK(waiter.Answers == 20 && waiter.Last == address("10.1.2.3"));
+	CHECK(lookups() - before == 5);
+
+	const DnsClient::DnsStatistics after = DnsClient::Instance()->GetStatistics();
+	CHECK(after.Misses - statistics.Misses == 20 && after.Coalesced - statistics.Coalesced == 15);
+	CHECK(after.InFlight == 0);
+	setDelay(50);
+}
+
+void testCache()
+{
+	const uint32_t before = lookups();
+	const uint32_t hits = DnsClient::Instance()->GetStatistics().Hits;
+	Waiter waiter;
+	ip_addr_t result = {};
+	CHECK(resolve("camera.example", waiter, result) == Result::Done && result.u_addr.ip4.addr == address("10.1.2.3"));
+	CHECK(resolve("CAMERA.Example", waiter, result) == Result::Done);
+	CHECK(DnsClient::Instance()->GetStatistics().Hits - hits == 2);
+	CHECK(lookups() == before && waiter.Answers == 0);
+
+	// an answer is kept for at most a minute
+	Hal::Hardware::Instance()->Skip(60000);
+	CHECK(lookUp("camera.example"));
+	CHECK(lookups() - before == 1);
+}
+
+void testNegative()
+{
+	const uint32_t before = lookups();
+	Waiter waiter;
+	ip_addr_t result = {};
+	CHECK(resolve("missing.example", waiter, result) == Result::Processing);
+	CHECK(waiter.Wait(1) && waiter.Failures == 1);
+
+	// a dead name is not asked for again on every reconnect, but only for a few seconds
+	CHECK(resolve("missing.example", waiter, result) == Result::ErrorToResolve);
+	CHECK(lookups() - before == 1);
+	Hal::Hardware::Instance()->Skip(5000);
+	CHECK(lookUp("missing.example"));
+	CHECK(lookups() - before == 2);
+}
+
+void testLocalFailure()
+{
+	// lwIP's table is full: the caller hears of it right away and the name is not written off
+	Dns::Instance().Refuse = ERR_MEM;
+	Waiter waiter;
+	ip_addr_t result = {};
+	CHECK(resolve("busy.example", waiter, result) == Result::UnknownError);
+	CHECK(waiter.Answers == 0 && waiter.Failures == 0);
+	Dns::Instance().Refuse = ERR_OK;
+	CHECK(lookUp("busy.example"));
+}
+
+void testEviction()
+{
+	std::vector<std::string> names;
+	for (int i = 0; i < 9; i++)
+	{
+		names.push_back("host" + std::to_string(i) + ".example");
+		Dns::Instance().Add(names.back().c_str(), ("10.0.0." + std::to_string(i + 1)).c_str());
+	}
+	for (int i = 0; i < 8; i++)
+		CHECK(lookUp(names[i].c_str()));
+
+	// host0 was used again, so host1 is the least recently used one when host8 needs room
+	Waiter waiter;
+	ip_addr_t result = {};
+	CHECK(resolve(names[0].c_str(), waiter, result) == Result::Done);
+	CHECK(lookUp(names[8].c_str()));
+	CHECK(resolve(names[0].c_str(), waiter, result) == Result::Done);
+	CHECK(resolve(names[2].c_str(), waiter, result) == Result::Done);
+	CHECK(lookUp(names[1].c_str()));
+}
+
+void testConcurrentBlocking()
+{
+	setDelay(100);
+	const uint32_t before = lookups();
+	std::atomic<int> resolved{0};
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 8; i++)
+	{
+		threads.emplace_back([&] {
+			ip_addr_t result = {};
+			if (DnsClient::Instance()->Resolve("shared.example", result) == Result::Done && result.u_addr.ip4.addr == address("10.9.9.9"))
+				resolved++;
+		});
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+	CHECK(resolved == 8);
+	CHECK(lookups() - before >= 1 && lookups() - before <= 2);
+	setDelay(50);
+}
+
+void testTimeout()
+{
+	// the answer comes after Resolve() gave up, it must not touch the returned frame
+	setDelay(1300);
+	ip_addr_t result = {};
+	auto start = std::chrono::steady_clock::now();
+	CHECK(DnsClient::Instance()->Resolve("slow.example", result) == Result::ErrorToResolve);
+	CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(900));
+
+	// overwrite the stack the waiter lived on while the answer is on its way
+	volatile char scratch[4096];
+	for (size_t i = 0; i < sizeof(scratch); i++)
+		scratch[i] = static_cast<char>(i);
+	std::this_thread::sleep_for(std::chrono::milliseconds(600));
+	Tcpip::Instance().Settle();
+
+	// the late answer is cached all the same
+	Waiter waiter;
+	CHECK(resolve("slow.example", waiter, result) == Result::Done && result.u_addr.ip4.addr == address("10.5.5.5"));
+	setDelay(50);
+}
+
+} // namespace
+
+int main()
+{
+	ip_addr_t server;
+	ipaddr_aton("192.168.1.1", &server);
+	DnsClient::Instance()->SetDnsServer(server);
+	Dns::Instance().Add("camera.example", "10.1.2.3");
+	Dns::Instance().Add("shared.example", "10.9.9.9");
+	Dns::Instance().Add("slow.example", "10.5.5.5");
+	Dns::Instance().Add("busy.example", "10.7.7.7");
+
+	testLiteral();
+	testCoalescing();
+	testCache();
+	testNegative();
+	testLocalFailure();
+	testEviction();
+	testConcurrentBlocking();
+	testTimeout();
+	return HostTest::Finish("DnsClientCache");
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+// Minimal checks for the host tests, a failed check is reported and the test exits non zero.
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace HostTest
+{
+
+inline int &Failures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+inline int Finish(const char *name)
+{
+	if (Failures() != 0)
+	{
+		printf("%s: %d checks failed\n", name, Failures());
+		return EXIT_FAILURE;
+	}
+	printf("%s: passed\n", name);
+	return EXIT_SUCCESS;
+}
+
+} // namespace HostTest
+
+#define CHECK(condition)                                                              \
+	do                                                                                \
+	{                                                                                 \
+		if (!(condition))                                                             \
+		{                                                                             \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);      \
+			HostTest::Failures()++;                                                   \
+		}                                                                             \
+	} while (0)
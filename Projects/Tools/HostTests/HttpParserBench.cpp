@@ -0,0 +1,151 @@
+// HttpParser throughput on realistic headers, per character state machine against the
+// bulk scanning fast path, each with values copied to the scratch and passed as views.
+// Whole messages in one call, like a full receive buffer. Requests are also run through
+// the C http_parser my_http_server uses, when the Makefile finds its sources.
+
+#include <chrono>
+#include <string>
+#include "HttpParser.h"
+#ifdef WITH_HTTP_PARSER
+extern "C"
+{
+#include "http_parser.h"
+}
+#endif
+
+using namespace Protocol;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr double Seconds = 0.5;
+
+class Sink
+{
+public:
+	uint32_t Headers = 0;
+
+	bool Header(void *opaque, const char *key, uint16_t nkey, const char *value, uint16_t nvalue)
+	{
+		Headers++;
+		return true;
+	}
+};
+
+const std::string Response = "HTTP/1.1 200 OK\r\n"
+							 "Server: nginx/1.24.0\r\n"
+							 "Date: Mon, 19 Oct 2026 10:00:00 GMT\r\n"
+							 "Content-Type: application/json; charset=utf-8\r\n"
+							 "Content-Length: 0\r\n"
+							 "Connection: keep-alive\r\n"
+							 "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+							 "Strict-Transport-Security: max-age=31536000; includeSubDomains\r\n"
+							 "X-Request-Id: 6f1c2d9a-4b7e-4f0a-9c3d-2e8b5a7f1d04\r\n"
+							 "ETag: \"5f3a9c1b2d4e6f708192a3b4c5d6e7f8\"\r\n"
+							 "\r\n";
+
+const std::string Upgrade = "HTTP/1.1 101 Switching Protocols\r\n"
+							"Upgrade: websocket\r\n"
+							"Connection: Upgrade\r\n"
+							"Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"
+							"\r\n";
+
+const std::string Request = "GET /control?var=framesize&val=5 HTTP/1.1\r\n"
+							"Host: 192.168.4.1\r\n"
+							"Connection: keep-alive\r\n"
+							"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+							"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+							"Referer: http://192.168.4.1/\r\n"
+							"Accept-Encoding: gzip, deflate\r\n"
+							"Accept-Language: en-US,en;q=0.9\r\n"
+							"\r\n";
+
+/// @return	MB/s parsing message over and over for Seconds.
+double measure(const std::string &message, HttpParserMode mode, bool fastPath, bool zeroCopy)
+{
+	HttpParser parser;
+	Sink sink;
+	parser.SetFastPath(fastPath);
+	parser.SetZeroCopy(zeroCopy);
+	parser.SetProcessHeader(HttpParser::ProcessHeaderDelegate(&sink, &Sink::Header));
+
+	HttpParser::HttpParserRoundtripper rt;
+	uint64_t bytes = 0;
+	Clock::time_point start = Clock::now();
+	double elapsed = 0;
+	do
+	{
+		for (int i = 0; i < 1000; i++)
+		{
+			parser.HttpInit(&rt, nullptr, mode);
+			int read = 0;
+			parser.HttpProcessData(&rt, message.data(), message.size(), &read);
+			bytes += read;
+		}
+		elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	} while (elapsed < Seconds);
+
+	return bytes / elapsed / 1e6;
+}
+
+#ifdef WITH_HTTP_PARSER
+int countData(http_parser *parser, const char *data, size_t length)
+{
+	++*static_cast<uint32_t *>(parser->data);
+	return 0;
+}
+
+/// @return	MB/s of the C parser, with callbacks as cheap as the ones above.
+double measureC(const std::string &message)
+{
+	http_parser_settings settings = {};
+	settings.on_url = countData;
+	settings.on_header_field = countData;
+	settings.on_header_value = countData;
+	settings.on_body = countData;
+
+	http_parser parser;
+	uint32_t calls = 0;
+	uint64_t bytes = 0;
+	Clock::time_point start = Clock::now();
+	double elapsed = 0;
+	do
+	{
+		for (int i = 0; i < 1000; i++)
+		{
+			http_parser_init(&parser, HTTP_REQUEST);
+			parser.data = &calls;
+			bytes += http_parser_execute(&parser, &settings, message.data(), message.size());
+		}
+		elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	} while (elapsed < Seconds);
+
+	return bytes / elapsed / 1e6;
+}
+#endif
+
+void report(const char *name, const std::string &message, HttpParserMode mode)
+{
+	double slow = measure(message, mode, false, false);
+	double fast = measure(message, mode, true, false);
+	double slowView = measure(message, mode, false, true);
+	double fastView = measure(message, mode, true, true);
+	printf("%-10s %4zu bytes  state machine %7.1f / %7.1f MB/s  fast path %7.1f / %7.1f MB/s (copy / view)\n", name,
+		   message.size(), slow, slowView, fast, fastView);
+}
+
+} // namespace
+
+int main()
+{
+	report("response", Response, HttpParserMode::Response);
+	report("upgrade", Upgrade, HttpParserMode::Response);
+	report("request", Request, HttpParserMode::Request);
+#ifdef WITH_HTTP_PARSER
+	printf("%-10s %4zu bytes  C http_parser %7.1f MB/s\n", "request", Request.size(), measureC(Request));
+#else
+	printf("C http_parser not built, point HTTP_PARSER at the directory holding http_parser.c\n");
+#endif
+	return 0;
+}
@@ -0,0 +1,237 @@
+// HttpParser with the bulk scanning fast path against the per character state machine,
+// and with header values passed as views against copies in the scratch. Every message is
+// fed in random pieces at random buffer alignments, both runs must make the same callbacks
+// with the same arguments and end in the same state.
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "HostTest.h"
+#include "HttpParser.h"
+
+using namespace Protocol;
+
+namespace
+{
+
+constexpr int CutsPerMessage = 400;
+
+struct Options
+{
+	bool FastPath;
+	bool ZeroCopy;
+};
+
+class Recorder
+{
+public:
+	std::string Log;
+
+	bool Code(void *opaque, uint32_t code)
+	{
+		Log += "C" + std::to_string(code) + "\n";
+		return true;
+	}
+
+	bool Header(void *opaque, const char *key, uint16_t nkey, const char *value, uint16_t nvalue)
+	{
+		Log += "H[" + std::string(key, nkey) + "]=[" + std::string(value, nvalue) + "]\n";
+		return true;
+	}
+
+	bool Body(HttpParser::HttpParserRoundtripper *rt, const char *data, uint16_t length)
+	{
+		// body pieces follow the cuts, only the bytes are compared
+		Log += std::string(data, length);
+		return true;
+	}
+
+	bool RequestLine(void *opaque, const HttpRequestLine &line)
+	{
+		Log += "L" + std::to_string(static_cast<int>(line.Method)) + "[" + std::string(line.MethodName, line.MethodLength) +
+			   "][" + std::string(line.Path, line.PathLength) + "][" + std::string(line.Query, line.QueryLength) +
+			   "]1." + std::to_string(line.VersionMinor) + "\n";
+		return true;
+	}
+
+	void Error(void *opaque, uint32_t error)
+	{
+		Log += "E" + std::to_string(error) + "\n";
+	}
+};
+
+/// @brief	Parses message in the pieces given by cuts, each one copied to a buffer at offset alignment.
+std::string parse(const std::string &message, HttpParserMode mode, Options options, const std::vector<size_t> &cuts,
+				  size_t alignment)
+{
+	HttpParser parser;
+	Recorder recorder;
+	parser.SetFastPath(options.FastPath);
+	parser.SetZeroCopy(options.ZeroCopy);
+	parser.SetProcessCode(HttpParser::ProcessCodeDelegate(&recorder, &Recorder::Code));
+	parser.SetProcessHeader(HttpParser::ProcessHeaderDelegate(&recorder, &Recorder::Header));
+	parser.SetAppendBody(HttpParser::AppendBodyDelegate(&recorder, &Recorder::Body));
+	parser.SetProcessRequestLine(HttpParser::ProcessRequestLineDelegate(&recorder, &Recorder::RequestLine));
+	parser.SetProcessError(HttpParser::ProcessErrorDelegate(&recorder, &Recorder::Error));
+
+	HttpParser::HttpParserRoundtripper rt;
+	parser.HttpInit(&rt, nullptr, mode);
+
+	std::vector<char> buffer(message.size() + 8);
+	size_t position = 0;
+	for (size_t cut = 0; cut <= cuts.size() && position < message.size(); cut++)
+	{
+		size_t end = cut < cuts.size() ? cuts[cut] : message.size();
+		if (end <= position)
+			continue;
+
+		// the previous piece is gone once the call returns, like a reused receive buffer
+		const int length = end - position;
+		char *piece = buffer.data() + (alignment + cut) % 4;
+		std::fill(buffer.begin(), buffer.end(), '#');
+		memcpy(piece, message.data() + position, length);
+		int read = 0;
+		int more = parser.HttpProcessData(&rt, piece, length, &read);
+		recorder.Log += "\nR" + std::to_string(more) + "\n";
+		position += read;
+		if (more == 0 || read < length)
+			break;
+	}
+	recorder.Log += "S" + std::to_string(static_cast<int>(rt.state)) + " " + std::to_string(position);
+	return recorder.Log;
+}
+
+struct Message
+{
+	HttpParserMode Mode;
+	std::string Text;
+};
+
+const std::vector<Message> &messages()
+{
+	static const std::vector<Message> corpus = {
+		{HttpParserMode::Response, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+								   "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n\r\n"},
+		{HttpParserMode::Response, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: 28\r\n"
+								   "Cache-Control: no-cache, no-store\r\n\r\n{\"framesize\":5,\"quality\":10}"},
+		{HttpParserMode::Response, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nX-Long: " + std::string(120, 'v') +
+									   "\r\n\r\n5\r\nhello\r\n1A\r\nabcdefghijklmnopqrstuvwxyz\r\n0\r\n\r\n"},
+		{HttpParserMode::Response, "HTTP/1.0 404 Not Found\nServer: gateway\nContent-Length: 0\n\n"},
+		{HttpParserMode::Response, "HTTP/1.1 200 OK\r\nX-Folded: first,\r\n\tsecond\r\nX-Tab:\tvalue\r\nACCEPT-RANGES: Bytes\r\n\r\n"
+								   "unknown length body"},
+		{HttpParserMode::Response, "HTTP/1.1 200 OK\r\nBad Header\r\n\r\n"},
+		{HttpParserMode::Response, "HTXP/1.1 200 OK\r\n\r\n"},
+		{HttpParserMode::Response, "HTTP/1.1 204 No Content\r\nDate: Mon, 19 Oct 2026 10:00:00 GMT\r\n\r\n"},
+		{HttpParserMode::Request, "GET /control?var=framesize&val=5 HTTP/1.1\r\nHost: 192.168.4.1\r\nConnection: keep-alive\r\n\r\n"},
+		{HttpParserMode::Request, "POST /config HTTP/1.0\r\nContent-Type: application/json\r\nContent-Length: 11\r\n\r\n{\"ssid\":\"\"}"},
+		{HttpParserMode::Request, "GET /ws HTTP/1.1\r\nUpgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+								  "Sec-WebSocket-Version: 13\r\n\r\n"},
+		{HttpParserMode::Request, "BREW /pot HTTP/1.1\r\n\r\n"},
+		{HttpParserMode::Request, "GET  /bad HTTP/1.1\r\n\r\n"},
+		{HttpParserMode::Request, "GET /x HTTP/2\r\n\r\n"},
+	};
+	return corpus;
+}
+
+/// @return	Number of messages and cuts where the two runs differ.
+int compare(Options left, Options right, uint32_t seed)
+{
+	std::mt19937 random(seed);
+	int differences = 0;
+	for (const Message &message : messages())
+	{
+		for (int round = 0; round < CutsPerMessage; round++)
+		{
+			std::vector<size_t> cuts;
+			int count = round == 0 ? 0 : round == 1 ? message.Text.size() : random() % 8;
+			for (int i = 0; i < count; i++)
+				cuts.push_back(round == 1 ? i + 1 : random() % (message.Text.size() + 1));
+			std::sort(cuts.begin(), cuts.end());
+			size_t alignment = random() % 4;
+
+			std::string expected = parse(message.Text, message.Mode, left, cuts, alignment);
+			std::string actual = parse(message.Text, message.Mode, right, cuts, alignment);
+			if (expected != actual)
+			{
+				if (differences++ == 0)
+					printf("first difference:\n%s\n---\n%s\n", expected.c_str(), actual.c_str());
+			}
+		}
+	}
+	return differences;
+}
+
+void testFastPath()
+{
+	CHECK(compare({false, false}, {true, false}, 1) == 0);
+	CHECK(compare({false, true}, {true, true}, 2) == 0);
+}
+
+void testZeroCopy()
+{
+	CHECK(compare({false, false}, {false, true}, 3) == 0);
+	CHECK(compare({true, false}, {true, true}, 4) == 0);
+}
+
+void testLongHeader()
+{
+	// longer than the whole scratch, only a view can carry it
+	const std::string value(HttpParser::ScratchSize + 200, 'k');
+	const std::string message = "HTTP/1.1 200 OK\r\nX-Long: " + value + "\r\nContent-Length: 0\r\n\r\n";
+	const std::string header = "H[x-long]=[" + value + "]\n";
+
+	std::string log = parse(message, HttpParserMode::Response, {true, true}, {}, 0);
+	CHECK(log.find(header) != std::string::npos);
+	CHECK(log.find("S5 ") != std::string::npos);
+	CHECK(parse(message, HttpParserMode::Response, {false, true}, {}, 1) == log);
+
+	// the copy can not hold it, and neither can a view split over two calls
+	log = parse(message, HttpParserMode::Response, {true, false}, {}, 0);
+	CHECK(log.find(header) == std::string::npos);
+	log = parse(message, HttpParserMode::Response, {true, true}, {message.find(value) + 10}, 0);
+	CHECK(log.find(header) == std::string::npos);
+}
+
+void testHeaderIndex()
+{
+	HttpParser parser;
+	HttpParser::HttpParserRoundtripper rt;
+	std::string message = "HTTP/1.1 101 Switching Protocols\r\nUPGRADE: websocket\r\nContent-Length: 0\r\n"
+						  "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nX-Other: 1\r\n"
+						  "Sec-WebSocket-Protocol: " + std::string(HttpHeaderIndex::ValueSize + 1, 'p') + "\r\n\r\n";
+	parser.HttpInit(&rt, nullptr);
+	int read = 0;
+	parser.HttpProcessData(&rt, message.data(), message.size(), &read);
+	// the index keeps copies, the receive buffer can be reused right away
+	message.assign(message.size(), '#');
+
+	const HttpHeaderIndex &index = parser.GetHeaderIndex();
+	CHECK(index.Get(HttpHeaderId::Upgrade) != nullptr && strcmp(index.Get(HttpHeaderId::Upgrade), "websocket") == 0);
+	CHECK(index.GetLength(HttpHeaderId::Upgrade) == 9);
+	CHECK(index.Get(HttpHeaderId::ContentLength) != nullptr && strcmp(index.Get(HttpHeaderId::ContentLength), "0") == 0);
+	CHECK(index.Get(HttpHeaderId::SecWebSocketAccept) != nullptr &&
+		  strcmp(index.Get(HttpHeaderId::SecWebSocketAccept), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0);
+	CHECK(!index.Has(HttpHeaderId::SecWebSocketKey) && index.Get(HttpHeaderId::SecWebSocketKey) == nullptr);
+	CHECK(!index.IsTruncated(HttpHeaderId::Upgrade));
+	CHECK(index.IsTruncated(HttpHeaderId::SecWebSocketProtocol));
+	CHECK(index.GetLength(HttpHeaderId::SecWebSocketProtocol) == HttpHeaderIndex::ValueSize);
+
+	CHECK(HttpHeaderIndex::Lookup("sec-websocket-key", 17) == HttpHeaderId::SecWebSocketKey);
+	CHECK(HttpHeaderIndex::Lookup("x-other", 7) == HttpHeaderId::Unknown);
+
+	// a new message starts with an empty index
+	parser.HttpInit(&rt, nullptr);
+	CHECK(!index.Has(HttpHeaderId::Upgrade));
+}
+
+} // namespace
+
+int main()
+{
+	testFastPath();
+	testZeroCopy();
+	testLongHeader();
+	testHeaderIndex();
+	return HostTest::Finish("HttpParserDifferential");
+}
@@ -0,0 +1,199 @@
+// HttpParser in request mode: method, path, query and version from the request line,
+// bodies only with Content-Length or chunked encoding, and pipelined requests.
+
+#include <string>
+#include <vector>
+#include "HostTest.h"
+#include "HttpParser.h"
+
+using namespace Protocol;
+
+namespace
+{
+
+struct Request
+{
+	HttpMethod Method = HttpMethod::Unknown;
+	std::string MethodName;
+	std::string Path;
+	std::string Query;
+	int VersionMinor = -1;
+	bool PathIsView = false;
+	std::string Body;
+};
+
+class Collector
+{
+public:
+	std::vector<Request> Requests;
+	const char *Buffer = nullptr;
+	size_t BufferSize = 0;
+
+	bool RequestLine(void *opaque, const HttpRequestLine &line)
+	{
+		Request request;
+		request.Method = line.Method;
+		request.MethodName.assign(line.MethodName, line.MethodLength);
+		request.Path.assign(line.Path, line.PathLength);
+		request.Query.assign(line.Query, line.QueryLength);
+		request.VersionMinor = line.VersionMinor;
+		request.PathIsView = line.Path >= Buffer && line.Path < Buffer + BufferSize;
+		Requests.push_back(request);
+		return true;
+	}
+
+	bool Body(HttpParser::HttpParserRoundtripper *rt, const char *data, uint16_t length)
+	{
+		Requests.back().Body.append(data, length);
+		return true;
+	}
+};
+
+/// @brief	Parses all requests in text, one after the other like a server does.
+/// @return	The state the last request ended in.
+HttpParser::HttpRoundtripperState parse(const std::string &text, Collector &collector, bool fastPath = true)
+{
+	HttpParser parser;
+	parser.SetFastPath(fastPath);
+	parser.SetProcessRequestLine(HttpParser::ProcessRequestLineDelegate(&collector, &Collector::RequestLine));
+	parser.SetAppendBody(HttpParser::AppendBodyDelegate(&collector, &Collector::Body));
+	collector.Buffer = text.data();
+	collector.BufferSize = text.size();
+
+	HttpParser::HttpParserRoundtripper rt = {};
+	const char *data = text.data();
+	int size = text.size();
+	while (size > 0)
+	{
+		parser.HttpInit(&rt, nullptr, HttpParserMode::Request);
+		int read = 0;
+		parser.HttpProcessData(&rt, data, size, &read);
+		if (rt.state != HttpParser::HttpRoundtripperState::http_roundtripper_close)
+			break;
+		data += read;
+		size -= read;
+	}
+	return rt.state;
+}
+
+void testRequestLine()
+{
+	for (bool fastPath : {false, true})
+	{
+		Collector collector;
+		CHECK(parse("GET /control?var=framesize&val=5 HTTP/1.1\r\nHost: 192.168.4.1\r\n\r\n", collector, fastPath) ==
+			  HttpParser::HttpRoundtripperState::http_roundtripper_close);
+		CHECK(collector.Requests.size() == 1);
+		const Request &request = collector.Requests[0];
+		CHECK(request.Method == HttpMethod::Get && request.MethodName == "GET");
+		CHECK(request.Path == "/control" && request.Query == "var=framesize&val=5");
+		CHECK(request.VersionMinor == 1);
+		// a request line in one piece is never copied
+		CHECK(request.PathIsView);
+	}
+
+	const struct
+	{
+		const char *Name;
+		HttpMethod Method;
+	} methods[] = {
+		{"GET", HttpMethod::Get},
+		{"HEAD", HttpMethod::Head},
+		{"POST", HttpMethod::Post},
+		{"PUT", HttpMethod::Put},
+		{"DELETE", HttpMethod::Delete},
+		{"OPTIONS", HttpMethod::Options},
+		{"PATCH", HttpMethod::Patch},
+		{"BREW", HttpMethod::Unknown},
+	};
+	for (const auto &method : methods)
+	{
+		Collector collector;
+		parse(std::string(method.Name) + " /status HTTP/1.0\n\n", collector);
+		CHECK(collector.Requests.size() == 1 && collector.Requests[0].Method == method.Method);
+		CHECK(collector.Requests.size() == 1 && collector.Requests[0].VersionMinor == 0);
+	}
+
+	Collector collector;
+	parse("GET /? HTTP/1.1\r\n\r\nGET * HTTP/1.1\r\n\r\n", collector);
+	CHECK(collector.Requests.size() == 2);
+	CHECK(collector.Requests.size() == 2 && collector.Requests[0].Path == "/" && collector.Requests[0].Query.empty());
+	CHECK(collector.Requests.size() == 2 && collector.Requests[1].Path == "*");
+}
+
+void testInvalidRequestLine()
+{
+	const char *invalid[] = {
+		"GET  /double-space HTTP/1.1\r\n\r\n",
+		"GET /x HTTP/2\r\n\r\n",
+		"GET /x HTTP/1.x\r\n\r\n",
+		"GET /x\r\n\r\n",
+		" /x HTTP/1.1\r\n\r\n",
+		"GET /x FTP/1.1\r\n\r\n",
+	};
+	for (const char *text : invalid)
+	{
+		Collector collector;
+		// a line the character table already refuses ends as a plain error
+		HttpParser::HttpRoundtripperState state = parse(text, collector);
+		CHECK(state == HttpParser::HttpRoundtripperState::http_roundtripper_start_line_is_invalid ||
+			  state == HttpParser::HttpRoundtripperState::http_roundtripper_error);
+		CHECK(collector.Requests.empty());
+	}
+}
+
+void testBodies()
+{
+	Collector collector;
+	CHECK(parse("POST /config HTTP/1.1\r\nContent-Length: 11\r\n\r\n{\"ssid\":\"\"}"
+				"PUT /config HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n4\r\nabcd\r\n3\r\nefg\r\n0\r\n\r\n"
+				"POST /empty HTTP/1.1\r\n\r\n"
+				"GET /after HTTP/1.1\r\n\r\n",
+				collector) == HttpParser::HttpRoundtripperState::http_roundtripper_close);
+	CHECK(collector.Requests.size() == 4);
+	if (collector.Requests.size() != 4)
+		return;
+
+	CHECK(collector.Requests[0].Body == "{\"ssid\":\"\"}");
+	CHECK(collector.Requests[1].Body == "abcdefg");
+	// no length means no body, the next request is not taken for one
+	CHECK(collector.Requests[2].Body.empty());
+	CHECK(collector.Requests[3].Path == "/after");
+}
+
+void testSplitRequestLine()
+{
+	// cut inside the target, the line continues in the scratch and the views point there
+	const std::string text = "GET /stream?quality=10 HTTP/1.1\r\n\r\n";
+	for (size_t cut = 1; cut < text.size(); cut++)
+	{
+		HttpParser parser;
+		Collector collector;
+		parser.SetProcessRequestLine(HttpParser::ProcessRequestLineDelegate(&collector, &Collector::RequestLine));
+		HttpParser::HttpParserRoundtripper rt;
+		parser.HttpInit(&rt, nullptr, HttpParserMode::Request);
+
+		std::string first = text.substr(0, cut);
+		std::string second = text.substr(cut);
+		int read = 0;
+		parser.HttpProcessData(&rt, first.data(), first.size(), &read);
+		first.assign(first.size(), '#');
+		parser.HttpProcessData(&rt, second.data(), second.size(), &read);
+
+		CHECK(collector.Requests.size() == 1);
+		CHECK(collector.Requests.size() == 1 && collector.Requests[0].Path == "/stream" &&
+			  collector.Requests[0].Query == "quality=10");
+		CHECK(rt.state == HttpParser::HttpRoundtripperState::http_roundtripper_close);
+	}
+}
+
+} // namespace
+
+int main()
+{
+	testRequestLine();
+	testInvalidRequestLine();
+	testBodies();
+	testSplitRequestLine();
+	return HostTest::Finish("HttpParserRequest");
+}
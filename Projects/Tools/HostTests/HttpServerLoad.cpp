@@ -0,0 +1,153 @@
+// Load on HttpServer over loopback: one keep-alive client per connection slot, each
+// sending short GETs back to back. Reports requests/s and latency percentiles, and the
+// same once more with a new connection for every request to show what keep-alive saves.
+
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "HttpServer.h"
+
+using namespace Applications;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr uint16_t Port = 28081;
+constexpr int RequestsPerClient = 5000;
+
+class Routes
+{
+public:
+	void Ping(const HttpRequestInfo &request, HttpResponseInfo &response)
+	{
+		response.BodyLength = snprintf(response.Body, response.BodySize, "{\"uptime\":%u}", Hal::Hardware::Instance()->Milliseconds());
+	}
+};
+
+Routes routes;
+
+int connectClient()
+{
+	int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+	int noDelay = 1;
+	setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+	struct sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(Port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	for (int attempt = 0; attempt < 50; attempt++)
+	{
+		if (connect(socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0)
+			return socket;
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+	close(socket);
+	return -1;
+}
+
+/// @brief	Sends one request and reads until the end of its response, false if the server closed.
+bool exchange(int socket, const std::string &request)
+{
+	if (send(socket, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<int>(request.size()))
+		return false;
+
+	std::string response;
+	for (;;)
+	{
+		char buffer[1024];
+		int length = recv(socket, buffer, sizeof(buffer), 0);
+		if (length <= 0)
+			return false;
+		response.append(buffer, length);
+
+		size_t end = response.find("\r\n\r\n");
+		size_t field = response.find("Content-Length: ");
+		if (end != std::string::npos && field != std::string::npos &&
+			response.size() >= end + 4 + atoi(response.c_str() + field + 16))
+			return true;
+	}
+}
+
+void report(const char *name, std::vector<double> &latencies, double seconds, int failures)
+{
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&](double p) {
+		return latencies.empty() ? 0.0 : latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+	};
+	printf("%-12s %7zu requests %9.0f req/s  p50 %6.1f us  p90 %6.1f us  p99 %6.1f us  max %7.1f us  failed %d\n",
+		   name, latencies.size(), latencies.size() / seconds, percentile(0.5), percentile(0.9), percentile(0.99),
+		   latencies.empty() ? 0.0 : latencies.back(), failures);
+}
+
+void run(const char *name, bool keepAlive)
+{
+	const std::string request = keepAlive ? "GET /ping HTTP/1.1\r\nHost: camera\r\n\r\n"
+										  : "GET /ping HTTP/1.1\r\nHost: camera\r\nConnection: close\r\n\r\n";
+	std::vector<std::vector<double>> latencies(HttpServer::MaxConnections);
+	std::vector<int> failures(HttpServer::MaxConnections);
+	std::vector<std::thread> clients;
+
+	Clock::time_point start = Clock::now();
+	for (int client = 0; client < HttpServer::MaxConnections; client++)
+	{
+		clients.emplace_back([&, client] {
+			int socket = keepAlive ? connectClient() : -1;
+			for (int i = 0; i < RequestsPerClient; i++)
+			{
+				Clock::time_point sent = Clock::now();
+				if (socket < 0)
+					socket = connectClient();
+				bool served = exchange(socket, request);
+				if (served)
+					latencies[client].push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+				else
+					failures[client]++;
+
+				if (!served || !keepAlive)
+				{
+					close(socket);
+					socket = -1;
+				}
+			}
+			if (socket >= 0)
+				close(socket);
+		});
+	}
+	for (std::thread &client : clients)
+		client.join();
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::vector<double> all;
+	int failed = 0;
+	for (int client = 0; client < HttpServer::MaxConnections; client++)
+	{
+		all.insert(all.end(), latencies[client].begin(), latencies[client].end());
+		failed += failures[client];
+	}
+	report(name, all, seconds, failed);
+}
+
+} // namespace
+
+int main()
+{
+	signal(SIGPIPE, SIG_IGN);
+
+	HttpServer server(Port);
+	server.AddRoute("/ping", fastdelegate::MakeDelegate(&routes, &Routes::Ping));
+	server.Start();
+
+	printf("%d clients, %d short GETs each\n", HttpServer::MaxConnections, RequestsPerClient);
+	run("keep-alive", true);
+	run("close", false);
+
+	// the server task never returns, it goes down with the process
+	fflush(stdout);
+	_exit(0);
+}
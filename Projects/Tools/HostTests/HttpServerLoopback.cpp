@@ -0,0 +1,254 @@
+// HttpServer on a loopback port, driven by plain sockets. One client stops reading while
+// hundreds of responses are queued for it, the others must be served meanwhile and the
+// stalled client must get every response, complete and in order, once it reads again.
+
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include "HostTest.h"
+#include "HttpServer.h"
+
+using namespace Applications;
+
+namespace
+{
+
+constexpr uint16_t Port = 28080;
+constexpr int StalledRequests = 4000;
+
+class Routes
+{
+public:
+	void Echo(const HttpRequestInfo &request, HttpResponseInfo &response)
+	{
+		response.BodyLength = snprintf(response.Body, response.BodySize, "%s:", request.Query);
+		if (request.Body != nullptr && request.BodyLength <= response.BodySize - response.BodyLength)
+		{
+			memcpy(response.Body + response.BodyLength, request.Body, request.BodyLength);
+			response.BodyLength += request.BodyLength;
+		}
+	}
+
+	void Large(const HttpRequestInfo &request, HttpResponseInfo &response)
+	{
+		// the query leads a body close to the largest one, so a lost or repeated piece shows
+		response.BodyLength = snprintf(response.Body, response.BodySize, "%s:", request.Query);
+		memset(response.Body + response.BodyLength, 'x', response.BodySize - response.BodyLength);
+		response.BodyLength = response.BodySize;
+	}
+};
+
+Routes routes;
+
+int connectClient(int receiveBuffer = 0)
+{
+	int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+	if (receiveBuffer != 0)
+		setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+
+	struct sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(Port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	for (int attempt = 0; attempt < 50; attempt++)
+	{
+		if (connect(socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0)
+		{
+			struct timeval timeout = {3, 0};
+			setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			return socket;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+	close(socket);
+	return -1;
+}
+
+void sendText(int socket, const std::string &text)
+{
+	send(socket, text.data(), text.size(), MSG_NOSIGNAL);
+}
+
+struct Response
+{
+	int Status = 0;
+	std::string Headers;
+	std::string Body;
+};
+
+/// @brief	Reads one response, bytes behind it stay in pending for the next call.
+bool readResponse(int socket, std::string &pending, Response &response)
+{
+	size_t end;
+	while ((end = pending.find("\r\n\r\n")) == std::string::npos)
+	{
+		char buffer[4096];
+		int length = recv(socket, buffer, sizeof(buffer), 0);
+		if (length <= 0)
+			return false;
+		pending.append(buffer, length);
+	}
+
+	response.Headers = pending.substr(0, end + 4);
+	response.Status = atoi(response.Headers.c_str() + 9);
+	size_t field = response.Headers.find("Content-Length: ");
+	size_t bodyLength = field == std::string::npos ? 0 : atoi(response.Headers.c_str() + field + 16);
+	while (pending.size() < end + 4 + bodyLength)
+	{
+		char buffer[4096];
+		int length = recv(socket, buffer, sizeof(buffer), 0);
+		if (length <= 0)
+			return false;
+		pending.append(buffer, length);
+	}
+
+	response.Body = pending.substr(end + 4, bodyLength);
+	pending.erase(0, end + 4 + bodyLength);
+	return true;
+}
+
+bool isClosed(int socket)
+{
+	char byte;
+	return recv(socket, &byte, 1, 0) == 0;
+}
+
+void testPipelinedBodies()
+{
+	int socket = connectClient();
+	CHECK(socket >= 0);
+	// split inside the second body, it is completed by the next receive
+	sendText(socket, "GET /echo?1 HTTP/1.1\r\n\r\n"
+					 "POST /echo?2 HTTP/1.1\r\nContent-Length: 11\r\n\r\nhello");
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	sendText(socket, " world"
+					 "POST /echo?3 HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n"
+					 "GET /missing HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+	std::string pending;
+	Response response;
+	CHECK(readResponse(socket, pending, response) && response.Status == 200 && response.Body == "1:");
+	CHECK(readResponse(socket, pending, response) && response.Status == 200 && response.Body == "2:hello world");
+	CHECK(readResponse(socket, pending, response) && response.Status == 200 && response.Body == "3:abcde");
+	CHECK(readResponse(socket, pending, response) && response.Status == 404);
+	CHECK(response.Headers.find("Connection: close") != std::string::npos);
+	CHECK(isClosed(socket));
+	close(socket);
+}
+
+void testBodyTooLarge()
+{
+	int socket = connectClient();
+	CHECK(socket >= 0);
+	std::string request = "POST /echo HTTP/1.1\r\nContent-Length: " + std::to_string(HttpServer::MaxBodySize + 1) + "\r\n\r\n";
+	sendText(socket, request + std::string(HttpServer::MaxBodySize + 1, 'b'));
+
+	std::string pending;
+	Response response;
+	CHECK(readResponse(socket, pending, response) && response.Status == 413);
+	CHECK(isClosed(socket));
+	close(socket);
+
+	// a chunked body gives no size up front, it is refused once it outgrows the buffer
+	socket = connectClient();
+	CHECK(socket >= 0);
+	sendText(socket, "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n");
+	for (int chunk = 0; chunk < 3; chunk++)
+		sendText(socket, "100\r\n" + std::string(0x100, 'c') + "\r\n");
+
+	pending.clear();
+	CHECK(readResponse(socket, pending, response) && response.Status == 413);
+	CHECK(isClosed(socket));
+	close(socket);
+
+	// the largest body still fits
+	socket = connectClient();
+	CHECK(socket >= 0);
+	request = "POST /echo HTTP/1.1\r\nContent-Length: " + std::to_string(HttpServer::MaxBodySize) + "\r\n\r\n";
+	sendText(socket, request + std::string(HttpServer::MaxBodySize, 'b'));
+	pending.clear();
+	CHECK(readResponse(socket, pending, response) && response.Status == 200);
+	CHECK(response.Body.size() == HttpServer::MaxBodySize + 1);
+	close(socket);
+}
+
+void testStalledClient()
+{
+	// a small receive window, the server's socket buffer fills after a few responses
+	int stalled = connectClient(4096);
+	CHECK(stalled >= 0);
+	std::string requests;
+	for (int i = 0; i < StalledRequests; i++)
+		requests += "GET /large?" + std::to_string(i) + " HTTP/1.1\r\n\r\n";
+
+	// the server stops reading once a response is stuck, so the requests are pushed from another thread
+	std::thread writer([&] {
+		size_t offset = 0;
+		while (offset < requests.size())
+		{
+			int sent = send(stalled, requests.data() + offset, requests.size() - offset, MSG_NOSIGNAL);
+			if (sent <= 0)
+				break;
+			offset += sent;
+		}
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	// the other slots are served right away while the stalled one waits for room
+	for (int i = 0; i < 3; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		int socket = connectClient();
+		CHECK(socket >= 0);
+		sendText(socket, "GET /echo?other HTTP/1.1\r\n\r\n");
+		std::string pending;
+		Response response;
+		CHECK(readResponse(socket, pending, response) && response.Body == "other:");
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+		CHECK(elapsed.count() < 300);
+		close(socket);
+	}
+
+	// every response arrives once the client reads, complete and in request order
+	std::string pending;
+	Response response;
+	int received = 0;
+	size_t bodyLength = 0;
+	while (received < StalledRequests && readResponse(stalled, pending, response))
+	{
+		std::string expected = std::to_string(received) + ":";
+		if (received == 0)
+			bodyLength = response.Body.size();
+		if (response.Status != 200 || response.Body.size() != bodyLength || response.Body.back() != 'x' ||
+			response.Body.compare(0, expected.size(), expected) != 0)
+			break;
+		received++;
+	}
+	CHECK(received == StalledRequests);
+	writer.join();
+	close(stalled);
+}
+
+} // namespace
+
+int main()
+{
+	signal(SIGPIPE, SIG_IGN);
+
+	HttpServer server(Port);
+	server.AddRoute("/echo", fastdelegate::MakeDelegate(&routes, &Routes::Echo));
+	server.AddRoute("/large", fastdelegate::MakeDelegate(&routes, &Routes::Large));
+	server.Start();
+
+	testPipelinedBodies();
+	testBodyTooLarge();
+	testStalledClient();
+
+	// the server task never returns, it goes down with the process
+	int result = HostTest::Finish("HttpServerLoopback");
+	fflush(stdout);
+	_exit(result);
+}
@@ -0,0 +1,221 @@
+// The two ways StreamBroadcaster has written an MJPEG part: part header, JPEG and boundary as
+// up to three send() calls, and as one sendmsg() over an iovec. Both resume after partial
+// writes from a byte offset the way sendPending() does. Over a socketpair and over loopback
+// TCP with TCP_NODELAY and a 1436 byte MSS, where TCP_INFO tells the segments per frame.
+
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+// the kernel's own struct tcp_info, glibc's lacks the segment counters
+#include <linux/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr uint16_t Port = 28085;
+constexpr int Frames = 2000;
+constexpr int Mss = 1436;
+const char Boundary[] = "\r\n--123456789000000000000987654321\r\n";
+
+struct Part
+{
+	char Header[64];
+	size_t HeaderLength;
+	const uint8_t *Jpeg;
+	size_t JpegLength;
+};
+
+size_t total(const Part &part)
+{
+	return part.HeaderLength + part.JpegLength + strlen(Boundary);
+}
+
+/// @brief	The writes before the change: one send() per piece, each resumed from the offset.
+ssize_t writeSeparately(int socket, const Part &part, size_t offset)
+{
+	const size_t boundaryLength = strlen(Boundary);
+	const uint8_t *data;
+	size_t length;
+	if (offset < part.HeaderLength)
+	{
+		data = reinterpret_cast<const uint8_t *>(part.Header) + offset;
+		length = part.HeaderLength - offset;
+	}
+	else if (offset < part.HeaderLength + part.JpegLength)
+	{
+		data = part.Jpeg + offset - part.HeaderLength;
+		length = part.JpegLength - (offset - part.HeaderLength);
+	}
+	else
+	{
+		data = reinterpret_cast<const uint8_t *>(Boundary) + offset - part.HeaderLength - part.JpegLength;
+		length = boundaryLength - (offset - part.HeaderLength - part.JpegLength);
+	}
+	return send(socket, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+/// @brief	The write after the change: what is left of the three pieces in one sendmsg().
+ssize_t writeVectored(int socket, const Part &part, size_t offset)
+{
+	const uint8_t *pieces[3] = {reinterpret_cast<const uint8_t *>(part.Header), part.Jpeg, reinterpret_cast<const uint8_t *>(Boundary)};
+	const size_t lengths[3] = {part.HeaderLength, part.JpegLength, strlen(Boundary)};
+	struct iovec vectors[3];
+	int count = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		if (offset >= lengths[i])
+		{
+			offset -= lengths[i];
+			continue;
+		}
+		vectors[count].iov_base = const_cast<uint8_t *>(pieces[i] + offset);
+		vectors[count].iov_len = lengths[i] - offset;
+		count++;
+		offset = 0;
+	}
+	struct msghdr message = {};
+	message.msg_iov = vectors;
+	message.msg_iovlen = count;
+	return sendmsg(socket, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+uint64_t segmentsOut(int socket)
+{
+	struct tcp_info info = {};
+	socklen_t length = sizeof(info);
+	if (getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &length) != 0)
+		return 0;
+	return info.tcpi_segs_out;
+}
+
+/// @brief	Socket pairs that carry the stream, [0] writes and [1] reads.
+bool openTcp(int sockets[2])
+{
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	int mss = Mss;
+	setsockopt(listener, IPPROTO_TCP, TCP_MAXSEG, &mss, sizeof(mss));
+	struct sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(Port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listener, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 1) != 0)
+	{
+		close(listener);
+		return false;
+	}
+
+	sockets[1] = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(sockets[1], IPPROTO_TCP, TCP_MAXSEG, &mss, sizeof(mss));
+	if (connect(sockets[1], reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0)
+	{
+		close(listener);
+		close(sockets[1]);
+		return false;
+	}
+	sockets[0] = accept(listener, nullptr, nullptr);
+	close(listener);
+
+	// the camera turns Nagle off for the stream, every write leaves as soon as it can
+	int noDelay = 1;
+	setsockopt(sockets[0], IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	return sockets[0] >= 0;
+}
+
+template <typename Write>
+void run(const char *transport, const char *name, bool tcp, const std::vector<uint8_t> &jpeg, Write write)
+{
+	int sockets[2];
+	if (tcp ? !openTcp(sockets) : socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+	{
+		printf("%s: no connection\n", transport);
+		return;
+	}
+	// a send buffer about lwIP's size and a reader taking a segment at a time, so parts are cut
+	// by partial writes as on the device; a receive window that small stalls Linux for 200 ms
+	int sendBuffer = 8 * 1024;
+	setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+
+	uint64_t received = 0;
+	std::thread reader([&] {
+		std::vector<uint8_t> buffer(Mss);
+		ssize_t length;
+		while ((length = recv(sockets[1], buffer.data(), buffer.size(), 0)) > 0)
+			received += length;
+	});
+
+	Part part = {};
+	part.Jpeg = jpeg.data();
+	part.JpegLength = jpeg.size();
+	part.HeaderLength = snprintf(part.Header, sizeof(part.Header), "Content-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n", jpeg.size());
+
+	uint64_t calls = 0;
+	uint64_t partial = 0;
+	uint64_t bytes = 0;
+	const uint64_t segmentsBefore = tcp ? segmentsOut(sockets[0]) : 0;
+	Clock::time_point start = Clock::now();
+	for (int frame = 0; frame < Frames; frame++)
+	{
+		const size_t length = total(part);
+		for (size_t offset = 0; offset < length;)
+		{
+			ssize_t sent = write(sockets[0], part, offset);
+			if (sent < 0)
+			{
+				// the send loop waits for the socket the same way
+				struct pollfd writable = {sockets[0], POLLOUT, 0};
+				poll(&writable, 1, 100);
+				continue;
+			}
+			calls++;
+			offset += sent;
+			if (offset < length && (offset != part.HeaderLength && offset != part.HeaderLength + part.JpegLength))
+				partial++;
+		}
+		bytes += length;
+	}
+	shutdown(sockets[0], SHUT_WR);
+	reader.join();
+	const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	const uint64_t segments = tcp ? segmentsOut(sockets[0]) - segmentsBefore : 0;
+	close(sockets[0]);
+	close(sockets[1]);
+
+	printf("%-10s %-10s %6.2f calls/frame %5.2f partial  ", transport, name, static_cast<double>(calls) / Frames,
+		   static_cast<double>(partial) / Frames);
+	if (tcp)
+		printf("%6.2f segments/frame  ", static_cast<double>(segments) / Frames);
+	printf("%7.1f MB/s%s\n", bytes / seconds / 1e6, received == bytes ? "" : "  lost bytes");
+}
+
+} // namespace
+
+int main()
+{
+	// the sizes of a QVGA and an SVGA frame at the default quality
+	for (size_t size : {9000, 32000})
+	{
+		std::vector<uint8_t> jpeg(size);
+		for (size_t i = 0; i < jpeg.size(); i++)
+			jpeg[i] = i * 31 + (i >> 9);
+
+		printf("%zu byte JPEG, %d frames\n", size, Frames);
+		run("socketpair", "3 x send", false, jpeg, writeSeparately);
+		run("socketpair", "sendmsg", false, jpeg, writeVectored);
+		run("tcp", "3 x send", true, jpeg, writeSeparately);
+		run("tcp", "sendmsg", true, jpeg, writeVectored);
+	}
+	return 0;
+}
@@ -0,0 +1,129 @@
+// BlobLabeller, BlobTracker and ZoneMonitor per frame at QVGA and VGA: a quiet mask, a few
+// people sized blobs walking through, the same with sensor noise sprinkled over it, and a
+// noise storm that runs out of runs. Reports the time per frame and the frame rate it allows.
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "MotionBlobs.h"
+
+using namespace Hal;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr int Frames = 64;
+constexpr double Seconds = 0.5;
+
+struct Scene
+{
+	const char *Name;
+	int Walkers;
+	double Noise;
+};
+
+/// @brief	Frames of a scene, walkers are ellipses moving right, noise is single pixels.
+std::vector<std::vector<uint8_t>> makeFrames(uint16_t width, uint16_t height, const Scene &scene)
+{
+	std::mt19937 random(7);
+	std::bernoulli_distribution noise(scene.Noise);
+	std::vector<std::vector<uint8_t>> frames(Frames, std::vector<uint8_t>(static_cast<size_t>(width) * height));
+	for (int frame = 0; frame < Frames; frame++)
+	{
+		std::vector<uint8_t> &mask = frames[frame];
+		for (int walker = 0; walker < scene.Walkers; walker++)
+		{
+			const int radiusX = width / 32;
+			const int radiusY = height / 8;
+			const int centreX = (walker * width / 3 + frame * width / 96) % width;
+			const int centreY = height / 2 + (walker % 2 ? radiusY : -radiusY);
+			for (int y = std::max(centreY - radiusY, 0); y <= std::min(centreY + radiusY, height - 1); y++)
+			{
+				for (int x = std::max(centreX - radiusX, 0); x <= std::min(centreX + radiusX, width - 1); x++)
+				{
+					const double dx = static_cast<double>(x - centreX) / radiusX;
+					const double dy = static_cast<double>(y - centreY) / radiusY;
+					if (dx * dx + dy * dy <= 1)
+						mask[y * width + x] = 1;
+				}
+			}
+		}
+		if (scene.Noise > 0)
+		{
+			for (uint8_t &pixel : mask)
+				pixel |= noise(random);
+		}
+	}
+	return frames;
+}
+
+void report(uint16_t width, uint16_t height, const Scene &scene)
+{
+	static BlobLabeller labeller;
+	static BlobTracker tracker;
+	static ZoneMonitor zones;
+	const std::vector<std::vector<uint8_t>> frames = makeFrames(width, height, scene);
+	const ZonePoint door[] = {{static_cast<uint16_t>(width / 3), 0},
+							  {static_cast<uint16_t>(width * 2 / 3), 0},
+							  {static_cast<uint16_t>(width * 2 / 3), height},
+							  {static_cast<uint16_t>(width / 3), height}};
+	zones.SetZone(0, door, 4);
+	tracker.Reset();
+
+	// noise specks stay under the area filter
+	const uint32_t minArea = width * height / 1000;
+	uint64_t labelled = 0;
+	uint64_t runs = 0;
+	uint32_t blobs = 0;
+	uint32_t events = 0;
+	bool truncated = false;
+	double labelTime = 0;
+	double trackTime = 0;
+	Clock::time_point start = Clock::now();
+	do
+	{
+		for (const std::vector<uint8_t> &mask : frames)
+		{
+			Clock::time_point before = Clock::now();
+			blobs += labeller.Label(mask.data(), width, height, width, minArea);
+			Clock::time_point between = Clock::now();
+			tracker.Update(labeller);
+			events += zones.Update(tracker);
+			Clock::time_point after = Clock::now();
+
+			labelTime += std::chrono::duration<double, std::micro>(between - before).count();
+			trackTime += std::chrono::duration<double, std::micro>(after - between).count();
+			runs += labeller.GetRunCount();
+			truncated |= labeller.IsTruncated();
+			labelled++;
+		}
+	} while (std::chrono::duration<double>(Clock::now() - start).count() < Seconds);
+
+	const double perFrame = (labelTime + trackTime) / labelled;
+	printf("%3ux%-3u %-14s label %8.1f us  track+zones %5.1f us  %7.0f fps  %6.0f runs %4.1f blobs %5.2f events per frame%s\n",
+		   width, height, scene.Name, labelTime / labelled, trackTime / labelled, 1e6 / perFrame,
+		   static_cast<double>(runs) / labelled, static_cast<double>(blobs) / labelled, static_cast<double>(events) / labelled,
+		   truncated ? "  truncated" : "");
+}
+
+} // namespace
+
+int main()
+{
+	const Scene scenes[] = {
+		{"empty", 0, 0},
+		{"3 walkers", 3, 0},
+		{"3 walkers 0.2%", 3, 0.002},
+		{"noise 5%", 0, 0.05},
+	};
+	printf("BlobLabeller keeps %u runs and %u blobs, %zu bytes\n", BlobLabeller::MaxRuns, BlobLabeller::MaxBlobs,
+		   sizeof(BlobLabeller));
+	for (const auto &size : {std::make_pair(320, 240), std::make_pair(640, 480)})
+	{
+		for (const Scene &scene : scenes)
+			report(size.first, size.second, scene);
+	}
+	return 0;
+}
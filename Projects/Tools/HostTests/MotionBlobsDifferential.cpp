@@ -0,0 +1,302 @@
+// BlobLabeller against a per pixel flood fill on random masks: both have to find the same
+// blobs with the same areas, centroids and bounding boxes. Then BlobTracker and ZoneMonitor
+// on a blob walking through a zone.
+
+#include <algorithm>
+#include <random>
+#include <tuple>
+#include <vector>
+#include "HostTest.h"
+#include "MotionBlobs.h"
+
+using namespace Hal;
+
+namespace
+{
+
+constexpr int Rounds = 2000;
+
+struct Mask
+{
+	uint16_t Width;
+	uint16_t Height;
+	uint16_t Stride;
+	std::vector<uint8_t> Pixels;
+
+	Mask(uint16_t width, uint16_t height, uint16_t padding = 0)
+		: Width(width), Height(height), Stride(width + padding), Pixels(static_cast<size_t>(width + padding) * height)
+	{
+		Clear();
+	}
+
+	/// @brief	Clears the mask, the padding is filled and must never be taken for motion.
+	void Clear()
+	{
+		std::fill(Pixels.begin(), Pixels.end(), 0);
+		for (uint16_t y = 0; y < Height; y++)
+			std::fill_n(Pixels.data() + static_cast<size_t>(y) * Stride + Width, Stride - Width, 0xFF);
+	}
+
+	uint8_t &At(int x, int y)
+	{
+		return Pixels[static_cast<size_t>(y) * Stride + x];
+	}
+
+	void Fill(int left, int top, int right, int bottom)
+	{
+		for (int y = std::max(top, 0); y <= std::min(bottom, Height - 1); y++)
+			for (int x = std::max(left, 0); x <= std::min(right, Width - 1); x++)
+				At(x, y) = 1;
+	}
+};
+
+auto key(const Blob &blob)
+{
+	return std::make_tuple(blob.Area, blob.CentroidX, blob.CentroidY, blob.Left, blob.Top, blob.Right, blob.Bottom);
+}
+
+/// @brief	8-connected flood fill, one pixel at a time.
+std::vector<Blob> reference(Mask &mask, uint32_t minArea)
+{
+	std::vector<uint8_t> seen(static_cast<size_t>(mask.Width) * mask.Height);
+	std::vector<std::pair<int, int>> stack;
+	std::vector<Blob> blobs;
+	for (int y = 0; y < mask.Height; y++)
+	{
+		for (int x = 0; x < mask.Width; x++)
+		{
+			if (mask.At(x, y) == 0 || seen[y * mask.Width + x])
+				continue;
+
+			uint64_t sumX = 0;
+			uint64_t sumY = 0;
+			Blob blob = {0, 0, 0, static_cast<uint16_t>(x), static_cast<uint16_t>(y), static_cast<uint16_t>(x), static_cast<uint16_t>(y)};
+			seen[y * mask.Width + x] = 1;
+			stack.emplace_back(x, y);
+			while (!stack.empty())
+			{
+				auto [px, py] = stack.back();
+				stack.pop_back();
+				blob.Area++;
+				sumX += px;
+				sumY += py;
+				blob.Left = std::min<uint16_t>(blob.Left, px);
+				blob.Right = std::max<uint16_t>(blob.Right, px);
+				blob.Top = std::min<uint16_t>(blob.Top, py);
+				blob.Bottom = std::max<uint16_t>(blob.Bottom, py);
+				for (int ny = py - 1; ny <= py + 1; ny++)
+				{
+					for (int nx = px - 1; nx <= px + 1; nx++)
+					{
+						if (nx < 0 || ny < 0 || nx >= mask.Width || ny >= mask.Height || mask.At(nx, ny) == 0 ||
+							seen[ny * mask.Width + nx])
+							continue;
+						seen[ny * mask.Width + nx] = 1;
+						stack.emplace_back(nx, ny);
+					}
+				}
+			}
+			if (blob.Area < minArea)
+				continue;
+			blob.CentroidX = sumX / blob.Area;
+			blob.CentroidY = sumY / blob.Area;
+			blobs.push_back(blob);
+		}
+	}
+	return blobs;
+}
+
+/// @brief	Rectangles, diagonal strokes and noise, shapes that join only on lower rows included.
+void randomScene(Mask &mask, std::mt19937 &random)
+{
+	mask.Clear();
+	const int shapes = random() % 12;
+	for (int i = 0; i < shapes; i++)
+	{
+		int x = random() % mask.Width;
+		int y = random() % mask.Height;
+		switch (random() % 4)
+		{
+		case 0:
+			mask.Fill(x, y, x + random() % 20, y + random() % 20);
+			break;
+		case 1:
+		{
+			// a U, its arms are separate runs until the bottom joins them
+			int size = 3 + random() % 15;
+			mask.Fill(x, y, x + 1, y + size);
+			mask.Fill(x + size, y, x + size + 1, y + size);
+			mask.Fill(x, y + size, x + size + 1, y + size + 1);
+			break;
+		}
+		case 2:
+		{
+			// pixels touching only at their corners
+			int length = random() % 30;
+			int direction = random() % 2 ? 1 : -1;
+			for (int step = 0; step < length; step++)
+				mask.Fill(x + step * direction, y + step, x + step * direction, y + step);
+			break;
+		}
+		default:
+			for (int pixel = random() % 40; pixel > 0; pixel--)
+				mask.At(random() % mask.Width, random() % mask.Height) = 1 + random() % 255;
+			break;
+		}
+	}
+}
+
+void testLabeller()
+{
+	static BlobLabeller labeller;
+	std::mt19937 random(1);
+	int differences = 0;
+	int compared = 0;
+	for (int round = 0; round < Rounds; round++)
+	{
+		Mask mask(1 + random() % 80, 1 + random() % 60, random() % 3);
+		randomScene(mask, random);
+		const uint32_t minArea = random() % 3 == 0 ? 1 + random() % 10 : 1;
+
+		uint8_t count = labeller.Label(mask.Pixels.data(), mask.Width, mask.Height, mask.Stride, minArea);
+		std::vector<Blob> expected = reference(mask, minArea);
+		if (labeller.IsTruncated())
+		{
+			CHECK(labeller.GetRunCount() == BlobLabeller::MaxRuns || expected.size() > BlobLabeller::MaxBlobs);
+			continue;
+		}
+
+		std::vector<Blob> actual(count);
+		for (uint8_t i = 0; i < count; i++)
+			actual[i] = labeller.GetBlob(i);
+		auto byKey = [](const Blob &a, const Blob &b) { return key(a) < key(b); };
+		std::sort(actual.begin(), actual.end(), byKey);
+		std::sort(expected.begin(), expected.end(), byKey);
+		compared++;
+		if (actual.size() != expected.size() || !std::equal(actual.begin(), actual.end(), expected.begin(),
+															  [](const Blob &a, const Blob &b) { return key(a) == key(b); }))
+		{
+			if (differences++ == 0)
+				printf("first difference in a %ux%u mask: %zu blobs, expected %zu\n", mask.Width, mask.Height, actual.size(),
+					   expected.size());
+		}
+	}
+	CHECK(differences == 0);
+	// most rounds fit the fixed buffers
+	CHECK(compared > Rounds * 3 / 4);
+}
+
+void testTruncation()
+{
+	static BlobLabeller labeller;
+
+	// every other pixel is a run of its own
+	Mask dots(320, 240);
+	for (int y = 0; y < dots.Height; y += 2)
+		for (int x = 0; x < dots.Width; x += 2)
+			dots.At(x, y) = 1;
+	labeller.Label(dots.Pixels.data(), dots.Width, dots.Height, dots.Stride, 1);
+	CHECK(labeller.IsTruncated() && labeller.GetRunCount() == BlobLabeller::MaxRuns);
+	CHECK(labeller.GetBlobCount() == BlobLabeller::MaxBlobs);
+
+	// few runs but too many blobs, the area filter decides which ones count
+	Mask squares(320, 240);
+	for (int i = 0; i < 40; i++)
+		squares.Fill(i * 8, 10, i * 8 + 3, 13);
+	squares.Fill(0, 100, 99, 199);
+	CHECK(labeller.Label(squares.Pixels.data(), squares.Width, squares.Height, squares.Stride, 1) == BlobLabeller::MaxBlobs);
+	CHECK(labeller.IsTruncated());
+	CHECK(labeller.Label(squares.Pixels.data(), squares.Width, squares.Height, squares.Stride, 17) == 1);
+	CHECK(!labeller.IsTruncated() && labeller.GetBlob(0).Area == 100 * 100);
+	CHECK(labeller.GetBlob(0).CentroidX == 49 && labeller.GetBlob(0).CentroidY == 149);
+}
+
+void testTracking()
+{
+	static BlobLabeller labeller;
+	static BlobTracker tracker;
+	static ZoneMonitor zones;
+	tracker.Configure(24, 2);
+
+	const ZonePoint door[] = {{100, 0}, {160, 0}, {160, 120}, {100, 120}};
+	CHECK(zones.SetZone(0, door, 4));
+	CHECK(!zones.SetZone(ZoneMonitor::MaxZones, door, 4));
+	CHECK(!zones.SetZone(1, door, 2));
+
+	// a 10x10 blob walks right 8 pixels a frame, a second one stays put below the zone
+	Mask mask(320, 240);
+	uint16_t walkerId = 0;
+	uint16_t standerId = 0;
+	int entered = -1;
+	int left = -1;
+	for (int frame = 0; frame < 30; frame++)
+	{
+		mask.Clear();
+		const int x = 20 + frame * 8;
+		mask.Fill(x, 50, x + 9, 59);
+		mask.Fill(200, 200, 209, 209);
+		labeller.Label(mask.Pixels.data(), mask.Width, mask.Height, mask.Stride, 20);
+		tracker.Update(labeller);
+		const uint8_t events = zones.Update(tracker);
+
+		CHECK(tracker.GetTrackCount() == 2);
+		for (uint8_t t = 0; t < tracker.GetTrackCount(); t++)
+		{
+			const TrackedBlob &track = tracker.GetTrack(t);
+			uint16_t &id = track.Y < 100 ? walkerId : standerId;
+			if (frame == 0)
+				id = track.Id;
+			CHECK(track.Id == id);
+		}
+		for (uint8_t e = 0; e < events; e++)
+		{
+			const ZoneEvent &event = zones.GetEvent(e);
+			CHECK(event.Zone == 0 && event.TrackId == walkerId);
+			(event.Type == ZoneEventType::Enter ? entered : left) = frame;
+		}
+	}
+	// the centroid is x + 4, the right edge at 160 is outside already
+	CHECK(entered == 10 && left == 17);
+	CHECK(zones.GetEnterCount(0) == 1 && zones.GetLeaveCount(0) == 1 && zones.GetOccupancy(0) == 0);
+
+	// a track inside the zone that disappears leaves it once it is dropped
+	mask.Clear();
+	mask.Fill(120, 20, 129, 29);
+	labeller.Label(mask.Pixels.data(), mask.Width, mask.Height, mask.Stride, 20);
+	tracker.Update(labeller);
+	CHECK(zones.Update(tracker) == 1 && zones.GetOccupancy(0) == 1);
+	const uint16_t inside = zones.GetEvent(0).TrackId;
+
+	mask.Clear();
+	int leftAt = -1;
+	for (int frame = 0; frame < 5; frame++)
+	{
+		labeller.Label(mask.Pixels.data(), mask.Width, mask.Height, mask.Stride, 20);
+		tracker.Update(labeller);
+		if (zones.Update(tracker) == 1 && zones.GetEvent(0).Type == ZoneEventType::Leave && zones.GetEvent(0).TrackId == inside)
+			leftAt = frame;
+	}
+	CHECK(leftAt == 2 && tracker.GetTrackCount() == 0 && zones.GetOccupancy(0) == 0);
+
+	// a redefined zone forgets its tracks without Leave events, the ones inside enter again
+	mask.Fill(120, 20, 129, 29);
+	labeller.Label(mask.Pixels.data(), mask.Width, mask.Height, mask.Stride, 20);
+	tracker.Update(labeller);
+	CHECK(zones.Update(tracker) == 1);
+	CHECK(zones.SetZone(0, door, 4));
+	tracker.Update(labeller);
+	CHECK(zones.Update(tracker) == 1 && zones.GetEvent(0).Type == ZoneEventType::Enter);
+	zones.ClearZone(0);
+	tracker.Update(labeller);
+	CHECK(zones.Update(tracker) == 0 && tracker.GetTrack(0).ZoneMask == 0);
+}
+
+} // namespace
+
+int main()
+{
+	testLabeller();
+	testTruncation();
+	testTracking();
+	return HostTest::Finish("MotionBlobsDifferential");
+}
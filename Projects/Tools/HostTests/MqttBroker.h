@@ -0,0 +1,418 @@
+#pragma once
+
+// Stand-in MQTT 3.1.1 broker for the host tests, serving one client session at a time on a
+// loopback port. It acknowledges what the client publishes and keeps count of it, and once
+// the client subscribes it pushes three messages on cam/cmd: "snapshot" at QoS 1, 3000 bytes
+// at QoS 1, more than MqttPath takes in, and "hello qos0" at QoS 0.
+// SocketConnection is the client side, a BaseConnection over a blocking TCP socket whose
+// receive thread plays the part of the lwIP task.
+
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "BaseConnection.h"
+
+namespace HostTest
+{
+
+class MqttBroker
+{
+public:
+	static constexpr uint16_t PushedPacketId = 0x1234;
+	static constexpr uint32_t OversizedLength = 3000;
+
+	struct Session
+	{
+		std::string ClientId;
+		std::string UserName;
+		std::string Password;
+		uint8_t ConnectFlags = 0;
+		uint16_t KeepAlive = 0;
+		std::vector<std::pair<std::string, uint8_t>> Subscriptions;
+		uint32_t Publishes[2] = {};
+		uint64_t PayloadBytes = 0;
+		/// @brief	Distinct payloads seen per topic, as hashes.
+		std::map<std::string, std::set<size_t>> Payloads;
+		std::vector<uint16_t> ClientAcks;
+		uint32_t Pings = 0;
+		uint32_t Unexpected = 0;
+		bool Disconnected = false;
+	};
+
+	/// @brief	Return code of the CONNACK, anything but 0 refuses the client and closes.
+	uint8_t ConnackCode = 0;
+	bool AnswerPings = true;
+	bool PushOnSubscribe = true;
+	/// @brief	Hashing every payload costs time a benchmark should not pay.
+	bool HashPayloads = true;
+
+	explicit MqttBroker(uint16_t port)
+	{
+		_listener = socket(AF_INET, SOCK_STREAM, 0);
+		int reuse = 1;
+		setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+		struct sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (bind(_listener, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 || listen(_listener, 1) != 0)
+		{
+			perror("MqttBroker");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	~MqttBroker()
+	{
+		Wait();
+		close(_listener);
+	}
+
+	/// @brief	Accepts the next client and serves it on a thread of its own.
+	void Start()
+	{
+		_session = Session();
+		_thread = std::thread([this] { serve(); });
+	}
+
+	/// @brief	Waits for the client to disconnect or close, and returns what it did.
+	Session Wait()
+	{
+		if (_thread.joinable())
+			_thread.join();
+		return _session;
+	}
+
+	static size_t Hash(const void *data, size_t length)
+	{
+		return std::hash<std::string_view>()(std::string_view(static_cast<const char *>(data), length));
+	}
+
+private:
+	void serve()
+	{
+		int client = accept(_listener, nullptr, nullptr);
+		if (client < 0)
+			return;
+
+		// a client that hangs fails the test instead of blocking it
+		struct timeval timeout = {10, 0};
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		int noDelay = 1;
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+		uint8_t header = 0;
+		std::vector<uint8_t> body;
+		if (readPacket(client, header, body) && header == 0x10 && connect(body))
+		{
+			const uint8_t connack[] = {0x20, 0x02, 0x00, ConnackCode};
+			sendAll(client, connack, sizeof(connack));
+			if (ConnackCode == 0)
+			{
+				while (readPacket(client, header, body) && packet(client, header, body))
+					;
+			}
+		}
+		else
+		{
+			_session.Unexpected++;
+		}
+		close(client);
+	}
+
+	bool connect(const std::vector<uint8_t> &body)
+	{
+		size_t position = 0;
+		std::string protocol;
+		if (!readString(body, position, protocol) || protocol != "MQTT" || position + 4 > body.size() || body[position] != 4)
+			return false;
+
+		_session.ConnectFlags = body[position + 1];
+		_session.KeepAlive = body[position + 2] << 8 | body[position + 3];
+		position += 4;
+		if (!readString(body, position, _session.ClientId))
+			return false;
+		if ((_session.ConnectFlags & 0x80) && !readString(body, position, _session.UserName))
+			return false;
+		if ((_session.ConnectFlags & 0x40) && !readString(body, position, _session.Password))
+			return false;
+		return position == body.size();
+	}
+
+	/// @return	False once the session is over.
+	bool packet(int client, uint8_t header, const std::vector<uint8_t> &body)
+	{
+		switch (header >> 4)
+		{
+		case 3:
+		{
+			const uint8_t qos = (header >> 1) & 0x03;
+			size_t position = 0;
+			std::string topic;
+			if (qos > 1 || !readString(body, position, topic) || position + (qos ? 2 : 0) > body.size())
+			{
+				_session.Unexpected++;
+				return false;
+			}
+			if (qos == 1)
+			{
+				const uint8_t puback[] = {0x40, 0x02, body[position], body[position + 1]};
+				sendAll(client, puback, sizeof(puback));
+				position += 2;
+			}
+			_session.Publishes[qos]++;
+			_session.PayloadBytes += body.size() - position;
+			if (HashPayloads)
+				_session.Payloads[topic].insert(Hash(body.data() + position, body.size() - position));
+			return true;
+		}
+
+		case 4:
+			_session.ClientAcks.push_back(body.size() == 2 ? body[0] << 8 | body[1] : 0);
+			return true;
+
+		case 8:
+		{
+			size_t position = 2;
+			std::string topic;
+			if (header != 0x82 || !readString(body, position, topic) || position + 1 != body.size())
+			{
+				_session.Unexpected++;
+				return false;
+			}
+			_session.Subscriptions.emplace_back(topic, body[position]);
+			const uint8_t suback[] = {0x90, 0x03, body[0], body[1], body[position]};
+			sendAll(client, suback, sizeof(suback));
+			if (PushOnSubscribe)
+			{
+				push(client, topic, 1, PushedPacketId, "snapshot");
+				push(client, topic, 1, PushedPacketId + 1, std::string(OversizedLength, 'x'));
+				push(client, topic, 0, 0, "hello qos0");
+			}
+			return true;
+		}
+
+		case 12:
+		{
+			_session.Pings++;
+			const uint8_t pingresp[] = {0xD0, 0x00};
+			if (AnswerPings)
+				sendAll(client, pingresp, sizeof(pingresp));
+			return true;
+		}
+
+		case 14:
+			_session.Disconnected = true;
+			return false;
+
+		default:
+			_session.Unexpected++;
+			return false;
+		}
+	}
+
+	void push(int client, const std::string &topic, uint8_t qos, uint16_t packetId, const std::string &payload)
+	{
+		std::vector<uint8_t> body;
+		body.push_back(topic.size() >> 8);
+		body.push_back(topic.size() & 0xFF);
+		body.insert(body.end(), topic.begin(), topic.end());
+		if (qos == 1)
+		{
+			body.push_back(packetId >> 8);
+			body.push_back(packetId & 0xFF);
+		}
+		body.insert(body.end(), payload.begin(), payload.end());
+
+		std::vector<uint8_t> packet = {static_cast<uint8_t>(0x30 | qos << 1)};
+		size_t length = body.size();
+		do
+		{
+			packet.push_back((length & 0x7F) | (length > 0x7F ? 0x80 : 0x00));
+			length >>= 7;
+		} while (length > 0);
+		packet.insert(packet.end(), body.begin(), body.end());
+		sendAll(client, packet.data(), packet.size());
+	}
+
+	static bool readString(const std::vector<uint8_t> &body, size_t &position, std::string &text)
+	{
+		if (position + 2 > body.size())
+			return false;
+		const size_t length = body[position] << 8 | body[position + 1];
+		if (position + 2 + length > body.size())
+			return false;
+		text.assign(reinterpret_cast<const char *>(&body[position + 2]), length);
+		position += 2 + length;
+		return true;
+	}
+
+	static bool readExactly(int client, uint8_t *data, size_t length)
+	{
+		while (length > 0)
+		{
+			ssize_t read = recv(client, data, length, 0);
+			if (read <= 0)
+				return false;
+			data += read;
+			length -= read;
+		}
+		return true;
+	}
+
+	static bool readPacket(int client, uint8_t &header, std::vector<uint8_t> &body)
+	{
+		if (!readExactly(client, &header, 1))
+			return false;
+
+		size_t length = 0;
+		for (int shift = 0;; shift += 7)
+		{
+			uint8_t digit = 0;
+			if (shift > 21 || !readExactly(client, &digit, 1))
+				return false;
+			length |= static_cast<size_t>(digit & 0x7F) << shift;
+			if (!(digit & 0x80))
+				break;
+		}
+		body.resize(length);
+		return readExactly(client, body.data(), length);
+	}
+
+	static void sendAll(int client, const uint8_t *data, size_t length)
+	{
+		while (length > 0)
+		{
+			ssize_t sent = send(client, data, length, MSG_NOSIGNAL);
+			if (sent <= 0)
+				return;
+			data += sent;
+			length -= sent;
+		}
+	}
+
+	int _listener = -1;
+	std::thread _thread;
+	Session _session;
+};
+
+class SocketConnection : public Protocol::BaseConnection
+{
+public:
+	~SocketConnection()
+	{
+		Join();
+	}
+
+	/// @brief	Waits for the receive thread once either side closed the connection.
+	void Join()
+	{
+		if (_receiver.joinable())
+			_receiver.join();
+		if (_socket >= 0)
+			close(_socket);
+		_socket = -1;
+	}
+
+	/// @brief	Sends made from the receive thread, nothing may go out from there.
+	uint32_t GetSendsFromReceiver() const
+	{
+		return _sendsFromReceiver;
+	}
+
+	/// @brief	Closes made from the receive thread, on the device that would pull the pcb
+	///			out from under the receive callback.
+	uint32_t GetClosesFromReceiver() const
+	{
+		return _closesFromReceiver;
+	}
+
+private:
+	ConnectStatus DoConnect(const Protocol::RemoteConnection &remoteConnection) override
+	{
+		_socket = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(remoteConnection.Port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(_socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0)
+			return ConnectStatus::Failed;
+		int noDelay = 1;
+		setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+		_connected = true;
+		_receiver = std::thread([this] {
+			_receiverId = std::this_thread::get_id();
+			SetConnectionState(Protocol::ConnectionState::Connected);
+			ConnectionChanged(Protocol::ConnectionChangeReason::None);
+
+			char buffer[1460];
+			for (;;)
+			{
+				ssize_t length = recv(_socket, buffer, sizeof(buffer), 0);
+				if (length <= 0)
+					break;
+				DataReceived(buffer, length);
+			}
+			_connected = false;
+			SetConnectionState(Protocol::ConnectionState::Disconnected);
+			ConnectionChanged(Protocol::ConnectionChangeReason::Closed);
+		});
+		return ConnectStatus::Connecting;
+	}
+
+	bool DoSend(const unsigned char *data, uint16_t length) override
+	{
+		if (std::this_thread::get_id() == _receiverId)
+			_sendsFromReceiver++;
+
+		while (length > 0)
+		{
+			ssize_t sent = send(_socket, data, length, MSG_NOSIGNAL);
+			if (sent <= 0)
+				return false;
+			data += sent;
+			length -= sent;
+		}
+		return true;
+	}
+
+	void DoClose() override
+	{
+		if (std::this_thread::get_id() == _receiverId)
+			_closesFromReceiver++;
+
+		if (_socket >= 0)
+			shutdown(_socket, SHUT_RDWR);
+	}
+
+	void DoReset() override
+	{
+		DoClose();
+	}
+
+	bool IsConnected() override
+	{
+		return _connected;
+	}
+
+	int _socket = -1;
+	std::thread _receiver;
+	std::atomic<std::thread::id> _receiverId;
+	std::atomic<bool> _connected{false};
+	std::atomic<uint32_t> _sendsFromReceiver{0};
+	std::atomic<uint32_t> _closesFromReceiver{0};
+};
+
+} // namespace HostTest
@@ -0,0 +1,206 @@
+// MqttPath against the stand-in broker over loopback TCP: the handshake with credentials,
+// subscribing and receiving at QoS 0 and 1, publishing copies and references, keep-alive
+// pings and the clean DISCONNECT, and brokers that refuse the client or stop answering pings.
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include "HostTest.h"
+#include "MqttBroker.h"
+#include "Mqtt.h"
+
+using namespace Protocol;
+using HostTest::MqttBroker;
+
+namespace
+{
+
+constexpr uint16_t Port = 28883;
+
+class Inbox
+{
+public:
+	std::mutex Lock;
+	std::vector<std::pair<std::string, std::string>> Messages;
+	std::vector<uint16_t> Published;
+
+	void Received(const char *topic, uint16_t topicLength, const uint8_t *data, uint32_t length)
+	{
+		std::lock_guard<std::mutex> guard(Lock);
+		Messages.emplace_back(std::string(topic, topicLength), std::string(reinterpret_cast<const char *>(data), length));
+	}
+
+	void Acknowledged(uint16_t packetId)
+	{
+		std::lock_guard<std::mutex> guard(Lock);
+		Published.push_back(packetId);
+	}
+
+	size_t MessageCount()
+	{
+		std::lock_guard<std::mutex> guard(Lock);
+		return Messages.size();
+	}
+};
+
+struct Client
+{
+	HostTest::SocketConnection Connection;
+	MqttPath Mqtt;
+	Inbox Sink;
+
+	explicit Client(uint16_t keepAlive)
+	{
+		Mqtt.SetConnection(&Connection);
+		Mqtt.SetKeepAlive(keepAlive);
+		Mqtt.SetMessageReceived(MakeDelegate(&Sink, &Inbox::Received));
+		Mqtt.SetPublished(MakeDelegate(&Sink, &Inbox::Acknowledged));
+	}
+
+	/// @brief	Runs Process() like the processing task until done() holds or time is up.
+	template <typename Done>
+	bool RunUntil(Done done, uint32_t milliseconds)
+	{
+		Hal::TimeLimit wait;
+		while (!done())
+		{
+			if (wait.IsTimeUp(milliseconds))
+				return false;
+			Mqtt.Process();
+			vTaskDelay(1);
+		}
+		return true;
+	}
+
+	bool Open()
+	{
+		RemoteConnection remote = {Port, {}};
+		strcpy(remote.Address.data(), "127.0.0.1");
+		if (!Mqtt.Start(BaseRouteHandler::ConnectionMode::DataConnection, &remote, 0, 0))
+			return false;
+		RunUntil([this] { return Mqtt.IsOpen() || Mqtt.IsTerminated(); }, 2000);
+		return Mqtt.IsOpen();
+	}
+};
+
+void testSession()
+{
+	MqttBroker broker(Port);
+	broker.Start();
+
+	Client client(30);
+	client.Mqtt.SetClientId("camera-1");
+	client.Mqtt.SetCredentials("user", "secret");
+	CHECK(client.Open());
+	CHECK(client.Mqtt.Subscribe("cam/cmd", 1) > 0);
+
+	// the oversized message is dropped but still acknowledged
+	CHECK(client.RunUntil([&] { return client.Sink.MessageCount() >= 2; }, 2000));
+	client.Mqtt.Process();
+	CHECK(client.Sink.Messages.size() == 2);
+	CHECK(client.Sink.Messages.size() == 2 && client.Sink.Messages[0] == std::make_pair(std::string("cam/cmd"), std::string("snapshot")));
+	CHECK(client.Sink.Messages.size() == 2 && client.Sink.Messages[1] == std::make_pair(std::string("cam/cmd"), std::string("hello qos0")));
+
+	std::vector<uint8_t> frame(60000);
+	for (size_t i = 0; i < frame.size(); i++)
+		frame[i] = i * 7 + (i >> 8);
+	const std::string status = "{\"motion\":1}";
+
+	CHECK(client.Mqtt.Publish("cam/event", reinterpret_cast<const uint8_t *>("motion"), 6) == 0);
+	CHECK(client.Mqtt.PublishReference("cam/snapshot", frame.data(), frame.size()) == 0);
+	const int32_t frameId = client.Mqtt.PublishReference("cam/snapshot", frame.data(), frame.size(), 1);
+	const int32_t statusId = client.Mqtt.Publish("cam/status", reinterpret_cast<const uint8_t *>(status.data()), status.size(), 1, true);
+	CHECK(frameId > 0 && statusId > 0 && frameId != statusId);
+	CHECK(client.RunUntil([&] { return client.Mqtt.GetInflightCount() == 0; }, 2000));
+	CHECK(client.Sink.Published == std::vector<uint16_t>({static_cast<uint16_t>(frameId), static_cast<uint16_t>(statusId)}));
+
+	// nothing goes out unless the client is open, and topics have limits
+	CHECK(client.Mqtt.Publish("", frame.data(), 1) < 0);
+	CHECK(client.Mqtt.Publish(std::string(MqttPath::MaxTopicLength + 1, 't').c_str(), frame.data(), 1) < 0);
+	CHECK(client.Mqtt.Publish("cam/event", frame.data(), 1, 2) < 0);
+
+	client.Mqtt.Terminate();
+	CHECK(client.Mqtt.IsTerminated());
+	CHECK(client.Mqtt.Publish("cam/event", frame.data(), 1) < 0);
+	MqttBroker::Session session = broker.Wait();
+	client.Connection.Join();
+
+	CHECK(session.ClientId == "camera-1" && session.UserName == "user" && session.Password == "secret");
+	CHECK(session.ConnectFlags == 0xC2 && session.KeepAlive == 30);
+	CHECK(session.Subscriptions.size() == 1 && session.Subscriptions[0] == std::make_pair(std::string("cam/cmd"), uint8_t(1)));
+	CHECK(session.ClientAcks == std::vector<uint16_t>({MqttBroker::PushedPacketId, MqttBroker::PushedPacketId + 1}));
+	CHECK(session.Publishes[0] == 2 && session.Publishes[1] == 2);
+	CHECK(session.PayloadBytes == 6 + 2 * frame.size() + status.size());
+	CHECK(session.Payloads["cam/snapshot"] == std::set<size_t>({MqttBroker::Hash(frame.data(), frame.size())}));
+	CHECK(session.Payloads["cam/status"] == std::set<size_t>({MqttBroker::Hash(status.data(), status.size())}));
+	CHECK(session.Disconnected && session.Unexpected == 0);
+	// the CONNECT and acknowledgements wait for Process(), the receive thread never sends
+	CHECK(client.Connection.GetSendsFromReceiver() == 0);
+}
+
+void testKeepAlive()
+{
+	MqttBroker broker(Port);
+	broker.Start();
+
+	Client client(1);
+	CHECK(client.Open());
+	CHECK(!client.RunUntil([&] { return client.Mqtt.IsTerminated(); }, 2600));
+	CHECK(client.Mqtt.IsOpen());
+	client.Mqtt.Terminate();
+	MqttBroker::Session session = broker.Wait();
+	client.Connection.Join();
+
+	CHECK(session.KeepAlive == 1 && session.Pings >= 2);
+	CHECK(session.Disconnected);
+	// no client id, a random one is made up
+	CHECK(session.ClientId.rfind("esp32cam-", 0) == 0 && session.ClientId.size() == 17);
+	CHECK((session.ConnectFlags & 0xC0) == 0);
+}
+
+void testUnansweredPing()
+{
+	MqttBroker broker(Port);
+	broker.AnswerPings = false;
+	broker.Start();
+
+	Client client(1);
+	CHECK(client.Open());
+	Hal::TimeLimit elapsed;
+	CHECK(client.RunUntil([&] { return client.Mqtt.IsTerminated(); }, 4000));
+	// one interval until the ping, one more waiting for its response
+	CHECK(elapsed.IsTimeUp(1500));
+	MqttBroker::Session session = broker.Wait();
+	client.Connection.Join();
+
+	CHECK(session.Pings == 1);
+	CHECK(!session.Disconnected);
+}
+
+void testRefused()
+{
+	MqttBroker broker(Port);
+	broker.ConnackCode = 5;
+	broker.Start();
+
+	Client client(30);
+	CHECK(!client.Open());
+	CHECK(client.Mqtt.IsTerminated());
+	CHECK(client.Mqtt.Subscribe("cam/cmd") < 0);
+	MqttBroker::Session session = broker.Wait();
+	client.Connection.Join();
+	CHECK(session.Unexpected == 0 && session.Publishes[0] == 0);
+	// the refusal arrived on the receive thread, Process() closed the connection
+	CHECK(client.Connection.GetClosesFromReceiver() == 0);
+}
+
+} // namespace
+
+int main()
+{
+	testSession();
+	testKeepAlive();
+	testUnansweredPing();
+	testRefused();
+	return HostTest::Finish("MqttLoopback");
+}
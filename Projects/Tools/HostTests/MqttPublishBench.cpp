@@ -0,0 +1,106 @@
+// MqttPath publish throughput against the stand-in broker over loopback TCP: 60 KB frames
+// passed by reference at QoS 0, the same at QoS 1 with MaxInflight PUBACKs outstanding, and
+// small copied QoS 0 status messages.
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "MqttBroker.h"
+#include "Mqtt.h"
+
+using namespace Protocol;
+using HostTest::MqttBroker;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr uint16_t Port = 28884;
+constexpr int Frames = 300;
+constexpr int StatusMessages = 5000;
+
+double secondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+int main()
+{
+	MqttBroker broker(Port);
+	broker.PushOnSubscribe = false;
+	broker.HashPayloads = false;
+	broker.Start();
+
+	HostTest::SocketConnection connection;
+	MqttPath mqtt;
+	mqtt.SetConnection(&connection);
+	mqtt.SetClientId("bench");
+
+	RemoteConnection remote = {Port, {}};
+	strcpy(remote.Address.data(), "127.0.0.1");
+	mqtt.Start(BaseRouteHandler::ConnectionMode::DataConnection, &remote, 0, 0);
+	Hal::TimeLimit wait;
+	while (!mqtt.IsOpen())
+	{
+		if (mqtt.IsTerminated() || wait.IsTimeUp(2000))
+		{
+			printf("no session with the broker\n");
+			return 1;
+		}
+		vTaskDelay(1);
+	}
+
+	std::vector<uint8_t> frame(60000);
+	for (size_t i = 0; i < frame.size(); i++)
+		frame[i] = i * 7;
+
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < Frames; i++)
+	{
+		if (mqtt.PublishReference("cam/snapshot", frame.data(), frame.size()) < 0)
+		{
+			printf("QoS 0 publish failed\n");
+			return 1;
+		}
+	}
+	double seconds = secondsSince(start);
+	printf("frames QoS 0  %5d x %zu bytes %8.1f MB/s %8.0f msg/s\n", Frames, frame.size(),
+		   Frames * frame.size() / seconds / 1e6, Frames / seconds);
+
+	start = Clock::now();
+	for (int i = 0; i < Frames; i++)
+	{
+		// a full window is only freed by PUBACKs
+		while (mqtt.PublishReference("cam/snapshot", frame.data(), frame.size(), 1) < 0)
+		{
+			mqtt.Process();
+			if (mqtt.IsTerminated())
+			{
+				printf("QoS 1 publish failed\n");
+				return 1;
+			}
+			std::this_thread::yield();
+		}
+	}
+	while (mqtt.GetInflightCount() != 0 && !mqtt.IsTerminated())
+		std::this_thread::yield();
+	seconds = secondsSince(start);
+	printf("frames QoS 1  %5d x %zu bytes %8.1f MB/s %8.0f msg/s  %u in flight at most\n", Frames, frame.size(),
+		   Frames * frame.size() / seconds / 1e6, Frames / seconds, MqttPath::MaxInflight);
+
+	const char status[] = "{\"motion\":1,\"framesize\":5}";
+	start = Clock::now();
+	for (int i = 0; i < StatusMessages; i++)
+		mqtt.Publish("cam/status", reinterpret_cast<const uint8_t *>(status), sizeof(status) - 1);
+	seconds = secondsSince(start);
+	printf("status QoS 0  %5d x %zu bytes %8.0f msg/s\n", StatusMessages, sizeof(status) - 1, StatusMessages / seconds);
+
+	mqtt.Terminate();
+	MqttBroker::Session session = broker.Wait();
+	connection.Join();
+	printf("broker got %u QoS 0 and %u QoS 1 messages, %.1f MB of payload\n", session.Publishes[0], session.Publishes[1],
+		   session.PayloadBytes / 1e6);
+	return 0;
+}
@@ -0,0 +1,202 @@
+// my_http_server over loopback, built against the netconn stand-in: short GETs with a new
+// connection for every request, the way each one was served before keep-alive, then on
+// persistent connections one at a time and pipelined. One client per worker task.
+
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "lwip/sockets.h"
+#include "my_http_server.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr int Port = 28082;
+constexpr int Workers = 2;
+constexpr int RequestsPerClient = 5000;
+constexpr int PipelineDepth = 8;
+
+const std::string Request = "GET /ping HTTP/1.1\r\nHost: camera\r\nUser-Agent: bench\r\nAccept: */*\r\n\r\n";
+
+void ping(http_context_t context, void *argument)
+{
+	static const char body[] = "pong";
+	http_response_begin(context, 200, "text/plain", sizeof(body) - 1);
+	const http_buffer_t buffer = {body, sizeof(body) - 1, true};
+	http_response_write(context, &buffer);
+	http_response_end(context);
+}
+
+class Client
+{
+public:
+	int Connections = 0;
+	int Failures = 0;
+
+	~Client()
+	{
+		Disconnect();
+	}
+
+	bool Connect()
+	{
+		_socket = socket(AF_INET, SOCK_STREAM, 0);
+		int noDelay = 1;
+		setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+		struct sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(Port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		_received.clear();
+		Connections++;
+		return connect(_socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0;
+	}
+
+	void Disconnect()
+	{
+		if (_socket >= 0)
+			close(_socket);
+		_socket = -1;
+	}
+
+	bool IsConnected() const
+	{
+		return _socket >= 0;
+	}
+
+	bool Send(const std::string &data)
+	{
+		return send(_socket, data.data(), data.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+	}
+
+	/// @brief	Reads one response, false if the server closed first.
+	bool Receive()
+	{
+		for (;;)
+		{
+			size_t end = _received.find("\r\n\r\n");
+			if (end != std::string::npos)
+			{
+				// the server spells it Content-length
+				const char *field = strcasestr(_received.c_str(), "content-length: ");
+				size_t total = end + 4 + (field != nullptr && field < _received.c_str() + end ? atoi(field + 16) : 0);
+				if (_received.size() >= total)
+				{
+					if (_received.compare(0, 12, "HTTP/1.1 200") != 0 || _received.compare(total - 4, 4, "pong") != 0)
+						Failures++;
+					_received.erase(0, total);
+					return true;
+				}
+			}
+
+			char buffer[4096];
+			ssize_t length = recv(_socket, buffer, sizeof(buffer), 0);
+			if (length <= 0)
+				return false;
+			_received.append(buffer, length);
+		}
+	}
+
+private:
+	int _socket = -1;
+	std::string _received;
+};
+
+/// @param depth	Requests sent at once on a persistent connection, 0 for a connection per request.
+void run(const char *name, int depth)
+{
+	const std::string batch = [&] {
+		std::string requests;
+		for (int i = 0; i < std::max(depth, 1); i++)
+			requests += Request;
+		return requests;
+	}();
+	const std::string closing = "GET /ping HTTP/1.1\r\nHost: camera\r\nConnection: close\r\n\r\n";
+
+	std::vector<Client> clients(Workers);
+	std::vector<std::vector<double>> latencies(Workers);
+	std::vector<std::thread> threads;
+	Clock::time_point start = Clock::now();
+	for (int index = 0; index < Workers; index++)
+	{
+		threads.emplace_back([&, index] {
+			Client &client = clients[index];
+			for (int done = 0; done < RequestsPerClient && client.Failures < 100;)
+			{
+				Clock::time_point sent = Clock::now();
+				if (!client.IsConnected() && !client.Connect())
+				{
+					client.Failures++;
+					client.Disconnect();
+					continue;
+				}
+
+				// the server ends a connection after a number of requests, what it did not answer is sent again
+				int count = std::min(std::max(depth, 1), RequestsPerClient - done);
+				int answered = 0;
+				if (client.Send(depth == 0 ? closing : batch.substr(0, count * Request.size())))
+				{
+					while (answered < count && client.Receive())
+						answered++;
+				}
+				const double elapsed = std::chrono::duration<double, std::micro>(Clock::now() - sent).count();
+				for (int i = 0; i < answered; i++)
+					latencies[index].push_back(elapsed);
+				done += answered;
+				if (depth == 0 || answered < count)
+					client.Disconnect();
+			}
+		});
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::vector<double> all;
+	int connections = 0;
+	int failures = 0;
+	for (int index = 0; index < Workers; index++)
+	{
+		all.insert(all.end(), latencies[index].begin(), latencies[index].end());
+		connections += clients[index].Connections;
+		failures += clients[index].Failures;
+	}
+	std::sort(all.begin(), all.end());
+	auto percentile = [&](double p) { return all.empty() ? 0.0 : all[static_cast<size_t>(p * (all.size() - 1))]; };
+	printf("%-12s %7zu requests %9.0f req/s  p50 %7.1f us  p99 %7.1f us  %5d connections  failed %d\n", name, all.size(),
+		   all.size() / seconds, percentile(0.5), percentile(0.99), connections, failures);
+}
+
+} // namespace
+
+int main()
+{
+	signal(SIGPIPE, SIG_IGN);
+
+	http_server_options_t options = HTTP_SERVER_OPTIONS_DEFAULT();
+	options.port = Port;
+	options.worker_count = Workers;
+	http_server_t server;
+	if (http_server_start(&options, &server) != ESP_OK)
+	{
+		printf("server did not start\n");
+		return 1;
+	}
+	http_register_handler(server, "/ping", HTTP_GET, HTTP_HANDLE_RESPONSE, ping, nullptr);
+
+	printf("%d clients, %d short GETs each, latency per round trip\n", Workers, RequestsPerClient);
+	run("close", 0);
+	run("keep-alive", 1);
+	run("pipelined", PipelineDepth);
+
+	http_server_stop(server);
+	return 0;
+}
@@ -0,0 +1,527 @@
+// RtspServer on loopback with two viewers. JPEGs made by libjpeg are pushed through the
+// server, the RTP packets are put back together by a depacketizer written after RFC 2435
+// appendix B, and the rebuilt JPEGs must decode to exactly the same pixels.
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <jpeglib.h>
+#include "HostTest.h"
+#include "RtspServer.h"
+
+namespace
+{
+
+typedef std::vector<uint8_t> Bytes;
+
+constexpr uint16_t Port = 8554;
+
+Bytes encode(int width, int height, int verticalSampling, int quality, int restartInterval, int seed)
+{
+	jpeg_compress_struct compress;
+	jpeg_error_mgr error;
+	compress.err = jpeg_std_error(&error);
+	jpeg_create_compress(&compress);
+	unsigned char *output = nullptr;
+	unsigned long outputLength = 0;
+	jpeg_mem_dest(&compress, &output, &outputLength);
+
+	compress.image_width = width;
+	compress.image_height = height;
+	compress.input_components = 3;
+	compress.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&compress);
+	jpeg_set_quality(&compress, quality, TRUE);
+	// 4:2:2 or 4:2:0, the two layouts RFC 2435 types 0 and 1 stand for
+	compress.comp_info[0].h_samp_factor = 2;
+	compress.comp_info[0].v_samp_factor = verticalSampling;
+	compress.restart_interval = restartInterval;
+
+	jpeg_start_compress(&compress, TRUE);
+	Bytes row(width * 3);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			row[x * 3] = (x * 7 + y * 3 + seed) & 0xFF;
+			row[x * 3 + 1] = ((x ^ y) + seed * 5) & 0xFF;
+			row[x * 3 + 2] = (x * y / 7 + seed) & 0xFF;
+		}
+		JSAMPROW line = row.data();
+		jpeg_write_scanlines(&compress, &line, 1);
+	}
+	jpeg_finish_compress(&compress);
+
+	Bytes jpeg(output, output + outputLength);
+	free(output);
+	jpeg_destroy_compress(&compress);
+	return jpeg;
+}
+
+Bytes decode(const Bytes &jpeg, int &width, int &height)
+{
+	jpeg_decompress_struct decompress;
+	jpeg_error_mgr error;
+	decompress.err = jpeg_std_error(&error);
+	jpeg_create_decompress(&decompress);
+	jpeg_mem_src(&decompress, jpeg.data(), jpeg.size());
+	jpeg_read_header(&decompress, TRUE);
+	decompress.dct_method = JDCT_ISLOW;
+	jpeg_start_decompress(&decompress);
+
+	width = decompress.output_width;
+	height = decompress.output_height;
+	Bytes pixels(width * height * 3);
+	while (decompress.output_scanline < decompress.output_height)
+	{
+		JSAMPROW line = pixels.data() + decompress.output_scanline * width * 3;
+		jpeg_read_scanlines(&decompress, &line, 1);
+	}
+	jpeg_finish_decompress(&decompress);
+	jpeg_destroy_decompress(&decompress);
+	return pixels;
+}
+
+/// @brief	The DHT segments libjpeg writes by default, they are the tables of the JPEG standard
+///			a depacketizer has to assume.
+Bytes standardHuffmanTables()
+{
+	Bytes jpeg = encode(16, 16, 1, 75, 0, 0);
+	Bytes tables;
+	for (size_t position = 2; position + 4 <= jpeg.size();)
+	{
+		uint8_t marker = jpeg[position + 1];
+		size_t length = (jpeg[position + 2] << 8) | jpeg[position + 3];
+		if (marker == 0xDA)
+			break;
+		if (marker == 0xC4)
+			tables.insert(tables.end(), jpeg.begin() + position, jpeg.begin() + position + 2 + length);
+		position += 2 + length;
+	}
+	return tables;
+}
+
+const Bytes HuffmanTables = standardHuffmanTables();
+
+/// @brief	Rebuilds JFIF images from RTP/JPEG packets the way RFC 2435 appendix B does.
+class Depacketizer
+{
+public:
+	std::vector<Bytes> Frames;
+	bool Lost = false;
+	bool Malformed = false;
+
+	void Packet(const uint8_t *packet, size_t length)
+	{
+		if (length < 20 || (packet[0] & 0xC0) != 0x80 || (packet[1] & 0x7F) != 26)
+		{
+			Malformed = true;
+			return;
+		}
+
+		uint16_t sequence = (packet[2] << 8) | packet[3];
+		uint32_t timestamp = (packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
+		bool marker = packet[1] & 0x80;
+		if (_started && sequence != _nextSequence)
+			Lost = true;
+		_nextSequence = sequence + 1;
+
+		const uint8_t *header = packet + 12;
+		uint32_t offset = (header[1] << 16) | (header[2] << 8) | header[3];
+		uint8_t type = header[4];
+		uint8_t q = header[5];
+		size_t headerLength = 8;
+		if (offset == 0)
+		{
+			_scan.clear();
+			_tables.clear();
+			_started = true;
+			_timestamp = timestamp;
+			_type = type & 0x3F;
+			_width = header[6] * 8;
+			_height = header[7] * 8;
+			_restartInterval = 0;
+		}
+		if (timestamp != _timestamp)
+			Malformed = true;
+
+		if (type & 0x40)
+		{
+			_restartInterval = (header[8] << 8) | header[9];
+			if (header[10] != 0xFF || header[11] != 0xFF)
+				Malformed = true;
+			headerLength += 4;
+		}
+		if (offset == 0 && q >= 128)
+		{
+			const uint8_t *quantization = header + headerLength;
+			size_t tablesLength = (quantization[2] << 8) | quantization[3];
+			if (quantization[1] != 0)
+				Malformed = true;
+			_tables.assign(quantization + 4, quantization + 4 + tablesLength);
+			headerLength += 4 + tablesLength;
+		}
+		if (offset != _scan.size())
+			Malformed = true;
+
+		_scan.insert(_scan.end(), header + headerLength, packet + length);
+		if (marker)
+			Frames.push_back(image());
+	}
+
+private:
+	Bytes _scan;
+	Bytes _tables;
+	bool _started = false;
+	uint16_t _nextSequence = 0;
+	uint32_t _timestamp = 0;
+	uint8_t _type = 0;
+	uint16_t _width = 0;
+	uint16_t _height = 0;
+	uint16_t _restartInterval = 0;
+
+	Bytes image() const
+	{
+		Bytes jpeg = {0xFF, 0xD8};
+		auto segment = [&jpeg](uint8_t marker, const Bytes &content) {
+			jpeg.push_back(0xFF);
+			jpeg.push_back(marker);
+			jpeg.push_back((content.size() + 2) >> 8);
+			jpeg.push_back((content.size() + 2) & 0xFF);
+			jpeg.insert(jpeg.end(), content.begin(), content.end());
+		};
+
+		Bytes quantization;
+		for (size_t table = 0; table * 64 < _tables.size(); table++)
+		{
+			quantization.push_back(table);
+			quantization.insert(quantization.end(), _tables.begin() + table * 64, _tables.begin() + table * 64 + 64);
+		}
+		segment(0xDB, quantization);
+		if (_restartInterval != 0)
+			segment(0xDD, {static_cast<uint8_t>(_restartInterval >> 8), static_cast<uint8_t>(_restartInterval)});
+
+		uint8_t sampling = _type == 0 ? 0x21 : 0x22;
+		segment(0xC0, {8, static_cast<uint8_t>(_height >> 8), static_cast<uint8_t>(_height),
+					   static_cast<uint8_t>(_width >> 8), static_cast<uint8_t>(_width), 3,
+					   0, sampling, 0, 1, 0x11, 1, 2, 0x11, 1});
+		jpeg.insert(jpeg.end(), HuffmanTables.begin(), HuffmanTables.end());
+		segment(0xDA, {3, 0, 0x00, 1, 0x11, 2, 0x11, 0, 63, 0});
+		jpeg.insert(jpeg.end(), _scan.begin(), _scan.end());
+		jpeg.push_back(0xFF);
+		jpeg.push_back(0xD9);
+		return jpeg;
+	}
+};
+
+int connectControl()
+{
+	int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(Port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0)
+	{
+		close(socket);
+		return -1;
+	}
+	struct timeval timeout = {3, 0};
+	setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	return socket;
+}
+
+/// @brief	Reads one reply, a pipelined one behind it stays in pending.
+std::string readReply(int socket, std::string &pending)
+{
+	for (;;)
+	{
+		size_t end = pending.find("\r\n\r\n");
+		if (end != std::string::npos)
+		{
+			size_t field = pending.find("Content-Length: ");
+			size_t body = field != std::string::npos && field < end ? atoi(pending.c_str() + field + 16) : 0;
+			if (pending.size() >= end + 4 + body)
+			{
+				std::string reply = pending.substr(0, end + 4 + body);
+				pending.erase(0, end + 4 + body);
+				return reply;
+			}
+		}
+
+		char buffer[2048];
+		int length = recv(socket, buffer, sizeof(buffer), 0);
+		if (length <= 0)
+			return std::string();
+		pending.append(buffer, length);
+	}
+}
+
+std::string request(int socket, const std::string &text)
+{
+	send(socket, text.data(), text.size(), MSG_NOSIGNAL);
+	std::string pending;
+	return readReply(socket, pending);
+}
+
+int bindUdp(uint16_t &port)
+{
+	int socket = ::socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address));
+	socklen_t length = sizeof(address);
+	getsockname(socket, reinterpret_cast<struct sockaddr *>(&address), &length);
+	port = ntohs(address.sin_port);
+	// a whole round of frames is read at once, nothing may be dropped on the way
+	int size = 8 << 20;
+	setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	return socket;
+}
+
+struct Viewer
+{
+	int Control = -1;
+	int Rtp = -1;
+	int Rtcp = -1;
+	uint16_t RtpPort = 0;
+	uint16_t RtcpPort = 0;
+	std::string Session;
+	Depacketizer Frames;
+
+	void Drain()
+	{
+		uint8_t packet[2048];
+		int length;
+		while ((length = recv(Rtp, packet, sizeof(packet), MSG_DONTWAIT)) > 0)
+			Frames.Packet(packet, length);
+	}
+};
+
+bool join(Viewer &viewer)
+{
+	viewer.Control = connectControl();
+	if (viewer.Control < 0)
+		return false;
+	viewer.Rtp = bindUdp(viewer.RtpPort);
+	viewer.Rtcp = bindUdp(viewer.RtcpPort);
+
+	std::string reply = request(viewer.Control, "OPTIONS rtsp://127.0.0.1/cam RTSP/1.0\r\nCSeq: 1\r\n\r\n");
+	CHECK(reply.find("RTSP/1.0 200") == 0 && reply.find("CSeq: 1\r\n") != std::string::npos);
+
+	reply = request(viewer.Control, "DESCRIBE rtsp://127.0.0.1/cam RTSP/1.0\r\nCSeq: 2\r\nAccept: application/sdp\r\n\r\n");
+	CHECK(reply.find("m=video 0 RTP/AVP 26") != std::string::npos);
+
+	// interleaved transport is not offered
+	reply = request(viewer.Control, "SETUP rtsp://127.0.0.1/cam/track1 RTSP/1.0\r\nCSeq: 3\r\n"
+									"Transport: RTP/AVP/TCP;interleaved=0-1\r\n\r\n");
+	CHECK(reply.find(" 461 ") != std::string::npos);
+
+	reply = request(viewer.Control, "SETUP rtsp://127.0.0.1/cam/track1 RTSP/1.0\r\nCSeq: 4\r\nTransport: RTP/AVP;unicast;client_port=" +
+										std::to_string(viewer.RtpPort) + "-" + std::to_string(viewer.RtcpPort) + "\r\n\r\n");
+	CHECK(reply.find("RTSP/1.0 200") == 0);
+	size_t session = reply.find("Session: ");
+	if (session == std::string::npos)
+		return false;
+	viewer.Session = reply.substr(session + 9, 8);
+
+	reply = request(viewer.Control, "PLAY rtsp://127.0.0.1/cam RTSP/1.0\r\nCSeq: 5\r\nSession: 00000000\r\n\r\n");
+	CHECK(reply.find(" 454 ") != std::string::npos);
+	reply = request(viewer.Control, "PLAY rtsp://127.0.0.1/cam RTSP/1.0\r\nCSeq: 6\r\nSession: " + viewer.Session +
+										"\r\nRange: npt=0-\r\n\r\n");
+	CHECK(reply.find("RTSP/1.0 200") == 0);
+	return true;
+}
+
+void settle()
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+}
+
+void testFrames(RtspServer &server, Viewer &first, Viewer &second)
+{
+	const struct
+	{
+		int Width;
+		int Height;
+		int VerticalSampling;
+		int Quality;
+		int RestartInterval;
+	} cases[] = {
+		{320, 240, 1, 80, 0},
+		{640, 480, 2, 60, 0},
+		{160, 120, 1, 95, 4},
+		{800, 600, 2, 30, 10},
+		{1600, 1200, 1, 12, 0},
+		{48, 16, 2, 90, 1},
+	};
+
+	size_t frames = 0;
+	for (int round = 0; round < 3; round++)
+	{
+		for (const auto &test : cases)
+		{
+			Bytes jpeg = encode(test.Width, test.Height, test.VerticalSampling, test.Quality, test.RestartInterval,
+								round * 10 + frames);
+			CHECK(server.PushFrame(jpeg.data(), jpeg.size()));
+			settle();
+			frames++;
+
+			int width, height;
+			Bytes expected = decode(jpeg, width, height);
+			for (Viewer *viewer : {&first, &second})
+			{
+				viewer->Drain();
+				CHECK(!viewer->Frames.Lost && !viewer->Frames.Malformed);
+				CHECK(viewer->Frames.Frames.size() == frames);
+				if (viewer->Frames.Frames.size() != frames)
+					continue;
+
+				int actualWidth, actualHeight;
+				Bytes actual = decode(viewer->Frames.Frames.back(), actualWidth, actualHeight);
+				CHECK(actualWidth == width && actualHeight == height && actual == expected);
+			}
+		}
+	}
+}
+
+void testShaping(RtspServer &server, Viewer &first, Viewer &second)
+{
+	// a frame is sent whole or not at all, never cut short
+	server.SetBandwidth(30000, 30000);
+	size_t before = first.Frames.Frames.size();
+	uint32_t shapedBefore = server.GetShapedFrames();
+	for (int i = 0; i < 5; i++)
+	{
+		Bytes jpeg = encode(640, 480, 1, 80, 0, 50 + i);
+		CHECK(server.PushFrame(jpeg.data(), jpeg.size()));
+	}
+	settle();
+	first.Drain();
+	second.Drain();
+
+	size_t sent = first.Frames.Frames.size() - before;
+	CHECK(sent >= 1 && sent < 5);
+	CHECK(!first.Frames.Lost && !second.Frames.Lost && !first.Frames.Malformed && !second.Frames.Malformed);
+	CHECK(first.Frames.Frames.size() == second.Frames.Frames.size());
+	CHECK(server.GetShapedFrames() - shapedBefore == 2 * (5 - sent));
+	server.SetBandwidth(0, 0);
+}
+
+void testTeardown(RtspServer &server, StreamBroadcaster &source, Viewer &first, Viewer &second)
+{
+	std::string reply = request(first.Control, "TEARDOWN rtsp://127.0.0.1/cam RTSP/1.0\r\nCSeq: 7\r\nSession: " +
+												   first.Session + "\r\n\r\n");
+	CHECK(reply.find("RTSP/1.0 200") == 0);
+	CHECK(server.GetPlayingCount() == 1);
+
+	// the other one keeps playing
+	size_t firstFrames = first.Frames.Frames.size();
+	size_t secondFrames = second.Frames.Frames.size();
+	Bytes jpeg = encode(320, 240, 1, 80, 0, 99);
+	server.PushFrame(jpeg.data(), jpeg.size());
+	settle();
+	first.Drain();
+	second.Drain();
+	CHECK(first.Frames.Frames.size() == firstFrames);
+	CHECK(second.Frames.Frames.size() == secondFrames + 1);
+
+	// a sender report followed by the SDES with the CNAME
+	uint8_t report[256];
+	struct timeval timeout = {7, 0};
+	setsockopt(second.Rtcp, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	int length = recv(second.Rtcp, report, sizeof(report), 0);
+	CHECK(length >= 38 && report[1] == 200 && report[28 + 1] == 202);
+	uint32_t packets = (report[20] << 24) | (report[21] << 16) | (report[22] << 8) | report[23];
+	CHECK(packets > 0);
+
+	// a dropped control connection ends the session, nobody is left to capture for
+	close(second.Control);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	CHECK(server.GetPlayingCount() == 0);
+	CHECK((source.Demands & StreamBroadcaster::DemandRtsp) == 0);
+}
+
+void testPipelinedRequests()
+{
+	int socket = connectControl();
+	CHECK(socket >= 0);
+	std::string requests;
+	for (int i = 1; i <= 3; i++)
+		requests += "OPTIONS rtsp://127.0.0.1/cam RTSP/1.0\r\nCSeq: " + std::to_string(i) + "\r\n\r\n";
+	send(socket, requests.data(), requests.size(), MSG_NOSIGNAL);
+
+	// more than the replies buffer holds, the third one waits until the first two are out
+	std::string pending;
+	for (int i = 1; i <= 3; i++)
+	{
+		std::string reply = readReply(socket, pending);
+		CHECK(reply.find("RTSP/1.0 200") == 0 && reply.find("CSeq: " + std::to_string(i) + "\r\n") != std::string::npos);
+	}
+
+	// the 400 goes out before the connection is closed
+	std::string reply = request(socket, "garbage\r\n\r\n");
+	CHECK(reply.find(" 400 ") != std::string::npos);
+	char byte;
+	CHECK(recv(socket, &byte, 1, 0) == 0);
+	close(socket);
+}
+
+void testFullRequestBuffer()
+{
+	// more pipelined requests than the request buffer holds are all answered
+	int socket = connectControl();
+	CHECK(socket >= 0);
+	std::string requests;
+	for (int i = 1; i <= 40; i++)
+		requests += "OPTIONS rtsp://127.0.0.1/cam RTSP/1.0\r\nCSeq: " + std::to_string(i) + "\r\n\r\n";
+	// the server reads requests into 1024 bytes
+	CHECK(requests.size() > 1024);
+	send(socket, requests.data(), requests.size(), MSG_NOSIGNAL);
+	std::string pending;
+	for (int i = 1; i <= 40; i++)
+	{
+		std::string reply = readReply(socket, pending);
+		CHECK(reply.find("RTSP/1.0 200") == 0 && reply.find("CSeq: " + std::to_string(i) + "\r\n") != std::string::npos);
+	}
+	close(socket);
+
+	// a request that does not fit is refused before the connection is closed
+	socket = connectControl();
+	CHECK(socket >= 0);
+	std::string oversized = "OPTIONS rtsp://127.0.0.1/cam RTSP/1.0\r\nCSeq: 7\r\nUser-Agent: " + std::string(1024, 'a');
+	send(socket, oversized.data(), oversized.size(), MSG_NOSIGNAL);
+	pending.clear();
+	std::string reply = readReply(socket, pending);
+	CHECK(reply.find("RTSP/1.0 413") == 0 && reply.find("CSeq: 7\r\n") != std::string::npos);
+	char byte;
+	CHECK(recv(socket, &byte, 1, 0) <= 0);
+	close(socket);
+}
+
+} // namespace
+
+int main()
+{
+	StreamBroadcaster source;
+	static RtspServer server;
+	CHECK(server.Start(source, Port));
+
+	Viewer first, second;
+	CHECK(join(first) && join(second));
+	CHECK(server.GetPlayingCount() == 2);
+	CHECK((source.Demands & StreamBroadcaster::DemandRtsp) != 0);
+
+	testFrames(server, first, second);
+	testShaping(server, first, second);
+	testTeardown(server, source, first, second);
+	testPipelinedRequests();
+	testFullRequestBuffer();
+
+	// the server task never returns, it goes down with the process
+	int result = HostTest::Finish("RtspLoopback");
+	fflush(stdout);
+	_exit(result);
+}
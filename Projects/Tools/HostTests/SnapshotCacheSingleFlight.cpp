@@ -0,0 +1,171 @@
+// SnapshotCache with the camera stand-in: pollers inside the freshness window share one frame,
+// misses that queue behind a running capture are served its result, a snapshot held by a slow
+// client survives newer captures, and every buffer is freed once the cache and the requests
+// let go of it. Built with AddressSanitizer.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "HostTest.h"
+#include "SnapshotCache.h"
+
+using HostCamera::Sensor;
+using Source = SnapshotCache::Source;
+
+namespace
+{
+
+/// @brief	Every byte of a stand-in frame is its sequence number.
+bool intact(const SnapshotCache::Snapshot &snapshot)
+{
+	for (size_t i = 1; i < snapshot.Length; i++)
+		if (snapshot.Data[i] != snapshot.Data[0])
+			return false;
+	return snapshot.Data != nullptr && snapshot.Length > 0;
+}
+
+snapshot_cache_stats_t stats(SnapshotCache &cache)
+{
+	snapshot_cache_stats_t current;
+	cache.GetStats(current);
+	return current;
+}
+
+void testPollers()
+{
+	SnapshotCache cache;
+	std::atomic<int> broken{0};
+	std::vector<std::thread> pollers;
+	for (int i = 0; i < 8; i++)
+	{
+		pollers.emplace_back([&] {
+			for (int request = 0; request < 20; request++)
+			{
+				SnapshotCache::Snapshot snapshot;
+				if (!cache.Acquire(snapshot) || !intact(snapshot))
+					broken++;
+				cache.Release(snapshot);
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			}
+		});
+	}
+	for (std::thread &poller : pollers)
+		poller.join();
+
+	// about a second of polling needs a capture per 200 ms window, never two at once
+	const snapshot_cache_stats_t result = stats(cache);
+	CHECK(broken == 0);
+	CHECK(result.requests == 160);
+	CHECK(result.hits + result.coalesced + result.captures == 160);
+	CHECK(result.captures >= 4 && result.captures <= 12);
+	CHECK(result.encodes == result.captures && result.encodes_saved == result.hits + result.coalesced);
+	CHECK(result.saved_ms >= (result.hits + result.coalesced) * 90);
+	CHECK(Sensor::Instance().MostInFlight == 1);
+	cache.Invalidate();
+}
+
+void testCoalescing()
+{
+	// with no freshness window only requests that waited on a capture share it
+	SnapshotCache cache;
+	cache.SetFreshness(0);
+	std::atomic<int> coalesced{0};
+	std::atomic<int> waiting{0};
+	std::vector<std::thread> requests;
+	for (int i = 0; i < 6; i++)
+	{
+		requests.emplace_back([&] {
+			waiting++;
+			while (waiting < 6)
+				std::this_thread::yield();
+			SnapshotCache::Snapshot snapshot;
+			if (cache.Acquire(snapshot) && snapshot.From == Source::Coalesced)
+				coalesced++;
+			cache.Release(snapshot);
+		});
+	}
+	for (std::thread &request : requests)
+		request.join();
+	CHECK(stats(cache).captures == 1);
+	CHECK(coalesced == 5);
+
+	for (int i = 0; i < 3; i++)
+	{
+		SnapshotCache::Snapshot snapshot;
+		CHECK(cache.Acquire(snapshot) && snapshot.From == Source::Captured);
+		cache.Release(snapshot);
+	}
+	CHECK(stats(cache).captures == 4);
+	cache.Invalidate();
+}
+
+void testHeldSnapshots()
+{
+	SnapshotCache cache;
+	cache.SetFreshness(0);
+
+	// a slow client keeps its frame while newer ones are taken, even with every slot busy
+	SnapshotCache::Snapshot held[6];
+	for (SnapshotCache::Snapshot &snapshot : held)
+		CHECK(cache.Acquire(snapshot) && snapshot.From == Source::Captured);
+	for (int i = 1; i < 6; i++)
+		CHECK(held[i].Data[0] != held[i - 1].Data[0]);
+	for (SnapshotCache::Snapshot &snapshot : held)
+	{
+		CHECK(intact(snapshot));
+		cache.Release(snapshot);
+		CHECK(snapshot.Data == nullptr);
+	}
+
+	SnapshotCache::Snapshot again;
+	CHECK(cache.Acquire(again) && intact(again));
+	cache.Release(again);
+	cache.Invalidate();
+}
+
+void testInvalidate()
+{
+	SnapshotCache cache;
+	cache.SetFreshness(10000);
+	SnapshotCache::Snapshot first, second, third;
+	CHECK(cache.Acquire(first) && first.From == Source::Captured);
+	CHECK(cache.Acquire(second) && second.From == Source::Cached && second.Data == first.Data);
+	cache.Invalidate();
+	CHECK(cache.Acquire(third) && third.From == Source::Captured && third.Data[0] != first.Data[0]);
+	CHECK(intact(first));
+	cache.Release(first);
+	cache.Release(second);
+	cache.Release(third);
+	cache.Invalidate();
+}
+
+void testJpegAndFailure()
+{
+	SnapshotCache cache;
+	Sensor::Instance().Format = PIXFORMAT_JPEG;
+	const uint32_t encodes = Sensor::Instance().Encodes;
+	SnapshotCache::Snapshot snapshot;
+	CHECK(cache.Acquire(snapshot) && intact(snapshot));
+	cache.Release(snapshot);
+	CHECK(Sensor::Instance().Encodes == encodes && stats(cache).encodes == 0);
+
+	cache.Invalidate();
+	Sensor::Instance().Fail = true;
+	CHECK(!cache.Acquire(snapshot));
+	CHECK(stats(cache).failures == 1);
+	Sensor::Instance().Fail = false;
+	Sensor::Instance().Format = PIXFORMAT_RGB565;
+}
+
+} // namespace
+
+int main()
+{
+	testPollers();
+	testCoalescing();
+	testHeldSnapshots();
+	testInvalidate();
+	testJpegAndFailure();
+	return HostTest::Finish("SnapshotCacheSingleFlight");
+}
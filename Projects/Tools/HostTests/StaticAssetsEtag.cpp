@@ -0,0 +1,187 @@
+// StaticAssets against a directory standing in for the SPIFFS partition: files go out in
+// chunks with their headers, If-None-Match lists get a 304 without the file being opened,
+// a changed file gets a new ETag and paths leaving the partition are refused. fopen() and
+// stat() are wrapped at link time to move /spiffs into the test's directory.
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <sys/stat.h>
+#include "HostTest.h"
+#include "StaticAssets.h"
+
+namespace
+{
+
+std::string root;
+int opened = 0;
+
+std::string redirect(const char *path)
+{
+	const size_t base = strlen(StaticAssets::BasePath);
+	return strncmp(path, StaticAssets::BasePath, base) == 0 ? root + (path + base) : path;
+}
+
+} // namespace
+
+extern "C" FILE *__real_fopen(const char *path, const char *mode);
+extern "C" int __real_stat(const char *path, struct stat *st);
+
+extern "C" FILE *__wrap_fopen(const char *path, const char *mode)
+{
+	opened++;
+	return __real_fopen(redirect(path).c_str(), mode);
+}
+
+extern "C" int __wrap_stat(const char *path, struct stat *st)
+{
+	return __real_stat(redirect(path).c_str(), st);
+}
+
+namespace
+{
+
+std::string store(const char *name, size_t length, int seed)
+{
+	std::string data(length, 0);
+	srand(seed);
+	for (char &c : data)
+		c = static_cast<char>(rand());
+	FILE *f = __real_fopen((root + name + ".gz").c_str(), "w");
+	fwrite(data.data(), 1, data.size(), f);
+	fclose(f);
+	return data;
+}
+
+static_asset_stats_t stats(StaticAssets &assets)
+{
+	static_asset_stats_t current;
+	assets.GetStats(current);
+	return current;
+}
+
+void testFile(StaticAssets &assets)
+{
+	const std::string data = store("/index.html", 5000, 1);
+	httpd_req_t req;
+	opened = 0;
+	CHECK(assets.Serve(&req, "/index.html?v=2") == ESP_OK);
+	CHECK(req.Sent && req.Status == "200 OK" && req.Body == data);
+	CHECK(req.Chunks.size() == 5);
+	CHECK(req.Type == "text/html");
+	CHECK(req.ResponseHeaders["Content-Encoding"] == "gzip");
+	CHECK(req.ResponseHeaders["Cache-Control"] == "public, no-cache");
+	CHECK(req.ResponseHeaders["Vary"] == "Accept-Encoding");
+	CHECK(req.ResponseHeaders["ETag"].size() == 18 && req.ResponseHeaders["ETag"][0] == '"');
+	// hashed and sent from one open
+	CHECK(opened == 1);
+
+	const static_asset_stats_t result = stats(assets);
+	CHECK(result.served == 1 && result.bytes == 5000 && result.hashed == 1);
+}
+
+void testNotModified(StaticAssets &assets)
+{
+	httpd_req_t first;
+	CHECK(assets.Serve(&first, "/index.html") == ESP_OK);
+	const std::string etag = first.ResponseHeaders["ETag"];
+
+	// weak comparison inside a list, and "*"
+	for (const std::string &list : {"\"0123456789abcdef\", W/" + etag, std::string("*")})
+	{
+		httpd_req_t req;
+		req.Headers["If-None-Match"] = list;
+		opened = 0;
+		CHECK(assets.Serve(&req, "/index.html") == ESP_OK);
+		CHECK(req.Sent && req.Status == "304 Not Modified" && req.Body.empty());
+		CHECK(req.ResponseHeaders["ETag"] == etag);
+		CHECK(opened == 0);
+	}
+
+	httpd_req_t other;
+	other.Headers["If-None-Match"] = "\"0123456789abcdef\"";
+	CHECK(assets.Serve(&other, "/index.html") == ESP_OK && other.Status == "200 OK");
+	CHECK(stats(assets).not_modified == 2 && stats(assets).hashed == 1);
+}
+
+void testChanged(StaticAssets &assets)
+{
+	httpd_req_t before;
+	CHECK(assets.Serve(&before, "/index.html") == ESP_OK);
+	const std::string data = store("/index.html", 4000, 2);
+
+	httpd_req_t req;
+	req.Headers["If-None-Match"] = before.ResponseHeaders["ETag"];
+	CHECK(assets.Serve(&req, "/index.html") == ESP_OK);
+	CHECK(req.Status == "200 OK" && req.Body == data);
+	CHECK(req.ResponseHeaders["ETag"] != before.ResponseHeaders["ETag"]);
+	CHECK(stats(assets).hashed == 2);
+}
+
+void testRefused(StaticAssets &assets)
+{
+	store("/secret", 10, 3);
+	const std::string tooLong = "/" + std::string(60, 'a') + ".js";
+	for (const char *path : {"/../secret", "/x/../secret", "secret", "/missing.css", tooLong.c_str()})
+	{
+		httpd_req_t req;
+		CHECK(assets.Serve(&req, path) == ESP_ERR_NOT_FOUND);
+		CHECK(!req.Sent && req.Chunks.empty());
+	}
+}
+
+void testTypesAndEviction(StaticAssets &assets)
+{
+	const char *names[] = {"/a.js", "/b.css", "/c.json", "/d.svg", "/e.png", "/f.jpg", "/g.ico", "/h.bin", "/i"};
+	const char *types[] = {"application/javascript", "text/css", "application/json", "image/svg+xml",
+						   "image/png", "image/jpeg", "image/x-icon", "application/octet-stream", "text/html"};
+	const uint32_t hashed = stats(assets).hashed;
+	for (int i = 0; i < 9; i++)
+	{
+		store(names[i], 100 + i, 10 + i);
+		httpd_req_t req;
+		CHECK(assets.Serve(&req, names[i]) == ESP_OK && req.Type == types[i]);
+	}
+	CHECK(stats(assets).hashed - hashed == 9);
+
+	// eight entries, /index.html was used longest ago and has to be hashed again
+	httpd_req_t req;
+	CHECK(assets.Serve(&req, "/i") == ESP_OK);
+	CHECK(assets.Serve(&req, "/index.html") == ESP_OK);
+	CHECK(stats(assets).hashed - hashed == 10);
+}
+
+void testEmbedded(StaticAssets &assets)
+{
+	const std::string page(3000, 'p');
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(page.data());
+	httpd_req_t req;
+	CHECK(assets.ServeEmbedded(&req, "/", data, page.size()) == ESP_OK);
+	CHECK(req.Sent && req.Body == page && req.Type == "text/html");
+	CHECK(req.ResponseHeaders["Content-Encoding"] == "gzip");
+
+	httpd_req_t again;
+	again.Headers["If-None-Match"] = req.ResponseHeaders["ETag"];
+	CHECK(assets.ServeEmbedded(&again, "/", data, page.size()) == ESP_OK);
+	CHECK(again.Status == "304 Not Modified" && again.Body.empty());
+}
+
+} // namespace
+
+int main()
+{
+	char directory[] = "/tmp/spiffsXXXXXX";
+	root = mkdtemp(directory);
+
+	StaticAssets assets;
+	testFile(assets);
+	testNotModified(assets);
+	testChanged(assets);
+	testRefused(assets);
+	testTypesAndEviction(assets);
+	testEmbedded(assets);
+
+	std::filesystem::remove_all(root);
+	return HostTest::Finish("StaticAssetsEtag");
+}
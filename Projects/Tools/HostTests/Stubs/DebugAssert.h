@@ -0,0 +1,22 @@
+#pragma once
+
+// Host stand-in, only the error names are used by the protocol code.
+
+#include <cassert>
+
+namespace Utilities
+{
+
+class DebugAssert
+{
+public:
+	static const char *GetLwipErrorName(int code)
+	{
+		static const char *const names[] = {"ERR_OK", "ERR_MEM", "ERR_BUF", "ERR_TIMEOUT", "ERR_RTE", "ERR_INPROGRESS",
+											"ERR_VAL", "ERR_WOULDBLOCK", "ERR_USE", "ERR_ALREADY", "ERR_ISCONN", "ERR_CONN",
+											"ERR_IF", "ERR_ABRT", "ERR_RST", "ERR_CLSD", "ERR_ARG"};
+		return code <= 0 && code > -17 ? names[-code] : "unknown";
+	}
+};
+
+} // namespace Utilities
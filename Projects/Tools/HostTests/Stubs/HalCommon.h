@@ -0,0 +1,5 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
@@ -0,0 +1,75 @@
+#pragma once
+
+// Host stand-in for the parts of Hal::Hardware the protocol code uses.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include "freertos/task.h"
+
+namespace Hal
+{
+
+class Rng
+{
+public:
+	uint32_t GetNumber()
+	{
+		return static_cast<uint32_t>(rand()) * 2654435761u ^ static_cast<uint32_t>(rand());
+	}
+};
+
+/// @brief	Always mounted, the host directory standing in for the partition is up to the test.
+class Spiffs
+{
+public:
+	bool Mount()
+	{
+		return true;
+	}
+
+	bool IsMounted()
+	{
+		return true;
+	}
+};
+
+class Hardware
+{
+public:
+	static Hardware *Instance()
+	{
+		static Hardware hardware;
+		return &hardware;
+	}
+
+	Rng &GetRng()
+	{
+		return _rng;
+	}
+
+	Spiffs &GetSpiffs()
+	{
+		return _spiffs;
+	}
+
+	uint32_t Milliseconds()
+	{
+		return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count()) + _skipped;
+	}
+
+	/// @brief	Moves Milliseconds() ahead, for timeouts longer than a test should wait.
+	void Skip(uint32_t milliseconds)
+	{
+		_skipped += milliseconds;
+	}
+
+private:
+	Rng _rng;
+	Spiffs _spiffs;
+	std::atomic<uint32_t> _skipped{0};
+};
+
+} // namespace Hal
@@ -0,0 +1,41 @@
+#pragma once
+
+// Host stand-in, errors go to stderr so a failing test shows why.
+
+#include <cstdint>
+#include <cstdio>
+
+namespace Utilities
+{
+
+class Logger
+{
+public:
+	enum class LogSource : uint8_t
+	{
+		Hal,
+		Configuration,
+		Camera,
+		Ble,
+		Wifi,
+		HttpServer,
+		Gateway,
+		FirmwareUpdate,
+		Unknown = 255
+	};
+
+	template <typename... Arguments>
+	static void LogInfo(LogSource source, const char *format, Arguments... arguments)
+	{
+	}
+
+	template <typename... Arguments>
+	static void LogError(LogSource source, const char *format, Arguments... arguments)
+	{
+		fprintf(stderr, "[log] ");
+		fprintf(stderr, format, arguments...);
+		fprintf(stderr, "\n");
+	}
+};
+
+} // namespace Utilities
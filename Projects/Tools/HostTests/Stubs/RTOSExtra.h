@@ -0,0 +1,5 @@
+#pragma once
+
+// Host stand-in, stack depths are meaningless for a std::thread.
+
+#define configHTTPSVC_STACK_DEPTH 4096
@@ -0,0 +1,33 @@
+#pragma once
+
+// Host stand-in, only the hooks RtspServer uses. The test pushes the frames itself.
+
+#include <cstddef>
+#include <cstdint>
+
+typedef void (*stream_jpeg_listener_t)(const uint8_t *jpeg, size_t length, void *arg);
+
+class StreamBroadcaster
+{
+public:
+	enum Demand : uint8_t
+	{
+		DemandRtsp = 0x01,
+		DemandTiles = 0x02
+	};
+
+	void SetJpegListener(stream_jpeg_listener_t listener, void *arg)
+	{
+		Listener = listener;
+		Arg = arg;
+	}
+
+	void SetExternalDemand(uint8_t source, bool demand)
+	{
+		Demands = demand ? Demands | source : Demands & ~source;
+	}
+
+	stream_jpeg_listener_t Listener = nullptr;
+	void *Arg = nullptr;
+	uint8_t Demands = 0;
+};
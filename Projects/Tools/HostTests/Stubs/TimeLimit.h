@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include "Hardware.h"
+
+namespace Hal
+{
+
+class TimeLimit
+{
+public:
+	TimeLimit()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		_start = Hardware::Instance()->Milliseconds();
+	}
+
+	uint32_t ElapsedTime() const
+	{
+		return Hardware::Instance()->Milliseconds() - _start;
+	}
+
+	bool IsTimeUp(uint32_t milliseconds) const
+	{
+		return ElapsedTime() >= milliseconds;
+	}
+
+private:
+	uint32_t _start = 0;
+};
+
+} // namespace Hal
@@ -0,0 +1,86 @@
+#pragma once
+
+// Host stand-in for the camera driver. A grab takes GrabMs and hands out a frame filled with
+// its own sequence number, so a test can tell which frame it holds. The counters show how many
+// grabs ran and how many overlapped.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+typedef enum
+{
+	PIXFORMAT_RGB565,
+	PIXFORMAT_YUV422,
+	PIXFORMAT_GRAYSCALE,
+	PIXFORMAT_JPEG,
+	PIXFORMAT_RGB888,
+} pixformat_t;
+
+typedef struct
+{
+	uint8_t *buf;
+	size_t len;
+	size_t width;
+	size_t height;
+	pixformat_t format;
+} camera_fb_t;
+
+namespace HostCamera
+{
+
+struct Sensor
+{
+	std::atomic<uint32_t> GrabMs{40};
+	std::atomic<uint32_t> EncodeMs{60};
+	std::atomic<pixformat_t> Format{PIXFORMAT_RGB565};
+	std::atomic<bool> Fail{false};
+	std::atomic<uint32_t> Grabs{0};
+	std::atomic<uint32_t> Encodes{0};
+	std::atomic<uint32_t> InFlight{0};
+	std::atomic<uint32_t> MostInFlight{0};
+
+	static Sensor &Instance()
+	{
+		static Sensor sensor;
+		return sensor;
+	}
+};
+
+constexpr size_t Width = 160;
+constexpr size_t Height = 120;
+
+} // namespace HostCamera
+
+inline camera_fb_t *esp_camera_fb_get()
+{
+	HostCamera::Sensor &sensor = HostCamera::Sensor::Instance();
+	uint32_t inFlight = ++sensor.InFlight;
+	for (uint32_t most = sensor.MostInFlight; inFlight > most && !sensor.MostInFlight.compare_exchange_weak(most, inFlight);)
+		;
+	std::this_thread::sleep_for(std::chrono::milliseconds(sensor.GrabMs));
+	if (sensor.Fail)
+	{
+		sensor.InFlight--;
+		return nullptr;
+	}
+
+	camera_fb_t *fb = new camera_fb_t();
+	fb->width = HostCamera::Width;
+	fb->height = HostCamera::Height;
+	fb->format = sensor.Format;
+	fb->len = fb->format == PIXFORMAT_JPEG ? fb->width * fb->height / 10 : fb->width * fb->height * 2;
+	fb->buf = static_cast<uint8_t *>(malloc(fb->len));
+	memset(fb->buf, static_cast<uint8_t>(++sensor.Grabs), fb->len);
+	return fb;
+}
+
+inline void esp_camera_fb_return(camera_fb_t *fb)
+{
+	free(fb->buf);
+	delete fb;
+	HostCamera::Sensor::Instance().InFlight--;
+}
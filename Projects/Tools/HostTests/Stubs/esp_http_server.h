@@ -0,0 +1,83 @@
+#pragma once
+
+// Host stand-in for the esp_http_server calls the camera server makes. A request carries the
+// headers the test gave it and records the response instead of sending it.
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "esp_err.h"
+
+struct httpd_req_t
+{
+	std::map<std::string, std::string> Headers;
+
+	std::string Status = "200 OK";
+	std::string Type;
+	std::map<std::string, std::string> ResponseHeaders;
+	std::vector<std::string> Chunks;
+	std::string Body;
+	bool Sent = false;
+};
+
+inline size_t httpd_req_get_hdr_value_len(httpd_req_t *req, const char *field)
+{
+	auto header = req->Headers.find(field);
+	return header != req->Headers.end() ? header->second.size() : 0;
+}
+
+inline esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *field, char *value, size_t size)
+{
+	auto header = req->Headers.find(field);
+	if (header == req->Headers.end())
+		return ESP_ERR_NOT_FOUND;
+	if (header->second.size() >= size)
+		return ESP_FAIL;
+	strcpy(value, header->second.c_str());
+	return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status)
+{
+	req->Status = status;
+	return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type)
+{
+	req->Type = type;
+	return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field, const char *value)
+{
+	req->ResponseHeaders[field] = value;
+	return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_send(httpd_req_t *req, const char *data, ssize_t length)
+{
+	req->Body.assign(data != nullptr ? data : "", data != nullptr ? length : 0);
+	req->Sent = true;
+	return ESP_OK;
+}
+
+/// @note	An empty chunk ends the response.
+inline esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *data, ssize_t length)
+{
+	if (data == nullptr || length == 0)
+	{
+		req->Sent = true;
+		return ESP_OK;
+	}
+	req->Chunks.emplace_back(data, length);
+	req->Body.append(data, length);
+	return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_send_500(httpd_req_t *req)
+{
+	req->Status = "500 Internal Server Error";
+	return httpd_resp_send(req, nullptr, 0);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+// Host stand-in for the ROM decoder on top of libjpeg. Scaled decoding only runs the DC part
+// of the IDCT there too, the rectangles handed out are single BGR888 lines.
+
+#include <csetjmp>
+#include <cstdint>
+#include <cstdio>
+#include <utility>
+#include <vector>
+#include <jpeglib.h>
+#include "esp_err.h"
+
+typedef enum
+{
+	JPG_SCALE_NONE,
+	JPG_SCALE_2X,
+	JPG_SCALE_4X,
+	JPG_SCALE_8X,
+	JPG_SCALE_MAX = JPG_SCALE_8X
+} jpg_scale_t;
+
+typedef size_t (*jpg_reader_cb)(void *arg, size_t index, uint8_t *buf, size_t len);
+typedef bool (*jpg_writer_cb)(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data);
+
+namespace HostJpeg
+{
+
+struct Error
+{
+	jpeg_error_mgr Manager;
+	jmp_buf Exit;
+};
+
+inline void exitDecoder(j_common_ptr decoder)
+{
+	longjmp(reinterpret_cast<Error *>(decoder->err)->Exit, 1);
+}
+
+inline void quiet(j_common_ptr decoder)
+{
+}
+
+} // namespace HostJpeg
+
+inline esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void *arg)
+{
+	std::vector<uint8_t> input(len);
+	if (reader(arg, 0, input.data(), len) != len)
+		return ESP_FAIL;
+
+	jpeg_decompress_struct decoder;
+	HostJpeg::Error error;
+	decoder.err = jpeg_std_error(&error.Manager);
+	error.Manager.error_exit = HostJpeg::exitDecoder;
+	error.Manager.output_message = HostJpeg::quiet;
+	std::vector<uint8_t> line;
+	if (setjmp(error.Exit))
+	{
+		jpeg_destroy_decompress(&decoder);
+		return ESP_FAIL;
+	}
+
+	jpeg_create_decompress(&decoder);
+	jpeg_mem_src(&decoder, input.data(), input.size());
+	jpeg_read_header(&decoder, TRUE);
+	decoder.scale_num = 1;
+	decoder.scale_denom = 1 << scale;
+	decoder.out_color_space = JCS_RGB;
+	jpeg_start_decompress(&decoder);
+
+	const uint16_t width = decoder.output_width;
+	const uint16_t height = decoder.output_height;
+	writer(arg, 0, 0, width, height, nullptr);
+	line.resize(width * 3);
+	bool interrupted = false;
+	while (!interrupted && decoder.output_scanline < height)
+	{
+		uint16_t y = decoder.output_scanline;
+		JSAMPROW row = line.data();
+		jpeg_read_scanlines(&decoder, &row, 1);
+		for (uint16_t x = 0; x < width; x++)
+			std::swap(line[x * 3], line[x * 3 + 2]);
+		interrupted = !writer(arg, 0, y, width, 1, line.data());
+	}
+	writer(arg, width, height, width, height, nullptr);
+	jpeg_abort_decompress(&decoder);
+	jpeg_destroy_decompress(&decoder);
+	return interrupted ? ESP_FAIL : ESP_OK;
+}
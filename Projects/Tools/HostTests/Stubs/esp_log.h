@@ -0,0 +1,13 @@
+#pragma once
+
+// Host stand-in, the ESP-IDF log macros are compiled out. On the device this header brings
+// stdio and assert along, the code relies on that.
+
+#include <assert.h>
+#include <stdio.h>
+
+#define ESP_LOGE(tag, ...)
+#define ESP_LOGW(tag, ...)
+#define ESP_LOGI(tag, ...)
+#define ESP_LOGD(tag, ...)
+#define ESP_LOGV(tag, ...)
@@ -0,0 +1,3 @@
+#pragma once
+
+// Host stand-in, nothing of it is used by the code under test.
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+#include "Hardware.h"
+
+inline uint32_t esp_random()
+{
+	return Hal::Hardware::Instance()->GetRng().GetNumber();
+}
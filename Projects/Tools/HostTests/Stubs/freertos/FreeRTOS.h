@@ -0,0 +1,25 @@
+#pragma once
+
+// Host stand-in, the tick is a millisecond and tasks are detached pthreads. Also used from C
+// by my_http_server.c.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void *TaskHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+#ifndef BIT
+#define BIT(n) (1u << (n))
+#endif
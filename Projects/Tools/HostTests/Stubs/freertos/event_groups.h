@@ -0,0 +1,50 @@
+#pragma once
+
+// Host stand-in, waits forever and never clears bits, which is all my_http_server.c asks for.
+
+#include "FreeRTOS.h"
+
+typedef uint32_t EventBits_t;
+
+typedef struct EventGroupDefinition
+{
+	pthread_mutex_t Lock;
+	pthread_cond_t Changed;
+	EventBits_t Bits;
+} *EventGroupHandle_t;
+
+static inline EventGroupHandle_t xEventGroupCreate(void)
+{
+	EventGroupHandle_t group = (EventGroupHandle_t)calloc(1, sizeof(*group));
+	pthread_mutex_init(&group->Lock, NULL);
+	pthread_cond_init(&group->Changed, NULL);
+	return group;
+}
+
+static inline void vEventGroupDelete(EventGroupHandle_t group)
+{
+	pthread_cond_destroy(&group->Changed);
+	pthread_mutex_destroy(&group->Lock);
+	free(group);
+}
+
+static inline EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+	pthread_mutex_lock(&group->Lock);
+	group->Bits |= bits;
+	EventBits_t result = group->Bits;
+	pthread_cond_broadcast(&group->Changed);
+	pthread_mutex_unlock(&group->Lock);
+	return result;
+}
+
+static inline EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clearOnExit,
+											  BaseType_t waitForAll, TickType_t ticks)
+{
+	pthread_mutex_lock(&group->Lock);
+	while ((group->Bits & bits) == 0)
+		pthread_cond_wait(&group->Changed, &group->Lock);
+	EventBits_t result = group->Bits;
+	pthread_mutex_unlock(&group->Lock);
+	return result;
+}
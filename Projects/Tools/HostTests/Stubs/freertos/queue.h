@@ -0,0 +1,100 @@
+#pragma once
+
+// Host stand-in, a FreeRTOS queue is a ring of fixed size items under a mutex.
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include "FreeRTOS.h"
+
+typedef struct QueueDefinition
+{
+	pthread_mutex_t Lock;
+	pthread_cond_t Changed;
+	UBaseType_t Length;
+	UBaseType_t ItemSize;
+	UBaseType_t Head;
+	UBaseType_t Count;
+	char *Items;
+} *QueueHandle_t;
+
+static inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+	QueueHandle_t queue = (QueueHandle_t)calloc(1, sizeof(*queue));
+	pthread_mutex_init(&queue->Lock, NULL);
+	pthread_cond_init(&queue->Changed, NULL);
+	queue->Length = length;
+	queue->ItemSize = itemSize;
+	queue->Items = (char *)calloc(length, itemSize > 0 ? itemSize : 1);
+	return queue;
+}
+
+static inline void vQueueDelete(QueueHandle_t queue)
+{
+	pthread_cond_destroy(&queue->Changed);
+	pthread_mutex_destroy(&queue->Lock);
+	free(queue->Items);
+	free(queue);
+}
+
+/// @brief	Waits with the lock held until the queue is not full, or not empty.
+static inline BaseType_t queueWait(QueueHandle_t queue, TickType_t ticks, BaseType_t forSend)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += ticks / 1000;
+	deadline.tv_nsec += (long)(ticks % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	while (forSend ? queue->Count == queue->Length : queue->Count == 0)
+	{
+		if (ticks == portMAX_DELAY)
+			pthread_cond_wait(&queue->Changed, &queue->Lock);
+		else if (pthread_cond_timedwait(&queue->Changed, &queue->Lock, &deadline) == ETIMEDOUT)
+			return pdFALSE;
+	}
+	return pdTRUE;
+}
+
+static inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+	pthread_mutex_lock(&queue->Lock);
+	BaseType_t sent = queueWait(queue, ticks, pdTRUE);
+	if (sent)
+	{
+		if (queue->ItemSize > 0)
+			memcpy(queue->Items + (queue->Head + queue->Count) % queue->Length * queue->ItemSize, item, queue->ItemSize);
+		queue->Count++;
+		pthread_cond_broadcast(&queue->Changed);
+	}
+	pthread_mutex_unlock(&queue->Lock);
+	return sent;
+}
+
+static inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+	pthread_mutex_lock(&queue->Lock);
+	BaseType_t received = queueWait(queue, ticks, pdFALSE);
+	if (received)
+	{
+		if (queue->ItemSize > 0)
+			memcpy(item, queue->Items + queue->Head * queue->ItemSize, queue->ItemSize);
+		queue->Head = (queue->Head + 1) % queue->Length;
+		queue->Count--;
+		pthread_cond_broadcast(&queue->Changed);
+	}
+	pthread_mutex_unlock(&queue->Lock);
+	return received;
+}
+
+static inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+	pthread_mutex_lock(&queue->Lock);
+	UBaseType_t count = queue->Count;
+	pthread_mutex_unlock(&queue->Lock);
+	return count;
+}
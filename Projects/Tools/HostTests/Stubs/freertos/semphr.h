@@ -0,0 +1,26 @@
+#pragma once
+
+// Host stand-in, a counting semaphore is a queue of empty items like in FreeRTOS.
+
+#include "queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount)
+{
+	SemaphoreHandle_t semaphore = xQueueCreate(maxCount, 0);
+	semaphore->Count = initialCount;
+	return semaphore;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+	return xQueueSend(semaphore, NULL, 0);
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+	return xQueueReceive(semaphore, NULL, ticks);
+}
+
+#define vSemaphoreDelete(semaphore) vQueueDelete(semaphore)
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <time.h>
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+
+static inline void vTaskDelay(TickType_t ticks)
+{
+	struct timespec delay = {(time_t)(ticks / 1000), (long)(ticks % 1000) * 1000000L};
+	nanosleep(&delay, NULL);
+}
+
+static inline TickType_t xTaskGetTickCount(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (TickType_t)(now.tv_sec * 1000u + now.tv_nsec / 1000000);
+}
+
+static inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stackDepth, void *parameter,
+												 UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, (void *(*)(void *))task, parameter) != 0)
+		return pdFALSE;
+	pthread_detach(thread);
+	if (handle != NULL)
+		*handle = NULL;
+	return pdPASS;
+}
+
+/// @brief	Distinct for every thread.
+static inline TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	static __thread char task;
+	return &task;
+}
+
+/// @note	Only a task deleting itself is supported.
+static inline void vTaskDelete(TaskHandle_t task)
+{
+	pthread_exit(NULL);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// Host stand-in, the "JPEG" is the first tenth of the frame and takes EncodeMs to make.
+
+#include "esp_camera.h"
+
+inline bool frame2jpg(camera_fb_t *fb, uint8_t quality, uint8_t **out, size_t *length)
+{
+	HostCamera::Sensor &sensor = HostCamera::Sensor::Instance();
+	std::this_thread::sleep_for(std::chrono::milliseconds(sensor.EncodeMs));
+	sensor.Encodes++;
+	*length = fb->len / 10;
+	*out = static_cast<uint8_t *>(malloc(*length));
+	if (*out == nullptr)
+		return false;
+	memcpy(*out, fb->buf, *length);
+	return true;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+// Host stand-in for the lwIP netconn API on POSIX sockets, as far as my_http_server.c uses it.
+// A netbuf holds what one recv() returned, in a single piece.
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "err.h"
+#include "ip_addr.h"
+
+#define NETCONN_TCP 0x10
+#define NETCONN_NOCOPY 0x00
+#define NETCONN_COPY 0x01
+
+struct netconn
+{
+	int socket;
+	int recv_timeout;
+};
+
+struct netbuf
+{
+	char data[1460];
+	u16_t length;
+};
+
+static inline struct netconn *netconn_new(int type)
+{
+	struct netconn *conn = (struct netconn *)calloc(1, sizeof(*conn));
+	conn->socket = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	setsockopt(conn->socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	return conn;
+}
+
+static inline void netconn_delete(struct netconn *conn)
+{
+	close(conn->socket);
+	free(conn);
+}
+
+/// @note	Always binds to the loopback address, whatever address is passed.
+static inline err_t netconn_bind(struct netconn *conn, const ip_addr_t *address, u16_t port)
+{
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(port);
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	return bind(conn->socket, (struct sockaddr *)&local, sizeof(local)) == 0 ? ERR_OK : ERR_MEM;
+}
+
+static inline err_t netconn_listen(struct netconn *conn)
+{
+	return listen(conn->socket, 16) == 0 ? ERR_OK : ERR_MEM;
+}
+
+#define netconn_set_recvtimeout(conn, timeout) ((conn)->recv_timeout = (timeout))
+
+/// @return	0 when the receive timeout passed without anything to read.
+static inline int netconnWait(struct netconn *conn)
+{
+	struct pollfd readable = {conn->socket, POLLIN, 0};
+	return poll(&readable, 1, conn->recv_timeout > 0 ? conn->recv_timeout : -1);
+}
+
+static inline err_t netconn_accept(struct netconn *conn, struct netconn **accepted)
+{
+	if (netconnWait(conn) == 0)
+		return ERR_TIMEOUT;
+	int socket = accept(conn->socket, NULL, NULL);
+	if (socket < 0)
+		return ERR_ABRT;
+
+	// lwIP sends small segments right away as well
+	int noDelay = 1;
+	setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	*accepted = (struct netconn *)calloc(1, sizeof(**accepted));
+	(*accepted)->socket = socket;
+	return ERR_OK;
+}
+
+static inline err_t netconn_recv(struct netconn *conn, struct netbuf **buffer)
+{
+	if (netconnWait(conn) == 0)
+		return ERR_TIMEOUT;
+	struct netbuf *received = (struct netbuf *)calloc(1, sizeof(*received));
+	ssize_t length = recv(conn->socket, received->data, sizeof(received->data), 0);
+	if (length <= 0)
+	{
+		free(received);
+		return length == 0 ? ERR_CLSD : ERR_RST;
+	}
+	received->length = (u16_t)length;
+	*buffer = received;
+	return ERR_OK;
+}
+
+static inline err_t netbuf_data(struct netbuf *buffer, void **data, u16_t *length)
+{
+	*data = buffer->data;
+	*length = buffer->length;
+	return ERR_OK;
+}
+
+static inline s8_t netbuf_next(struct netbuf *buffer)
+{
+	return -1;
+}
+
+static inline void netbuf_delete(struct netbuf *buffer)
+{
+	free(buffer);
+}
+
+static inline err_t netconn_write(struct netconn *conn, const void *data, size_t size, u8_t flags)
+{
+	const char *position = (const char *)data;
+	while (size > 0)
+	{
+		ssize_t sent = send(conn->socket, position, size, MSG_NOSIGNAL);
+		if (sent <= 0)
+			return ERR_RST;
+		position += sent;
+		size -= sent;
+	}
+	return ERR_OK;
+}
+
+static inline err_t netconn_close(struct netconn *conn)
+{
+	shutdown(conn->socket, SHUT_RDWR);
+	return ERR_OK;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+// Host stand-in for lwIP's resolver. Names are looked up in a table the test fills, every
+// lookup is answered on the tcpip thread after Delay milliseconds, unknown names with nullptr
+// like a lookup that ran out of retries. Nothing is cached here. Refuse makes every lookup
+// fail right away, like lwIP does when its table is full.
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "err.h"
+#include "opt.h"
+#include "tcpip.h"
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
+
+namespace HostLwip
+{
+
+struct Dns
+{
+	std::mutex Lock;
+	ip_addr_t Servers[DNS_MAX_SERVERS] = {};
+	std::map<std::string, ip_addr_t> Names;
+	uint32_t Delay = 50;
+	uint32_t Lookups = 0;
+	err_t Refuse = ERR_OK;
+
+	static Dns &Instance()
+	{
+		static Dns *dns = new Dns();
+		return *dns;
+	}
+
+	void Add(const char *name, const char *address)
+	{
+		std::lock_guard<std::mutex> lock(Lock);
+		ipaddr_aton(address, &Names[name]);
+	}
+};
+
+} // namespace HostLwip
+
+static inline void dns_init(void)
+{
+}
+
+static inline void dns_setserver(u8_t index, const ip_addr_t *server)
+{
+	std::lock_guard<std::mutex> lock(HostLwip::Dns::Instance().Lock);
+	HostLwip::Dns::Instance().Servers[index] = server != NULL ? *server : ip_addr_any;
+}
+
+static inline const ip_addr_t *dns_getserver(u8_t index)
+{
+	return &HostLwip::Dns::Instance().Servers[index];
+}
+
+static inline err_t dns_gethostbyname(const char *hostname, ip_addr_t *address, dns_found_callback found, void *argument)
+{
+	HostLwip::Dns &dns = HostLwip::Dns::Instance();
+	std::lock_guard<std::mutex> lock(dns.Lock);
+	if (dns.Refuse != ERR_OK)
+		return dns.Refuse;
+	dns.Lookups++;
+	auto entry = dns.Names.find(hostname);
+	const bool known = entry != dns.Names.end();
+	const ip_addr_t answer = known ? entry->second : ip_addr_any;
+	std::thread([=, name = std::string(hostname), delay = dns.Delay] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+		HostLwip::Tcpip::Instance().Post([=] { found(name.c_str(), known ? &answer : nullptr, argument); });
+	}).detach();
+	return ERR_INPROGRESS;
+}
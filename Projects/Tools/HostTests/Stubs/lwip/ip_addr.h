@@ -0,0 +1,74 @@
+#pragma once
+
+// Host stand-in, IPv4 only but laid out like lwIP's dual stack ip_addr_t. Brings in string.h
+// like lwIP's own headers do.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+typedef int8_t s8_t;
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+typedef int8_t err_t;
+
+typedef struct
+{
+	u32_t addr;
+} ip4_addr_t;
+
+typedef struct
+{
+	union
+	{
+		ip4_addr_t ip4;
+	} u_addr;
+	u8_t type;
+} ip_addr_t;
+
+#define IPADDR_TYPE_V4 0
+
+static const ip_addr_t ip_addr_any = {{{0}}, IPADDR_TYPE_V4};
+#define IP_ADDR_ANY (&ip_addr_any)
+
+#define ip4_addr_get_u32(address) ((address)->addr)
+#define ip_addr_copy(destination, source) ((destination) = (source))
+
+static inline int ip_addr_isany(const ip_addr_t *address)
+{
+	return address == NULL || address->u_addr.ip4.addr == 0;
+}
+
+static inline int ip4addr_aton(const char *text, ip4_addr_t *address)
+{
+	struct in_addr parsed;
+	if (text == NULL || inet_pton(AF_INET, text, &parsed) != 1)
+		return 0;
+	address->addr = parsed.s_addr;
+	return 1;
+}
+
+static inline int ipaddr_aton(const char *text, ip_addr_t *address)
+{
+	address->type = IPADDR_TYPE_V4;
+	return ip4addr_aton(text, &address->u_addr.ip4);
+}
+
+static inline char *ip4addr_ntoa_r(const ip4_addr_t *address, char *text, int length)
+{
+	struct in_addr value = {address->addr};
+	return inet_ntop(AF_INET, &value, text, length) != NULL ? text : NULL;
+}
+
+static inline char *ipaddr_ntoa_r(const ip_addr_t *address, char *text, int length)
+{
+	return ip4addr_ntoa_r(&address->u_addr.ip4, text, length);
+}
+
+static inline char *ipaddr_ntoa(const ip_addr_t *address)
+{
+	static char text[16];
+	return ipaddr_ntoa_r(address, text, sizeof(text));
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// Host stand-in, the sizes of the camera's lwIP configuration.
+
+#define TCP_MSS 1436
+#define TCP_SND_BUF (4 * TCP_MSS)
+#define TCP_SND_QUEUELEN ((4 * TCP_SND_BUF + TCP_MSS - 1) / TCP_MSS)
+#define TCP_WND (4 * TCP_MSS)
+#define DNS_MAX_SERVERS 3
@@ -0,0 +1,70 @@
+#pragma once
+
+// Host pbufs, plain heap blocks with a reference count.
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include "lwip/ip_addr.h"
+
+struct pbuf
+{
+	pbuf *next;
+	void *payload;
+	u16_t tot_len;
+	u16_t len;
+	u16_t ref;
+};
+
+/// @brief	pbufs allocated and not freed yet.
+inline std::atomic<int> &pbuf_host_live()
+{
+	static std::atomic<int> live{0};
+	return live;
+}
+
+inline pbuf *pbuf_host_alloc(const void *data, u16_t length)
+{
+	pbuf_host_live()++;
+	pbuf *buffer = new pbuf{nullptr, malloc(length), length, length, 1};
+	memcpy(buffer->payload, data, length);
+	return buffer;
+}
+
+inline u8_t pbuf_free(pbuf *buffer)
+{
+	u8_t freed = 0;
+	while (buffer != nullptr && --buffer->ref == 0)
+	{
+		pbuf *next = buffer->next;
+		free(buffer->payload);
+		delete buffer;
+		pbuf_host_live()--;
+		buffer = next;
+		freed++;
+	}
+	return freed;
+}
+
+inline void pbuf_ref(pbuf *buffer)
+{
+	buffer->ref++;
+}
+
+inline u16_t pbuf_copy_partial(const pbuf *buffer, void *destination, u16_t length, u16_t offset)
+{
+	u16_t copied = 0;
+	for (; buffer != nullptr && copied < length; buffer = buffer->next)
+	{
+		if (offset >= buffer->len)
+		{
+			offset -= buffer->len;
+			continue;
+		}
+		u16_t chunk = buffer->len - offset < length - copied ? buffer->len - offset : length - copied;
+		memcpy(static_cast<char *>(destination) + copied, static_cast<const char *>(buffer->payload) + offset, chunk);
+		copied += chunk;
+		offset = 0;
+	}
+	return copied;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+// Host stand-in, lwIP's BSD socket API is the POSIX one.
+
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
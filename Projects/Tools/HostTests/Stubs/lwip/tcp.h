@@ -0,0 +1,274 @@
+#pragma once
+
+// Host stand-in for the raw TCP API. tcp_write() keeps the caller's pointer like lwIP does
+// without TCP_WRITE_FLAG_COPY, and the bytes are only read when the test acknowledges them:
+// data released or overwritten before its acknowledgement shows up on the wire. A connect
+// completes once the test accepts it. Pcbs are never freed.
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "err.h"
+#include "opt.h"
+#include "pbuf.h"
+#include "tcpip.h"
+
+struct tcp_pcb;
+
+typedef err_t (*tcp_recv_fn)(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
+typedef err_t (*tcp_sent_fn)(void *arg, struct tcp_pcb *tpcb, u16_t len);
+typedef err_t (*tcp_poll_fn)(void *arg, struct tcp_pcb *tpcb);
+typedef void (*tcp_err_fn)(void *arg, err_t err);
+typedef err_t (*tcp_connected_fn)(void *arg, struct tcp_pcb *tpcb, err_t err);
+
+#define TCP_WRITE_FLAG_COPY 0x01
+#define TCP_WRITE_FLAG_MORE 0x02
+
+struct tcp_pcb
+{
+	u16_t local_port = 0;
+	void *callback_arg = nullptr;
+	tcp_recv_fn recv = nullptr;
+	tcp_sent_fn sent = nullptr;
+	tcp_err_fn errf = nullptr;
+	tcp_poll_fn poll = nullptr;
+	tcp_connected_fn connected = nullptr;
+	u16_t snd_buf = TCP_SND_BUF;
+	u16_t snd_queuelen = 0;
+
+	struct Segment
+	{
+		const u8_t *Data;
+		u16_t Length;
+		bool Output;
+	};
+
+	// host side, what the stack was given and what the peer acknowledged
+	u16_t Window = TCP_SND_BUF;
+	std::deque<Segment> Unacknowledged;
+	std::deque<std::vector<u8_t>> Copies;
+	std::vector<u8_t> Wire;
+	u32_t Recved = 0;
+	u32_t CopiedWrites = 0;
+	bool Closed = false;
+};
+
+#define tcp_sndbuf(pcb) ((pcb)->snd_buf)
+#define tcp_sndqueuelen(pcb) ((pcb)->snd_queuelen)
+
+namespace HostLwip
+{
+
+inline std::vector<std::unique_ptr<tcp_pcb>> &Pcbs()
+{
+	static std::vector<std::unique_ptr<tcp_pcb>> pcbs;
+	return pcbs;
+}
+
+/// @brief	Held by every raw API call, records calls lwIP would not allow.
+class ApiCall
+{
+public:
+	ApiCall(const char *function, const tcp_pcb *pcb) : _core(Tcpip::Instance().Core())
+	{
+		if (!Tcpip::Instance().IsTcpipThread())
+			Tcpip::Instance().Violation(std::string(function) + " off the tcpip thread");
+		if (pcb != nullptr && pcb->Closed)
+			Tcpip::Instance().Violation(std::string(function) + " on a closed pcb");
+	}
+
+private:
+	std::lock_guard<std::recursive_mutex> _core;
+};
+
+inline tcp_pcb *LastPcb()
+{
+	std::lock_guard<std::recursive_mutex> core(Tcpip::Instance().Core());
+	return Pcbs().empty() ? nullptr : Pcbs().back().get();
+}
+
+/// @brief	Bytes sent with tcp_output() and not acknowledged yet.
+inline u32_t Outstanding(const tcp_pcb *pcb)
+{
+	std::lock_guard<std::recursive_mutex> core(Tcpip::Instance().Core());
+	u32_t bytes = 0;
+	for (const tcp_pcb::Segment &segment : pcb->Unacknowledged)
+		bytes += segment.Output ? segment.Length : 0;
+	return bytes;
+}
+
+/// @brief	The send buffer of the pcb, less than TCP_SND_BUF throttles the sender sooner.
+inline void SetWindow(tcp_pcb *pcb, u16_t window)
+{
+	std::lock_guard<std::recursive_mutex> core(Tcpip::Instance().Core());
+	u32_t queued = 0;
+	for (const tcp_pcb::Segment &segment : pcb->Unacknowledged)
+		queued += segment.Length;
+	pcb->Window = window;
+	pcb->snd_buf = queued < window ? window - queued : 0;
+}
+
+/// @brief	The peer answers the SYN, the connected callback follows.
+/// @note	Call on the tcpip thread.
+inline void Accept(tcp_pcb *pcb)
+{
+	if (pcb->connected != nullptr && !pcb->Closed)
+		pcb->connected(pcb->callback_arg, pcb, ERR_OK);
+}
+
+/// @brief	The peer acknowledges up to bytes of what was output, the sent callback follows.
+/// @note	Call on the tcpip thread.
+inline void Acknowledge(tcp_pcb *pcb, u32_t bytes)
+{
+	u16_t acknowledged = 0;
+	while (bytes > 0 && !pcb->Unacknowledged.empty() && pcb->Unacknowledged.front().Output)
+	{
+		tcp_pcb::Segment &segment = pcb->Unacknowledged.front();
+		u16_t length = segment.Length < bytes ? segment.Length : bytes;
+		pcb->Wire.insert(pcb->Wire.end(), segment.Data, segment.Data + length);
+		segment.Data += length;
+		segment.Length -= length;
+		bytes -= length;
+		acknowledged += length;
+		if (segment.Length == 0)
+		{
+			pcb->Unacknowledged.pop_front();
+			pcb->snd_queuelen--;
+		}
+	}
+	u32_t room = pcb->snd_buf + acknowledged;
+	pcb->snd_buf = room < pcb->Window ? room : pcb->Window;
+	if (acknowledged > 0 && pcb->sent != nullptr && !pcb->Closed)
+		pcb->sent(pcb->callback_arg, pcb, acknowledged);
+}
+
+/// @brief	Data from the peer as a chain of pbufs of up to piece bytes each.
+/// @note	Call on the tcpip thread.
+inline void Receive(tcp_pcb *pcb, const void *data, u16_t length, u16_t piece)
+{
+	pbuf *head = nullptr;
+	pbuf **next = &head;
+	for (u16_t offset = 0; offset < length; offset += piece)
+	{
+		u16_t size = length - offset < piece ? length - offset : piece;
+		*next = pbuf_host_alloc(static_cast<const u8_t *>(data) + offset, size);
+		(*next)->tot_len = length - offset;
+		next = &(*next)->next;
+	}
+	if (pcb->recv != nullptr && !pcb->Closed)
+		pcb->recv(pcb->callback_arg, pcb, head, ERR_OK);
+	else
+		pbuf_free(head);
+}
+
+/// @brief	The peer closes its side.
+/// @note	Call on the tcpip thread.
+inline void RemoteClose(tcp_pcb *pcb)
+{
+	if (pcb->recv != nullptr && !pcb->Closed)
+		pcb->recv(pcb->callback_arg, pcb, nullptr, ERR_OK);
+}
+
+} // namespace HostLwip
+
+inline tcp_pcb *tcp_new()
+{
+	HostLwip::ApiCall call("tcp_new", nullptr);
+	HostLwip::Pcbs().emplace_back(new tcp_pcb());
+	return HostLwip::Pcbs().back().get();
+}
+
+inline err_t tcp_bind(tcp_pcb *pcb, const ip_addr_t *address, u16_t port)
+{
+	HostLwip::ApiCall call("tcp_bind", pcb);
+	pcb->local_port = port;
+	return ERR_OK;
+}
+
+inline void tcp_arg(tcp_pcb *pcb, void *arg)
+{
+	HostLwip::ApiCall call("tcp_arg", pcb);
+	pcb->callback_arg = arg;
+}
+
+inline void tcp_recv(tcp_pcb *pcb, tcp_recv_fn recv)
+{
+	HostLwip::ApiCall call("tcp_recv", pcb);
+	pcb->recv = recv;
+}
+
+inline void tcp_sent(tcp_pcb *pcb, tcp_sent_fn sent)
+{
+	HostLwip::ApiCall call("tcp_sent", pcb);
+	pcb->sent = sent;
+}
+
+inline void tcp_err(tcp_pcb *pcb, tcp_err_fn errf)
+{
+	HostLwip::ApiCall call("tcp_err", pcb);
+	pcb->errf = errf;
+}
+
+inline void tcp_poll(tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval)
+{
+	HostLwip::ApiCall call("tcp_poll", pcb);
+	pcb->poll = poll;
+}
+
+inline err_t tcp_connect(tcp_pcb *pcb, const ip_addr_t *address, u16_t port, tcp_connected_fn connected)
+{
+	HostLwip::ApiCall call("tcp_connect", pcb);
+	pcb->connected = connected;
+	return ERR_OK;
+}
+
+inline err_t tcp_write(tcp_pcb *pcb, const void *data, u16_t length, u8_t flags)
+{
+	HostLwip::ApiCall call("tcp_write", pcb);
+	if (pcb->Closed)
+		return ERR_CONN;
+	if (length > pcb->snd_buf || pcb->snd_queuelen >= TCP_SND_QUEUELEN)
+		return ERR_MEM;
+
+	const u8_t *bytes = static_cast<const u8_t *>(data);
+	if (flags & TCP_WRITE_FLAG_COPY)
+	{
+		pcb->CopiedWrites++;
+		pcb->Copies.emplace_back(bytes, bytes + length);
+		bytes = pcb->Copies.back().data();
+	}
+	pcb->Unacknowledged.push_back({bytes, length, false});
+	pcb->snd_buf -= length;
+	pcb->snd_queuelen++;
+	return ERR_OK;
+}
+
+inline err_t tcp_output(tcp_pcb *pcb)
+{
+	HostLwip::ApiCall call("tcp_output", pcb);
+	for (tcp_pcb::Segment &segment : pcb->Unacknowledged)
+		segment.Output = true;
+	return ERR_OK;
+}
+
+inline void tcp_recved(tcp_pcb *pcb, u16_t length)
+{
+	HostLwip::ApiCall call("tcp_recved", pcb);
+	pcb->Recved += length;
+}
+
+inline err_t tcp_close(tcp_pcb *pcb)
+{
+	HostLwip::ApiCall call("tcp_close", pcb);
+	pcb->Closed = true;
+	return ERR_OK;
+}
+
+inline void tcp_abort(tcp_pcb *pcb)
+{
+	HostLwip::ApiCall call("tcp_abort", pcb);
+	pcb->Closed = true;
+	if (pcb->errf != nullptr)
+		pcb->errf(pcb->callback_arg, ERR_ABRT);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+// Host stand-in for the tcpip task: one thread running posted work in order while it holds
+// the core lock. Tests post network events the same way, so everything the stack does
+// happens on that thread. Raw API calls from any other thread are recorded.
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "err.h"
+
+typedef void (*tcpip_callback_fn)(void *ctx);
+
+namespace HostLwip
+{
+
+class Tcpip
+{
+public:
+	/// @note	Never destroyed, the thread runs until the process exits.
+	static Tcpip &Instance()
+	{
+		static Tcpip *tcpip = new Tcpip();
+		return *tcpip;
+	}
+
+	void Post(std::function<void()> work)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_queue.push_back(std::move(work));
+		_changed.notify_all();
+	}
+
+	/// @brief	Runs work on the tcpip thread and waits for it.
+	void Run(const std::function<void()> &work)
+	{
+		std::promise<void> done;
+		Post([&] {
+			work();
+			done.set_value();
+		});
+		done.get_future().wait();
+	}
+
+	/// @brief	Waits until nothing is queued any more, work posted by work included.
+	void Settle()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_changed.wait(lock, [this] { return _queue.empty() && !_running; });
+	}
+
+	bool IsTcpipThread() const
+	{
+		return std::this_thread::get_id() == _thread;
+	}
+
+	std::recursive_mutex &Core()
+	{
+		return _core;
+	}
+
+	void Violation(const std::string &what)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_violations.push_back(what);
+	}
+
+	/// @brief	Raw API calls made off the tcpip thread or on a closed pcb, forgotten once taken.
+	std::vector<std::string> TakeViolations()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::vector<std::string> violations;
+		violations.swap(_violations);
+		return violations;
+	}
+
+private:
+	Tcpip()
+	{
+		std::thread thread([this] { loop(); });
+		_thread = thread.get_id();
+		thread.detach();
+	}
+
+	void loop()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		for (;;)
+		{
+			_changed.wait(lock, [this] { return !_queue.empty(); });
+			std::function<void()> work = std::move(_queue.front());
+			_queue.pop_front();
+			_running = true;
+			lock.unlock();
+			{
+				std::lock_guard<std::recursive_mutex> core(_core);
+				work();
+			}
+			lock.lock();
+			_running = false;
+			_changed.notify_all();
+		}
+	}
+
+	std::mutex _mutex;
+	std::condition_variable _changed;
+	std::deque<std::function<void()>> _queue;
+	bool _running = false;
+	std::recursive_mutex _core;
+	std::thread::id _thread;
+	std::vector<std::string> _violations;
+};
+
+} // namespace HostLwip
+
+static inline err_t tcpip_callback(tcpip_callback_fn function, void *ctx)
+{
+	HostLwip::Tcpip::Instance().Post([=] { function(ctx); });
+	return ERR_OK;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+// Host stand-in on top of OpenSSL.
+
+#include <cstddef>
+#include <openssl/evp.h>
+
+inline int mbedtls_base64_encode(unsigned char *destination, size_t size, size_t *written, const unsigned char *source, size_t length)
+{
+	if (size < 4 * ((length + 2) / 3) + 1)
+		return -1;
+	*written = EVP_EncodeBlock(destination, source, length);
+	return 0;
+}
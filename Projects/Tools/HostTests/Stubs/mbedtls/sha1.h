@@ -0,0 +1,33 @@
+#pragma once
+
+// Host stand-in on top of OpenSSL.
+
+#include <cstddef>
+#include <openssl/evp.h>
+
+typedef EVP_MD_CTX *mbedtls_sha1_context;
+
+inline void mbedtls_sha1_init(mbedtls_sha1_context *context)
+{
+	*context = EVP_MD_CTX_new();
+}
+
+inline void mbedtls_sha1_free(mbedtls_sha1_context *context)
+{
+	EVP_MD_CTX_free(*context);
+}
+
+inline int mbedtls_sha1_starts_ret(mbedtls_sha1_context *context)
+{
+	return EVP_DigestInit_ex(*context, EVP_sha1(), nullptr) == 1 ? 0 : -1;
+}
+
+inline int mbedtls_sha1_update_ret(mbedtls_sha1_context *context, const unsigned char *data, size_t length)
+{
+	return EVP_DigestUpdate(*context, data, length) == 1 ? 0 : -1;
+}
+
+inline int mbedtls_sha1_finish_ret(mbedtls_sha1_context *context, unsigned char output[20])
+{
+	return EVP_DigestFinal_ex(*context, output, nullptr) == 1 ? 0 : -1;
+}
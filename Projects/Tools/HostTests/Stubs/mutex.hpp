@@ -0,0 +1,46 @@
+#pragma once
+
+// Host stand-in for the freertos-addons mutex wrappers.
+
+#include <mutex>
+
+namespace cpp_freertos
+{
+
+class MutexStandard
+{
+public:
+	bool Lock()
+	{
+		_mutex.lock();
+		return true;
+	}
+
+	bool Unlock()
+	{
+		_mutex.unlock();
+		return true;
+	}
+
+private:
+	std::mutex _mutex;
+};
+
+class LockGuard
+{
+public:
+	explicit LockGuard(MutexStandard &mutex) : _mutex(mutex)
+	{
+		_mutex.Lock();
+	}
+
+	~LockGuard()
+	{
+		_mutex.Unlock();
+	}
+
+private:
+	MutexStandard &_mutex;
+};
+
+} // namespace cpp_freertos
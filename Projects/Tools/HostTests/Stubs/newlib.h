@@ -0,0 +1,11 @@
+#pragma once
+
+// Host stand-in for the newlib extensions glibc lacks, forced into the C sources with -include.
+
+#include <stdio.h>
+
+static inline char *itoa(int value, char *text, int base)
+{
+	sprintf(text, base == 16 ? "%x" : "%d", value);
+	return text;
+}
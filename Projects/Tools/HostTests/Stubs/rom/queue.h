@@ -0,0 +1,10 @@
+#pragma once
+
+// Host stand-in, the BSD list macros come with glibc, except the _SAFE variants.
+
+#include <sys/queue.h>
+
+#ifndef SLIST_FOREACH_SAFE
+#define SLIST_FOREACH_SAFE(var, head, field, next) \
+	for ((var) = SLIST_FIRST((head)); (var) && ((next) = SLIST_NEXT((var), field), 1); (var) = (next))
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+// Host stand-in for the freertos-addons binary semaphore.
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include "freertos/FreeRTOS.h"
+
+namespace cpp_freertos
+{
+
+class BinarySemaphore
+{
+public:
+	explicit BinarySemaphore(bool set = false) : _set(set)
+	{
+	}
+
+	bool Take(TickType_t timeout = portMAX_DELAY)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (timeout == portMAX_DELAY)
+			_changed.wait(lock, [this] { return _set; });
+		else if (!_changed.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return _set; }))
+			return false;
+		_set = false;
+		return true;
+	}
+
+	bool Give()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_set = true;
+		_changed.notify_one();
+		return true;
+	}
+
+private:
+	std::mutex _mutex;
+	std::condition_variable _changed;
+	bool _set;
+};
+
+} // namespace cpp_freertos
@@ -0,0 +1,12 @@
+#pragma once
+
+// Host stand-in for the newlib locks, a zeroed pthread mutex is an initialized one on glibc.
+
+#include <pthread.h>
+
+typedef pthread_mutex_t _lock_t;
+
+#define _lock_init(lock) pthread_mutex_init((lock), NULL)
+#define _lock_acquire(lock) pthread_mutex_lock(lock)
+#define _lock_release(lock) pthread_mutex_unlock(lock)
+#define _lock_close(lock) pthread_mutex_destroy(lock)
@@ -0,0 +1,30 @@
+#pragma once
+
+// Host stand-in for the freertos-addons thread, Run() goes on a detached std::thread.
+
+#include <cstdint>
+#include <thread>
+
+namespace cpp_freertos
+{
+
+class Thread
+{
+public:
+	Thread(const char *name, uint16_t stackDepth, uint8_t priority)
+	{
+	}
+
+	virtual ~Thread() = default;
+
+	bool Start()
+	{
+		std::thread([this] { Run(); }).detach();
+		return true;
+	}
+
+protected:
+	virtual void Run() = 0;
+};
+
+} // namespace cpp_freertos
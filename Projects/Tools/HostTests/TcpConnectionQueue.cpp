@@ -0,0 +1,282 @@
+// TcpConnection's send queue against the lwIP stand-in: copied and referenced sends of random
+// sizes through send buffers of random sizes, acknowledged a random number of bytes at a time.
+// The stand-in reads written data only when it is acknowledged, so the bytes on the wire show
+// whether the queue released or overwrote anything too early. Received chains are held past
+// the receive callback and the window only reopens by what was consumed. Connecting and
+// closing from the test's thread must leave every raw API call to the tcpip thread, and a close
+// from inside the receive callback must not touch the pcb afterwards.
+
+#include <atomic>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include "HostTest.h"
+#include "TcpConnection.h"
+
+using namespace Protocol;
+using HostLwip::Tcpip;
+
+namespace
+{
+
+constexpr uint16_t StagingSize = 2048;
+
+class Producer
+{
+public:
+	std::atomic<uint32_t> Ready{0};
+
+	void SendReady()
+	{
+		Ready++;
+	}
+};
+
+tcp_pcb *open(TcpConnection &connection)
+{
+	RemoteConnection remote = {8080, {}};
+	strcpy(remote.Address.data(), "127.0.0.1");
+	CHECK(connection.Connect(remote) == BaseConnection::ConnectStatus::Connecting);
+	CHECK(connection.GetConnectionState() == ConnectionState::Connecting);
+	tcp_pcb *pcb = HostLwip::LastPcb();
+	Tcpip::Instance().Run([&] { HostLwip::Accept(pcb); });
+	CHECK(connection.GetConnectionState() == ConnectionState::Connected);
+	return pcb;
+}
+
+void acknowledge(tcp_pcb *pcb, uint32_t bytes)
+{
+	Tcpip::Instance().Run([&] { HostLwip::Acknowledge(pcb, bytes); });
+	Tcpip::Instance().Settle();
+}
+
+std::vector<uint8_t> wire(tcp_pcb *pcb)
+{
+	std::vector<uint8_t> bytes;
+	Tcpip::Instance().Run([&] { bytes = pcb->Wire; });
+	return bytes;
+}
+
+/// @brief	Raw API calls that were made off the tcpip thread or on a closed pcb.
+int violations()
+{
+	int count = 0;
+	for (const std::string &violation : Tcpip::Instance().TakeViolations())
+	{
+		printf("%s\n", violation.c_str());
+		count++;
+	}
+	return count;
+}
+
+uint32_t refusedTotal = 0;
+uint32_t readyTotal = 0;
+
+void testQueue(uint32_t seed)
+{
+	std::mt19937 random(seed);
+	TcpConnection connection;
+	Producer producer;
+	connection.SetSendReady(MakeDelegate(&producer, &Producer::SendReady));
+	tcp_pcb *pcb = open(connection);
+	const uint16_t window = 200 + random() % 5000;
+	Tcpip::Instance().Run([&] { HostLwip::SetWindow(pcb, window); });
+
+	std::vector<uint8_t> expected;
+	// referenced buffers stay untouched until the connection is done with them
+	std::deque<std::vector<uint8_t>> references;
+	for (int i = 0; i < 300; i++)
+	{
+		const bool copy = random() % 3 != 0;
+		std::vector<uint8_t> data(1 + random() % (copy ? 700 : 4000));
+		for (uint8_t &byte : data)
+			byte = random();
+
+		auto send = [&] { return copy ? connection.Send(data.data(), data.size()) : connection.SendReference(data.data(), data.size()); };
+		uint32_t ready = producer.Ready;
+		bool queued = send();
+		for (int attempt = 0; !queued && attempt < 10000; attempt++)
+		{
+			// only acknowledgements make room, SendReady tells when to try again
+			refusedTotal++;
+			Tcpip::Instance().Settle();
+			CHECK(HostLwip::Outstanding(pcb) > 0);
+			acknowledge(pcb, 1 + random() % 3000);
+			if (producer.Ready != ready)
+			{
+				ready = producer.Ready;
+				queued = send();
+			}
+		}
+		CHECK(queued);
+
+		expected.insert(expected.end(), data.begin(), data.end());
+		if (copy)
+			std::fill(data.begin(), data.end(), 0xEE);
+		else
+			references.push_back(std::move(data));
+
+		if (random() % 2)
+			acknowledge(pcb, random() % 2000);
+	}
+
+	for (int round = 0; connection.IsSendPending() && round < 10000; round++)
+		acknowledge(pcb, 1 + random() % 3000);
+	CHECK(!connection.IsSendPending());
+	CHECK(wire(pcb) == expected);
+	CHECK(pcb->CopiedWrites == 0);
+
+	// everything is released, the whole staging buffer takes one copy again
+	std::vector<uint8_t> full(StagingSize, 0x5A);
+	CHECK(connection.Send(full.data(), full.size()));
+	expected.insert(expected.end(), full.begin(), full.end());
+	for (int round = 0; connection.IsSendPending() && round < 1000; round++)
+		acknowledge(pcb, 1 + random() % 3000);
+	CHECK(wire(pcb) == expected);
+
+	readyTotal += producer.Ready;
+	CHECK(violations() == 0);
+}
+
+void testClose()
+{
+	TcpConnection connection;
+	tcp_pcb *pcb = open(connection);
+
+	// what was queued is dropped with the connection, no reference is held on to
+	std::vector<uint8_t> data(3000, 0x11);
+	CHECK(connection.SendReference(data.data(), data.size()));
+	Tcpip::Instance().Settle();
+	CHECK(connection.IsSendPending());
+	// Close() returns once the tcpip task closed the pcb
+	connection.Close();
+	CHECK(!connection.IsSendPending());
+	CHECK(!connection.Send(data.data(), 10));
+	CHECK(pcb->Closed);
+	CHECK(violations() == 0);
+}
+
+class Reader
+{
+public:
+	std::vector<PbufChain> Chains;
+	std::string Data;
+
+	void ChainReceived(PbufChain &chain)
+	{
+		Chains.push_back(std::move(chain));
+	}
+
+	void DataReceived(const char *data, uint16_t length)
+	{
+		Data.append(data, length);
+	}
+};
+
+void receive(tcp_pcb *pcb, const std::string &data, uint16_t piece)
+{
+	Tcpip::Instance().Run([&] { HostLwip::Receive(pcb, data.data(), data.size(), piece); });
+}
+
+uint32_t recved(tcp_pcb *pcb)
+{
+	uint32_t bytes = 0;
+	Tcpip::Instance().Settle();
+	Tcpip::Instance().Run([&] { bytes = pcb->Recved; });
+	return bytes;
+}
+
+void testChainReceive()
+{
+	TcpConnection connection;
+	Reader reader;
+	connection.SetChainReceived(MakeDelegate(&reader, &Reader::ChainReceived));
+	tcp_pcb *pcb = open(connection);
+
+	std::string data(3000, 0);
+	for (char &c : data)
+		c = 'a' + rand() % 26;
+	receive(pcb, data, 700);
+	CHECK(reader.Chains.size() == 1 && reader.Chains[0].Length() == data.size());
+	CHECK(recved(pcb) == 0);
+
+	// read after the callback returned, through a second holder
+	PbufChain shared = reader.Chains[0].Share();
+	reader.Chains[0].Release();
+	CHECK(pbuf_host_live() > 0);
+	std::string copied(data.size(), 0);
+	CHECK(shared.Copy(&copied[0], copied.size()) == data.size() && copied == data);
+	std::string segments;
+	shared.ForEachSegment([&](const uint8_t *bytes, uint16_t length) { segments.append(reinterpret_cast<const char *>(bytes), length); });
+	CHECK(segments == data);
+
+	// the window follows Consume(), called from this thread
+	connection.Consume(1000);
+	CHECK(recved(pcb) == 1000);
+	connection.Consume(2000);
+	CHECK(recved(pcb) == 3000);
+	shared.Release();
+	CHECK(pbuf_host_live() == 0);
+	CHECK(violations() == 0);
+}
+
+void testSegmentReceive()
+{
+	TcpConnection connection;
+	Reader reader;
+	connection.SetDataReceived(MakeDelegate(&reader, &Reader::DataReceived));
+	tcp_pcb *pcb = open(connection);
+
+	// without a chain consumer every segment is handed over and the window reopens right away
+	std::string data(2500, 'x');
+	receive(pcb, data, 600);
+	CHECK(reader.Data == data);
+	CHECK(recved(pcb) == data.size());
+	CHECK(pbuf_host_live() == 0);
+	CHECK(violations() == 0);
+}
+
+class Closer
+{
+public:
+	TcpConnection *Connection = nullptr;
+	uint32_t Received = 0;
+
+	void DataReceived(const char *data, uint16_t length)
+	{
+		Received += length;
+		Connection->Close();
+	}
+};
+
+void testCloseWhileReceiving()
+{
+	// a handler may give up on the connection from inside the receive callback
+	TcpConnection connection;
+	Closer closer;
+	closer.Connection = &connection;
+	connection.SetDataReceived(MakeDelegate(&closer, &Closer::DataReceived));
+	tcp_pcb *pcb = open(connection);
+
+	receive(pcb, std::string(1000, 'x'), 1000);
+	CHECK(closer.Received == 1000);
+	CHECK(pcb->Closed);
+	CHECK(pbuf_host_live() == 0);
+	CHECK(violations() == 0);
+}
+
+} // namespace
+
+int main()
+{
+	for (uint32_t seed = 1; seed <= 40; seed++)
+		testQueue(seed);
+	// small windows made the queue refuse sends and hand out SendReady again
+	CHECK(refusedTotal > 0 && readyTotal > 0);
+	testClose();
+	testChainReceive();
+	testSegmentReceive();
+	testCloseWhileReceiving();
+	return HostTest::Finish("TcpConnectionQueue");
+}
@@ -0,0 +1,375 @@
+// Two WebsocketPath endpoints, client and server, talking over an in-memory connection.
+// Received bytes are delivered in random pieces like TCP segments, and the connection
+// refuses every send made while bytes are being received: on the device that is the
+// lwIP task, which must never write to the connection.
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "HostTest.h"
+#include "WebSocket.h"
+
+using namespace Protocol;
+
+namespace
+{
+
+class LoopConnection : public BaseConnection
+{
+public:
+	LoopConnection *Peer = nullptr;
+	std::vector<uint8_t> Output;
+	bool Closed = false;
+	bool Receiving = false;
+	std::atomic<bool> Full = {false};
+	uint32_t SendsWhileReceiving = 0;
+
+	/// @brief	Hands everything written so far to the peer, in pieces of 1 to maxPiece bytes.
+	bool Flush(uint16_t maxPiece)
+	{
+		if (Output.empty())
+			return false;
+
+		std::vector<uint8_t> pending;
+		pending.swap(Output);
+		for (size_t offset = 0; offset < pending.size();)
+		{
+			uint16_t piece = 1 + rand() % maxPiece;
+			if (piece > pending.size() - offset)
+				piece = pending.size() - offset;
+			Peer->Receiving = true;
+			Peer->DataReceived(reinterpret_cast<const char *>(&pending[offset]), piece);
+			Peer->Receiving = false;
+			offset += piece;
+		}
+		return true;
+	}
+
+private:
+	bool DoSend(const unsigned char *data, uint16_t length) override
+	{
+		if (Receiving)
+		{
+			SendsWhileReceiving++;
+			return false;
+		}
+		if (Full)
+			return false;
+		Output.insert(Output.end(), data, data + length);
+		return true;
+	}
+
+	ConnectStatus DoConnect(const RemoteConnection &remoteConnection) override
+	{
+		return ConnectStatus::Connecting;
+	}
+
+	void DoClose() override
+	{
+		Closed = true;
+	}
+
+	void DoReset() override
+	{
+		Closed = true;
+	}
+
+	bool IsConnected() override
+	{
+		return !Closed;
+	}
+};
+
+class Sink
+{
+public:
+	std::vector<std::pair<WebsocketOpcode, std::string>> Messages;
+
+	void Received(WebsocketOpcode opcode, const uint8_t *data, uint16_t length)
+	{
+		Messages.emplace_back(opcode, std::string(reinterpret_cast<const char *>(data), length));
+	}
+};
+
+struct Pair
+{
+	LoopConnection ClientConnection;
+	LoopConnection ServerConnection;
+	WebsocketPath Client;
+	WebsocketPath Server;
+	Sink ClientSink;
+	Sink ServerSink;
+
+	Pair()
+	{
+		ClientConnection.Peer = &ServerConnection;
+		ServerConnection.Peer = &ClientConnection;
+		Client.SetConnection(&ClientConnection);
+		Server.SetConnection(&ServerConnection);
+		Client.SetMessageReceived(MakeDelegate(&ClientSink, &Sink::Received));
+		Server.SetMessageReceived(MakeDelegate(&ServerSink, &Sink::Received));
+	}
+
+	/// @brief	Runs both sides until nothing is written any more, like the processing task would.
+	void Pump(uint16_t maxPiece = 300)
+	{
+		for (uint8_t round = 0; round < 32; round++)
+		{
+			Client.Process();
+			Server.Process();
+			bool moved = ClientConnection.Flush(maxPiece);
+			moved = ServerConnection.Flush(maxPiece) || moved;
+			if (!moved)
+				return;
+		}
+	}
+
+	void Open()
+	{
+		RemoteConnection remote = {80, {}};
+		strcpy(remote.Address.data(), "camera.local");
+		Server.Start(BaseRouteHandler::ConnectionMode::DataConnection, nullptr, 0, 0);
+		Client.Start(BaseRouteHandler::ConnectionMode::DataConnection, &remote, 0, 0);
+		ClientConnection.SetConnectionState(ConnectionState::Connected);
+		ClientConnection.ConnectionChanged(ConnectionChangeReason::None);
+		Pump();
+	}
+};
+
+std::vector<uint8_t> maskedFrame(uint8_t first, const std::string &payload)
+{
+	std::vector<uint8_t> frame = {first, static_cast<uint8_t>(0x80 | payload.size())};
+	uint8_t key[4];
+	uint32_t mask = rand();
+	memcpy(key, &mask, sizeof(key));
+	frame.insert(frame.end(), key, key + 4);
+	for (size_t i = 0; i < payload.size(); i++)
+		frame.push_back(payload[i] ^ key[i & 3]);
+	return frame;
+}
+
+void deliver(LoopConnection &connection, const std::vector<uint8_t> &bytes, uint16_t maxPiece)
+{
+	for (size_t offset = 0; offset < bytes.size();)
+	{
+		uint16_t piece = 1 + rand() % maxPiece;
+		if (piece > bytes.size() - offset)
+			piece = bytes.size() - offset;
+		connection.Receiving = true;
+		connection.DataReceived(reinterpret_cast<const char *>(&bytes[offset]), piece);
+		connection.Receiving = false;
+		offset += piece;
+	}
+}
+
+void testAccept()
+{
+	char accept[29];
+	CHECK(WebsocketPath::ComputeAccept("dGhlIHNhbXBsZSBub25jZQ==", 24, accept, sizeof(accept)));
+	CHECK(strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0);
+}
+
+void testMask()
+{
+	for (int round = 0; round < 2000; round++)
+	{
+		uint8_t data[300], expected[300];
+		const int start = rand() % 4, length = rand() % 290, offset = rand() % 1000;
+		const uint32_t mask = rand();
+		for (int i = 0; i < 300; i++)
+			data[i] = expected[i] = rand();
+
+		WebsocketPath::ApplyMask(data + start, length, mask, offset);
+		uint8_t key[4];
+		memcpy(key, &mask, sizeof(key));
+		for (int i = 0; i < length; i++)
+			expected[start + i] ^= key[(offset + i) & 3];
+		CHECK(memcmp(data, expected, sizeof(data)) == 0);
+	}
+}
+
+void testExchange(uint16_t maxPiece)
+{
+	Pair pair;
+	pair.Open();
+	CHECK(pair.Server.IsOpen() && pair.Client.IsOpen());
+	CHECK(pair.Server.GetResult() == BaseRouteHandler::ConnectionExecutionResult::Success);
+	CHECK(pair.Client.GetResult() == BaseRouteHandler::ConnectionExecutionResult::Success);
+
+	std::string text(1500, 'x');
+	for (char &c : text)
+		c = 'a' + rand() % 26;
+	std::vector<uint8_t> binary(300);
+	for (uint8_t &b : binary)
+		b = rand();
+
+	CHECK(pair.Server.SendBinary(reinterpret_cast<const uint8_t *>("hello"), 5));
+	CHECK(pair.Client.SendText(text.c_str()));
+	CHECK(pair.Client.SendBinary(binary.data(), binary.size()));
+	CHECK(pair.Client.SendPing());
+	pair.Pump(maxPiece);
+	CHECK(pair.ClientSink.Messages.size() == 1 && pair.ClientSink.Messages[0].second == "hello");
+	CHECK(pair.ServerSink.Messages.size() == 2);
+	if (pair.ServerSink.Messages.size() == 2)
+	{
+		CHECK(pair.ServerSink.Messages[0].first == WebsocketOpcode::Text && pair.ServerSink.Messages[0].second == text);
+		CHECK(pair.ServerSink.Messages[1].second == std::string(binary.begin(), binary.end()));
+	}
+
+	// a ping between the fragments of a message, its pong only goes out from Process()
+	std::vector<uint8_t> bytes;
+	for (const std::vector<uint8_t> &frame : {maskedFrame(0x01, "frag"), maskedFrame(0x89, "pi"), maskedFrame(0x00, "men"), maskedFrame(0x80, "ted")})
+		bytes.insert(bytes.end(), frame.begin(), frame.end());
+	deliver(pair.ServerConnection, bytes, 5);
+	CHECK(pair.ServerConnection.Output.empty());
+	CHECK(pair.ServerSink.Messages.size() == 3 && pair.ServerSink.Messages.back().second == "fragmented");
+	pair.Server.Process();
+	const std::vector<uint8_t> pong = {0x8A, 0x02, 'p', 'i'};
+	CHECK(pair.ServerConnection.Output == pong);
+	pair.Pump(maxPiece);
+
+	// the client closes, the server answers with the same code and is done once that is out
+	pair.Client.Terminate();
+	pair.Pump(maxPiece);
+	CHECK(pair.ServerConnection.Closed && pair.ClientConnection.Closed);
+	CHECK(pair.Server.IsTerminated() && pair.Client.IsTerminated());
+
+	CHECK(pair.ClientConnection.SendsWhileReceiving == 0 && pair.ServerConnection.SendsWhileReceiving == 0);
+}
+
+void testPongQueued()
+{
+	Pair pair;
+	pair.Open();
+
+	// while the connection stays full the pong is kept and sent by a later Process()
+	deliver(pair.ServerConnection, maskedFrame(0x89, "again"), 3);
+	pair.ServerConnection.Full = true;
+	pair.Server.Process();
+	CHECK(pair.ServerConnection.Output.empty());
+	pair.ServerConnection.Full = false;
+	pair.Server.Process();
+	const std::vector<uint8_t> pong = {0x8A, 0x05, 'a', 'g', 'a', 'i', 'n'};
+	CHECK(pair.ServerConnection.Output == pong);
+	CHECK(pair.Server.IsOpen());
+}
+
+void testSendReady()
+{
+	Pair pair;
+	pair.Open();
+
+	// the sender sleeps on SendReady, given from the network side once room is made
+	pair.ServerConnection.Full = true;
+	std::thread network([&] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		pair.ServerConnection.Full = false;
+		pair.ServerConnection.SendReady();
+	});
+	Hal::TimeLimit wait;
+	const std::vector<uint8_t> data(100, 0x33);
+	CHECK(pair.Server.SendBinary(data.data(), data.size()));
+	CHECK(!wait.IsTimeUp(WebsocketPath::SendTimeout / 2));
+	network.join();
+	pair.Pump();
+	CHECK(pair.ClientSink.Messages.size() == 1 && pair.ClientSink.Messages[0].second == std::string(100, 0x33));
+
+	// without it the send gives up after SendTimeout
+	pair.ServerConnection.Full = true;
+	wait.Reset();
+	CHECK(!pair.Server.SendBinary(data.data(), data.size()));
+	CHECK(wait.IsTimeUp(WebsocketPath::SendTimeout));
+}
+
+void testMessageTooBig()
+{
+	Pair pair;
+	pair.Open();
+
+	std::vector<uint8_t> big(70000);
+	for (uint8_t &b : big)
+		b = rand();
+	CHECK(pair.Server.SendBinaryReference(big.data(), big.size()));
+	pair.Pump();
+	CHECK(pair.ClientSink.Messages.empty());
+	CHECK(pair.ClientConnection.Closed && pair.ServerConnection.Closed);
+	CHECK(pair.ClientConnection.SendsWhileReceiving == 0 && pair.ServerConnection.SendsWhileReceiving == 0);
+}
+
+void testProtocolError()
+{
+	Pair pair;
+	pair.Open();
+
+	// reserved bits set, the server tells the client why before it closes
+	deliver(pair.ServerConnection, maskedFrame(0xC2, "x"), 3);
+	CHECK(!pair.ServerConnection.Closed && pair.ServerConnection.Output.empty());
+	pair.Server.Process();
+	const std::vector<uint8_t> close = {0x88, 0x02, 0x03, 0xEA};
+	CHECK(pair.ServerConnection.Output == close);
+	CHECK(pair.ServerConnection.Closed);
+	CHECK(pair.Server.GetResult() == BaseRouteHandler::ConnectionExecutionResult::Error);
+}
+
+void testReject()
+{
+	LoopConnection connection;
+	WebsocketPath server;
+	server.SetConnection(&connection);
+	server.Start(BaseRouteHandler::ConnectionMode::DataConnection, nullptr, 0, 0);
+
+	const char request[] = "GET / HTTP/1.1\r\nHost: x\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+						   "Sec-WebSocket-Version: 8\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+	deliver(connection, std::vector<uint8_t>(request, request + sizeof(request) - 1), 7);
+	CHECK(connection.Output.empty() && !connection.Closed);
+	server.Process();
+	CHECK(std::string(connection.Output.begin(), connection.Output.end()).compare(0, 12, "HTTP/1.1 400") == 0);
+	CHECK(connection.Closed && server.IsTerminated());
+	CHECK(connection.SendsWhileReceiving == 0);
+}
+
+void testDefaultBandwidth()
+{
+	Pair pair;
+	pair.Open();
+	pair.Client.SetBandwidth(0, 0);
+
+	// a full bucket admits one frame beyond its size, the next waits for the rate to pay it back
+	BaseRouteHandler::SetDefaultBandwidth(1000, 1000);
+	pair.Pump();
+	std::vector<uint8_t> data(1200, 0x55);
+	CHECK(pair.Server.SendBinary(data.data(), data.size()));
+	CHECK(!pair.Server.SendBinary(data.data(), data.size()));
+	CHECK(pair.Server.SendPing());
+	CHECK(pair.Server.GetBandwidthStatistics().Dropped == 1);
+
+	// the client has its own budget and keeps it
+	CHECK(pair.Client.SendBinary(data.data(), data.size()));
+	CHECK(pair.Client.SendBinary(data.data(), data.size()));
+
+	// a change reaches the open route with its next Process()
+	BaseRouteHandler::SetDefaultBandwidth(0, 0);
+	pair.Pump();
+	CHECK(pair.Server.SendBinary(data.data(), data.size()));
+	CHECK(pair.ClientSink.Messages.size() == 1);
+}
+
+} // namespace
+
+int main()
+{
+	srand(1);
+	testAccept();
+	testMask();
+	for (int round = 0; round < 200; round++)
+		testExchange(round % 2 ? 7 : 300);
+	testPongQueued();
+	testSendReady();
+	testMessageTooBig();
+	testProtocolError();
+	testReject();
+	testDefaultBandwidth();
+	return HostTest::Finish("WebSocketLoopback");
+}
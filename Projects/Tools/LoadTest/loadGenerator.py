@@ -0,0 +1,566 @@
+#!/usr/bin/env python3
+"""Load generator for the camera's stream and HTTP endpoints.
+
+Opens any number of concurrent clients against a camera and reports, per client
+and per kind, frames per second, bytes per second, frame interval jitter and
+request latency percentiles:
+
+  mjpeg     GET /stream on the stream port, counts multipart JPEG parts
+  snapshot  GET /capture in a loop on one keep-alive connection
+  ws        WebSocket on the web port, counts binary messages pushed by the
+            camera and times text messages echoed back
+  config    GET /control?var=quality&val=... followed by GET /status
+
+For mjpeg and ws clients the latency is the time from connecting to the first
+frame and the echo round trip, for the others it is the request round trip.
+
+Without a device, --local starts a stand-in server on 127.0.0.1 that speaks the
+same endpoints, so the tool itself and a test setup can be checked anywhere.
+
+  python3 loadGenerator.py 192.168.4.1 --mjpeg 4 --snapshot 2 --duration 30
+  python3 loadGenerator.py --local --mjpeg 8 --ws 2 --config 1 --json result.json
+
+Only the Python 3.7+ standard library is used.
+"""
+
+import argparse
+import asyncio
+import base64
+import hashlib
+import json
+import math
+import os
+import struct
+import sys
+import time
+
+BOUNDARY = b"123456789000000000000987654321"
+WS_GUID = b"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+
+class ClientStats:
+    """What one client saw, turned into a summary by report()."""
+
+    def __init__(self, kind, index):
+        self.kind = kind
+        self.index = index
+        self.started = None
+        self.stopped = None
+        self.frames = 0
+        self.bytes = 0
+        self.frame_times = []
+        self.latencies = []
+        self.errors = 0
+        self.last_error = None
+
+    def frame(self, length):
+        self.frames += 1
+        self.bytes += length
+        self.frame_times.append(time.monotonic())
+
+    def request(self, latency, length):
+        self.bytes += length
+        self.latencies.append(latency)
+
+    def error(self, error):
+        self.errors += 1
+        self.last_error = "%s: %s" % (type(error).__name__, error)
+
+    def report(self):
+        elapsed = max((self.stopped or time.monotonic()) - (self.started or time.monotonic()), 1e-9)
+        intervals = [(b - a) * 1000.0 for a, b in zip(self.frame_times, self.frame_times[1:])]
+        result = {
+            "client": "%s-%d" % (self.kind, self.index),
+            "kind": self.kind,
+            "seconds": round(elapsed, 3),
+            "frames": self.frames,
+            "fps": round(self.frames / elapsed, 2),
+            "bytes": self.bytes,
+            "bytes_per_second": round(self.bytes / elapsed, 1),
+            "requests": len(self.latencies),
+            "errors": self.errors,
+        }
+        if intervals:
+            result["interval_ms"] = summarize(intervals)
+            result["jitter_ms"] = round(stddev(intervals), 2)
+        if self.latencies:
+            result["latency_ms"] = summarize([latency * 1000.0 for latency in self.latencies])
+        if self.last_error:
+            result["last_error"] = self.last_error
+        return result
+
+
+def percentile(ordered, fraction):
+    """Nearest rank percentile of an already sorted list."""
+    if not ordered:
+        return 0.0
+    rank = max(int(math.ceil(fraction * len(ordered))) - 1, 0)
+    return ordered[min(rank, len(ordered) - 1)]
+
+
+def stddev(values):
+    if len(values) < 2:
+        return 0.0
+    mean = sum(values) / len(values)
+    return math.sqrt(sum((value - mean) ** 2 for value in values) / (len(values) - 1))
+
+
+def summarize(values):
+    ordered = sorted(values)
+    return {
+        "mean": round(sum(ordered) / len(ordered), 2),
+        "p50": round(percentile(ordered, 0.50), 2),
+        "p90": round(percentile(ordered, 0.90), 2),
+        "p99": round(percentile(ordered, 0.99), 2),
+        "max": round(ordered[-1], 2),
+    }
+
+
+# ---------------------------------------------------------------------------
+# HTTP and WebSocket on top of asyncio streams
+
+async def read_headers(reader):
+    """Status or request line and a dict of lower case header names."""
+    line = await reader.readline()
+    if not line:
+        raise ConnectionError("connection closed")
+    headers = {}
+    while True:
+        header = await reader.readline()
+        if header in (b"\r\n", b"\n", b""):
+            break
+        name, _, value = header.decode("latin-1").partition(":")
+        headers[name.strip().lower()] = value.strip()
+    return line.decode("latin-1").strip(), headers
+
+
+async def read_body(reader, headers):
+    if headers.get("transfer-encoding", "").lower() == "chunked":
+        body = bytearray()
+        while True:
+            size = int((await reader.readline()).split(b";")[0], 16)
+            if size == 0:
+                await reader.readline()
+                return bytes(body)
+            body += await reader.readexactly(size)
+            await reader.readline()
+    length = int(headers.get("content-length", "0"))
+    return await reader.readexactly(length)
+
+
+async def http_get(reader, writer, host, path):
+    """One keep-alive request, returns status, headers and body."""
+    writer.write(("GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n" % (path, host)).encode())
+    await writer.drain()
+    status, headers = await read_headers(reader)
+    body = await read_body(reader, headers)
+    code = int(status.split()[1])
+    return code, headers, body
+
+
+def ws_accept(key):
+    return base64.b64encode(hashlib.sha1(key.encode() + WS_GUID).digest()).decode()
+
+
+async def ws_handshake(reader, writer, host, path):
+    key = base64.b64encode(os.urandom(16)).decode()
+    writer.write(("GET %s HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                  "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n" % (path, host, key)).encode())
+    await writer.drain()
+    status, headers = await read_headers(reader)
+    if " 101 " not in status + " ":
+        raise ConnectionError("handshake refused: %s" % status)
+    if headers.get("sec-websocket-accept") != ws_accept(key):
+        raise ConnectionError("bad Sec-WebSocket-Accept")
+
+
+def ws_frame(opcode, payload, mask):
+    header = bytearray([0x80 | opcode])
+    mask_bit = 0x80 if mask else 0x00
+    if len(payload) < 126:
+        header.append(mask_bit | len(payload))
+    elif len(payload) <= 0xFFFF:
+        header.append(mask_bit | 126)
+        header += struct.pack(">H", len(payload))
+    else:
+        header.append(mask_bit | 127)
+        header += struct.pack(">Q", len(payload))
+    if not mask:
+        return bytes(header) + payload
+    key = os.urandom(4)
+    masked = bytes(byte ^ key[i % 4] for i, byte in enumerate(payload))
+    return bytes(header) + key + masked
+
+
+async def ws_read(reader):
+    """One complete message as (opcode, payload), fragments are joined."""
+    message = bytearray()
+    message_opcode = None
+    while True:
+        first, second = await reader.readexactly(2)
+        opcode = first & 0x0F
+        length = second & 0x7F
+        if length == 126:
+            length = struct.unpack(">H", await reader.readexactly(2))[0]
+        elif length == 127:
+            length = struct.unpack(">Q", await reader.readexactly(8))[0]
+        key = await reader.readexactly(4) if second & 0x80 else None
+        payload = await reader.readexactly(length)
+        if key:
+            payload = bytes(byte ^ key[i % 4] for i, byte in enumerate(payload))
+        if opcode >= 0x8:
+            return opcode, payload
+        if opcode != 0x0:
+            message_opcode = opcode
+        message += payload
+        if first & 0x80:
+            return message_opcode, bytes(message)
+
+
+# ---------------------------------------------------------------------------
+# Clients, each runs until the deadline and records into its ClientStats
+
+async def mjpeg_client(args, stats, deadline):
+    reader, writer = await asyncio.open_connection(args.host, args.stream_port)
+    try:
+        requested = time.monotonic()
+        writer.write(("GET /stream HTTP/1.1\r\nHost: %s\r\n\r\n" % args.host).encode())
+        await writer.drain()
+        status, _ = await read_headers(reader)
+        if " 200 " not in status + " ":
+            raise ConnectionError(status)
+        first = True
+        while True:
+            # parts are separated by boundary lines, skip them up to the part headers
+            line = await reader.readline()
+            if not line:
+                raise ConnectionError("stream closed")
+            if not line.lower().startswith(b"content-type"):
+                continue
+            length = None
+            while True:
+                header = await reader.readline()
+                if header in (b"\r\n", b""):
+                    break
+                name, _, value = header.decode("latin-1").partition(":")
+                if name.strip().lower() == "content-length":
+                    length = int(value)
+            if length is None:
+                raise ConnectionError("part without Content-Length")
+            await reader.readexactly(length)
+            stats.frame(length)
+            if first:
+                # time to the first complete frame
+                stats.latencies.append(time.monotonic() - requested)
+                first = False
+    finally:
+        writer.close()
+
+
+async def snapshot_client(args, stats, deadline):
+    reader, writer = await asyncio.open_connection(args.host, args.port)
+    try:
+        while time.monotonic() < deadline:
+            started = time.monotonic()
+            code, _, body = await http_get(reader, writer, args.host, "/capture")
+            if code != 200:
+                raise ConnectionError("HTTP %d" % code)
+            stats.latencies.append(time.monotonic() - started)
+            stats.frame(len(body))
+            await asyncio.sleep(args.snapshot_interval)
+    finally:
+        writer.close()
+
+
+async def config_client(args, stats, deadline):
+    reader, writer = await asyncio.open_connection(args.host, args.port)
+    quality = 10
+    try:
+        while time.monotonic() < deadline:
+            quality = 10 if quality >= 20 else quality + 1
+            for path in ("/control?var=quality&val=%d" % quality, "/status"):
+                started = time.monotonic()
+                code, _, body = await http_get(reader, writer, args.host, path)
+                if code != 200:
+                    raise ConnectionError("HTTP %d on %s" % (code, path))
+                stats.request(time.monotonic() - started, len(body))
+            await asyncio.sleep(args.config_interval)
+    finally:
+        writer.close()
+
+
+async def ws_client(args, stats, deadline):
+    reader, writer = await asyncio.open_connection(args.host, args.ws_port)
+    probes = {}
+
+    async def probe():
+        # a text message the camera echoes times the round trip through its receive path
+        while True:
+            stamp = ("%.6f" % time.monotonic()).encode()
+            probes[stamp] = time.monotonic()
+            writer.write(ws_frame(0x1, stamp, mask=True))
+            await writer.drain()
+            await asyncio.sleep(args.ws_interval)
+
+    prober = None
+    try:
+        await ws_handshake(reader, writer, args.host, args.ws_path)
+        prober = asyncio.ensure_future(probe())
+        while True:
+            opcode, payload = await ws_read(reader)
+            if opcode == 0x2:
+                stats.frame(len(payload))
+            elif opcode == 0x1:
+                stats.bytes += len(payload)
+                if payload in probes:
+                    stats.latencies.append(time.monotonic() - probes.pop(payload))
+            elif opcode == 0x9:
+                writer.write(ws_frame(0xA, payload, mask=True))
+            elif opcode == 0x8:
+                raise ConnectionError("closed by the camera")
+    finally:
+        if prober is not None:
+            prober.cancel()
+        writer.close()
+
+
+CLIENTS = {
+    "mjpeg": mjpeg_client,
+    "snapshot": snapshot_client,
+    "ws": ws_client,
+    "config": config_client,
+}
+
+
+async def run_client(client, args, stats, deadline):
+    """Keeps a client going until the deadline, reconnecting after errors."""
+    stats.started = time.monotonic()
+    while time.monotonic() < deadline:
+        try:
+            # clients run until they are cancelled at the deadline, that is not an error
+            await asyncio.wait_for(client(args, stats, deadline), deadline - time.monotonic())
+        except asyncio.TimeoutError:
+            break
+        except (OSError, ConnectionError, asyncio.IncompleteReadError, ValueError) as error:
+            stats.error(error)
+            await asyncio.sleep(min(args.retry_delay, max(deadline - time.monotonic(), 0)))
+    stats.stopped = time.monotonic()
+
+
+# ---------------------------------------------------------------------------
+# Stand-in for a camera, serves every endpoint from one port
+
+class StandInCamera:
+    def __init__(self, fps, frame_size):
+        self.period = 1.0 / fps
+        self.frame_size = frame_size
+        self.quality = 12
+        self.sequence = 0
+        self.connections = set()
+
+    def jpeg(self):
+        self.sequence += 1
+        body = struct.pack(">I", self.sequence) + os.urandom(max(self.frame_size - 8, 0))
+        return b"\xff\xd8" + body + b"\xff\xd9"
+
+    async def handle(self, reader, writer):
+        self.connections.add(asyncio.current_task())
+        try:
+            while True:
+                request, headers = await read_headers(reader)
+                method, target, _ = request.split(" ", 2)
+                path, _, query = target.partition("?")
+                if headers.get("upgrade", "").lower() == "websocket":
+                    await self.websocket(reader, writer, headers)
+                    return
+                if path == "/stream":
+                    await self.stream(writer)
+                    return
+                if path == "/capture":
+                    await asyncio.sleep(0.02)
+                    self.respond(writer, 200, "image/jpeg", self.jpeg())
+                elif path == "/control":
+                    fields = dict(item.partition("=")[::2] for item in query.split("&") if item)
+                    if fields.get("var") == "quality" and fields.get("val", "").isdigit():
+                        self.quality = int(fields["val"])
+                    self.respond(writer, 200, "text/plain", b"")
+                elif path == "/status":
+                    self.respond(writer, 200, "application/json", json.dumps({"quality": self.quality}).encode())
+                else:
+                    self.respond(writer, 404, "text/plain", b"Not Found")
+                await writer.drain()
+        except (ConnectionError, asyncio.IncompleteReadError, ValueError, asyncio.CancelledError):
+            # cancelled by close(), streams and WebSockets never end on their own
+            pass
+        finally:
+            self.connections.discard(asyncio.current_task())
+            writer.close()
+
+    async def close(self):
+        for connection in list(self.connections):
+            connection.cancel()
+        await asyncio.gather(*self.connections, return_exceptions=True)
+
+    @staticmethod
+    def respond(writer, code, content_type, body):
+        reason = {200: "OK", 404: "Not Found"}.get(code, "Error")
+        writer.write(("HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n"
+                      % (code, reason, content_type, len(body))).encode() + body)
+
+    async def stream(self, writer):
+        writer.write(b"HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace;boundary=" + BOUNDARY +
+                     b"\r\nConnection: close\r\n\r\n")
+        while True:
+            frame = self.jpeg()
+            writer.write(b"Content-Type: image/jpeg\r\nContent-Length: %d\r\n\r\n" % len(frame) + frame +
+                         b"\r\n--" + BOUNDARY + b"\r\n")
+            await writer.drain()
+            await asyncio.sleep(self.period)
+
+    async def websocket(self, reader, writer, headers):
+        writer.write(("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                      "Sec-WebSocket-Accept: %s\r\n\r\n" % ws_accept(headers.get("sec-websocket-key", ""))).encode())
+
+        async def push():
+            while True:
+                writer.write(ws_frame(0x2, self.jpeg(), mask=False))
+                await writer.drain()
+                await asyncio.sleep(self.period)
+
+        pusher = asyncio.ensure_future(push())
+        try:
+            while True:
+                opcode, payload = await ws_read(reader)
+                if opcode == 0x8:
+                    writer.write(ws_frame(0x8, payload[:2], mask=False))
+                    return
+                if opcode == 0x9:
+                    writer.write(ws_frame(0xA, payload, mask=False))
+                elif opcode == 0x1:
+                    writer.write(ws_frame(0x1, payload, mask=False))
+        finally:
+            pusher.cancel()
+
+
+# ---------------------------------------------------------------------------
+
+async def run(args):
+    server = None
+    camera = None
+    if args.local:
+        camera = StandInCamera(args.local_fps, args.local_frame_size)
+        server = await asyncio.start_server(camera.handle, "127.0.0.1", 0)
+        port = server.sockets[0].getsockname()[1]
+        args.host = "127.0.0.1"
+        args.port = args.stream_port = args.ws_port = port
+        print("Stand-in camera on 127.0.0.1:%d" % port, file=sys.stderr)
+
+    deadline = time.monotonic() + args.duration
+    stats = []
+    tasks = []
+    for kind, client in CLIENTS.items():
+        for index in range(getattr(args, kind)):
+            client_stats = ClientStats(kind, index)
+            stats.append(client_stats)
+            tasks.append(run_client(client, args, client_stats, deadline))
+            # staggered so the camera is not hit by every connect at once
+            await asyncio.sleep(args.ramp)
+
+    await asyncio.gather(*tasks)
+    if server is not None:
+        server.close()
+        await camera.close()
+        await server.wait_closed()
+    return stats
+
+
+def aggregate(clients):
+    """Totals per kind, latencies and intervals of all its clients pooled."""
+    kinds = {}
+    for client in clients:
+        kinds.setdefault(client.kind, []).append(client)
+    result = {}
+    for kind, members in kinds.items():
+        reports = [member.report() for member in members]
+        intervals = []
+        latencies = []
+        for member in members:
+            intervals += [(b - a) * 1000.0 for a, b in zip(member.frame_times, member.frame_times[1:])]
+            latencies += [latency * 1000.0 for latency in member.latencies]
+        summary = {
+            "clients": len(members),
+            "fps": round(sum(report["fps"] for report in reports), 2),
+            "fps_per_client": round(sum(report["fps"] for report in reports) / len(reports), 2),
+            "bytes_per_second": round(sum(report["bytes_per_second"] for report in reports), 1),
+            "requests": sum(report["requests"] for report in reports),
+            "errors": sum(report["errors"] for report in reports),
+        }
+        if intervals:
+            summary["interval_ms"] = summarize(intervals)
+            summary["jitter_ms"] = round(stddev(intervals), 2)
+        if latencies:
+            summary["latency_ms"] = summarize(latencies)
+        result[kind] = summary
+    return result
+
+
+def print_table(reports):
+    print("%-12s %8s %8s %12s %10s %10s %10s %6s" %
+          ("client", "frames", "fps", "bytes/s", "jitter ms", "p50 ms", "p99 ms", "errors"))
+    for report in reports:
+        latency = report.get("latency_ms", {})
+        print("%-12s %8d %8.2f %12.0f %10s %10s %10s %6d" % (
+            report["client"], report["frames"], report["fps"], report["bytes_per_second"],
+            report.get("jitter_ms", "-"), latency.get("p50", "-"), latency.get("p99", "-"), report["errors"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Load generator for the camera's stream and HTTP endpoints.")
+    parser.add_argument("host", nargs="?", default="192.168.4.1", help="camera address")
+    parser.add_argument("--port", type=int, default=80, help="web server port, /capture /control /status")
+    parser.add_argument("--stream-port", type=int, default=None, help="port of /stream, default port + 1")
+    parser.add_argument("--ws-port", type=int, default=None, help="WebSocket port, default port")
+    parser.add_argument("--ws-path", default="/", help="WebSocket resource")
+    parser.add_argument("--mjpeg", type=int, default=1, help="MJPEG stream clients")
+    parser.add_argument("--snapshot", type=int, default=0, help="snapshot polling clients")
+    parser.add_argument("--ws", type=int, default=0, help="WebSocket clients")
+    parser.add_argument("--config", type=int, default=0, help="config clients")
+    parser.add_argument("--duration", type=float, default=10.0, help="seconds to run")
+    parser.add_argument("--ramp", type=float, default=0.05, help="seconds between client starts")
+    parser.add_argument("--snapshot-interval", type=float, default=0.0, help="pause between snapshots")
+    parser.add_argument("--config-interval", type=float, default=1.0, help="pause between config rounds")
+    parser.add_argument("--ws-interval", type=float, default=1.0, help="seconds between echo probes")
+    parser.add_argument("--retry-delay", type=float, default=0.5, help="pause before reconnecting")
+    parser.add_argument("--local", action="store_true", help="run against a stand-in camera on 127.0.0.1")
+    parser.add_argument("--local-fps", type=float, default=20.0, help="frame rate of the stand-in")
+    parser.add_argument("--local-frame-size", type=int, default=20000, help="JPEG size of the stand-in")
+    parser.add_argument("--json", metavar="FILE", help="write the results to FILE, - for stdout")
+    args = parser.parse_args()
+    if args.stream_port is None:
+        args.stream_port = args.port + 1
+    if args.ws_port is None:
+        args.ws_port = args.port
+
+    clients = asyncio.run(run(args))
+    reports = [client.report() for client in clients]
+
+    result = {
+        "target": "local" if args.local else args.host,
+        "duration": args.duration,
+        "clients": reports,
+        "summary": aggregate(clients),
+    }
+    if args.json == "-":
+        json.dump(result, sys.stdout, indent=2)
+        print()
+    else:
+        print_table(reports)
+        for kind, summary in result["summary"].items():
+            print("%s: %s" % (kind, json.dumps(summary)))
+        if args.json:
+            with open(args.json, "w") as output:
+                json.dump(result, output, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -18,6 +18,9 @@ public:
 
     void Initialize();
 
+    /// @brief	Applies the bandwidth section of the board configuration, also while running.
+    void BandwidthUpdated();
+
     static inline ApplicationAgent *Instance()
     {
         if (_applications == nullptr)
@@ -34,10 +37,10 @@ public:
 
 private:
     static ApplicationAgent *_applications;
-    WifiService *_wifiService;
-    HttpServer *_httpServer;
-    GatewayService *_gatewayService;
-    FirmwareUpdateService * _firmwareUpdateService;
+    WifiService *_wifiService = nullptr;
+    HttpServer *_httpServer = nullptr;
+    GatewayService *_gatewayService = nullptr;
+    FirmwareUpdateService * _firmwareUpdateService = nullptr;
 
 private:
     /// @brief	Hide Copy constructor.
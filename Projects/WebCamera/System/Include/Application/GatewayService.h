@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Hardware.h"
+#include "queue.hpp"
 #include "WifiService.h"
 #include "HttpServer.h"
 #include "TimeLimit.h"
@@ -19,16 +20,46 @@ using Common::ProtocolType;
 using Common::TransportLayerType;
 using Protocol::BaseConnection;
 using Protocol::BaseRouteHandler;
+using Protocol::ConnectionChangeReason;
 using Protocol::RemoteConnection;
 using Protocol::TcpConnection;
 using Utilities::Logger;
 
+/// @brief	Keeps the link to the configured server up.
+/// @note	The thread sleeps on the connection's state changes, a lost link is retried
+///			after an exponential backoff with random jitter so a fleet of cameras does not
+///			reconnect in lockstep after a server restart.
 class GatewayService : public cpp_freertos::Thread
 {
 public:
+    struct Statistics
+    {
+        uint32_t Attempts;
+        uint32_t Connects;
+        uint32_t Disconnects;
+        uint32_t LastConnectTime; // ms from Connect() until the connected event
+        uint32_t Uptime;          // ms the current link has been up, 0 while down
+        uint32_t NextRetry;       // ms until the next attempt, 0 if none is scheduled
+    };
+
     GatewayService();
 
+    Statistics GetStatistics() const;
+
 private:
+    static constexpr uint32_t StartupDelay = 6000;
+    static constexpr uint32_t ConnectTimeout = 15000;
+    static constexpr uint32_t BackoffBase = 500;
+    static constexpr uint32_t BackoffMax = 60000;
+    static constexpr uint32_t StableUptime = 30000; // a link that lasted this long resets the backoff
+    static constexpr uint8_t MaxEvents = 8;
+
+    struct ConnectionEvent
+    {
+        Protocol::ConnectionState State;
+        ConnectionChangeReason Reason;
+    };
+
     struct RoutePathConnection
     {
         RoutePathConnection() : Connection(nullptr),
@@ -60,12 +91,28 @@ private:
 
     RoutePathConnection _connectionPath;
     ConnectionState _connectionState;
+    cpp_freertos::Queue _events;
+    RemoteConnection *_remote = nullptr;
+    uint32_t _deadline = 0;
+    uint32_t _attemptStarted = 0;
+    uint32_t _connectedSince = 0;
+    uint8_t _failures = 0;
+    Statistics _statistics = {};
 
     void changeState(ConnectionState connectionState)
     {
         _connectionState = connectionState;
     }
 
+    void connectionStateChanged(Protocol::ConnectionState state, ConnectionChangeReason reason);
+
+    void connect();
+    void connectionEvent(const ConnectionEvent &event);
+    void deadlineReached();
+    void scheduleRetry();
+    TickType_t ticksUntilDeadline() const;
+    uint32_t nextBackoff();
+
 protected:
     void Run() override;
 
@@ -14,37 +14,147 @@
 #include "Logger.h"
 #include "lwip/sockets.h"
 #include "esp_netif.h"
+#include "TimeLimit.h"
+#include "HttpParser.h"
+#include "FastDelegate.h"
+#include "TokenBucket.h"
 
 namespace Applications
 {
 
 using Utilities::Logger;
 using std::array;
+using Hal::TimeLimit;
+using Protocol::HttpParser;
+using Protocol::HttpMethod;
+using Protocol::HttpHeaderIndex;
+using Utilities::TokenBucket;
 
+struct HttpRequestInfo
+{
+	HttpMethod Method;
+	const char *Path;
+	const char *Query;
+	const HttpHeaderIndex *Headers;
+	bool KeepAlive;
+	const uint8_t *Body; // nullptr without a body, valid until the handler returns
+	uint16_t BodyLength;
+};
+
+struct HttpResponseInfo
+{
+	uint16_t Status;
+	const char *ContentType;
+	char *Body;
+	uint16_t BodySize;
+	uint16_t BodyLength;
+};
+
+/// @brief	Single task server multiplexing a fixed pool of keep-alive connections with select().
+/// @note	Sockets are never waited on. A response the socket does not take at once is finished
+///			when select() reports room for it, and the requests pipelined behind it wait until then.
 class HttpServer : public cpp_freertos::Thread
 {
 public:
+	typedef fastdelegate::FastDelegate2<const HttpRequestInfo &, HttpResponseInfo &> RouteDelegate;
+
+	static constexpr uint8_t MaxConnections = 4;
+	static constexpr uint8_t MaxRoutes = 8;
+	/// Keep-alive connection without any traffic, in ms.
+	static constexpr uint32_t IdleTimeout = 5000;
+	/// Time for a started request to arrive completely, or for a client to take its response, in ms.
+	static constexpr uint32_t RequestTimeout = 10000;
+	/// Largest request body handed to a route, a longer one is answered with 413.
+	static constexpr uint16_t MaxBodySize = 512;
+	/// Seconds a client whose response was dropped for bandwidth is asked to wait.
+	static constexpr uint8_t RetryAfter = 1;
+
     HttpServer(uint32_t port) : cpp_freertos::Thread("WEBSVC", configHTTPSVC_STACK_DEPTH, 3),
 	_port(port)
     {
     }
 	~HttpServer();
+
+	/// @brief	Registers a handler for an exact path, call before the thread is started.
+	bool AddRoute(const char *path, RouteDelegate handler);
+
+	/// @brief	Budget for each connection, on top of the device wide one.
+	/// @note	A response over budget is never cut short, it is replaced by a 503 with Retry-After.
+	void SetBandwidth(uint32_t bytesPerSecond, uint32_t burst);
+
+	/// @brief	All connections together, the counters cover every connection ever served.
+	TokenBucket::Statistics GetBandwidthStatistics();
+
 protected:
     void Run() override;
 
 private:
-	uint16_t _httpResponse = 0;
-	uint16_t _packetsCount = 0;
 	static constexpr uint16_t _rxBufferSize = 1024;
-	array<uint8_t, _rxBufferSize> _rxBuffer;
-
 	static constexpr uint16_t _txBufferSize = 1024;
-	array<uint8_t, _txBufferSize> _txBuffer;
+	/// Room kept in front of the body for status line and headers.
+	static constexpr uint16_t _txHeaderSize = 160;
+	static constexpr uint8_t _pathSize = 64;
+	static constexpr uint8_t _querySize = 64;
+
+	struct Connection
+	{
+		int Socket = -1;
+		HttpParser Parser;
+		HttpParser::HttpParserRoundtripper Roundtripper;
+		TimeLimit Activity;
+		TimeLimit RequestTimer;
+		bool RequestStarted = false;
+		// received bytes not parsed yet, held back while a response is pending
+		uint16_t RxOffset = 0;
+		uint16_t RxLength = 0;
+		// response part the socket has not taken yet, it lives in TxBuffer
+		const uint8_t *Pending = nullptr;
+		uint16_t PendingLength = 0;
+		bool CloseAfterSend = false;
+		uint16_t Error = 0;
+		HttpMethod Method = HttpMethod::Unknown;
+		uint8_t VersionMinor = 0;
+		array<char, _pathSize + 1> Path;
+		array<char, _querySize + 1> Query;
+		array<uint8_t, _rxBufferSize> RxBuffer;
+		array<uint8_t, _txBufferSize> TxBuffer;
+		array<uint8_t, MaxBodySize> Body;
+		uint16_t BodyLength = 0;
+		TokenBucket Bandwidth;
+	};
 
-	int _connectionTimeout;
+	struct Route
+	{
+		const char *Path;
+		RouteDelegate Handler;
+	};
+
+	array<Connection, MaxConnections> _connections;
+	array<Route, MaxRoutes> _routes = {};
+	uint8_t _routeCount = 0;
+	int _listenSocket = -1;
 	uint32_t _port = 0;
+	uint32_t _bandwidthRate = 0;
+	uint32_t _bandwidthBurst = 0;
+
+	bool openListenSocket();
+	void acceptConnection();
+	void receive(Connection &connection);
+	void parse(Connection &connection);
+	bool processRequest(Connection &connection);
+	bool sendError(Connection &connection, uint16_t status);
+	bool sendResponse(Connection &connection, HttpResponseInfo &response, bool keepAlive, bool withBody);
+	bool queueResponse(Connection &connection, const uint8_t *data, uint16_t length, bool close);
+	bool sendPending(Connection &connection);
+	void resetRequest(Connection &connection);
+	void closeConnection(Connection &connection);
+	void checkTimeouts();
+
+	bool onRequestLine(void *opaque, const Protocol::HttpRequestLine &line);
+	bool onAppendBody(HttpParser::HttpParserRoundtripper *roundtripper, const char *data, uint16_t length);
+
+	static const char *statusText(uint16_t status);
 
-	sockaddr_in _localHost;
 private:
     /// @brief	Hide Copy constructor.
     HttpServer(const HttpServer &) = delete;
@@ -59,4 +169,4 @@ private:
     HttpServer &operator=(HttpServer &&) = delete;
 };
 
-} // namespace Applications
\ No newline at end of file
+} // namespace Applications
@@ -113,13 +113,46 @@ struct BoardConfigurationData
         }
     };
 
+    /// @brief	Outgoing bandwidth, a rate of 0 leaves it unlimited.
+    struct BandwidthConfiguration
+    {
+        uint32_t DeviceKbps = 0;     // all connections together
+        uint32_t ConnectionKbps = 0; // each connection on its own
+        uint32_t BurstKb = DefaultBurstKb;
+
+        static constexpr uint32_t DefaultBurstKb = 32;
+
+        /// @brief	Configuration flags
+        union _Changes {
+            struct
+            {
+                bool DeviceKbps : 1;
+                bool ConnectionKbps : 1;
+                bool BurstKb : 1;
+                uint32_t _NotUsed : 29;
+            } Flags;
+            uint32_t AllChanges;
+        } Changes;
+
+        uint32_t DeviceRate() const { return DeviceKbps * 1000 / 8; }
+        uint32_t ConnectionRate() const { return ConnectionKbps * 1000 / 8; }
+        uint32_t Burst() const { return BurstKb * 1024; }
+
+        uint32_t GetCRC() const
+        {
+            return Crc32xZlib::GetCrc((unsigned char *)this, sizeof(BandwidthConfiguration), Crc32xZlib::Polynomial);
+        }
+    };
+
     GeneralConfiguration GeneralConfig;
     WifiConfiguration WifiConfig;
     ServerConfiguration ServerConfig;
+    BandwidthConfiguration BandwidthConfig;
 
     BoardConfigurationData() : GeneralConfig(),
                                WifiConfig(),
-                               ServerConfig()
+                               ServerConfig(),
+                               BandwidthConfig()
 
     {
     }
@@ -140,10 +173,11 @@ public:
     bool Serialize(char *json, int length);
     BoardConfigurationData *GetConfiguration() { return &_configuration; }
     void DefaultConfiguration();
+    void ApplyConfiguration();
 
 private:
     BoardConfigurationData _configuration = {};
-    static constexpr uint16_t JsonConversionLength = 512;
+    static constexpr uint16_t JsonConversionLength = 768;
 
 private:
     /// @brief	Hide Copy constructor.
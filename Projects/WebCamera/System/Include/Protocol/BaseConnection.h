@@ -6,6 +6,7 @@
 #include "lwip/ip_addr.h"
 #include "CommonTypes.h"
 #include "ConnectionTypes.h"
+#include "PbufChain.h"
 #include "ConfigurationCommon.h"
 
 namespace Protocol
@@ -35,11 +36,23 @@ public:
 		return DoConnect(remoteConnection);
 	}
 
+	/// @brief	Queues a copy of data, false if there is no room for it right now.
 	bool Send(const unsigned char *data, uint16_t length)
 	{
 		return DoSend(data, length);
 	}
 
+	/// @brief	Queues data without copying it, it has to stay unchanged until IsSendPending() is false.
+	bool SendReference(const unsigned char *data, uint16_t length)
+	{
+		return DoSendReference(data, length);
+	}
+
+	bool IsSendPending()
+	{
+		return HasPendingSend();
+	}
+
 	void Close()
 	{
 		DoClose();
@@ -60,11 +73,31 @@ public:
 		_connectionContext.OnDataReceived = delegate;
 	}
 
+	/// @brief	Replaces DataReceived with the received chain itself. The chain may be moved
+	///			out and read later, the receive window only reopens by what is passed to Consume().
+	void SetChainReceived(DelegateChainReceived delegate)
+	{
+		_connectionContext.OnChainReceived = delegate;
+	}
+
+	/// @brief	Returns length bytes of receive window, for data taken through SetChainReceived().
+	void Consume(uint16_t length)
+	{
+		DoConsume(length);
+	}
+
 	void SetConnectionStateChanged(DelegateConnectionStateChanged delegate)
 	{
 		_connectionContext.OnStateChanged = delegate;
 	}
 
+	/// @brief	Called when a refused send would fit again or everything sent was acknowledged.
+	/// @note	May run on the network stack task, do not send from it, just wake the producer.
+	void SetSendReady(DelegateSendReady delegate)
+	{
+		_connectionContext.OnSendReady = delegate;
+	}
+
 	inline void IncrementTimeout()
 	{
 		_connectionContext.Timeout++;
@@ -103,6 +136,21 @@ public:
 		_connectionContext.OnDataReceived(data, len);
 	}
 
+	/// @return	False if nobody takes chains, the data has to go through DataReceived().
+	bool ChainReceived(PbufChain &chain)
+	{
+		if (!_connectionContext.OnChainReceived)
+			return false;
+		_connectionContext.OnChainReceived(chain);
+		return true;
+	}
+
+	void SendReady()
+	{
+		if (_connectionContext.OnSendReady)
+			_connectionContext.OnSendReady();
+	}
+
 	constexpr TransportLayerType GetConnection() const
 	{
 		return _connectionType;
@@ -129,6 +177,20 @@ private:
 
 	virtual bool DoSend(const unsigned char *data, uint16_t length) = 0;
 
+	virtual bool DoSendReference(const unsigned char *data, uint16_t length)
+	{
+		return DoSend(data, length);
+	}
+
+	virtual bool HasPendingSend()
+	{
+		return false;
+	}
+
+	virtual void DoConsume(uint16_t length)
+	{
+	}
+
 	virtual void DoClose() = 0;
 
 	virtual void DoReset() = 0;
@@ -146,6 +208,8 @@ protected:
 		ConnectionState State;
 		DelegateConnectionStateChanged OnStateChanged;
 		DelegateDataReceived OnDataReceived;
+		DelegateSendReady OnSendReady;
+		DelegateChainReceived OnChainReceived;
 	};
 
 	ConnectionContext _connectionContext = {};
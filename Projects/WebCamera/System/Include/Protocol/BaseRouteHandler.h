@@ -1,12 +1,15 @@
 #pragma once
 
+#include <atomic>
 #include "TimeLimit.h"
 #include "BaseConnection.h"
+#include "TokenBucket.h"
 
 namespace Protocol
 {
 
 using Hal::TimeLimit;
+using Utilities::TokenBucket;
 
 class BaseRouteHandler
 {
@@ -49,6 +52,7 @@ public:
 
 	bool Start(ConnectionMode connectionMode, RemoteConnection *address, uint8_t processingIndex, uint8_t processingLogicalId)
 	{
+		applyDefaultBandwidth();
 		return start(connectionMode, address, processingIndex, processingLogicalId);
 	}
 
@@ -59,9 +63,28 @@ public:
 
 	void Process()
 	{
+		applyDefaultBandwidth();
 		process();
 	}
 
+	/// @brief	Budget for the messages sent on this route, on top of the device wide one.
+	///			The route keeps it, later default budgets are not applied any more.
+	/// @param bytesPerSecond	0 leaves only the device wide budget.
+	void SetBandwidth(uint32_t bytesPerSecond, uint32_t burst)
+	{
+		_ownBandwidth = true;
+		_bandwidth.Configure(bytesPerSecond, burst);
+	}
+
+	/// @brief	Budget of every route without one of its own, the per connection rate of the board configuration.
+	/// @note	Routes pick a change up on their next Start() or Process().
+	static void SetDefaultBandwidth(uint32_t bytesPerSecond, uint32_t burst);
+
+	TokenBucket::Statistics GetBandwidthStatistics()
+	{
+		return _bandwidth.GetStatistics();
+	}
+
 	void SetConnection(BaseConnection* connection)
 	{
 		//_pathDataExchangeHandler.SetPathInfo(&_pathInfo);
@@ -71,12 +94,12 @@ public:
 		if (connection == nullptr)
 		{
 			_connection = nullptr;
-			//DoSetConnection();
+			setConnection();
 		}
 		else
 		{
 			_connection = connection;
-			//DoSetConnection();
+			setConnection();
 		}
 	}
 	
@@ -97,6 +120,25 @@ protected:
 		return _remoteConnection;
 	}
 
+	/// @brief	Asks the budget for a whole message before any of it is written.
+	/// @return	False if the message has to be dropped.
+	bool admit(uint32_t length)
+	{
+		return _bandwidth.Admit(length);
+	}
+
+private:
+	TokenBucket _bandwidth;
+	bool _ownBandwidth = false;
+	uint32_t _bandwidthGeneration = 0;
+
+	static std::atomic<uint32_t> _defaultRate;
+	static std::atomic<uint32_t> _defaultBurst;
+	// bumped after every change of the defaults, a route that has seen the value is up to date
+	static std::atomic<uint32_t> _defaultGeneration;
+
+	void applyDefaultBandwidth();
+
 
 private:
 	virtual void setConnection() = 0;
@@ -32,6 +32,10 @@ enum class ConnectionChangeReason
 
 using DelegateDataReceived = FastDelegate2<const char *, uint16_t>;
 using DelegateConnectionStateChanged = FastDelegate2<ConnectionState, ConnectionChangeReason>;
+using DelegateSendReady = FastDelegate0<>;
+
+class PbufChain;
+using DelegateChainReceived = FastDelegate1<PbufChain &>;
 
 struct RemoteConnection
 {
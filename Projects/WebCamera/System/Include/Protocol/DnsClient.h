@@ -11,12 +11,19 @@
 #include "freertos/timers.h"
 #include "Hardware.h"
 #include "semaphore.hpp"
+#include "mutex.hpp"
 #include "TimeLimit.h"
+#include "FastDelegate.h"
+#include <array>
 
 namespace Protocol
 {
 
 using cpp_freertos::BinarySemaphore;
+using cpp_freertos::LockGuard;
+using cpp_freertos::MutexStandard;
+using fastdelegate::FastDelegate2;
+using std::array;
 using Hal::TimeLimit;
 using Protocol::IPParser;
 
@@ -57,22 +64,89 @@ public:
 		Done,
 	};
 
-	class DnsParameter
+	/// @brief	Completion of a query, address is nullptr if the name could not be resolved.
+	/// @note	Runs on the tcpip task.
+	using DelegateResolved = FastDelegate2<const ip_addr_t *, void *>;
+
+	struct DnsStatistics
 	{
-	public:
-		DnsParameter() : IpAddress(nullptr),
-						 DnsSemaphore(nullptr){};
-		ip_addr_t *IpAddress;
-		BinarySemaphore *DnsSemaphore;
+		uint32_t Hits;
+		uint32_t Misses;
+		uint32_t Coalesced; // misses that joined a query already on the way
+		uint8_t InFlight;
 	};
 
 	void SetDnsServer(const ip_addr_t &dnsServer);
 
+	/// @brief	Blocks the calling task until the name is resolved or ResolveTimeout passed.
 	DnsResolveResult Resolve(const char *hostname, ip_addr_t &ipaddr);
 
+	/// @brief	Resolves without blocking. Done means ipaddr is filled in right away (literal
+	///			address or cache hit), Processing means callback is called with context later.
+	///			Requests for a name already being resolved share that query.
+	DnsResolveResult ResolveAsync(const char *hostname, DelegateResolved callback, void *context, ip_addr_t &ipaddr);
+
+	/// @brief	Drops a pending callback, false if it is already running or done.
+	bool Cancel(void *context);
+
+	DnsStatistics GetStatistics();
+
 private:
+	static constexpr uint8_t MaxQueries = 8;
+	static constexpr uint8_t MaxWaiters = 4;
+	static constexpr uint8_t CacheSize = 8;
+	static constexpr uint8_t MaxHostnameLength = 64;
+	static constexpr TickType_t ResolveTimeout = 10 * 100;
+	// lwIP does not pass the record TTL on, its own table honours it behind this cache,
+	// which only keeps names for at most CacheTtl
+	static constexpr uint32_t CacheTtl = 60000;
+	static constexpr uint32_t NegativeCacheTtl = 5000;
+
+	struct Waiter
+	{
+		DelegateResolved Callback;
+		void *Context;
+	};
+
+	struct Query
+	{
+		bool InUse;
+		char Hostname[MaxHostnameLength + 1];
+		Waiter Waiters[MaxWaiters];
+		uint8_t WaiterCount;
+	};
+
+	struct CacheEntry
+	{
+		char Hostname[MaxHostnameLength + 1];
+		ip_addr_t Address;
+		bool Resolved;
+		uint32_t Expires;
+		uint32_t LastUsed;
+	};
+
+	struct BlockingWaiter
+	{
+		BinarySemaphore Done;
+		ip_addr_t Address;
+		bool Resolved;
+	};
+
+	bool hasDnsServer();
+	CacheEntry *findCached(const char *hostname, uint32_t now);
+	void store(const char *hostname, const ip_addr_t *ipaddr, uint32_t now);
+	/// @param cache	False for a failure lwIP reported before asking any server, nothing is learnt about the name then.
+	void complete(Query &query, const ip_addr_t *ipaddr, bool cache);
+	void blockingResolved(const ip_addr_t *ipaddr, void *context);
+
 	static DnsClient *_dnsClient;
-	BinarySemaphore _dnsSemaphore;
+	MutexStandard _lock;
+	array<Query, MaxQueries> _queries = {};
+	array<CacheEntry, CacheSize> _cache = {};
+	uint32_t _useCounter = 0;
+	uint32_t _hits = 0;
+	uint32_t _misses = 0;
+	uint32_t _coalesced = 0;
 
 	friend void dns_callback(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
 
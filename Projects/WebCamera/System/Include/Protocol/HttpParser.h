@@ -3,10 +3,108 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <array>
 #include "FastDelegate.h"
 
 namespace Protocol
 {
+using std::array;
+
+enum class HttpHeaderId : uint8_t
+{
+	Host,
+	Connection,
+	Upgrade,
+	ContentType,
+	ContentLength,
+	TransferEncoding,
+	SecWebSocketKey,
+	SecWebSocketAccept,
+	SecWebSocketVersion,
+	SecWebSocketProtocol,
+	Count,
+	Unknown = Count
+};
+
+enum class HttpParserMode : uint8_t
+{
+	Response,
+	Request
+};
+
+enum class HttpMethod : uint8_t
+{
+	Get,
+	Head,
+	Post,
+	Put,
+	Delete,
+	Options,
+	Patch,
+	Unknown
+};
+
+/// @brief	Views into the request line, only valid during the ProcessRequestLine callback.
+struct HttpRequestLine
+{
+	HttpMethod Method;
+	const char *MethodName;
+	uint16_t MethodLength;
+	const char *Path;
+	uint16_t PathLength;
+	const char *Query;
+	uint16_t QueryLength;
+	uint8_t VersionMinor;
+};
+
+/// @brief	Keeps the values of the headers the device acts on, so handlers can look them up
+///			after parsing without walking all headers again. Every header owns a small slot,
+///			longer values are cut and flagged.
+class HttpHeaderIndex
+{
+public:
+	static constexpr uint8_t ValueSize = 48;
+
+	/// @param	key lowercase header name.
+	static HttpHeaderId Lookup(const char *key, int nkey);
+
+	void Clear()
+	{
+		_present = 0;
+		_truncated = 0;
+	}
+
+	void Store(HttpHeaderId id, const char *value, int nvalue);
+
+	bool Has(HttpHeaderId id) const
+	{
+		return id < HttpHeaderId::Count && (_present & (1u << static_cast<uint8_t>(id)));
+	}
+
+	bool IsTruncated(HttpHeaderId id) const
+	{
+		return Has(id) && (_truncated & (1u << static_cast<uint8_t>(id)));
+	}
+
+	/// @return	Null terminated value, or nullptr if the header was not received.
+	const char *Get(HttpHeaderId id) const
+	{
+		return Has(id) ? _values[static_cast<uint8_t>(id)].data() : nullptr;
+	}
+
+	uint8_t GetLength(HttpHeaderId id) const
+	{
+		return Has(id) ? _lengths[static_cast<uint8_t>(id)] : 0;
+	}
+
+private:
+	static constexpr uint8_t Slots = static_cast<uint8_t>(HttpHeaderId::Count);
+
+	array<array<char, ValueSize + 1>, Slots> _values = {};
+	array<uint8_t, Slots> _lengths = {};
+	uint16_t _present = 0;
+	uint16_t _truncated = 0;
+};
 
 class HttpParser
 {
@@ -22,7 +120,11 @@ public:
 		http_header_status_value_character,
 		http_header_status_store_keyvalue,
 		http_header_status_code_done,
-		http_header_version_done
+		http_header_version_done,
+		http_header_status_request_line_character,
+		http_header_status_method_done,
+		http_header_status_target_done,
+		http_header_status_request_line_done
 	};
 
 	enum class HttpRoundtripperState
@@ -52,12 +154,24 @@ private:
 		0x84, 0xC1, 0xC0, 0x05, 0xC1, 0xC1, 0x06, 0xC1, /* state 4: Start of header field */
 		0xC1, 0xC1, 0xC0, 0xC1, 0xC1, 0xC1, 0xC1, 0xC1, /* state 5: Last CR before end of header */
 		0x87, 0x06, 0xC1, 0xC1, 0x06, 0x87, 0x87, 0xC1, /* state 6: leading whitespace before header value */
-		0x87, 0x87, 0xC4, 0x10, 0x87, 0x88, 0x87, 0xC1, /* state 7: header field value */
+		0x87, 0x87, 0xC4, 0x0A, 0x87, 0x88, 0x87, 0xC1, /* state 7: header field value */
 		0x87, 0x88, 0x06, 0x09, 0x88, 0x88, 0x87, 0xC1, /* state 8: Split value field value */
 		0xC1, 0xC1, 0x06, 0xC1, 0xC1, 0xC1, 0xC1, 0xC1, /* state 9: CR after split value field */
 		0xC1, 0xC1, 0xC4, 0xC1, 0xC1, 0xC1, 0xC1, 0xC1, /* state 10:CR after header value */
+		0x8B, 0xC1, 0xC1, 0xC1, 0xAC, 0xC1, 0xC1, 0xC1, /* state 11:Request method */
+		0x8C, 0xC1, 0xC1, 0xC1, 0xAD, 0x8C, 0x8C, 0xC1, /* state 12:Request target */
+		0x8D, 0xC1, 0xA4, 0xAE, 0xC1, 0xC1, 0xC1, 0xC1, /* state 13:Request HTTP version */
+		0xC1, 0xC1, 0x04, 0xC1, 0xC1, 0xC1, 0xC1, 0xC1, /* state 14:CR after request line */
 	};
 
+	// header table states the bulk scanner knows how to skip through
+	static constexpr uint8_t HeaderStateReason = 2;
+	static constexpr uint8_t HeaderStateKey = 4;
+	static constexpr uint8_t HeaderStateValue = 7;
+	static constexpr uint8_t HeaderStateMethod = 11;
+	static constexpr uint8_t HeaderStateTarget = 12;
+	static constexpr uint8_t HeaderStateRequestVersion = 13;
+
 	static constexpr unsigned char http_chunk_state[] =
 		{
 			/*     *    LF    CR    HEX */
@@ -85,6 +199,15 @@ public:
 		int nkey;
 		int nvalue;
 
+		// value still in the caller's buffer, nullptr once it lives in scratch
+		const char *value;
+
+		// request mode, the request line is collected like a header value
+		bool request;
+		HttpMethod method;
+		int nmethod;
+		int ntarget;
+
 		int chunked;
 
 		bool endOfHeadersDetected;
@@ -94,8 +217,11 @@ public:
 	typedef fastdelegate::FastDelegate5<void *, const char *, uint16_t, const char *, uint16_t, bool> ProcessHeaderDelegate;
 	typedef fastdelegate::FastDelegate2<void *, uint32_t, bool> ProcessCodeDelegate;
 	typedef fastdelegate::FastDelegate2<void *, uint32_t> ProcessErrorDelegate;
+	typedef fastdelegate::FastDelegate2<void *, const HttpRequestLine &, bool> ProcessRequestLineDelegate;
 
-	void HttpInit(struct HttpParserRoundtripper *rt, void *opaque)
+	/// @param	mode Response parses a status line (client side), Request a request line (server side).
+	///			Requests without Content-Length or chunked encoding have no body.
+	void HttpInit(struct HttpParserRoundtripper *rt, void *opaque, HttpParserMode mode = HttpParserMode::Response)
 	{
 		rt->scratch = &_scratch[0];
 		rt->nscratch = ScratchSize;
@@ -103,13 +229,20 @@ public:
 		rt->code = 0;
 		rt->contentlength = -1;
 
-		rt->parsestate = HttpRoundtripperState::http_roundtripper_header;
+		rt->request = mode == HttpParserMode::Request;
+		rt->parsestate = rt->request ? static_cast<HttpRoundtripperState>(HeaderStateMethod) : HttpRoundtripperState::http_roundtripper_header;
 		rt->state = HttpRoundtripperState::http_roundtripper_header;
+		rt->method = HttpMethod::Unknown;
+		rt->nmethod = 0;
+		rt->ntarget = 0;
 
 		rt->nkey = 0;
 		rt->nvalue = 0;
+		rt->value = nullptr;
 		rt->chunked = 0;
 		rt->endOfHeadersDetected = false;
+
+		_headerIndex.Clear();
 	}
 
 	int HttpProcessData(struct HttpParserRoundtripper *rt, const char *data, int size, int *read);
@@ -158,17 +291,48 @@ public:
 		_onProcessError = delegate;
 	}
 
+	void SetProcessRequestLine(ProcessRequestLineDelegate delegate)
+	{
+		_onProcessRequestLine = delegate;
+	}
+
+	/// @brief	Enables scanning whole runs of key, value and reason bytes a word at a time.
+	///			The result is the same as with the per character state machine.
+	void SetFastPath(bool enabled)
+	{
+		_fastPath = enabled;
+	}
+
+	/// @brief	Passes header values as views into the buffer given to HttpProcessData.
+	///			Only values split over two calls or folded lines are copied into the scratch,
+	///			which lifts the scratch size limit for everything else.
+	void SetZeroCopy(bool enabled)
+	{
+		_zeroCopy = enabled;
+	}
+
+	const HttpHeaderIndex &GetHeaderIndex() const
+	{
+		return _headerIndex;
+	}
+
 private:
 	char _scratch[ScratchSize];
+	bool _fastPath = true;
+	bool _zeroCopy = true;
+	HttpHeaderIndex _headerIndex;
 
 	HttpHeaderStatus httpParseHeaderChar(HttpRoundtripperState &state, char ch);
 
 	int httpParseChunked(HttpRoundtripperState &state, int &size, char ch);
 
+	int httpScanHeaderRun(struct HttpParserRoundtripper *rt, const char *data, int size);
+
 	AppendBodyDelegate _onAppendBody;
 	ProcessHeaderDelegate _onProcessHeader;
 	ProcessCodeDelegate _onProcessCode;
 	ProcessErrorDelegate _onProcessError;
+	ProcessRequestLineDelegate _onProcessRequestLine;
 
 	bool appendBody(HttpParserRoundtripper *rt, const char *data, int ndata)
 	{
@@ -200,8 +364,22 @@ private:
 			_onProcessError(opqaue, (uint32_t)errorno);
 	}
 
+	bool processRequestLine(void *opaque, const HttpRequestLine &line)
+	{
+		if (_onProcessRequestLine)
+			return _onProcessRequestLine(opaque, line);
+		else
+			return true;
+	}
+
+	bool parseRequestLine(struct HttpParserRoundtripper *rt);
+
 	bool growScratch(struct HttpParserRoundtripper *rt, int size);
 
+	bool appendValue(struct HttpParserRoundtripper *rt, const char *data, int size);
+
+	bool detachValue(struct HttpParserRoundtripper *rt);
+
 	inline int min(int a, int b)
 	{
 		return a > b ? b : a;
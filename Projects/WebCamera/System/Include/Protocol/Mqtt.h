@@ -0,0 +1,297 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include "BaseRouteHandler.h"
+#include "TimeLimit.h"
+#include "semaphore.hpp"
+
+namespace Protocol
+{
+
+using std::array;
+using std::atomic;
+using Hal::TimeLimit;
+
+enum class MqttPacketType : uint8_t
+{
+	Connect = 1,
+	Connack = 2,
+	Publish = 3,
+	Puback = 4,
+	Pubrec = 5,
+	Pubrel = 6,
+	Pubcomp = 7,
+	Subscribe = 8,
+	Suback = 9,
+	Unsubscribe = 10,
+	Unsuback = 11,
+	Pingreq = 12,
+	Pingresp = 13,
+	Disconnect = 14
+};
+
+/// @brief	Builds MQTT packets into a caller supplied buffer.
+/// @note	Nothing is written past the buffer, a packet that does not fit leaves Valid() false.
+class MqttWriter
+{
+public:
+	static constexpr uint32_t MaxRemainingLength = 268435455;
+
+	MqttWriter(uint8_t *buffer, uint16_t size) : _buffer(buffer), _size(size)
+	{
+	}
+
+	/// @brief	Packet type and flags followed by the variable length encoded remaining length.
+	void FixedHeader(MqttPacketType type, uint8_t flags, uint32_t remainingLength);
+
+	void Byte(uint8_t value);
+
+	void Word(uint16_t value);
+
+	/// @brief	Length prefixed UTF-8 string.
+	void String(const char *text, uint16_t length);
+
+	void Bytes(const uint8_t *data, uint16_t length);
+
+	bool Valid() const
+	{
+		return _valid;
+	}
+
+	uint16_t Length() const
+	{
+		return _length;
+	}
+
+private:
+	uint8_t *_buffer;
+	uint16_t _size;
+	uint16_t _length = 0;
+	bool _valid = true;
+};
+
+/// @brief	Reads the variable header and payload of a received packet in place.
+class MqttReader
+{
+public:
+	MqttReader(const uint8_t *data, uint32_t length) : _data(data), _length(length)
+	{
+	}
+
+	uint8_t Byte();
+
+	uint16_t Word();
+
+	/// @brief	Points text at the string inside the packet, it is not null terminated.
+	void String(const char *&text, uint16_t &length);
+
+	const uint8_t *Rest() const
+	{
+		return _data + _position;
+	}
+
+	uint32_t Remaining() const
+	{
+		return _length - _position;
+	}
+
+	bool Valid() const
+	{
+		return _valid;
+	}
+
+private:
+	bool take(uint32_t count);
+
+	const uint8_t *_data;
+	uint32_t _length;
+	uint32_t _position = 0;
+	bool _valid = true;
+};
+
+/// @brief	MQTT 3.1.1 client on top of a BaseConnection, publishing at QoS 0 and 1.
+/// @note	Sessions are always clean, a QoS 1 publish that is not acknowledged before the
+///			connection is lost is gone, so is its PacketId. Publish(), Subscribe() and Process()
+///			belong to one task. The CONNECT and acknowledgements for received messages are queued
+///			by the connection's callbacks and sent from Process() so two tasks never interleave
+///			bytes on the connection and the network stack never waits for its own acknowledgements.
+///			A failure seen by the receive path also leaves closing the connection to Process().
+class MqttPath : public BaseRouteHandler
+{
+public:
+	/// @brief	Topic is not null terminated, payload stays valid only during the call.
+	using DelegateMessageReceived = FastDelegate4<const char *, uint16_t, const uint8_t *, uint32_t>;
+
+	/// @brief	Called from the receive path with the PacketId a QoS 1 publish returned.
+	using DelegatePublished = FastDelegate1<uint16_t>;
+
+	static constexpr uint16_t MaxIncomingPacket = 1024;
+	static constexpr uint16_t MaxTopicLength = 128;
+	static constexpr uint8_t MaxInflight = 4;
+	static constexpr uint8_t MaxPendingAcks = 8;
+	static constexpr uint16_t DefaultKeepAlive = 60;
+	static constexpr uint32_t HandshakeTimeout = 5000;
+	static constexpr uint32_t AckTimeout = 10000;
+	static constexpr uint32_t SendTimeout = 2000;
+
+	MqttPath() = default;
+
+	/// @brief	An empty client id is replaced by a random one when connecting.
+	void SetClientId(const char *clientId)
+	{
+		_clientId = clientId;
+	}
+
+	/// @param password	Only sent together with a user name.
+	void SetCredentials(const char *userName, const char *password)
+	{
+		_userName = userName;
+		_password = password;
+	}
+
+	/// @param seconds	0 disables the keep-alive.
+	void SetKeepAlive(uint16_t seconds)
+	{
+		_keepAlive = seconds;
+	}
+
+	void SetMessageReceived(DelegateMessageReceived delegate)
+	{
+		_onMessageReceived = delegate;
+	}
+
+	void SetPublished(DelegatePublished delegate)
+	{
+		_onPublished = delegate;
+	}
+
+	/// @brief	Publishes a copy of the payload.
+	/// @return	PacketId for QoS 1, 0 for QoS 0 once sent, -1 on failure or if the bandwidth
+	///			budget dropped the message, nothing of it was sent then.
+	int32_t Publish(const char *topic, const uint8_t *data, uint32_t length, uint8_t qos = 0, bool retain = false);
+
+	/// @brief	Hands the payload to the connection as it is, so a JPEG frame buffer is never
+	///			copied. It has to stay unchanged until the connection has no send pending any more.
+	int32_t PublishReference(const char *topic, const uint8_t *data, uint32_t length, uint8_t qos = 0, bool retain = false);
+
+	/// @param qos	Highest QoS to receive at, 0 or 1.
+	/// @return	PacketId of the SUBSCRIBE, -1 on failure.
+	int32_t Subscribe(const char *topic, uint8_t qos = 0);
+
+	bool IsOpen() const
+	{
+		return _state == State::Open;
+	}
+
+	/// @brief	QoS 1 publishes still waiting for their PUBACK.
+	uint8_t GetInflightCount() const;
+
+private:
+	enum class State : uint8_t
+	{
+		Idle,
+		Connecting,
+		Handshake,
+		Open,
+		// failed, Process() closes the connection, the receive path must not
+		Failed,
+		Closed
+	};
+
+	enum class ReceiveState : uint8_t
+	{
+		Header,
+		Length,
+		Body
+	};
+
+	struct Inflight
+	{
+		atomic<uint16_t> PacketId;
+		uint32_t SentAt;
+	};
+
+	static constexpr uint16_t ScratchSize = 256;
+
+	void receivedData(const uint8_t *data, uint16_t length) override;
+
+	void connectionStateChanged(ConnectionState state, ConnectionChangeReason reason) override;
+
+	bool sendFrame(const uint8_t *data, uint16_t length) override;
+
+	void setConnection() override;
+
+	bool isTerminated() const override;
+
+	bool start(BaseRouteHandler::ConnectionMode connectionMode, RemoteConnection *address, uint8_t processingIndex, uint8_t processingLogicalId) override;
+
+	void terminate() override;
+
+	void process() override;
+
+	void onDataReceived(const char *data, uint16_t length);
+	void onSendReady();
+
+	void packetReceived();
+	void publishReceived(uint8_t flags, MqttReader &reader);
+	void acknowledged(uint16_t packetId);
+	void queueAck(uint16_t packetId);
+	void sendPendingAcks();
+
+	bool sendConnect();
+	int32_t publish(const char *topic, const uint8_t *data, uint32_t length, uint8_t qos, bool retain, bool reference);
+	bool sendControl(MqttPacketType type, uint8_t flags, const uint16_t *packetId);
+	bool sendRaw(const uint8_t *data, uint32_t length, bool reference = false);
+	uint16_t nextPacketId();
+	void fail(const char *reason);
+
+	State _state = State::Idle;
+	TimeLimit _timer;
+	TimeLimit _sendTimer;
+	bool _pingPending = false;
+	// set by the connection event, the CONNECT is written by Process()
+	atomic<bool> _connectPending = {false};
+	const char *_clientId = "";
+	const char *_userName = nullptr;
+	const char *_password = nullptr;
+	uint16_t _keepAlive = DefaultKeepAlive;
+	uint16_t _packetId = 0;
+	DelegateMessageReceived _onMessageReceived;
+	DelegatePublished _onPublished;
+
+	// packet being received
+	ReceiveState _receiveState = ReceiveState::Header;
+	uint8_t _packetHeader = 0;
+	uint32_t _remainingLength = 0;
+	uint8_t _lengthShift = 0;
+	uint32_t _received = 0;
+	array<uint8_t, MaxIncomingPacket> _packet = {};
+
+	array<Inflight, MaxInflight> _inflight = {};
+
+	// PUBACKs owed to the broker, written by the receive path and sent by Process()
+	array<uint16_t, MaxPendingAcks> _pendingAcks = {};
+	atomic<uint8_t> _ackHead = {0};
+	atomic<uint8_t> _ackTail = {0};
+
+	array<uint8_t, ScratchSize> _scratch = {};
+
+	// given by the connection once a refused send would fit
+	cpp_freertos::BinarySemaphore _sendReady;
+
+private:
+	/// @brief	Hide Copy constructor.
+	MqttPath(const MqttPath &) = delete;
+
+	/// @brief	Hide Assignment operator.
+	MqttPath &operator=(const MqttPath &) = delete;
+
+	/// @brief	Hide Move constructor.
+	MqttPath(MqttPath &&) = delete;
+
+	/// @brief	Hide Move assignment operator.
+	MqttPath &operator=(MqttPath &&) = delete;
+};
+} // namespace Protocol
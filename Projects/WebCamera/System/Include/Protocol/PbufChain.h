@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include "lwip/pbuf.h"
+
+namespace Protocol
+{
+
+/// @brief	Owns one reference to a received pbuf chain, so the payload can be read
+///			after the receive callback returned without copying it first.
+/// @note	Holding a chain does not keep the receive window closed, the connection's
+///			Consume() does. Free the chain once its data is no longer needed.
+class PbufChain
+{
+public:
+	PbufChain() = default;
+
+	/// @brief	Takes over the reference the caller holds on chain.
+	explicit PbufChain(pbuf *chain) : _chain(chain)
+	{
+	}
+
+	~PbufChain()
+	{
+		Release();
+	}
+
+	PbufChain(PbufChain &&other) : _chain(other._chain)
+	{
+		other._chain = nullptr;
+	}
+
+	PbufChain &operator=(PbufChain &&other)
+	{
+		if (this != &other)
+		{
+			Release();
+			_chain = other._chain;
+			other._chain = nullptr;
+		}
+		return *this;
+	}
+
+	/// @brief	A second view on the same chain, the buffers are freed with the last one.
+	PbufChain Share() const
+	{
+		if (_chain != nullptr)
+			pbuf_ref(_chain);
+		return PbufChain(_chain);
+	}
+
+	void Release()
+	{
+		if (_chain == nullptr)
+			return;
+
+		pbuf_free(_chain);
+		_chain = nullptr;
+	}
+
+	uint16_t Length() const
+	{
+		return _chain != nullptr ? _chain->tot_len : 0;
+	}
+
+	/// @brief	Copies up to length bytes starting at offset into destination.
+	/// @return	Number of bytes copied.
+	uint16_t Copy(void *destination, uint16_t length, uint16_t offset = 0) const
+	{
+		return _chain != nullptr ? pbuf_copy_partial(_chain, destination, length, offset) : 0;
+	}
+
+	/// @brief	Calls visitor(const uint8_t *data, uint16_t length) for every segment in order.
+	template <typename Visitor>
+	void ForEachSegment(Visitor visitor) const
+	{
+		for (const pbuf *segment = _chain; segment != nullptr; segment = segment->next)
+		{
+			if (segment->len != 0)
+				visitor(static_cast<const uint8_t *>(segment->payload), segment->len);
+		}
+	}
+
+private:
+	pbuf *_chain = nullptr;
+
+	/// @brief	Hide Copy constructor, use Share().
+	PbufChain(const PbufChain &) = delete;
+
+	/// @brief	Hide Assignment operator.
+	PbufChain &operator=(const PbufChain &) = delete;
+};
+
+} // namespace Protocol
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include "BaseConnection.h"
 #include "TimeLimit.h"
 #include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "freertos/task.h"
+#include "semaphore.hpp"
 #include "DnsClient.h"
 #include "Logger.h"
 
@@ -13,6 +18,7 @@ using Hal::Hardware;
 using Hal::TimeLimit;
 // using BaseConnection::ConnectStatus;
 using Utilities::Logger;
+using std::array;
 
 class TcpConnection : public BaseConnection
 {
@@ -30,10 +36,58 @@ public:
 	uint16_t GetPort();
 
 private:
+	static constexpr uint8_t MaxSendEntries = 16;
+	static constexpr uint16_t StagingSize = 2048;
+
+	/// @brief	Data handed to tcp_write() without TCP_WRITE_FLAG_COPY, released once acknowledged.
+	struct SendEntry
+	{
+		const uint8_t *Data;
+		uint16_t Length;
+		uint16_t Written;
+		uint16_t Acknowledged;
+		uint32_t StagingEnd; // staging position freed with this entry
+	};
+
 	uint16_t _port;
 	bool _isConnected;
 	tcp_pcb *_pcb;
 
+	// Connect() and Close() hand their raw API work to the tcpip task and wait for it
+	static std::atomic<TaskHandle_t> _tcpipTask;
+	void (TcpConnection::*_apiWork)() = nullptr;
+	cpp_freertos::BinarySemaphore _apiDone;
+	ip_addr_t _remoteAddress = {};
+	BaseConnection::ConnectStatus _connectStatus = BaseConnection::ConnectStatus::Failed;
+
+	// single producer (the sending task) and single consumer (the tcpip task), the
+	// counters run freely and each one is only advanced by one side
+	array<SendEntry, MaxSendEntries> _sendQueue = {};
+	std::atomic<uint32_t> _queueTail{0};  // producer, next free entry
+	std::atomic<uint32_t> _queueWrite{0}; // consumer, next entry for tcp_write()
+	std::atomic<uint32_t> _queueHead{0};  // consumer, oldest unacknowledged entry
+	// copies made by Send() live here until acknowledged, so lwIP never copies them again
+	array<uint8_t, StagingSize> _staging = {};
+	std::atomic<uint32_t> _stagingTail{0};
+	std::atomic<uint32_t> _stagingHead{0};
+	std::atomic<bool> _callbackScheduled{false};
+	std::atomic<bool> _sendBlocked{false};
+	// received bytes handed back through Consume(), not yet reported with tcp_recved()
+	std::atomic<uint32_t> _consumed{0};
+
+	bool enqueue(const uint8_t *data, uint16_t length, bool copy);
+	void scheduleCallback();
+	void flush();
+	bool acknowledge(uint16_t length);
+	void applyConsumed();
+	void dropQueue();
+	bool runOnTcpip(void (TcpConnection::*work)());
+	void connectPcb();
+	void closePcb();
+
+	static void tcpipCallback(void *arg);
+	static void apiCallback(void *arg);
+
 	static err_t receiveHandler(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err);
 	static void clearPcbHandler(TcpConnection *conn, tcp_pcb *pcb);
 	static err_t pollHandler(void *arg, struct tcp_pcb *pcb);
@@ -45,6 +99,12 @@ private:
 
 	bool DoSend(const unsigned char *data, uint16_t length) override;
 
+	bool DoSendReference(const unsigned char *data, uint16_t length) override;
+
+	bool HasPendingSend() override;
+
+	void DoConsume(uint16_t length) override;
+
 	void DoClose() override;
 
 	void DoReset() override;
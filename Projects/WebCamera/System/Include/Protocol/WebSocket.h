@@ -1,22 +1,129 @@
 #pragma once
 
+#include <cstdint>
+#include <array>
+#include <atomic>
 #include "BaseRouteHandler.h"
 #include "HttpParser.h"
 #include "CommonConnection.h"
+#include "TimeLimit.h"
+#include "semaphore.hpp"
 
 namespace Protocol
 {
 
+using std::array;
+using std::atomic;
+using Hal::TimeLimit;
+
+enum class WebsocketOpcode : uint8_t
+{
+	Continuation = 0x0,
+	Text = 0x1,
+	Binary = 0x2,
+	Close = 0x8,
+	Ping = 0x9,
+	Pong = 0xA
+};
+
+/// @brief	RFC 6455 endpoint on top of a BaseConnection.
+/// @note	Started with a remote address it connects out and performs the client handshake.
+///			Started without one it answers the upgrade request arriving on the connection
+///			it was given, which is how the dashboard pulls frames from the camera.
+///			The receive path never writes to the connection, handshakes, pongs and close
+///			frames it owes the peer are queued and sent by Process() like everything else.
 class WebsocketPath : public BaseRouteHandler
 {
 public:
+	/// @brief	Opcode is Text or Binary, fragmented messages are delivered once complete.
+	using DelegateMessageReceived = FastDelegate3<WebsocketOpcode, const uint8_t *, uint16_t>;
 
-private:
-    void receivedData(const uint8_t *data, uint16_t length) override;
+	static constexpr uint16_t MaxMessageLength = HayStackMaxSize;
+	static constexpr uint32_t HandshakeTimeout = 5000;
+	static constexpr uint32_t PingInterval = 20000;
+	static constexpr uint32_t SendTimeout = 2000;
+
+	WebsocketPath() = default;
+
+	/// @brief	Host header and resource of the client handshake.
+	void SetTarget(const char *host, const char *path);
+
+	void SetMessageReceived(DelegateMessageReceived delegate)
+	{
+		_onMessageReceived = delegate;
+	}
 
-    void connectionStateChanged(ConnectionState state, ConnectionChangeReason reason) override;
+	/// @brief	Sends one binary message, the payload is copied and can be reused right away.
+	/// @note	Also false if the bandwidth budget dropped the message, nothing of it was sent then.
+	bool SendBinary(const uint8_t *data, uint32_t length);
 
-    bool sendFrame(const uint8_t *data, uint16_t length) override;
+	/// @brief	As server the payload is handed to the connection behind the frame header
+	///			as it is, so a JPEG buffer is never copied. It has to stay unchanged until
+	///			the connection has no send pending any more. As client it has to be masked
+	///			and goes through the scratch buffer like SendBinary().
+	bool SendBinaryReference(const uint8_t *data, uint32_t length);
+
+	bool SendText(const char *text);
+
+	bool SendPing();
+
+	bool IsOpen() const
+	{
+		return _state == State::Open;
+	}
+
+	/// @brief	XORs data with the masking key 32 bits at a time.
+	/// @param	offset Position of data inside the frame payload, selects the key byte to start with.
+	static void ApplyMask(uint8_t *data, uint32_t length, uint32_t mask, uint32_t offset);
+
+	/// @brief	Sec-WebSocket-Accept value for a Sec-WebSocket-Key.
+	/// @param	accept Receives the null terminated value, at least 29 bytes.
+	static bool ComputeAccept(const char *key, uint8_t keyLength, char *accept, uint8_t acceptSize);
+
+private:
+	enum class State : uint8_t
+	{
+		Idle,
+		Connecting,
+		Handshake,
+		Accepting, // upgrade request accepted, the 101 response is not sent yet
+		Open,
+		Closing,   // our close frame is queued or sent, waiting for the peer's
+		Answering, // the peer is done, the connection closes once the reply queued for it is sent
+		Closed
+	};
+
+	enum class Role : uint8_t
+	{
+		Client,
+		Server
+	};
+
+	enum PendingReply : uint8_t
+	{
+		ReplyHandshake = 0x01,
+		ReplyReject = 0x02,
+		ReplyPong = 0x04,
+		ReplyClose = 0x08
+	};
+
+	enum CloseCode : uint16_t
+	{
+		CloseNone = 0, // the close frame carries no status code
+		CloseNormal = 1000,
+		CloseProtocolError = 1002,
+		CloseMessageTooBig = 1009
+	};
+
+	static constexpr uint8_t MaxControlPayload = 125;
+	static constexpr uint8_t MaxFrameHeader = 14;
+	static constexpr uint16_t ScratchSize = 512;
+
+	void receivedData(const uint8_t *data, uint16_t length) override;
+
+	void connectionStateChanged(ConnectionState state, ConnectionChangeReason reason) override;
+
+	bool sendFrame(const uint8_t *data, uint16_t length) override;
 
 	void setConnection() override;
 
@@ -28,11 +135,75 @@ private:
 
 	void process() override;
 
+	void onDataReceived(const char *data, uint16_t length);
+	void onSendReady();
+	bool onRequestLine(void *opaque, const HttpRequestLine &line);
+
+	uint16_t handshakeData(const uint8_t *data, uint16_t length);
+	bool sendClientHandshake();
+	bool acceptServerHandshake();
+	bool sendServerHandshake();
+	bool verifyServerHandshake();
+
+	void frameData(const uint8_t *data, uint16_t length);
+	bool decodeHeader();
+	void finishFrame();
+	void finishControl();
+
+	bool send(WebsocketOpcode opcode, const uint8_t *data, uint32_t length, bool reference = false);
+	bool sendRaw(const uint8_t *data, uint32_t length, bool reference = false);
+	void close(uint16_t code);
+	void queueClose(uint16_t code, State next);
+	void queueReply(PendingReply reply);
+	void sendPendingReplies();
+	void fail(const char *reason);
+	void fail(const char *reason, uint16_t code);
+
+	State _state = State::Idle;
+	Role _role = Role::Server;
+	TimeLimit _timer;
+	TimeLimit _pingTimer;
+	bool _pongPending = false;
+	DelegateMessageReceived _onMessageReceived;
+
+	// handshake
+	HttpParser _parser;
+	HttpParser::HttpParserRoundtripper _roundtripper = {};
+	HttpMethod _requestMethod = HttpMethod::Unknown;
+	const char *_host = "";
+	const char *_path = "/";
+	array<char, 29> _accept = {};
+
+	// frame being received
+	array<uint8_t, MaxFrameHeader> _header = {};
+	uint8_t _headerLength = 0;
+	bool _inPayload = false;
+	bool _final = false;
+	WebsocketOpcode _opcode = WebsocketOpcode::Continuation;
+	bool _masked = false;
+	uint32_t _mask = 0;
+	uint64_t _payloadLength = 0;
+	uint64_t _payloadReceived = 0;
+	array<uint8_t, MaxControlPayload> _control = {};
+
+	// replies owed to the peer, written by the receive path and sent by Process()
+	atomic<uint8_t> _pendingReplies = {0};
+	array<uint8_t, MaxControlPayload> _pongPayload = {};
+	uint8_t _pongLength = 0;
+	uint16_t _closeCode = CloseNone;
+
+	// given by the connection once a refused send would fit
+	cpp_freertos::BinarySemaphore _sendReady;
+
+	// message being assembled from one or more data frames
 	static constexpr uint16_t MaxHayStackLength = HayStackMaxSize;
-	
-	std::array<char, MaxHayStackLength> _hayStack = { };
-	
+	array<char, MaxHayStackLength> _hayStack = {};
 	uint16_t _hayStackWorkingLength = 0;
+	WebsocketOpcode _messageOpcode = WebsocketOpcode::Continuation;
+	bool _messageActive = false;
+	bool _messageTooBig = false;
+
+	array<uint8_t, ScratchSize> _scratch = {};
 
 private:
     /// @brief	Hide Copy constructor.
@@ -47,4 +218,4 @@ private:
     /// @brief	Hide Move assignment operator.
     WebsocketPath &operator=(WebsocketPath &&) = delete;
 };
-} // namespace Protocol
\ No newline at end of file
+} // namespace Protocol
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include "Hardware.h"
+#include "mutex.hpp"
+
+using cpp_freertos::LockGuard;
+using cpp_freertos::MutexStandard;
+
+namespace Utilities
+{
+
+/// @brief	Token bucket deciding for whole messages whether they may be sent now.
+/// @note	A message is admitted while the bucket is not in debt and its full length is taken
+///			from it, so a frame larger than the burst still goes out and the ones behind it wait
+///			until the rate has paid it back. A refused message is counted as dropped, the caller
+///			skips it completely, nothing of it is written. Every admission also has to pass the
+///			device wide bucket, which counts the traffic of all connections together.
+class TokenBucket
+{
+public:
+	struct Statistics
+	{
+		uint32_t Rate;    // bytes/s admitted over the last RateWindow
+		uint32_t Passed;  // messages admitted
+		uint32_t Dropped; // messages refused
+		uint32_t Bytes;   // bytes admitted
+	};
+
+	/// Period the reported rate is measured over, in ms.
+	static constexpr uint32_t RateWindow = 1000;
+
+	TokenBucket() = default;
+
+	/// @param bytesPerSecond	0 lets everything through, the traffic is still counted.
+	/// @param burst	Bytes that may leave back to back after an idle period, 0 for one second of the rate.
+	void Configure(uint32_t bytesPerSecond, uint32_t burst);
+
+	/// @brief	Takes length bytes from this bucket and the device wide one if both allow it.
+	/// @return	False if the message has to be dropped.
+	bool Admit(uint32_t length);
+
+	Statistics GetStatistics();
+
+	/// @brief	Budget shared by every connection of the device.
+	static TokenBucket &Device();
+
+private:
+	static constexpr int64_t Scale = 1000; // tokens are kept in 1/1000 byte, one ms of rate is exact
+
+	bool available(uint32_t now);
+	bool settle(uint32_t now, uint32_t length, bool admitted);
+	void roll(uint32_t now);
+
+	MutexStandard _lock;
+	uint32_t _bytesPerSecond = 0;
+	int64_t _burst = 0;
+	int64_t _tokens = 0;
+	uint32_t _lastRefill = 0;
+	uint32_t _windowStart = 0;
+	uint32_t _windowBytes = 0;
+	Statistics _statistics = {};
+
+private:
+	/// @brief	Hide Copy constructor.
+	TokenBucket(const TokenBucket &) = delete;
+
+	/// @brief	Hide Assignment operator.
+	TokenBucket &operator=(const TokenBucket &) = delete;
+
+	/// @brief	Hide Move constructor.
+	TokenBucket(TokenBucket &&) = delete;
+
+	/// @brief	Hide Move assignment operator.
+	TokenBucket &operator=(TokenBucket &&) = delete;
+};
+
+} // namespace Utilities
@@ -1,8 +1,15 @@
 #include "ApplicationAgent.h"
+#include "ConfigurationAgent.h"
+#include "TokenBucket.h"
+#include "BaseRouteHandler.h"
 
 namespace Applications
 {
 
+using Configuration::ConfigurationAgent;
+using Protocol::BaseRouteHandler;
+using Utilities::TokenBucket;
+
 ApplicationAgent *ApplicationAgent::_applications;
 
 ApplicationAgent::ApplicationAgent()
@@ -23,6 +30,18 @@ void ApplicationAgent::Initialize()
     _httpServer = new HttpServer(80);
     _gatewayService = new GatewayService();
     _firmwareUpdateService = new FirmwareUpdateService();
+    BandwidthUpdated();
+}
+
+void ApplicationAgent::BandwidthUpdated()
+{
+    auto &bandwidth = ConfigurationAgent::Instance()->GetBoardConfiguration()->GetConfiguration()->BandwidthConfig;
+    TokenBucket::Device().Configure(bandwidth.DeviceRate(), bandwidth.Burst());
+    BaseRouteHandler::SetDefaultBandwidth(bandwidth.ConnectionRate(), bandwidth.Burst());
+
+    // a configuration loaded before Initialize() reaches the server once it is created
+    if (_httpServer != nullptr)
+        _httpServer->SetBandwidth(bandwidth.ConnectionRate(), bandwidth.Burst());
 }
 
 } // namespace Applications
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "GatewayService.h"
 #include "ConfigurationAgent.h"
 
@@ -5,53 +6,187 @@ namespace Applications
 {
 
 using Configuration::ConfigurationAgent;
+using Hal::Hardware;
 // using Applications::GatewayService;
 
 GatewayService::GatewayService() : cpp_freertos::Thread("GWSVC", configGATEWAYSVC_STACK_DEPTH, 3),
-    _connectionPath(), _connectionState(ConnectionState::None)
+    _connectionPath(), _connectionState(ConnectionState::None), _events(MaxEvents, sizeof(ConnectionEvent))
 {
     _connectionPath.Protocol = ProtocolType::Websocket;
     _connectionPath.TransportLayer = TransportLayerType::Wifi;
     _connectionPath.Connection = new TcpConnection();
+    _connectionPath.Connection->SetConnectionStateChanged(fastdelegate::MakeDelegate(this, &GatewayService::connectionStateChanged));
     _connectionPath.RouteHandler = nullptr;
 }
 
+GatewayService::Statistics GatewayService::GetStatistics() const
+{
+    Statistics statistics = _statistics;
+    uint32_t now = Hardware::Instance()->Milliseconds();
+
+    statistics.Uptime = _connectionState == ConnectionState::Done ? now - _connectedSince : 0;
+    statistics.NextRetry = 0;
+    if (_connectionState == ConnectionState::RestartConnection && static_cast<int32_t>(_deadline - now) > 0)
+        statistics.NextRetry = _deadline - now;
+
+    return statistics;
+}
+
 void GatewayService::Run()
 {
-    vTaskDelay(6000);
+    vTaskDelay(pdMS_TO_TICKS(StartupDelay));
 
-    RemoteConnection *connection = &ConfigurationAgent::Instance()->GetBoardConfiguration()->GetConfiguration()->ServerConfig.connection;
+    _remote = &ConfigurationAgent::Instance()->GetBoardConfiguration()->GetConfiguration()->ServerConfig.connection;
 
     for (;;)
     {
         switch (_connectionState)
         {
         case ConnectionState::None:
-            changeState(ConnectionState::RestartConnection);
-            break;
-
-        case ConnectionState::RestartConnection:
-            _connectionPath.Connection->Close();
             changeState(ConnectionState::TryToConnect);
             break;
 
         case ConnectionState::TryToConnect:
-            _connectionPath.Connection->Connect(*connection);
-            changeState(ConnectionState::EstablishConnection);
+            connect();
             break;
 
+        case ConnectionState::RestartConnection:
         case ConnectionState::EstablishConnection:
-            changeState(ConnectionState::Done);
-            break;
-
         case ConnectionState::Done:
+        {
+            // sleeps until the connection reports a change or the pending deadline passes
+            ConnectionEvent event;
+            if (_events.Dequeue(&event, ticksUntilDeadline()))
+                connectionEvent(event);
+            else
+                deadlineReached();
             break;
+        }
 
         default:
             break;
         }
-        vTaskDelay(100);
     }
 }
 
+void GatewayService::connectionStateChanged(Protocol::ConnectionState state, ConnectionChangeReason reason)
+{
+    // runs on the lwIP thread, which must not block on a full queue
+    ConnectionEvent event = {state, reason};
+    if (_events.Enqueue(&event, 0) == false)
+        Logger::LogError(Logger::LogSource::Gateway, "Connection event dropped, state %u", static_cast<uint8_t>(state));
+}
+
+void GatewayService::connect()
+{
+    _statistics.Attempts++;
+    _attemptStarted = Hardware::Instance()->Milliseconds();
+
+    Logger::LogInfo(Logger::LogSource::Gateway, "Connecting to %s:%u, attempt %u", _remote->Address.data(), _remote->Port, _statistics.Attempts);
+
+    if (_connectionPath.Connection->Connect(*_remote) == BaseConnection::ConnectStatus::Failed)
+    {
+        Logger::LogError(Logger::LogSource::Gateway, "Connect failed");
+        scheduleRetry();
+        return;
+    }
+
+    _deadline = _attemptStarted + ConnectTimeout;
+    changeState(ConnectionState::EstablishConnection);
+}
+
+void GatewayService::connectionEvent(const ConnectionEvent &event)
+{
+    uint32_t now = Hardware::Instance()->Milliseconds();
+
+    switch (_connectionState)
+    {
+    case ConnectionState::EstablishConnection:
+        if (event.State == Protocol::ConnectionState::Connected)
+        {
+            _statistics.Connects++;
+            _statistics.LastConnectTime = now - _attemptStarted;
+            _connectedSince = now;
+            changeState(ConnectionState::Done);
+
+            Logger::LogInfo(Logger::LogSource::Gateway, "Connected in %u ms, attempt %u", _statistics.LastConnectTime, _statistics.Attempts);
+        }
+        else if (event.State == Protocol::ConnectionState::Disconnected)
+        {
+            Logger::LogError(Logger::LogSource::Gateway, "Connect refused, reason %u", static_cast<uint8_t>(event.Reason));
+            scheduleRetry();
+        }
+        break;
+
+    case ConnectionState::Done:
+        if (event.State == Protocol::ConnectionState::Disconnected)
+        {
+            uint32_t uptime = now - _connectedSince;
+            _statistics.Disconnects++;
+            if (uptime >= StableUptime)
+                _failures = 0;
+
+            Logger::LogError(Logger::LogSource::Gateway, "Link lost after %u s, reason %u", uptime / 1000, static_cast<uint8_t>(event.Reason));
+            scheduleRetry();
+        }
+        break;
+
+    default:
+        // left over from an attempt that was already given up
+        break;
+    }
+}
+
+void GatewayService::deadlineReached()
+{
+    switch (_connectionState)
+    {
+    case ConnectionState::EstablishConnection:
+        Logger::LogError(Logger::LogSource::Gateway, "Connect timed out");
+        scheduleRetry();
+        break;
+
+    case ConnectionState::RestartConnection:
+        changeState(ConnectionState::TryToConnect);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void GatewayService::scheduleRetry()
+{
+    _connectionPath.Connection->Close();
+
+    uint32_t delay = nextBackoff();
+    _deadline = Hardware::Instance()->Milliseconds() + delay;
+    changeState(ConnectionState::RestartConnection);
+
+    Logger::LogInfo(Logger::LogSource::Gateway, "Reconnecting in %u ms", delay);
+}
+
+TickType_t GatewayService::ticksUntilDeadline() const
+{
+    if (_connectionState == ConnectionState::Done)
+        return portMAX_DELAY;
+
+    int32_t remaining = static_cast<int32_t>(_deadline - Hardware::Instance()->Milliseconds());
+    return remaining > 0 ? pdMS_TO_TICKS(remaining) : 0;
+}
+
+uint32_t GatewayService::nextBackoff()
+{
+    uint32_t ceiling = BackoffBase;
+    for (uint8_t i = 0; i < _failures && ceiling < BackoffMax; i++)
+        ceiling *= 2;
+    ceiling = std::min(ceiling, BackoffMax);
+    if (_failures < UINT8_MAX)
+        _failures++;
+
+    // equal jitter, never less than half the ceiling so a dead server is not hammered
+    uint32_t half = ceiling / 2;
+    return half + Hardware::Instance()->GetRng().GetNumber() % (half + 1);
+}
+
 } // namespace Applications
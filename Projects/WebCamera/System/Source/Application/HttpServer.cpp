@@ -1,85 +1,480 @@
 #include "HttpServer.h"
+#include <strings.h>
 
 namespace Applications
 {
 
+using Protocol::HttpHeaderId;
+using Protocol::HttpParserMode;
+using Protocol::HttpRequestLine;
+
 HttpServer::~HttpServer()
 {
+	for (Connection &connection : _connections)
+		closeConnection(connection);
+
+	if (_listenSocket >= 0)
+		close(_listenSocket);
+}
+
+bool HttpServer::AddRoute(const char *path, RouteDelegate handler)
+{
+	if (_routeCount >= MaxRoutes || path == nullptr)
+		return false;
+
+	_routes[_routeCount].Path = path;
+	_routes[_routeCount].Handler = handler;
+	_routeCount++;
+	return true;
+}
+
+void HttpServer::SetBandwidth(uint32_t bytesPerSecond, uint32_t burst)
+{
+	_bandwidthRate = bytesPerSecond;
+	_bandwidthBurst = burst;
+	for (Connection &connection : _connections)
+		connection.Bandwidth.Configure(bytesPerSecond, burst);
+}
+
+TokenBucket::Statistics HttpServer::GetBandwidthStatistics()
+{
+	TokenBucket::Statistics total = {};
+	for (Connection &connection : _connections)
+	{
+		TokenBucket::Statistics statistics = connection.Bandwidth.GetStatistics();
+		total.Rate += statistics.Rate;
+		total.Passed += statistics.Passed;
+		total.Dropped += statistics.Dropped;
+		total.Bytes += statistics.Bytes;
+	}
+	return total;
+}
+
+bool HttpServer::openListenSocket()
+{
+	struct sockaddr_in address = {};
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_family = AF_INET;
+	address.sin_port = htons(_port);
+
+	_listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+	if (_listenSocket < 0)
+	{
+		Logger::LogError(Logger::LogSource::HttpServer, "Failed to create socket: errno %d", errno);
+		return false;
+	}
+
+	int reuse = 1;
+	setsockopt(_listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	if (bind(_listenSocket, (struct sockaddr *)&address, sizeof(address)) != 0)
+	{
+		Logger::LogError(Logger::LogSource::HttpServer, "Socket unable to bind: errno %d", errno);
+		close(_listenSocket);
+		_listenSocket = -1;
+		return false;
+	}
+
+	if (listen(_listenSocket, MaxConnections) != 0)
+	{
+		Logger::LogError(Logger::LogSource::HttpServer, "Error occurred during listen: errno %d", errno);
+		close(_listenSocket);
+		_listenSocket = -1;
+		return false;
+	}
+
+	Logger::LogInfo(Logger::LogSource::HttpServer, "Listening on port %d", _port);
+	return true;
 }
 
 void HttpServer::Run()
 {
+	for (Connection &connection : _connections)
+	{
+		connection.Parser.SetProcessRequestLine(fastdelegate::MakeDelegate(this, &HttpServer::onRequestLine));
+		connection.Parser.SetAppendBody(fastdelegate::MakeDelegate(this, &HttpServer::onAppendBody));
+	}
+
+	while (openListenSocket() == false)
+		vTaskDelay(1000 / portTICK_PERIOD_MS);
 
 	for (;;)
 	{
-		int sock, rc;
+		fd_set readSet;
+		fd_set writeSet;
+		FD_ZERO(&readSet);
+		FD_ZERO(&writeSet);
+		FD_SET(_listenSocket, &readSet);
+		int maxSocket = _listenSocket;
 
-		char addr_str[128];
-		Logger::LogError(Logger::LogSource::HttpServer, "Creating Socket");
-		int addr_family;
-		int ip_protocol;
-		struct sockaddr_in dest_addr;
+		for (Connection &connection : _connections)
+		{
+			if (connection.Socket < 0)
+				continue;
 
-		dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-		dest_addr.sin_family = AF_INET;
-		dest_addr.sin_port = htons(_port);
-		addr_family = AF_INET;
-		ip_protocol = IPPROTO_IP;
+			// a connection with a pending response is not read from until it is out
+			FD_SET(connection.Socket, connection.PendingLength > 0 ? &writeSet : &readSet);
+			if (connection.Socket > maxSocket)
+				maxSocket = connection.Socket;
+		}
 
-		inet_ntoa_r(dest_addr.sin_addr, addr_str, sizeof(addr_str) - 1);
+		// wake up regularly even without traffic, the timeouts are checked here
+		struct timeval timeout = {0, 100 * 1000};
+		int ready = select(maxSocket + 1, &readSet, &writeSet, nullptr, &timeout);
+		if (ready < 0)
+		{
+			Logger::LogError(Logger::LogSource::HttpServer, "select failed: errno %d", errno);
+			vTaskDelay(100 / portTICK_PERIOD_MS);
+			continue;
+		}
 
-		int listen_sock = socket(addr_family, SOCK_STREAM, ip_protocol);
-		if (listen_sock < 0)
+		if (ready > 0)
 		{
-			Logger::LogError(Logger::LogSource::HttpServer, "Failed to create socket");
-			return;
+			if (FD_ISSET(_listenSocket, &readSet))
+				acceptConnection();
+
+			for (Connection &connection : _connections)
+			{
+				if (connection.Socket < 0)
+					continue;
+
+				if (FD_ISSET(connection.Socket, &writeSet))
+				{
+					// the requests that arrived behind the response are served once it is out
+					if (sendPending(connection) && connection.PendingLength == 0)
+						parse(connection);
+				}
+				else if (FD_ISSET(connection.Socket, &readSet))
+				{
+					receive(connection);
+				}
+			}
 		}
 
-		int err = bind(listen_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-		if (err != 0)
+		checkTimeouts();
+	}
+}
+
+void HttpServer::acceptConnection()
+{
+	struct sockaddr_in6 sourceAddress; // Large enough for both IPv4 or IPv6
+	socklen_t addressLength = sizeof(sourceAddress);
+	int socket = accept(_listenSocket, (struct sockaddr *)&sourceAddress, &addressLength);
+	if (socket < 0)
+	{
+		Logger::LogError(Logger::LogSource::HttpServer, "Unable to accept connection: errno %d", errno);
+		return;
+	}
+
+	int noDelay = 1;
+	setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+	for (Connection &connection : _connections)
+	{
+		if (connection.Socket >= 0)
+			continue;
+
+		connection.Socket = socket;
+		connection.Activity.Reset();
+		// a new client starts with a full burst, not with the debt of the previous one
+		connection.Bandwidth.Configure(_bandwidthRate, _bandwidthBurst);
+		resetRequest(connection);
+		return;
+	}
+
+	// the send buffer of a new socket is empty, the short reply always fits
+	static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	send(socket, busy, sizeof(busy) - 1, MSG_DONTWAIT);
+	close(socket);
+	Logger::LogError(Logger::LogSource::HttpServer, "No free connection slot");
+}
+
+void HttpServer::receive(Connection &connection)
+{
+	int length = recv(connection.Socket, connection.RxBuffer.data(), _rxBufferSize, 0);
+	if (length <= 0)
+	{
+		closeConnection(connection);
+		return;
+	}
+	connection.Activity.Reset();
+	connection.RxOffset = 0;
+	connection.RxLength = length;
+	parse(connection);
+}
+
+void HttpServer::parse(Connection &connection)
+{
+	// responses go out in request order, while one is pending the rest stays in RxBuffer
+	while (connection.RxLength > 0 && connection.PendingLength == 0)
+	{
+		if (connection.RequestStarted == false)
 		{
-			Logger::LogError(Logger::LogSource::HttpServer, "Socket unable to bind: errno %d", errno);
-			break;
+			connection.RequestStarted = true;
+			connection.RequestTimer.Reset();
 		}
-		Logger::LogInfo(Logger::LogSource::HttpServer, "Socket bound, port %d", _port);
 
-		err = listen(listen_sock, 1);
-		if (err != 0)
+		const char *data = reinterpret_cast<const char *>(connection.RxBuffer.data()) + connection.RxOffset;
+		int read = 0;
+		int more = connection.Parser.HttpProcessData(&connection.Roundtripper, data, connection.RxLength, &read);
+		if (connection.Roundtripper.state != HttpParser::HttpRoundtripperState::http_roundtripper_close)
 		{
-			Logger::LogError(Logger::LogSource::HttpServer, "Error occurred during listen: errno %d", errno);
+			// everything was taken, the request goes on with the next receive
+			connection.RxLength = 0;
+			if (more == 0)
+				sendError(connection, connection.Error != 0 ? connection.Error : 400);
 			return;
 		}
-		Logger::LogInfo(Logger::LogSource::HttpServer, "Socket listening");
 
-		struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
-		uint addr_len = sizeof(source_addr);
-		sock = accept(listen_sock, (struct sockaddr *)&source_addr, &addr_len);
-		if (sock < 0)
-		{
-			Logger::LogError(Logger::LogSource::HttpServer, "Unable to accept connection: errno %d", errno);
+		// pipelined requests continue right behind the finished one
+		connection.RxOffset += read;
+		connection.RxLength -= read;
+		if (processRequest(connection) == false)
 			return;
+		resetRequest(connection);
+	}
+}
+
+bool HttpServer::processRequest(Connection &connection)
+{
+	const HttpHeaderIndex &headers = connection.Parser.GetHeaderIndex();
+
+	bool keepAlive = connection.VersionMinor >= 1;
+	const char *connectionHeader = headers.Get(HttpHeaderId::Connection);
+	if (connectionHeader != nullptr)
+	{
+		if (strncasecmp(connectionHeader, "close", 5) == 0)
+			keepAlive = false;
+		else if (strncasecmp(connectionHeader, "keep-alive", 10) == 0)
+			keepAlive = true;
+	}
+
+	if (connection.Error != 0)
+	{
+		sendError(connection, connection.Error);
+		return false;
+	}
+
+	HttpRequestInfo request = {connection.Method, connection.Path.data(), connection.Query.data(), &headers, keepAlive,
+							   connection.BodyLength > 0 ? connection.Body.data() : nullptr, connection.BodyLength};
+	HttpResponseInfo response = {
+		404,
+		"text/plain",
+		reinterpret_cast<char *>(connection.TxBuffer.data()) + _txHeaderSize,
+		_txBufferSize - _txHeaderSize,
+		0};
+
+	for (uint8_t i = 0; i < _routeCount; i++)
+	{
+		if (strcmp(_routes[i].Path, connection.Path.data()) == 0)
+		{
+			response.Status = 200;
+			_routes[i].Handler(request, response);
+			break;
 		}
-		Logger::LogInfo(Logger::LogSource::HttpServer, "Socket accepted");
+	}
+
+	if (response.BodyLength > response.BodySize)
+		response.BodyLength = response.BodySize;
 
-		do
+	return sendResponse(connection, response, keepAlive, connection.Method != HttpMethod::Head);
+}
+
+bool HttpServer::sendResponse(Connection &connection, HttpResponseInfo &response, bool keepAlive, bool withBody)
+{
+	char header[_txHeaderSize];
+	int headerLength = snprintf(header, sizeof(header),
+								"HTTP/1.1 %u %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: %s\r\n\r\n",
+								response.Status, statusText(response.Status), response.ContentType, response.BodyLength,
+								keepAlive ? "keep-alive" : "close");
+	if (headerLength <= 0 || headerLength >= static_cast<int>(sizeof(header)))
+	{
+		closeConnection(connection);
+		return false;
+	}
+
+	if (!connection.Bandwidth.Admit(headerLength + (withBody ? response.BodyLength : 0)))
+	{
+		// dropped as a whole, the client is told when to come back instead of getting a part
+		headerLength = snprintf(header, sizeof(header),
+								"HTTP/1.1 503 %s\r\nRetry-After: %u\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n",
+								statusText(503), RetryAfter, keepAlive ? "keep-alive" : "close");
+		memcpy(connection.TxBuffer.data(), header, headerLength);
+		return queueResponse(connection, connection.TxBuffer.data(), headerLength, !keepAlive);
+	}
+
+	// the body was written behind the reserved room, put the header right in front of it
+	uint8_t *start = reinterpret_cast<uint8_t *>(response.Body) - headerLength;
+	memcpy(start, header, headerLength);
+	return queueResponse(connection, start, headerLength + (withBody ? response.BodyLength : 0), !keepAlive);
+}
+
+bool HttpServer::queueResponse(Connection &connection, const uint8_t *data, uint16_t length, bool close)
+{
+	connection.Pending = data;
+	connection.PendingLength = length;
+	connection.CloseAfterSend = close;
+	connection.Activity.Reset();
+	return sendPending(connection);
+}
+
+bool HttpServer::sendPending(Connection &connection)
+{
+	while (connection.PendingLength > 0)
+	{
+		int sent = send(connection.Socket, connection.Pending, connection.PendingLength, MSG_DONTWAIT);
+		if (sent < 0)
 		{
-			int len = recv(sock, _rxBuffer.data(), _rxBufferSize, 0);
-			// Error occurred during receiving
-			if (len < 0)
-			{
-				Logger::LogError(Logger::LogSource::HttpServer, "recv failed: errno %d", errno);
-				break;
-			}
-			// Connection closed
-			else if (len == 0)
-			{
-				Logger::LogError(Logger::LogSource::HttpServer, "Connection closed");
-				break;
-			}
-			fwrite(_rxBuffer.data(), 1, len, stdout);
-		} while (true);
-		close(sock);
+			if (errno == EINTR)
+				continue;
+			// the socket buffer is full, select() tells when the rest can go
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+
+			closeConnection(connection);
+			return false;
+		}
+		connection.Pending += sent;
+		connection.PendingLength -= sent;
+		connection.Activity.Reset();
+	}
+
+	if (connection.CloseAfterSend)
+	{
+		closeConnection(connection);
+		return false;
+	}
+	return true;
+}
+
+bool HttpServer::sendError(Connection &connection, uint16_t status)
+{
+	HttpResponseInfo response = {
+		status,
+		"text/plain",
+		reinterpret_cast<char *>(connection.TxBuffer.data()) + _txHeaderSize,
+		_txBufferSize - _txHeaderSize,
+		0};
+	response.BodyLength = snprintf(response.Body, response.BodySize, "%u %s\n", status, statusText(status));
+	return sendResponse(connection, response, false, true);
+}
+
+void HttpServer::resetRequest(Connection &connection)
+{
+	connection.Parser.HttpInit(&connection.Roundtripper, &connection, HttpParserMode::Request);
+	connection.RequestStarted = false;
+	connection.Error = 0;
+	connection.Method = HttpMethod::Unknown;
+	connection.VersionMinor = 0;
+	connection.Path[0] = '\0';
+	connection.Query[0] = '\0';
+	connection.BodyLength = 0;
+}
+
+void HttpServer::closeConnection(Connection &connection)
+{
+	if (connection.Socket < 0)
+		return;
+
+	close(connection.Socket);
+	connection.Socket = -1;
+	connection.RxLength = 0;
+	connection.PendingLength = 0;
+	connection.CloseAfterSend = false;
+}
+
+void HttpServer::checkTimeouts()
+{
+	for (Connection &connection : _connections)
+	{
+		if (connection.Socket < 0)
+			continue;
+
+		if (connection.PendingLength > 0)
+		{
+			// a client that stopped reading is given up, its slot is needed
+			if (connection.Activity.IsTimeUp(RequestTimeout))
+				closeConnection(connection);
+		}
+		else if (connection.RequestStarted)
+		{
+			if (connection.RequestTimer.IsTimeUp(RequestTimeout))
+				sendError(connection, 408);
+		}
+		else if (connection.Activity.IsTimeUp(IdleTimeout))
+		{
+			closeConnection(connection);
+		}
+	}
+}
+
+bool HttpServer::onRequestLine(void *opaque, const HttpRequestLine &line)
+{
+	Connection &connection = *static_cast<Connection *>(opaque);
+	connection.Method = line.Method;
+	connection.VersionMinor = line.VersionMinor;
+
+	// the parser views die with the receive buffer, keep copies for the handler
+	if (line.PathLength > _pathSize || line.QueryLength > _querySize)
+	{
+		connection.Error = 414;
+		return true;
+	}
+	if (line.Method == HttpMethod::Unknown)
+		connection.Error = 501;
+
+	memcpy(connection.Path.data(), line.Path, line.PathLength);
+	connection.Path[line.PathLength] = '\0';
+	memcpy(connection.Query.data(), line.Query, line.QueryLength);
+	connection.Query[line.QueryLength] = '\0';
+	return true;
+}
+
+bool HttpServer::onAppendBody(HttpParser::HttpParserRoundtripper *roundtripper, const char *data, uint16_t length)
+{
+	Connection &connection = *static_cast<Connection *>(roundtripper->opaque);
+
+	// Content-Length is known up front, a chunked body is refused once it outgrows the buffer
+	int remaining = roundtripper->chunked ? 0 : roundtripper->contentlength - length;
+	if (connection.BodyLength + length + (remaining > 0 ? remaining : 0) > MaxBodySize)
+	{
+		connection.Error = 413;
+		return false;
+	}
+
+	memcpy(connection.Body.data() + connection.BodyLength, data, length);
+	connection.BodyLength += length;
+	return true;
+}
+
+const char *HttpServer::statusText(uint16_t status)
+{
+	switch (status)
+	{
+	case 200:
+		return "OK";
+	case 204:
+		return "No Content";
+	case 304:
+		return "Not Modified";
+	case 400:
+		return "Bad Request";
+	case 404:
+		return "Not Found";
+	case 408:
+		return "Request Timeout";
+	case 413:
+		return "Payload Too Large";
+	case 414:
+		return "URI Too Long";
+	case 500:
+		return "Internal Server Error";
+	case 501:
+		return "Not Implemented";
+	case 503:
+		return "Service Unavailable";
 	}
+	return "Unknown";
 }
 
-} // namespace Applications
\ No newline at end of file
+} // namespace Applications
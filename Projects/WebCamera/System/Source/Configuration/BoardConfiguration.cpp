@@ -2,7 +2,9 @@
 #include "ArduinoJson.h"
 #include "CommonTypes.h"
 #include "IPParser.h"
+#include "ApplicationAgent.h"
 
+using Applications::ApplicationAgent;
 using Common::IpAddress;
 using Protocol::IPParser;
 
@@ -13,6 +15,9 @@ void BoardConfiguration::DefaultConfiguration()
 {
     _configuration.GeneralConfig.Settings.Flags.WifiEnabled = true;
     _configuration.WifiConfig.Settings.Flags.DhcpEnabled = true;
+    _configuration.BandwidthConfig.DeviceKbps = 0;
+    _configuration.BandwidthConfig.ConnectionKbps = 0;
+    _configuration.BandwidthConfig.BurstKb = BoardConfigurationData::BandwidthConfiguration::DefaultBurstKb;
 
 #ifdef TEST_CLIENT
     /*Client Configuration*/
@@ -38,6 +43,7 @@ bool BoardConfiguration::Deserialize(const char *json)
     DeserializationError error = deserializeJson(doc, json);
     auto &generalChanges = _configuration.GeneralConfig.Changes.Flags;
     auto &generalFlags = _configuration.GeneralConfig.Settings.Flags;
+    auto &bandwidth = _configuration.BandwidthConfig;
     bool temp = false;
 
     if (doc["wifi"].isNull() == false)
@@ -49,6 +55,18 @@ bool BoardConfiguration::Deserialize(const char *json)
             generalFlags.WifiEnabled = temp;
         }
     }
+
+    if (doc["bandwidth"].isNull() == false)
+    {
+        if (doc["bandwidth"]["device_kbps"].isNull() == false)
+            bandwidth.Changes.Flags.DeviceKbps = UpdateConfig(bandwidth.DeviceKbps, doc["bandwidth"]["device_kbps"].as<uint32_t>());
+        if (doc["bandwidth"]["connection_kbps"].isNull() == false)
+            bandwidth.Changes.Flags.ConnectionKbps = UpdateConfig(bandwidth.ConnectionKbps, doc["bandwidth"]["connection_kbps"].as<uint32_t>());
+        if (doc["bandwidth"]["burst_kb"].isNull() == false)
+            bandwidth.Changes.Flags.BurstKb = UpdateConfig(bandwidth.BurstKb, doc["bandwidth"]["burst_kb"].as<uint32_t>());
+    }
+
+    ApplyConfiguration();
     return true;
 }
 bool BoardConfiguration::Serialize(char *json, int length)
@@ -84,6 +102,10 @@ bool BoardConfiguration::Serialize(char *json, int length)
     doc["wifi"]["ssid"] = wificonfig.Ssid.data();
     doc["wifi"]["passwd"] =wificonfig.Password.data();
     doc["wifi"]["mac"] = wificonfig.Mac.data();
+
+    doc["bandwidth"]["device_kbps"] = _configuration.BandwidthConfig.DeviceKbps;
+    doc["bandwidth"]["connection_kbps"] = _configuration.BandwidthConfig.ConnectionKbps;
+    doc["bandwidth"]["burst_kb"] = _configuration.BandwidthConfig.BurstKb;
     
     uint16_t jsonLength = measureJson(doc) + 1;
 
@@ -97,6 +119,15 @@ bool BoardConfiguration::Serialize(char *json, int length)
     return true;
 }
 
+void BoardConfiguration::ApplyConfiguration()
+{
+    // the buckets are reconfigured only for a real change, that refills them
+    if (_configuration.BandwidthConfig.Changes.AllChanges)
+        ApplicationAgent::Instance()->BandwidthUpdated();
+
+    _configuration.BandwidthConfig.Changes.AllChanges = 0;
+}
+
 BoardConfiguration::BoardConfiguration() : BaseConfiguration("Board Config")
 {
 }
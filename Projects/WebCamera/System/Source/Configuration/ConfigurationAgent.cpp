@@ -27,6 +27,7 @@ void ConfigurationAgent::UseDefaultConfiguration()
     _boardConfiguration.DefaultConfiguration();
     _cameraConfiguration.DefaultConfiguration();
     Applications::ApplicationAgent::Instance()->GetWifi().ConfigurationUpdated();
+    Applications::ApplicationAgent::Instance()->BandwidthUpdated();
 }
 
 void ConfigurationAgent::DefaulAllConfigurations()
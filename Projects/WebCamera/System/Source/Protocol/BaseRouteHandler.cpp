@@ -3,8 +3,30 @@
 namespace Protocol
 {
 
+std::atomic<uint32_t> BaseRouteHandler::_defaultRate(0);
+std::atomic<uint32_t> BaseRouteHandler::_defaultBurst(0);
+std::atomic<uint32_t> BaseRouteHandler::_defaultGeneration(0);
+
 BaseRouteHandler::BaseRouteHandler()
 {
 }
 
+void BaseRouteHandler::SetDefaultBandwidth(uint32_t bytesPerSecond, uint32_t burst)
+{
+	_defaultRate = bytesPerSecond;
+	_defaultBurst = burst;
+	_defaultGeneration++;
+}
+
+void BaseRouteHandler::applyDefaultBandwidth()
+{
+	uint32_t generation = _defaultGeneration;
+	if (_ownBandwidth || generation == _bandwidthGeneration)
+		return;
+
+	// reconfiguring refills the bucket, so it is only done when the defaults changed
+	_bandwidthGeneration = generation;
+	_bandwidth.Configure(_defaultRate, _defaultBurst);
+}
+
 } // namespace Protocol
\ No newline at end of file
@@ -1,8 +1,11 @@
 #include "DnsClient.h"
+#include <strings.h>
 
 namespace Protocol
 {
 
+using Hal::Hardware;
+
 DnsClient *DnsClient::_dnsClient = nullptr;
 
 void DnsClient::SetDnsServer(const ip_addr_t &dnsServer)
@@ -12,70 +15,238 @@ void DnsClient::SetDnsServer(const ip_addr_t &dnsServer)
 
 void dns_callback(const char *name, const ip_addr_t *ipaddr, void *callback_arg)
 {
-	DnsClient::DnsParameter *dnsParam = static_cast<DnsClient::DnsParameter *>(callback_arg);
-	if (dnsParam == nullptr || dnsParam->DnsSemaphore == nullptr || dnsParam->IpAddress == nullptr)
+	DnsClient::Query *query = static_cast<DnsClient::Query *>(callback_arg);
+	if (query == nullptr)
 		return;
 
-	if (ipaddr != nullptr)
-		dnsParam->IpAddress->u_addr.ip4.addr = ip4_addr_get_u32(&ipaddr->u_addr.ip4);
-	else
-		dnsParam->IpAddress->u_addr.ip4.addr = 0;
+	// an answer from the server, or its absence after lwIP's retries, both are worth caching
+	DnsClient::Instance()->complete(*query, ipaddr, true);
+}
 
-	dnsParam->DnsSemaphore->Give();
+bool DnsClient::hasDnsServer()
+{
+	for (int i = 0; i < DNS_MAX_SERVERS; i++)
+	{
+		const ip_addr_t *dnsaddr = dns_getserver(i);
+		if (IPParser::IsValid(*dnsaddr))
+			return true;
+	}
+	return false;
 }
 
 DnsClient::DnsResolveResult DnsClient::Resolve(const char *hostname, ip_addr_t &ipaddr)
+{
+	// every caller waits on its own semaphore, concurrent resolves no longer share one
+	BlockingWaiter waiter;
+	waiter.Resolved = false;
+
+	DnsResolveResult result = ResolveAsync(hostname, fastdelegate::MakeDelegate(this, &DnsClient::blockingResolved), &waiter, ipaddr);
+	if (result != DnsResolveResult::Processing)
+		return result;
+
+	if (!waiter.Done.Take(ResolveTimeout))
+	{
+		if (Cancel(&waiter))
+			return DnsResolveResult::ErrorToResolve;
+
+		// the completion is already running, it still refers to this frame
+		waiter.Done.Take(portMAX_DELAY);
+	}
+
+	if (!waiter.Resolved)
+		return DnsResolveResult::ErrorToResolve;
+
+	ip_addr_copy(ipaddr, waiter.Address);
+	return DnsResolveResult::Done;
+}
+
+void DnsClient::blockingResolved(const ip_addr_t *ipaddr, void *context)
+{
+	BlockingWaiter *waiter = static_cast<BlockingWaiter *>(context);
+	if (ipaddr != nullptr)
+	{
+		ip_addr_copy(waiter->Address, *ipaddr);
+		waiter->Resolved = true;
+	}
+	waiter->Done.Give();
+}
+
+DnsClient::DnsResolveResult DnsClient::ResolveAsync(const char *hostname, DelegateResolved callback, void *context, ip_addr_t &ipaddr)
 {
 	if (IPParser::Parse(hostname, ipaddr))
 		return DnsResolveResult::Done;
 
-	bool isDnsValid = false;
-	for (int i = 0; i < DNS_MAX_SERVERS; i++)
+	if (hostname == nullptr || hostname[0] == '\0' || strlen(hostname) > MaxHostnameLength || !callback)
+		return DnsResolveResult::InvalidArguments;
+
+	Query *query = nullptr;
 	{
-		const ip_addr_t *dnsaddr = dns_getserver(i);
-		if (IPParser::IsValid(*dnsaddr))
+		LockGuard guard(_lock);
+		CacheEntry *cached = findCached(hostname, Hardware::Instance()->Milliseconds());
+		if (cached != nullptr)
 		{
-			isDnsValid = true;
-			break;
+			_hits++;
+			if (!cached->Resolved)
+				return DnsResolveResult::ErrorToResolve;
+
+			ip_addr_copy(ipaddr, cached->Address);
+			return DnsResolveResult::Done;
 		}
-	}
-	if (isDnsValid == false)
-	{
-		return DnsResolveResult::InvalidDnsServer;
-	}
+		_misses++;
 
-	ipaddr = ip_addr_any;
-	DnsParameter dnsParam;
+		for (Query &candidate : _queries)
+		{
+			// a full query does not turn callers away, they start another one below
+			if (candidate.InUse && candidate.WaiterCount < MaxWaiters && strcasecmp(candidate.Hostname, hostname) == 0)
+			{
+				candidate.Waiters[candidate.WaiterCount++] = {callback, context};
+				_coalesced++;
+				return DnsResolveResult::Processing;
+			}
+		}
+
+		if (!hasDnsServer())
+			return DnsResolveResult::InvalidDnsServer;
+
+		for (Query &candidate : _queries)
+		{
+			if (!candidate.InUse)
+			{
+				query = &candidate;
+				break;
+			}
+		}
+		if (query == nullptr)
+			return DnsResolveResult::UnknownError;
 
-	dnsParam.DnsSemaphore = &_dnsSemaphore;
-	dnsParam.IpAddress = &ipaddr;
+		query->InUse = true;
+		strcpy(query->Hostname, hostname);
+		query->Waiters[0] = {callback, context};
+		query->WaiterCount = 1;
+	}
 
+	// outside the lock, the answer may arrive on the tcpip task before this returns
 	ip_addr_t cachedaddr = {};
-	err_t err = dns_gethostbyname(hostname, &cachedaddr, &dns_callback, &dnsParam);
+	err_t err = dns_gethostbyname(query->Hostname, &cachedaddr, &dns_callback, query);
+	if (err == ERR_INPROGRESS)
+		return DnsResolveResult::Processing;
+
+	// answered right away, there is no lwIP callback coming, the caller learns it from the return value
+	{
+		LockGuard guard(_lock);
+		query->Waiters[0].Callback.clear();
+	}
+	// a local failure such as ERR_MEM says nothing about the name, it is not negatively cached
+	complete(*query, err == ERR_OK ? &cachedaddr : nullptr, err == ERR_OK);
+
 	switch (err)
 	{
 	case ERR_OK:
 		ip_addr_copy(ipaddr, cachedaddr);
 		return DnsResolveResult::Done;
-	case ERR_INPROGRESS:
-		while (ipaddr.u_addr.ip4.addr == 0)
+	case ERR_ARG:
+		return DnsResolveResult::InvalidArguments;
+	default:
+		return DnsResolveResult::UnknownError;
+	}
+}
+
+bool DnsClient::Cancel(void *context)
+{
+	LockGuard guard(_lock);
+	for (Query &query : _queries)
+	{
+		if (!query.InUse)
+			continue;
+
+		for (uint8_t i = 0; i < query.WaiterCount; i++)
 		{
-			if (!_dnsSemaphore.Take(10 * 100))
+			if (query.Waiters[i].Context == context && query.Waiters[i].Callback)
 			{
-				return DnsResolveResult::ErrorToResolve;
+				// the query itself stays, lwIP still holds on to it
+				query.Waiters[i].Callback.clear();
+				return true;
 			}
 		}
-		if (ipaddr.u_addr.ip4.addr != 0)
+	}
+	return false;
+}
+
+void DnsClient::complete(Query &query, const ip_addr_t *ipaddr, bool cache)
+{
+	Waiter waiters[MaxWaiters];
+	uint8_t waiterCount;
+	{
+		LockGuard guard(_lock);
+		if (cache)
+			store(query.Hostname, ipaddr, Hardware::Instance()->Milliseconds());
+		waiterCount = query.WaiterCount;
+		for (uint8_t i = 0; i < waiterCount; i++)
+			waiters[i] = query.Waiters[i];
+		query.WaiterCount = 0;
+		query.InUse = false;
+	}
+
+	// without the lock, a callback may start the next resolve right away
+	for (uint8_t i = 0; i < waiterCount; i++)
+	{
+		if (waiters[i].Callback)
+			waiters[i].Callback(ipaddr, waiters[i].Context);
+	}
+}
+
+DnsClient::CacheEntry *DnsClient::findCached(const char *hostname, uint32_t now)
+{
+	for (CacheEntry &entry : _cache)
+	{
+		if (entry.Hostname[0] == '\0' || strcasecmp(entry.Hostname, hostname) != 0)
+			continue;
+
+		if (static_cast<int32_t>(now - entry.Expires) >= 0)
 		{
-			return DnsResolveResult::Done;
+			entry.Hostname[0] = '\0';
+			return nullptr;
 		}
-		break;
-	case ERR_ARG:
-		return DnsResolveResult::InvalidArguments;
-	default:
-		return DnsResolveResult::UnknownError;
+
+		entry.LastUsed = ++_useCounter;
+		return &entry;
+	}
+	return nullptr;
+}
+
+void DnsClient::store(const char *hostname, const ip_addr_t *ipaddr, uint32_t now)
+{
+	// the same name again, a free entry or else the least recently used one
+	CacheEntry *slot = &_cache[0];
+	for (CacheEntry &entry : _cache)
+	{
+		if (entry.Hostname[0] != '\0' && strcasecmp(entry.Hostname, hostname) == 0)
+		{
+			slot = &entry;
+			break;
+		}
+		if (slot->Hostname[0] != '\0' && (entry.Hostname[0] == '\0' || entry.LastUsed < slot->LastUsed))
+			slot = &entry;
+	}
+
+	strcpy(slot->Hostname, hostname);
+	slot->Resolved = ipaddr != nullptr;
+	if (ipaddr != nullptr)
+		ip_addr_copy(slot->Address, *ipaddr);
+	slot->Expires = now + (ipaddr != nullptr ? CacheTtl : NegativeCacheTtl);
+	slot->LastUsed = ++_useCounter;
+}
+
+DnsClient::DnsStatistics DnsClient::GetStatistics()
+{
+	LockGuard guard(_lock);
+	DnsStatistics statistics = {_hits, _misses, _coalesced, 0};
+	for (Query &query : _queries)
+	{
+		if (query.InUse)
+			statistics.InFlight++;
 	}
-	return DnsResolveResult::UnknownError;
+	return statistics;
 }
 
 } // namespace Protocol
\ No newline at end of file
@@ -13,6 +13,138 @@ namespace Protocol
 constexpr unsigned char HttpParser::http_header_state[];
 constexpr unsigned char HttpParser::http_chunk_state[];
 
+namespace
+{
+
+constexpr uint32_t Ones = 0x01010101u;
+constexpr uint32_t HighBits = 0x80808080u;
+
+/// Bit 7 of every byte of the result is set where the word holds the byte c.
+/// Only the lowest flagged byte is exact, which is all the scanners need.
+inline uint32_t matchByte(uint32_t word, uint8_t c)
+{
+	uint32_t x = word ^ (Ones * c);
+	return (x - Ones) & ~x & HighBits;
+}
+
+/// ASCII lowercase of four bytes at once, bytes above 0x7F are left alone like tolower() does.
+inline uint32_t lowerWord(uint32_t word)
+{
+	uint32_t heptets = word & ~HighBits;
+	uint32_t aboveZ = heptets + Ones * (0x7F - 'Z');
+	uint32_t fromA = heptets + Ones * (0x80 - 'A');
+	uint32_t upper = ~word & (fromA ^ aboveZ) & HighBits;
+	return word | (upper >> 2);
+}
+
+inline char lowerChar(char ch)
+{
+	return static_cast<uint8_t>(ch - 'A') < 26 ? ch | 0x20 : ch;
+}
+
+inline bool isKeyEnd(char ch)
+{
+	return ch == ':' || ch == '\r' || ch == '\n' || ch == ' ' || ch == '\t' || ch == ',';
+}
+
+inline bool isValueEnd(char ch)
+{
+	return ch == '\r' || ch == '\n' || ch == ',';
+}
+
+inline bool isLineEnd(char ch)
+{
+	return ch == '\r' || ch == '\n';
+}
+
+inline uint32_t loadAligned(const char *data)
+{
+	uint32_t word;
+	memcpy(&word, __builtin_assume_aligned(data, sizeof(uint32_t)), sizeof(word));
+	return word;
+}
+
+/// Length of the run of bytes up to the first delimiter. Head and tail are checked
+/// byte wise so that the word loads are always aligned, the ESP32 traps otherwise.
+template <bool (*IsEnd)(char), uint32_t (*MatchWord)(uint32_t)>
+int scanRun(const char *data, int size)
+{
+	int i = 0;
+	while (i < size && (reinterpret_cast<uintptr_t>(data + i) & 3) != 0)
+	{
+		if (IsEnd(data[i]))
+			return i;
+		++i;
+	}
+	while (i + 4 <= size && MatchWord(loadAligned(data + i)) == 0)
+		i += 4;
+	while (i < size && !IsEnd(data[i]))
+		++i;
+	return i;
+}
+
+inline uint32_t matchKeyEnd(uint32_t word)
+{
+	return matchByte(word, ':') | matchByte(word, '\r') | matchByte(word, '\n') |
+		   matchByte(word, ' ') | matchByte(word, '\t') | matchByte(word, ',');
+}
+
+inline uint32_t matchValueEnd(uint32_t word)
+{
+	return matchByte(word, '\r') | matchByte(word, '\n') | matchByte(word, ',');
+}
+
+inline uint32_t matchLineEnd(uint32_t word)
+{
+	return matchByte(word, '\r') | matchByte(word, '\n');
+}
+
+inline bool isTargetEnd(char ch)
+{
+	return ch == ' ' || ch == '\r' || ch == '\n' || ch == '\t';
+}
+
+inline uint32_t matchTargetEnd(uint32_t word)
+{
+	return matchByte(word, ' ') | matchByte(word, '\r') | matchByte(word, '\n') | matchByte(word, '\t');
+}
+
+struct MethodName
+{
+	const char *Name;
+	uint8_t Length;
+	HttpMethod Method;
+};
+
+constexpr MethodName MethodNames[] = {
+	{"GET", 3, HttpMethod::Get},
+	{"HEAD", 4, HttpMethod::Head},
+	{"POST", 4, HttpMethod::Post},
+	{"PUT", 3, HttpMethod::Put},
+	{"DELETE", 6, HttpMethod::Delete},
+	{"OPTIONS", 7, HttpMethod::Options},
+	{"PATCH", 5, HttpMethod::Patch},
+};
+
+void copyLower(char *destination, const char *source, int size)
+{
+	int i = 0;
+	while (i < size && (reinterpret_cast<uintptr_t>(source + i) & 3) != 0)
+	{
+		destination[i] = lowerChar(source[i]);
+		++i;
+	}
+	for (; i + 4 <= size; i += 4)
+	{
+		uint32_t word = lowerWord(loadAligned(source + i));
+		memcpy(destination + i, &word, sizeof(word));
+	}
+	for (; i < size; ++i)
+		destination[i] = lowerChar(source[i]);
+}
+
+} // namespace
+
 HttpParser::HttpHeaderStatus HttpParser::httpParseHeaderChar(HttpRoundtripperState &state, char ch)
 {
 	int code = 0;
@@ -66,6 +198,17 @@ HttpParser::HttpHeaderStatus HttpParser::httpParseHeaderChar(HttpRoundtripperSta
 		return HttpHeaderStatus::http_header_status_code_done;
 	case 0xA1:
 		return HttpHeaderStatus::http_header_version_done;
+	case 0x8B:
+	case 0x8C:
+	case 0x8D:
+		return HttpHeaderStatus::http_header_status_request_line_character;
+	case 0xAC:
+		return HttpHeaderStatus::http_header_status_method_done;
+	case 0xAD:
+		return HttpHeaderStatus::http_header_status_target_done;
+	case 0xA4:
+	case 0xAE:
+		return HttpHeaderStatus::http_header_status_request_line_done;
 	}
 
 	return HttpHeaderStatus::http_header_status_continue;
@@ -140,6 +283,94 @@ int HttpParser::httpParseChunked(HttpRoundtripperState &state, int &size, char c
 	return 1;
 }
 
+int HttpParser::httpScanHeaderRun(struct HttpParserRoundtripper *rt, const char *data, int size)
+{
+	// Runs never include a byte that changes the table state, so the state machine
+	// continues exactly where the per character path would be after the same bytes.
+	switch (static_cast<uint8_t>(rt->parsestate))
+	{
+	case HeaderStateKey:
+	{
+		int run = scanRun<isKeyEnd, matchKeyEnd>(data, min(size, rt->nscratch - rt->nkey));
+		copyLower(rt->scratch + rt->nkey, data, run);
+		rt->nkey += run;
+		return run;
+	}
+
+	case HeaderStateValue:
+	{
+		// a view can grow without limit as long as the bytes stay contiguous
+		const bool view = rt->value != nullptr ? rt->value + rt->nvalue == data : _zeroCopy && rt->nvalue == 0;
+		int run = scanRun<isValueEnd, matchValueEnd>(data, view ? size : min(size, rt->nscratch - rt->nkey - rt->nvalue));
+		if (run > 0)
+			appendValue(rt, data, run);
+		return run;
+	}
+
+	case HeaderStateReason:
+		return scanRun<isLineEnd, matchLineEnd>(data, size);
+
+	case HeaderStateMethod:
+	case HeaderStateTarget:
+	case HeaderStateRequestVersion:
+	{
+		// the request line is collected as one value, method and version stop where keys do
+		const bool view = rt->value != nullptr ? rt->value + rt->nvalue == data : _zeroCopy && rt->nvalue == 0;
+		const int limit = view ? size : min(size, rt->nscratch - rt->nkey - rt->nvalue);
+		int run = static_cast<uint8_t>(rt->parsestate) == HeaderStateTarget ? scanRun<isTargetEnd, matchTargetEnd>(data, limit)
+																			 : scanRun<isKeyEnd, matchKeyEnd>(data, limit);
+		if (run > 0)
+			appendValue(rt, data, run);
+		return run;
+	}
+	}
+
+	return 0;
+}
+
+bool HttpParser::parseRequestLine(struct HttpParserRoundtripper *rt)
+{
+	const char *line = rt->value != nullptr ? rt->value : rt->scratch + rt->nkey;
+	const char *version = line + rt->ntarget + 1;
+	const int nversion = rt->nvalue - rt->ntarget - 1;
+
+	if (rt->nmethod == 0 || rt->ntarget <= rt->nmethod + 1 || nversion != 8 || strncmp(version, "HTTP/1.", 7) != 0 ||
+		version[7] < '0' || version[7] > '9')
+		return false;
+
+	HttpRequestLine request = {};
+	request.Method = HttpMethod::Unknown;
+	for (const MethodName &name : MethodNames)
+	{
+		if (name.Length == rt->nmethod && memcmp(line, name.Name, name.Length) == 0)
+		{
+			request.Method = name.Method;
+			break;
+		}
+	}
+	request.MethodName = line;
+	request.MethodLength = rt->nmethod;
+	request.Path = line + rt->nmethod + 1;
+	request.PathLength = rt->ntarget - rt->nmethod - 1;
+	request.VersionMinor = version[7] - '0';
+
+	const char *query = static_cast<const char *>(memchr(request.Path, '?', request.PathLength));
+	if (query != nullptr)
+	{
+		request.Query = query + 1;
+		request.QueryLength = request.Path + request.PathLength - request.Query;
+		request.PathLength = query - request.Path;
+	}
+	else
+	{
+		request.Query = request.Path + request.PathLength;
+		request.QueryLength = 0;
+	}
+
+	rt->method = request.Method;
+	return processRequestLine(rt->opaque, request);
+}
+
 bool HttpParser::growScratch(struct HttpParserRoundtripper *rt, int size)
 {
 	if (size > rt->nscratch)
@@ -148,6 +379,113 @@ bool HttpParser::growScratch(struct HttpParserRoundtripper *rt, int size)
 	return true;
 }
 
+bool HttpParser::detachValue(struct HttpParserRoundtripper *rt)
+{
+	if (rt->value == nullptr)
+		return true;
+
+	if (growScratch(rt, rt->nkey + rt->nvalue) == false)
+		return false;
+
+	memmove(rt->scratch + rt->nkey, rt->value, rt->nvalue);
+	rt->value = nullptr;
+	return true;
+}
+
+bool HttpParser::appendValue(struct HttpParserRoundtripper *rt, const char *data, int size)
+{
+	if (rt->value != nullptr)
+	{
+		if (rt->value + rt->nvalue == data)
+		{
+			rt->nvalue += size;
+			return true;
+		}
+
+		// folded or otherwise split value, continue in the scratch
+		if (detachValue(rt) == false)
+			return false;
+	}
+	else if (_zeroCopy && rt->nvalue == 0)
+	{
+		rt->value = data;
+		rt->nvalue = size;
+		return true;
+	}
+
+	if (growScratch(rt, rt->nkey + rt->nvalue + size) == false)
+		return false;
+
+	memcpy(rt->scratch + rt->nkey + rt->nvalue, data, size);
+	rt->nvalue += size;
+	return true;
+}
+
+HttpHeaderId HttpHeaderIndex::Lookup(const char *key, int nkey)
+{
+	switch (nkey)
+	{
+	case 4:
+		if (memcmp(key, "host", 4) == 0)
+			return HttpHeaderId::Host;
+		break;
+	case 7:
+		if (memcmp(key, "upgrade", 7) == 0)
+			return HttpHeaderId::Upgrade;
+		break;
+	case 10:
+		if (memcmp(key, "connection", 10) == 0)
+			return HttpHeaderId::Connection;
+		break;
+	case 12:
+		if (memcmp(key, "content-type", 12) == 0)
+			return HttpHeaderId::ContentType;
+		break;
+	case 14:
+		if (memcmp(key, "content-length", 14) == 0)
+			return HttpHeaderId::ContentLength;
+		break;
+	case 17:
+		if (memcmp(key, "transfer-encoding", 17) == 0)
+			return HttpHeaderId::TransferEncoding;
+		if (memcmp(key, "sec-websocket-key", 17) == 0)
+			return HttpHeaderId::SecWebSocketKey;
+		break;
+	case 20:
+		if (memcmp(key, "sec-websocket-accept", 20) == 0)
+			return HttpHeaderId::SecWebSocketAccept;
+		break;
+	case 21:
+		if (memcmp(key, "sec-websocket-version", 21) == 0)
+			return HttpHeaderId::SecWebSocketVersion;
+		break;
+	case 22:
+		if (memcmp(key, "sec-websocket-protocol", 22) == 0)
+			return HttpHeaderId::SecWebSocketProtocol;
+		break;
+	}
+	return HttpHeaderId::Unknown;
+}
+
+void HttpHeaderIndex::Store(HttpHeaderId id, const char *value, int nvalue)
+{
+	if (id >= HttpHeaderId::Count)
+		return;
+
+	const uint8_t slot = static_cast<uint8_t>(id);
+	const uint16_t bit = 1u << slot;
+	const int length = nvalue > ValueSize ? ValueSize : nvalue;
+
+	memcpy(_values[slot].data(), value, length);
+	_values[slot][length] = '\0';
+	_lengths[slot] = length;
+	_present |= bit;
+	if (length < nvalue)
+		_truncated |= bit;
+	else
+		_truncated &= ~bit;
+}
+
 int HttpParser::HttpProcessData(struct HttpParserRoundtripper *rt, const char *data, int size, int *read)
 {
 	const int initial_size = size;
@@ -157,7 +495,19 @@ int HttpParser::HttpProcessData(struct HttpParserRoundtripper *rt, const char *d
 		{
 		case HttpRoundtripperState::http_roundtripper_header:
 		{
-			switch (httpParseHeaderChar(rt->parsestate, *data))
+			if (_fastPath)
+			{
+				const int run = httpScanHeaderRun(rt, data, size);
+				if (run > 0)
+				{
+					size -= run;
+					data += run;
+					break;
+				}
+			}
+
+			const HttpHeaderStatus status = httpParseHeaderChar(rt->parsestate, *data);
+			switch (status)
 			{
 			case HttpHeaderStatus::http_header_status_continue:
 			{
@@ -194,6 +544,41 @@ int HttpParser::HttpProcessData(struct HttpParserRoundtripper *rt, const char *d
 			}
 			break;
 
+			case HttpHeaderStatus::http_header_status_request_line_character:
+				if (appendValue(rt, data, 1) == false)
+				{
+					rt->state = HttpRoundtripperState::http_roundtripper_error_scrach_exceeded;
+				}
+				break;
+
+			case HttpHeaderStatus::http_header_status_method_done:
+			case HttpHeaderStatus::http_header_status_target_done:
+			{
+				// the separator stays in the line so that the view remains contiguous
+				if (status == HttpHeaderStatus::http_header_status_method_done)
+					rt->nmethod = rt->nvalue;
+				else
+					rt->ntarget = rt->nvalue;
+
+				if (appendValue(rt, data, 1) == false)
+				{
+					rt->state = HttpRoundtripperState::http_roundtripper_error_scrach_exceeded;
+				}
+			}
+			break;
+
+			case HttpHeaderStatus::http_header_status_request_line_done:
+			{
+				if (parseRequestLine(rt) == false)
+				{
+					rt->state = HttpRoundtripperState::http_roundtripper_start_line_is_invalid;
+					return false;
+				}
+				rt->nvalue = 0;
+				rt->value = nullptr;
+			}
+			break;
+
 			case HttpHeaderStatus::http_header_status_code_done:
 			{
 				if (processCode(rt->opaque, rt->code) == false)
@@ -206,8 +591,12 @@ int HttpParser::HttpProcessData(struct HttpParserRoundtripper *rt, const char *d
 
 			case HttpHeaderStatus::http_header_status_done:
 			{
+				// parsestate is a table state here, the empty line is only known from this status
+				rt->endOfHeadersDetected = true;
 				if (rt->parsestate != HttpRoundtripperState::http_roundtripper_header)
 					rt->state = HttpRoundtripperState::http_roundtripper_error;
+				else if (!rt->request && (rt->code / 100 == 1 || rt->code == 204 || rt->code == 304))
+					rt->state = HttpRoundtripperState::http_roundtripper_close; // never a body, e.g. 101 before a websocket stream
 				else if (rt->chunked)
 				{
 					rt->contentlength = 0;
@@ -217,6 +606,8 @@ int HttpParser::HttpProcessData(struct HttpParserRoundtripper *rt, const char *d
 					rt->state = HttpRoundtripperState::http_roundtripper_close;
 				else if (rt->contentlength > 0)
 					rt->state = HttpRoundtripperState::http_roundtripper_raw_data;
+				else if (rt->contentlength == -1 && rt->request)
+					rt->state = HttpRoundtripperState::http_roundtripper_close;
 				else if (rt->contentlength == -1)
 					rt->state = HttpRoundtripperState::http_roundtripper_unknown_data;
 				else
@@ -239,32 +630,32 @@ int HttpParser::HttpProcessData(struct HttpParserRoundtripper *rt, const char *d
 				break;
 
 			case HttpHeaderStatus::http_header_status_value_character:
-				if (growScratch(rt, rt->nkey + rt->nvalue + 1) == false)
+				if (appendValue(rt, data, 1) == false)
 				{
 					rt->state = HttpRoundtripperState::http_roundtripper_error_scrach_exceeded;
 					break;
 				}
-				rt->scratch[rt->nkey + rt->nvalue] = *data;
-				++rt->nvalue;
 				break;
 
 			case HttpHeaderStatus::http_header_status_store_keyvalue:
 			{
-				if (rt->nkey == 17 && strncmp(rt->scratch, "transfer-encoding", rt->nkey) == 0)
+				const char *value = rt->value != nullptr ? rt->value : rt->scratch + rt->nkey;
+				const HttpHeaderId id = HttpHeaderIndex::Lookup(rt->scratch, rt->nkey);
+				if (id == HttpHeaderId::TransferEncoding)
 				{
-					rt->chunked = (rt->nvalue == 7 && strncmp(rt->scratch + rt->nkey, "chunked", rt->nvalue) == 0);
+					rt->chunked = (rt->nvalue == 7 && strncmp(value, "chunked", rt->nvalue) == 0);
 				}
-				else if (rt->nkey == 14 && strncmp(rt->scratch, "content-length", rt->nkey) == 0)
+				else if (id == HttpHeaderId::ContentLength)
 				{
-					int ii, end;
 					rt->contentlength = 0;
-					for (ii = rt->nkey, end = rt->nkey + rt->nvalue; ii != end; ++ii)
+					for (int ii = 0; ii != rt->nvalue; ++ii)
 					{
-						rt->contentlength = rt->contentlength * 10 + rt->scratch[ii] - '0';
+						rt->contentlength = rt->contentlength * 10 + value[ii] - '0';
 					}
 				}
+				_headerIndex.Store(id, value, rt->nvalue);
 
-				if (processHeader(rt->opaque, rt->scratch, rt->nkey, rt->scratch + rt->nkey, rt->nvalue) == false)
+				if (processHeader(rt->opaque, rt->scratch, rt->nkey, value, rt->nvalue) == false)
 				{
 					rt->state = HttpRoundtripperState::http_roundtripper_header_is_invalid;
 					return false;
@@ -272,14 +663,11 @@ int HttpParser::HttpProcessData(struct HttpParserRoundtripper *rt, const char *d
 
 				rt->nkey = 0;
 				rt->nvalue = 0;
+				rt->value = nullptr;
 			}
 			break;
 
 			} // switch(httpParseHeaderChar(...))
-			if (rt->parsestate == HttpRoundtripperState::http_roundtripper_close)
-			{
-				rt->endOfHeadersDetected = true;
-			}
 			--size;
 			++data;
 		}
@@ -409,6 +797,14 @@ int HttpParser::HttpProcessData(struct HttpParserRoundtripper *rt, const char *d
 
 	} // while (size)
 	*read = initial_size - size;
+
+	// the caller reuses its buffer, a value that is still open has to move into the scratch
+	if (detachValue(rt) == false)
+	{
+		rt->state = HttpRoundtripperState::http_roundtripper_error_scrach_exceeded;
+		processError(rt->opaque, 2);
+		return 0;
+	}
 	return 1;
 }
 
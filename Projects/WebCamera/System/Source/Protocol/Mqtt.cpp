@@ -0,0 +1,635 @@
+#include "Mqtt.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "Hardware.h"
+#include "Logger.h"
+
+namespace Protocol
+{
+
+using Hal::Hardware;
+using Utilities::Logger;
+
+void MqttWriter::FixedHeader(MqttPacketType type, uint8_t flags, uint32_t remainingLength)
+{
+	if (remainingLength > MaxRemainingLength)
+	{
+		_valid = false;
+		return;
+	}
+
+	Byte((static_cast<uint8_t>(type) << 4) | (flags & 0x0F));
+	do
+	{
+		uint8_t digit = remainingLength & 0x7F;
+		remainingLength >>= 7;
+		Byte(remainingLength > 0 ? digit | 0x80 : digit);
+	} while (remainingLength > 0);
+}
+
+void MqttWriter::Byte(uint8_t value)
+{
+	if (_length >= _size)
+	{
+		_valid = false;
+		return;
+	}
+	_buffer[_length++] = value;
+}
+
+void MqttWriter::Word(uint16_t value)
+{
+	Byte(value >> 8);
+	Byte(value);
+}
+
+void MqttWriter::String(const char *text, uint16_t length)
+{
+	Word(length);
+	Bytes(reinterpret_cast<const uint8_t *>(text), length);
+}
+
+void MqttWriter::Bytes(const uint8_t *data, uint16_t length)
+{
+	if (_size - _length < length)
+	{
+		_valid = false;
+		return;
+	}
+	memcpy(_buffer + _length, data, length);
+	_length += length;
+}
+
+bool MqttReader::take(uint32_t count)
+{
+	if (!_valid || _length - _position < count)
+	{
+		_valid = false;
+		return false;
+	}
+	return true;
+}
+
+uint8_t MqttReader::Byte()
+{
+	return take(1) ? _data[_position++] : 0;
+}
+
+uint16_t MqttReader::Word()
+{
+	if (!take(2))
+		return 0;
+
+	uint16_t value = (_data[_position] << 8) | _data[_position + 1];
+	_position += 2;
+	return value;
+}
+
+void MqttReader::String(const char *&text, uint16_t &length)
+{
+	length = Word();
+	if (!take(length))
+	{
+		text = nullptr;
+		length = 0;
+		return;
+	}
+
+	text = reinterpret_cast<const char *>(_data + _position);
+	_position += length;
+}
+
+int32_t MqttPath::Publish(const char *topic, const uint8_t *data, uint32_t length, uint8_t qos, bool retain)
+{
+	return publish(topic, data, length, qos, retain, false);
+}
+
+int32_t MqttPath::PublishReference(const char *topic, const uint8_t *data, uint32_t length, uint8_t qos, bool retain)
+{
+	return publish(topic, data, length, qos, retain, true);
+}
+
+int32_t MqttPath::Subscribe(const char *topic, uint8_t qos)
+{
+	const size_t topicLength = strnlen(topic, MaxTopicLength + 1);
+	if (_state != State::Open || qos > 1 || topicLength == 0 || topicLength > MaxTopicLength)
+		return -1;
+
+	uint16_t packetId = nextPacketId();
+	MqttWriter writer(_scratch.data(), _scratch.size());
+	writer.FixedHeader(MqttPacketType::Subscribe, 0x02, 2 + 2 + topicLength + 1);
+	writer.Word(packetId);
+	writer.String(topic, topicLength);
+	writer.Byte(qos);
+	if (!writer.Valid() || !sendRaw(_scratch.data(), writer.Length()))
+		return -1;
+
+	_sendTimer.Reset();
+	return packetId;
+}
+
+uint8_t MqttPath::GetInflightCount() const
+{
+	uint8_t count = 0;
+	for (const Inflight &slot : _inflight)
+	{
+		if (slot.PacketId != 0)
+			count++;
+	}
+	return count;
+}
+
+bool MqttPath::sendFrame(const uint8_t *data, uint16_t length)
+{
+	// a frame has no topic, publishing goes through Publish()
+	return false;
+}
+
+void MqttPath::setConnection()
+{
+	if (_connection == nullptr)
+		return;
+
+	_connection->SetDataReceived(MakeDelegate(this, &MqttPath::onDataReceived));
+	_connection->SetSendReady(MakeDelegate(this, &MqttPath::onSendReady));
+	_connection->SetConnectionStateChanged(MakeDelegate(this, &MqttPath::connectionStateChanged));
+}
+
+bool MqttPath::isTerminated() const
+{
+	return _state == State::Closed;
+}
+
+bool MqttPath::start(BaseRouteHandler::ConnectionMode connectionMode, RemoteConnection *address, uint8_t processingIndex, uint8_t processingLogicalId)
+{
+	// the broker never connects to us
+	if (_connection == nullptr || address == nullptr)
+		return false;
+
+	_executionResult = ConnectionExecutionResult::Working;
+	_receiveState = ReceiveState::Header;
+	_pingPending = false;
+	_connectPending = false;
+	_ackHead = 0;
+	_ackTail = 0;
+	for (Inflight &slot : _inflight)
+		slot.PacketId = 0;
+
+	_remoteConnection = *address;
+	_state = State::Connecting;
+	_timer.Reset();
+	return _connection->Connect(*address) != BaseConnection::ConnectStatus::Failed;
+}
+
+void MqttPath::terminate()
+{
+	if (_state == State::Closed || _state == State::Idle)
+		return;
+
+	if (_state == State::Open)
+		sendControl(MqttPacketType::Disconnect, 0, nullptr);
+
+	_state = State::Closed;
+	if (_connection != nullptr)
+		_connection->Close();
+}
+
+void MqttPath::process()
+{
+	switch (_state)
+	{
+	case State::Failed:
+		_state = State::Closed;
+		_connection->Close();
+		break;
+
+	case State::Connecting:
+	case State::Handshake:
+		if (_connectPending.exchange(false) && !sendConnect())
+		{
+			fail("connect not sent");
+			break;
+		}
+		if (_timer.IsTimeUp(HandshakeTimeout))
+			fail("handshake timeout");
+		break;
+
+	case State::Open:
+	{
+		sendPendingAcks();
+
+		// TCP does not lose a PUBLISH, a missing PUBACK means the broker is gone
+		const uint32_t now = Hardware::Instance()->Milliseconds();
+		for (const Inflight &slot : _inflight)
+		{
+			if (slot.PacketId != 0 && now - slot.SentAt > AckTimeout)
+			{
+				fail("publish not acknowledged");
+				return;
+			}
+		}
+
+		if (_keepAlive == 0)
+			break;
+
+		const uint32_t interval = _keepAlive * 1000;
+		if (_pingPending)
+		{
+			if (_timer.IsTimeUp(interval))
+				fail("no ping response");
+		}
+		else if (_sendTimer.IsTimeUp(interval))
+		{
+			_pingPending = true;
+			_timer.Reset();
+			if (!sendControl(MqttPacketType::Pingreq, 0, nullptr))
+				fail("ping not sent");
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+void MqttPath::connectionStateChanged(ConnectionState state, ConnectionChangeReason reason)
+{
+	if (state == ConnectionState::Connected && _state == State::Connecting)
+	{
+		// this is the network stack's task, a full send queue could only drain behind it
+		_timer.Reset();
+		_connectPending = true;
+		_state = State::Handshake;
+		return;
+	}
+
+	if (state == ConnectionState::Disconnected && _state != State::Closed)
+	{
+		_executionResult = ConnectionExecutionResult::Error;
+		_state = State::Closed;
+	}
+}
+
+void MqttPath::onDataReceived(const char *data, uint16_t length)
+{
+	receivedData(reinterpret_cast<const uint8_t *>(data), length);
+}
+
+void MqttPath::onSendReady()
+{
+	_sendReady.Give();
+}
+
+void MqttPath::receivedData(const uint8_t *data, uint16_t length)
+{
+	while (length > 0 && (_state == State::Handshake || _state == State::Open))
+	{
+		switch (_receiveState)
+		{
+		case ReceiveState::Header:
+			_packetHeader = *data++;
+			length--;
+			_remainingLength = 0;
+			_lengthShift = 0;
+			_receiveState = ReceiveState::Length;
+			break;
+
+		case ReceiveState::Length:
+		{
+			const uint8_t digit = *data++;
+			length--;
+			_remainingLength |= static_cast<uint32_t>(digit & 0x7F) << _lengthShift;
+			_lengthShift += 7;
+			if (digit & 0x80)
+			{
+				if (_lengthShift >= 28)
+				{
+					fail("malformed remaining length");
+					return;
+				}
+				break;
+			}
+
+			_received = 0;
+			if (_remainingLength == 0)
+				packetReceived();
+			else
+				_receiveState = ReceiveState::Body;
+			break;
+		}
+
+		case ReceiveState::Body:
+		{
+			const uint32_t chunk = std::min<uint32_t>(_remainingLength - _received, length);
+
+			// the start of an oversized packet is kept, it still tells what to acknowledge
+			if (_received < MaxIncomingPacket)
+				memcpy(_packet.data() + _received, data, std::min<uint32_t>(chunk, MaxIncomingPacket - _received));
+
+			_received += chunk;
+			data += chunk;
+			length -= chunk;
+			if (_received == _remainingLength)
+				packetReceived();
+			break;
+		}
+		}
+	}
+}
+
+void MqttPath::packetReceived()
+{
+	_receiveState = ReceiveState::Header;
+
+	const MqttPacketType type = static_cast<MqttPacketType>(_packetHeader >> 4);
+	MqttReader reader(_packet.data(), std::min<uint32_t>(_remainingLength, MaxIncomingPacket));
+
+	if (_state == State::Handshake)
+	{
+		if (type != MqttPacketType::Connack || _remainingLength != 2)
+		{
+			fail("expected CONNACK");
+			return;
+		}
+
+		reader.Byte();
+		const uint8_t code = reader.Byte();
+		if (code != 0)
+		{
+			Logger::LogError(Logger::LogSource::Gateway, "Mqtt connection refused, code %u", code);
+			fail("connection refused");
+			return;
+		}
+
+		_state = State::Open;
+		_executionResult = ConnectionExecutionResult::Success;
+		_sendTimer.Reset();
+		Logger::LogInfo(Logger::LogSource::Gateway, "Mqtt open to %s", _remoteConnection.Address.data());
+		return;
+	}
+
+	switch (type)
+	{
+	case MqttPacketType::Publish:
+		publishReceived(_packetHeader & 0x0F, reader);
+		break;
+
+	case MqttPacketType::Puback:
+		acknowledged(reader.Word());
+		break;
+
+	case MqttPacketType::Suback:
+	{
+		const uint16_t packetId = reader.Word();
+		while (reader.Remaining() > 0)
+		{
+			if (reader.Byte() == 0x80)
+				Logger::LogError(Logger::LogSource::Gateway, "Mqtt subscription %u refused", packetId);
+		}
+		break;
+	}
+
+	case MqttPacketType::Pingresp:
+		_pingPending = false;
+		break;
+
+	default:
+		fail("unexpected packet");
+		break;
+	}
+}
+
+void MqttPath::publishReceived(uint8_t flags, MqttReader &reader)
+{
+	// subscriptions ask for QoS 1 at most, so the broker never sends QoS 2
+	const uint8_t qos = (flags >> 1) & 0x03;
+	if (qos > 1)
+	{
+		fail("unexpected QoS");
+		return;
+	}
+
+	const char *topic = nullptr;
+	uint16_t topicLength = 0;
+	reader.String(topic, topicLength);
+	const uint16_t packetId = qos == 1 ? reader.Word() : 0;
+	if (!reader.Valid())
+	{
+		fail("malformed publish");
+		return;
+	}
+
+	if (_remainingLength > MaxIncomingPacket)
+		Logger::LogError(Logger::LogSource::Gateway, "Mqtt message of %u bytes dropped", _remainingLength);
+	else if (_onMessageReceived)
+		_onMessageReceived(topic, topicLength, reader.Rest(), reader.Remaining());
+
+	if (qos == 1)
+		queueAck(packetId);
+}
+
+void MqttPath::acknowledged(uint16_t packetId)
+{
+	for (Inflight &slot : _inflight)
+	{
+		uint16_t expected = packetId;
+		if (packetId != 0 && slot.PacketId.compare_exchange_strong(expected, 0))
+		{
+			if (_onPublished)
+				_onPublished(packetId);
+			return;
+		}
+	}
+}
+
+void MqttPath::queueAck(uint16_t packetId)
+{
+	const uint8_t tail = _ackTail;
+	if (static_cast<uint8_t>(tail - _ackHead) >= MaxPendingAcks)
+	{
+		fail("too many unacknowledged messages");
+		return;
+	}
+
+	_pendingAcks[tail % MaxPendingAcks] = packetId;
+	_ackTail = tail + 1;
+}
+
+void MqttPath::sendPendingAcks()
+{
+	while (_ackHead != _ackTail)
+	{
+		const uint16_t packetId = _pendingAcks[_ackHead % MaxPendingAcks];
+		if (!sendControl(MqttPacketType::Puback, 0, &packetId))
+			return;
+		_ackHead++;
+	}
+}
+
+bool MqttPath::sendConnect()
+{
+	array<char, 24> generatedId;
+	const char *clientId = _clientId;
+	if (clientId[0] == '\0')
+	{
+		snprintf(generatedId.data(), generatedId.size(), "esp32cam-%08x", Hardware::Instance()->GetRng().GetNumber());
+		clientId = generatedId.data();
+	}
+
+	const bool hasUser = _userName != nullptr;
+	const bool hasPassword = hasUser && _password != nullptr;
+	const size_t idLength = strlen(clientId);
+	const size_t userLength = hasUser ? strlen(_userName) : 0;
+	const size_t passwordLength = hasPassword ? strlen(_password) : 0;
+
+	uint8_t flags = 0x02; // clean session
+	if (hasUser)
+		flags |= 0x80;
+	if (hasPassword)
+		flags |= 0x40;
+
+	uint32_t remaining = 10 + 2 + idLength;
+	if (hasUser)
+		remaining += 2 + userLength;
+	if (hasPassword)
+		remaining += 2 + passwordLength;
+
+	MqttWriter writer(_scratch.data(), _scratch.size());
+	writer.FixedHeader(MqttPacketType::Connect, 0, remaining);
+	writer.String("MQTT", 4);
+	writer.Byte(4); // protocol level 3.1.1
+	writer.Byte(flags);
+	writer.Word(_keepAlive);
+	writer.String(clientId, idLength);
+	if (hasUser)
+		writer.String(_userName, userLength);
+	if (hasPassword)
+		writer.String(_password, passwordLength);
+
+	return writer.Valid() && sendRaw(_scratch.data(), writer.Length());
+}
+
+int32_t MqttPath::publish(const char *topic, const uint8_t *data, uint32_t length, uint8_t qos, bool retain, bool reference)
+{
+	const size_t topicLength = strnlen(topic, MaxTopicLength + 1);
+	if (_state != State::Open || qos > 1 || topicLength == 0 || topicLength > MaxTopicLength)
+		return -1;
+
+	Inflight *slot = nullptr;
+	uint16_t packetId = 0;
+	if (qos == 1)
+	{
+		for (Inflight &candidate : _inflight)
+		{
+			if (candidate.PacketId == 0)
+			{
+				slot = &candidate;
+				break;
+			}
+		}
+		if (slot == nullptr)
+			return -1;
+		packetId = nextPacketId();
+	}
+
+	MqttWriter writer(_scratch.data(), _scratch.size());
+	writer.FixedHeader(MqttPacketType::Publish, (qos << 1) | (retain ? 0x01 : 0x00), 2 + topicLength + (qos == 1 ? 2 : 0) + length);
+	writer.String(topic, topicLength);
+	if (qos == 1)
+		writer.Word(packetId);
+
+	// a small copied payload goes out with its header in one piece
+	const bool packed = !reference && length <= static_cast<uint32_t>(_scratch.size() - writer.Length());
+	if (packed)
+		writer.Bytes(data, length);
+	if (!writer.Valid())
+		return -1;
+
+	// over budget the whole publish is dropped, before anything of it is written
+	if (!admit(writer.Length() + (packed ? 0 : length)))
+		return -1;
+
+	// armed first, the PUBACK can come back before the payload call returns
+	if (slot != nullptr)
+	{
+		slot->SentAt = Hardware::Instance()->Milliseconds();
+		slot->PacketId = packetId;
+	}
+
+	if (!sendRaw(_scratch.data(), writer.Length()))
+	{
+		if (slot != nullptr)
+			slot->PacketId = 0;
+		return -1;
+	}
+
+	if (!packed && !sendRaw(data, length, reference))
+	{
+		// the header is out already, the stream can not be framed any more
+		fail("send timed out");
+		return -1;
+	}
+
+	_sendTimer.Reset();
+	return packetId;
+}
+
+bool MqttPath::sendControl(MqttPacketType type, uint8_t flags, const uint16_t *packetId)
+{
+	uint8_t packet[4];
+	MqttWriter writer(packet, sizeof(packet));
+	writer.FixedHeader(type, flags, packetId != nullptr ? 2 : 0);
+	if (packetId != nullptr)
+		writer.Word(*packetId);
+
+	if (!sendRaw(packet, writer.Length()))
+		return false;
+
+	_sendTimer.Reset();
+	return true;
+}
+
+bool MqttPath::sendRaw(const uint8_t *data, uint32_t length, bool reference)
+{
+	if (_connection == nullptr)
+		return false;
+
+	// copies go through the connection's own buffer, keep them small
+	const uint32_t maxChunk = reference ? UINT16_MAX : ScratchSize;
+	while (length > 0)
+	{
+		uint16_t chunk = length > maxChunk ? maxChunk : length;
+
+		// the connection turns data away while its send queue is full, acknowledgements free it
+		// and give _sendReady, a give that came before the refusal only costs one more try
+		TimeLimit wait;
+		while (!(reference ? _connection->SendReference(data, chunk) : _connection->Send(data, chunk)))
+		{
+			const uint32_t elapsed = wait.ElapsedTime();
+			if (elapsed >= SendTimeout || !_sendReady.Take(pdMS_TO_TICKS(SendTimeout - elapsed)))
+				return false;
+		}
+		data += chunk;
+		length -= chunk;
+	}
+	return true;
+}
+
+uint16_t MqttPath::nextPacketId()
+{
+	// 0 is not a valid packet identifier
+	if (++_packetId == 0)
+		_packetId = 1;
+	return _packetId;
+}
+
+void MqttPath::fail(const char *reason)
+{
+	Logger::LogError(Logger::LogSource::Gateway, "Mqtt failed: %s", reason);
+	_executionResult = ConnectionExecutionResult::Error;
+	_state = State::Failed;
+}
+
+} // namespace Protocol
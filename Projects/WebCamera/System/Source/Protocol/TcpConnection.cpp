@@ -1,5 +1,6 @@
 #include "lwip/tcpip.h"
 #include <cstring>
+#include <algorithm>
 #include "Hardware.h"
 #include "TcpConnection.h"
 #include "Logger.h"
@@ -11,6 +12,8 @@ namespace Protocol
 
 using Utilities::DebugAssert;
 
+std::atomic<TaskHandle_t> TcpConnection::_tcpipTask{nullptr};
+
 BaseConnection::ConnectStatus TcpConnection::DoConnect(const RemoteConnection &remoteConnection)
 {
     _port = remoteConnection.Port;
@@ -23,20 +26,35 @@ BaseConnection::ConnectStatus TcpConnection::DoConnect(const RemoteConnection &r
 
     Logger::LogInfo(Logger::LogSource::Wifi, "DNS resolved %s to %s", remoteConnection.Address.data(), ipaddr_ntoa(&ipAddress));
 
+    _remoteAddress = ipAddress;
+    if (!runOnTcpip(&TcpConnection::connectPcb) || _connectStatus == BaseConnection::ConnectStatus::Failed)
+        return BaseConnection::ConnectStatus::Failed;
+
+    _isConnected = true;
+    return BaseConnection::ConnectStatus::Connecting;
+}
+
+void TcpConnection::connectPcb()
+{
+    _connectStatus = BaseConnection::ConnectStatus::Failed;
     if (_pcb != nullptr)
         Logger::LogInfo(Logger::LogSource::Wifi, "PCB exists already %p", (void *)_pcb);
     else
     {
         _pcb = tcp_new();
         if (_pcb == nullptr)
-            return BaseConnection::ConnectStatus::Failed;
+            return;
 
         Logger::LogInfo(Logger::LogSource::Wifi, "New PCB Allocated %p", (void *)_pcb);
     }
 
-    while (tcp_bind(_pcb, IP_ADDR_ANY, _port) != ERR_OK)
+    // the tcpip task cannot wait for the port to be released, the caller's retry comes back for it
+    err_t err = tcp_bind(_pcb, IP_ADDR_ANY, _port);
+    if (err != ERR_OK)
     {
-        vTaskDelay(20);
+        Logger::LogError(Logger::LogSource::Wifi, "tcp_bind failed: %s", DebugAssert::GetLwipErrorName(err));
+        clearPcbHandler(this, _pcb);
+        return;
     }
 
     tcp_arg(_pcb, this);
@@ -44,11 +62,16 @@ BaseConnection::ConnectStatus TcpConnection::DoConnect(const RemoteConnection &r
     tcp_err(_pcb, errorHandler);
     tcp_poll(_pcb, pollHandler, 10);
     tcp_sent(_pcb, sentHandler);
-    tcp_connect(_pcb, &ipAddress, remoteConnection.Port, connectedHandler);
+    if (tcp_connect(_pcb, &_remoteAddress, _port, connectedHandler) != ERR_OK)
+    {
+        clearPcbHandler(this, _pcb);
+        return;
+    }
 
+    // connectedHandler or errorHandler reports the outcome, both run after this
+    _connectStatus = BaseConnection::ConnectStatus::Connecting;
+    SetConnectionState(ConnectionState::Connecting);
     ConnectionChanged(ConnectionChangeReason::None);
-    _isConnected = true;
-    return BaseConnection::ConnectStatus::SuccessfullyConnected;
 }
 
 err_t TcpConnection::connectedHandler(void *arg, struct tcp_pcb *pcb, err_t err)
@@ -69,6 +92,7 @@ err_t TcpConnection::connectedHandler(void *arg, struct tcp_pcb *pcb, err_t err)
 
     tcpConnection->SetConnectionState(ConnectionState::Connected);
     tcpConnection->ConnectionChanged(ConnectionChangeReason::None);
+    tcpConnection->flush();
 
     return ERR_OK;
 }
@@ -81,6 +105,15 @@ err_t TcpConnection::sentHandler(void *arg, struct tcp_pcb *pcb, u16_t len)
     TcpConnection *tcpConnection = reinterpret_cast<TcpConnection *>(arg);
 
     tcpConnection->ResetTimeout();
+    bool released = tcpConnection->acknowledge(len);
+    tcpConnection->flush();
+
+    // the window reopened for a producer that was turned away, or its referenced data is free
+    if (released && (tcpConnection->_sendBlocked || tcpConnection->_queueHead == tcpConnection->_queueTail))
+    {
+        tcpConnection->_sendBlocked = false;
+        tcpConnection->SendReady();
+    }
     return (ERR_OK);
 }
 
@@ -92,6 +125,9 @@ void TcpConnection::errorHandler(void *arg, err_t err)
 
     Logger::LogInfo(Logger::LogSource::Wifi, "An Error happened: %s", DebugAssert::GetLwipErrorName(err));
 
+    // lwIP already freed the pcb
+    tcpConnection->_pcb = nullptr;
+    tcpConnection->dropQueue();
     tcpConnection->Reset();
     tcpConnection->SetConnectionState(ConnectionState::Disconnected);
 
@@ -147,15 +183,20 @@ err_t TcpConnection::receiveHandler(void *arg, struct tcp_pcb *pcb, struct pbuf
     {
         if (p != NULL)
         {
-            pbuf *temp_p = p;
             u16_t totalBytes = p->tot_len;
-            while (temp_p != NULL)
+            PbufChain chain(p);
+
+            // a chain consumer reopens the window itself once it is done with the data
+            if (tcpConnection->ChainReceived(chain) == false)
             {
-                tcpConnection->DataReceived((const char *)temp_p->payload, temp_p->len);
-                temp_p = temp_p->next;
+                chain.ForEachSegment([tcpConnection](const uint8_t *data, uint16_t length) {
+                    tcpConnection->DataReceived((const char *)data, length);
+                });
+
+                // the handler may have closed the connection, the pcb is gone then
+                if (tcpConnection->_pcb == pcb)
+                    tcp_recved(pcb, totalBytes);
             }
-            pbuf_free(p);
-            tcp_recved(pcb, totalBytes);
         }
         else if (p == NULL) // Server closed connection
         {
@@ -197,6 +238,7 @@ void TcpConnection::clearPcbHandler(TcpConnection *tcpConnection, tcp_pcb *pcb)
     tcp_err(pcb, NULL);
     tcp_poll(pcb, NULL, 0);
     tcp_close(pcb);
+    tcpConnection->dropQueue();
 
     Logger::LogInfo(Logger::LogSource::Wifi, "Deleting pcb, port %i.", localPort);
     // _isConnected = false;
@@ -204,11 +246,198 @@ void TcpConnection::clearPcbHandler(TcpConnection *tcpConnection, tcp_pcb *pcb)
 
 bool TcpConnection::DoSend(const unsigned char *data, uint16_t length)
 {
-    // To-Do
+    return enqueue(data, length, true);
+}
+
+bool TcpConnection::DoSendReference(const unsigned char *data, uint16_t length)
+{
+    return enqueue(data, length, false);
+}
+
+bool TcpConnection::HasPendingSend()
+{
+    return _queueHead != _queueTail;
+}
+
+bool TcpConnection::enqueue(const uint8_t *data, uint16_t length, bool copy)
+{
+    if (_pcb == nullptr)
+        return false;
+    if (length == 0)
+        return true;
+
+    // a copy that wraps around the end of the staging buffer takes two entries
+    uint32_t stagingTail = _stagingTail;
+    uint16_t offset = stagingTail % StagingSize;
+    uint16_t first = copy ? std::min<uint16_t>(length, StagingSize - offset) : length;
+    uint8_t entries = first < length ? 2 : 1;
+
+    bool stagingFull = copy && length > StagingSize - (stagingTail - _stagingHead);
+    if (stagingFull || _queueTail - _queueHead + entries > MaxSendEntries)
+    {
+        _sendBlocked = true;
+        return false;
+    }
+
+    uint32_t queueTail = _queueTail;
+    if (copy)
+    {
+        memcpy(&_staging[offset], data, first);
+        memcpy(&_staging[0], data + first, length - first);
+        _sendQueue[queueTail % MaxSendEntries] = {&_staging[offset], first, 0, 0, stagingTail + first};
+        if (entries == 2)
+            _sendQueue[(queueTail + 1) % MaxSendEntries] = {&_staging[0], static_cast<uint16_t>(length - first), 0, 0, stagingTail + length};
+        _stagingTail = stagingTail + length;
+    }
+    else
+    {
+        _sendQueue[queueTail % MaxSendEntries] = {data, length, 0, 0, stagingTail};
+    }
+
+    // publishes the entries to the tcpip task
+    _queueTail = queueTail + entries;
+    scheduleCallback();
+    return true;
+}
+
+void TcpConnection::DoConsume(uint16_t length)
+{
+    _consumed += length;
+    scheduleCallback();
+}
+
+void TcpConnection::scheduleCallback()
+{
+    // raw API calls belong on the tcpip task, one pending callback is enough
+    if (_callbackScheduled.exchange(true))
+        return;
+
+    if (tcpip_callback(tcpipCallback, this) != ERR_OK)
+        _callbackScheduled = false;
+}
+
+bool TcpConnection::runOnTcpip(void (TcpConnection::*work)())
+{
+    // already there, for example closing from one of the handlers
+    if (xTaskGetCurrentTaskHandle() == _tcpipTask)
+    {
+        (this->*work)();
+        return true;
+    }
+
+    _apiWork = work;
+    err_t err = tcpip_callback(apiCallback, this);
+    if (err != ERR_OK)
+    {
+        Logger::LogError(Logger::LogSource::Wifi, "tcpip_callback failed: %s", DebugAssert::GetLwipErrorName(err));
+        return false;
+    }
+    _apiDone.Take();
     return true;
 }
 
+void TcpConnection::apiCallback(void *arg)
+{
+    TcpConnection *tcpConnection = reinterpret_cast<TcpConnection *>(arg);
+    _tcpipTask = xTaskGetCurrentTaskHandle();
+    (tcpConnection->*tcpConnection->_apiWork)();
+    tcpConnection->_apiDone.Give();
+}
+
+void TcpConnection::tcpipCallback(void *arg)
+{
+    TcpConnection *tcpConnection = reinterpret_cast<TcpConnection *>(arg);
+    _tcpipTask = xTaskGetCurrentTaskHandle();
+    tcpConnection->_callbackScheduled = false;
+    tcpConnection->applyConsumed();
+    tcpConnection->flush();
+}
+
+void TcpConnection::applyConsumed()
+{
+    uint32_t consumed = _consumed.exchange(0);
+    if (_pcb == nullptr)
+        return;
+
+    while (consumed > 0)
+    {
+        u16_t length = std::min<uint32_t>(consumed, UINT16_MAX);
+        tcp_recved(_pcb, length);
+        consumed -= length;
+    }
+}
+
+void TcpConnection::flush()
+{
+    if (_pcb == nullptr)
+        return;
+
+    bool written = false;
+    while (_queueWrite != _queueTail)
+    {
+        // stop at the send buffer or segment limit, sentHandler() continues from here
+        uint16_t room = tcp_sndbuf(_pcb);
+        if (room == 0 || tcp_sndqueuelen(_pcb) >= TCP_SND_QUEUELEN)
+            break;
+
+        SendEntry &entry = _sendQueue[_queueWrite % MaxSendEntries];
+        uint16_t length = std::min<uint16_t>(room, entry.Length - entry.Written);
+        bool more = entry.Written + length < entry.Length || _queueWrite + 1 != _queueTail;
+        err_t err = tcp_write(_pcb, entry.Data + entry.Written, length, more ? TCP_WRITE_FLAG_MORE : 0);
+        if (err == ERR_MEM)
+            break;
+        if (err != ERR_OK)
+        {
+            Logger::LogError(Logger::LogSource::Wifi, "tcp_write failed: %s", DebugAssert::GetLwipErrorName(err));
+            break;
+        }
+
+        written = true;
+        entry.Written += length;
+        if (entry.Written == entry.Length)
+            _queueWrite++;
+    }
+
+    if (written)
+        tcp_output(_pcb);
+}
+
+bool TcpConnection::acknowledge(uint16_t length)
+{
+    // acknowledgements arrive in the order the entries were written
+    bool released = false;
+    while (length > 0 && _queueHead != _queueTail)
+    {
+        SendEntry &entry = _sendQueue[_queueHead % MaxSendEntries];
+        uint16_t acknowledged = std::min<uint16_t>(length, entry.Written - entry.Acknowledged);
+        entry.Acknowledged += acknowledged;
+        length -= acknowledged;
+        if (entry.Acknowledged < entry.Length)
+            break;
+
+        _stagingHead = entry.StagingEnd;
+        _queueHead++;
+        released = true;
+    }
+    return released;
+}
+
+void TcpConnection::dropQueue()
+{
+    _queueHead = _queueTail.load();
+    _queueWrite = _queueTail.load();
+    _stagingHead = _stagingTail.load();
+    _sendBlocked = false;
+    _consumed = 0;
+}
+
 void TcpConnection::DoClose()
+{
+    // waits for the tcpip task, no handler sees this connection once Close() returned
+    runOnTcpip(&TcpConnection::closePcb);
+}
+
+void TcpConnection::closePcb()
 {
     if (_pcb == nullptr)
         return;
@@ -216,9 +445,6 @@ void TcpConnection::DoClose()
     Logger::LogInfo(Logger::LogSource::Wifi, "Closing Connection port %i.\n", _port);
 
     clearPcbHandler(this, _pcb);
-    _pcb = nullptr;
-
-    return;
 }
 
 void TcpConnection::DoReset()
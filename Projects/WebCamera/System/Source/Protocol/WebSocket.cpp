@@ -1,41 +1,749 @@
 #include "WebSocket.h"
+#include <strings.h>
+#include "Hardware.h"
+#include "Logger.h"
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
 
 namespace Protocol
 {
 
-void WebsocketPath::receivedData(const uint8_t *data, uint16_t length)
+using Hal::Hardware;
+using Utilities::Logger;
+
+namespace
+{
+
+/// @brief	Case insensitive search for a token in a comma separated header value.
+bool containsToken(const char *value, const char *token)
+{
+	if (value == nullptr)
+		return false;
+
+	const size_t tokenLength = strlen(token);
+	for (; *value != '\0'; value++)
+	{
+		if (strncasecmp(value, token, tokenLength) == 0)
+			return true;
+	}
+	return false;
+}
+
+} // namespace
+
+void WebsocketPath::SetTarget(const char *host, const char *path)
 {
+	_host = host;
+	_path = path;
 }
 
-void WebsocketPath::connectionStateChanged(ConnectionState state, ConnectionChangeReason reason)
+void WebsocketPath::ApplyMask(uint8_t *data, uint32_t length, uint32_t mask, uint32_t offset)
 {
+	// mask holds the key bytes in wire order, payload byte i uses key byte i % 4
+	uint8_t key[4];
+	memcpy(key, &mask, sizeof(key));
+
+	while (length > 0 && (reinterpret_cast<uintptr_t>(data) & 3) != 0)
+	{
+		*data++ ^= key[offset++ & 3];
+		length--;
+	}
+
+	// rotate the key so it lines up with the aligned words
+	uint8_t rotated[4];
+	for (uint8_t i = 0; i < 4; i++)
+		rotated[i] = key[(offset + i) & 3];
+	uint32_t wordKey;
+	memcpy(&wordKey, rotated, sizeof(wordKey));
+
+	uint32_t *words = reinterpret_cast<uint32_t *>(data);
+	for (uint32_t count = length / 4; count > 0; count--)
+		*words++ ^= wordKey;
+
+	data = reinterpret_cast<uint8_t *>(words);
+	for (uint8_t i = 0; i < (length & 3); i++)
+		data[i] ^= rotated[i];
+}
+
+bool WebsocketPath::ComputeAccept(const char *key, uint8_t keyLength, char *accept, uint8_t acceptSize)
+{
+	static constexpr char Guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+	uint8_t digest[20];
+	mbedtls_sha1_context context;
+	mbedtls_sha1_init(&context);
+	int result = mbedtls_sha1_starts_ret(&context);
+	if (result == 0)
+		result = mbedtls_sha1_update_ret(&context, reinterpret_cast<const unsigned char *>(key), keyLength);
+	if (result == 0)
+		result = mbedtls_sha1_update_ret(&context, reinterpret_cast<const unsigned char *>(Guid), sizeof(Guid) - 1);
+	if (result == 0)
+		result = mbedtls_sha1_finish_ret(&context, digest);
+	mbedtls_sha1_free(&context);
+	if (result != 0)
+		return false;
+
+	size_t written = 0;
+	return mbedtls_base64_encode(reinterpret_cast<unsigned char *>(accept), acceptSize, &written, digest, sizeof(digest)) == 0;
+}
+
+bool WebsocketPath::SendBinary(const uint8_t *data, uint32_t length)
+{
+	return _state == State::Open && send(WebsocketOpcode::Binary, data, length);
+}
+
+bool WebsocketPath::SendBinaryReference(const uint8_t *data, uint32_t length)
+{
+	return _state == State::Open && send(WebsocketOpcode::Binary, data, length, true);
+}
+
+bool WebsocketPath::SendText(const char *text)
+{
+	return _state == State::Open && send(WebsocketOpcode::Text, reinterpret_cast<const uint8_t *>(text), strlen(text));
+}
+
+bool WebsocketPath::SendPing()
+{
+	if (_state != State::Open || !send(WebsocketOpcode::Ping, nullptr, 0))
+		return false;
+
+	_pongPending = true;
+	_pingTimer.Reset();
+	return true;
 }
 
 bool WebsocketPath::sendFrame(const uint8_t *data, uint16_t length)
 {
-    return false;
+	return SendBinary(data, length);
+}
+
+void WebsocketPath::setConnection()
+{
+	if (_connection == nullptr)
+		return;
+
+	_connection->SetDataReceived(MakeDelegate(this, &WebsocketPath::onDataReceived));
+	_connection->SetSendReady(MakeDelegate(this, &WebsocketPath::onSendReady));
+	_connection->SetConnectionStateChanged(MakeDelegate(this, &WebsocketPath::connectionStateChanged));
+}
+
+bool WebsocketPath::isTerminated() const
+{
+	return _state == State::Closed;
+}
+
+bool WebsocketPath::start(BaseRouteHandler::ConnectionMode connectionMode, RemoteConnection *address, uint8_t processingIndex, uint8_t processingLogicalId)
+{
+	if (_connection == nullptr)
+		return false;
+
+	_executionResult = ConnectionExecutionResult::Working;
+	_headerLength = 0;
+	_inPayload = false;
+	_hayStackWorkingLength = 0;
+	_messageActive = false;
+	_pongPending = false;
+	_pendingReplies = 0;
+	_timer.Reset();
+	_parser.SetProcessRequestLine(MakeDelegate(this, &WebsocketPath::onRequestLine));
+
+	if (address != nullptr)
+	{
+		_role = Role::Client;
+		_remoteConnection = *address;
+		_state = State::Connecting;
+		return _connection->Connect(*address) != BaseConnection::ConnectStatus::Failed;
+	}
+
+	// the peer connected to us, its first bytes are the upgrade request
+	_role = Role::Server;
+	_requestMethod = HttpMethod::Unknown;
+	_parser.HttpInit(&_roundtripper, this, HttpParserMode::Request);
+	_state = State::Handshake;
+	return true;
+}
+
+void WebsocketPath::terminate()
+{
+	if (_state == State::Open || _state == State::Accepting)
+	{
+		close(CloseNormal);
+		return;
+	}
+
+	if (_state != State::Closed && _state != State::Closing && _state != State::Answering)
+	{
+		_state = State::Closed;
+		if (_connection != nullptr)
+			_connection->Close();
+	}
+}
+
+void WebsocketPath::process()
+{
+	if (_pendingReplies != 0 && _state != State::Closed)
+		sendPendingReplies();
+
+	switch (_state)
+	{
+	case State::Connecting:
+	case State::Handshake:
+	case State::Accepting:
+		if (_timer.IsTimeUp(HandshakeTimeout))
+			fail("handshake timeout");
+		break;
+
+	case State::Open:
+		if (_pingTimer.IsTimeUp(PingInterval))
+		{
+			if (_pongPending)
+				fail("no pong received");
+			else
+				SendPing();
+		}
+		break;
+
+	case State::Closing:
+	case State::Answering:
+		if (_timer.IsTimeUp(HandshakeTimeout))
+		{
+			_state = State::Closed;
+			_connection->Close();
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+void WebsocketPath::connectionStateChanged(ConnectionState state, ConnectionChangeReason reason)
+{
+	if (state == ConnectionState::Connected && _state == State::Connecting && _role == Role::Client)
+	{
+		queueReply(ReplyHandshake);
+		return;
+	}
+
+	if (state == ConnectionState::Disconnected && _state != State::Closed)
+	{
+		if (_state != State::Closing && _state != State::Answering)
+			_executionResult = ConnectionExecutionResult::Error;
+		_state = State::Closed;
+	}
+}
+
+void WebsocketPath::onDataReceived(const char *data, uint16_t length)
+{
+	receivedData(reinterpret_cast<const uint8_t *>(data), length);
+}
+
+void WebsocketPath::onSendReady()
+{
+	_sendReady.Give();
+}
+
+void WebsocketPath::receivedData(const uint8_t *data, uint16_t length)
+{
+	if (_state == State::Handshake)
+	{
+		// frames may follow the handshake in the same segment
+		uint16_t used = handshakeData(data, length);
+		data += used;
+		length -= used;
+	}
+
+	// a client may send frames right behind its upgrade request, they are answered after the 101
+	if (_state == State::Accepting || _state == State::Open || _state == State::Closing)
+		frameData(data, length);
+}
+
+bool WebsocketPath::onRequestLine(void *opaque, const HttpRequestLine &line)
+{
+	_requestMethod = line.Method;
+	return true;
+}
+
+uint16_t WebsocketPath::handshakeData(const uint8_t *data, uint16_t length)
+{
+	int read = 0;
+	_parser.HttpProcessData(&_roundtripper, reinterpret_cast<const char *>(data), length, &read);
+	if (_parser.IsAnyHttpError(&_roundtripper))
+	{
+		fail("malformed handshake");
+		return length;
+	}
+
+	if (!_parser.HttpHeaderParsed(&_roundtripper))
+		return length;
+
+	bool accepted = _role == Role::Server ? acceptServerHandshake() : verifyServerHandshake();
+	if (!accepted)
+		return length;
+
+	if (_role == Role::Server)
+	{
+		// opened by Process() once the response is out
+		_state = State::Accepting;
+		queueReply(ReplyHandshake);
+		return read;
+	}
+
+	_state = State::Open;
+	_executionResult = ConnectionExecutionResult::Success;
+	_pingTimer.Reset();
+	Logger::LogInfo(Logger::LogSource::Gateway, "Websocket open as client");
+	return read;
+}
+
+bool WebsocketPath::sendClientHandshake()
+{
+	uint8_t nonce[16];
+	for (uint8_t i = 0; i < sizeof(nonce); i += 4)
+	{
+		uint32_t number = Hardware::Instance()->GetRng().GetNumber();
+		memcpy(nonce + i, &number, sizeof(number));
+	}
+
+	char key[25];
+	size_t written = 0;
+	if (mbedtls_base64_encode(reinterpret_cast<unsigned char *>(key), sizeof(key), &written, nonce, sizeof(nonce)) != 0 ||
+		!ComputeAccept(key, written, _accept.data(), _accept.size()))
+		return false;
+
+	_parser.HttpInit(&_roundtripper, this, HttpParserMode::Response);
+	const char *host = _host[0] != '\0' ? _host : _remoteConnection.Address.data();
+	int length = snprintf(reinterpret_cast<char *>(_scratch.data()), _scratch.size(),
+						  "GET %s HTTP/1.1\r\n"
+						  "Host: %s\r\n"
+						  "Upgrade: websocket\r\n"
+						  "Connection: Upgrade\r\n"
+						  "Sec-WebSocket-Key: %s\r\n"
+						  "Sec-WebSocket-Version: 13\r\n\r\n",
+						  _path, host, key);
+	if (length <= 0 || length >= static_cast<int>(_scratch.size()))
+		return false;
+
+	_state = State::Handshake;
+	_timer.Reset();
+	return sendRaw(_scratch.data(), length);
+}
+
+bool WebsocketPath::acceptServerHandshake()
+{
+	const HttpHeaderIndex &headers = _parser.GetHeaderIndex();
+	const char *version = headers.Get(HttpHeaderId::SecWebSocketVersion);
+
+	bool valid = _requestMethod == HttpMethod::Get &&
+				 containsToken(headers.Get(HttpHeaderId::Upgrade), "websocket") &&
+				 containsToken(headers.Get(HttpHeaderId::Connection), "upgrade") &&
+				 version != nullptr && strcmp(version, "13") == 0 &&
+				 headers.Has(HttpHeaderId::SecWebSocketKey) && !headers.IsTruncated(HttpHeaderId::SecWebSocketKey) &&
+				 ComputeAccept(headers.Get(HttpHeaderId::SecWebSocketKey), headers.GetLength(HttpHeaderId::SecWebSocketKey), _accept.data(), _accept.size());
+	if (!valid)
+	{
+		Logger::LogError(Logger::LogSource::Gateway, "Websocket failed: %s", "invalid upgrade request");
+		_executionResult = ConnectionExecutionResult::Error;
+		_state = State::Answering;
+		_timer.Reset();
+		queueReply(ReplyReject);
+		return false;
+	}
+	return true;
+}
+
+bool WebsocketPath::sendServerHandshake()
+{
+	int length = snprintf(reinterpret_cast<char *>(_scratch.data()), _scratch.size(),
+						  "HTTP/1.1 101 Switching Protocols\r\n"
+						  "Upgrade: websocket\r\n"
+						  "Connection: Upgrade\r\n"
+						  "Sec-WebSocket-Accept: %s\r\n\r\n",
+						  _accept.data());
+	return sendRaw(_scratch.data(), length);
+}
+
+bool WebsocketPath::verifyServerHandshake()
+{
+	const HttpHeaderIndex &headers = _parser.GetHeaderIndex();
+	const char *accept = headers.Get(HttpHeaderId::SecWebSocketAccept);
+
+	if (_roundtripper.code != 101 ||
+		!containsToken(headers.Get(HttpHeaderId::Upgrade), "websocket") ||
+		accept == nullptr || strcmp(accept, _accept.data()) != 0)
+	{
+		fail("upgrade refused by server");
+		return false;
+	}
+	return true;
+}
+
+void WebsocketPath::frameData(const uint8_t *data, uint16_t length)
+{
+	while (length > 0 && (_state == State::Accepting || _state == State::Open || _state == State::Closing))
+	{
+		if (!_inPayload)
+		{
+			_header[_headerLength++] = *data++;
+			length--;
+
+			// the header size is known after the second byte
+			uint8_t required = 2;
+			if (_headerLength >= 2)
+			{
+				const uint8_t length7 = _header[1] & 0x7F;
+				required += (length7 == 126 ? 2 : length7 == 127 ? 8 : 0) + ((_header[1] & 0x80) ? 4 : 0);
+			}
+			if (_headerLength < required)
+				continue;
+
+			if (!decodeHeader())
+			{
+				// the stream can not be framed any more, nothing behind this is trusted
+				fail("protocol error", CloseProtocolError);
+				return;
+			}
+			_inPayload = true;
+			_payloadReceived = 0;
+			if (_payloadLength == 0)
+				finishFrame();
+			continue;
+		}
+
+		uint64_t remaining = _payloadLength - _payloadReceived;
+		uint16_t chunk = remaining < length ? static_cast<uint16_t>(remaining) : length;
+
+		uint8_t *destination = nullptr;
+		if (static_cast<uint8_t>(_opcode) >= static_cast<uint8_t>(WebsocketOpcode::Close))
+			destination = _control.data() + _payloadReceived;
+		else if (!_messageTooBig && _hayStackWorkingLength + _payloadReceived + chunk <= MaxMessageLength)
+			destination = reinterpret_cast<uint8_t *>(_hayStack.data()) + _hayStackWorkingLength + _payloadReceived;
+		else
+			_messageTooBig = true;
+
+		if (destination != nullptr)
+		{
+			memcpy(destination, data, chunk);
+			if (_masked)
+				ApplyMask(destination, chunk, _mask, _payloadReceived);
+		}
+
+		_payloadReceived += chunk;
+		data += chunk;
+		length -= chunk;
+		if (_payloadReceived == _payloadLength)
+			finishFrame();
+	}
+}
+
+bool WebsocketPath::decodeHeader()
+{
+	// no extensions are negotiated, so the reserved bits must be clear
+	if (_header[0] & 0x70)
+		return false;
+
+	_final = (_header[0] & 0x80) != 0;
+	_opcode = static_cast<WebsocketOpcode>(_header[0] & 0x0F);
+	_masked = (_header[1] & 0x80) != 0;
+
+	uint8_t position = 2;
+	_payloadLength = _header[1] & 0x7F;
+	if (_payloadLength == 126)
+	{
+		_payloadLength = (_header[2] << 8) | _header[3];
+		position = 4;
+	}
+	else if (_payloadLength == 127)
+	{
+		_payloadLength = 0;
+		for (position = 2; position < 10; position++)
+			_payloadLength = (_payloadLength << 8) | _header[position];
+	}
+
+	if (_masked)
+		memcpy(&_mask, &_header[position], sizeof(_mask));
+
+	// clients mask every frame, servers never do
+	if (_masked != (_role == Role::Server))
+		return false;
+
+	switch (_opcode)
+	{
+	case WebsocketOpcode::Close:
+	case WebsocketOpcode::Ping:
+	case WebsocketOpcode::Pong:
+		return _final && _payloadLength <= MaxControlPayload;
+
+	case WebsocketOpcode::Continuation:
+		return _messageActive;
+
+	case WebsocketOpcode::Text:
+	case WebsocketOpcode::Binary:
+		if (_messageActive)
+			return false;
+		_messageActive = true;
+		_messageOpcode = _opcode;
+		_messageTooBig = false;
+		_hayStackWorkingLength = 0;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+void WebsocketPath::finishFrame()
+{
+	_headerLength = 0;
+	_inPayload = false;
+
+	if (static_cast<uint8_t>(_opcode) >= static_cast<uint8_t>(WebsocketOpcode::Close))
+	{
+		finishControl();
+		return;
+	}
+
+	if (!_messageTooBig)
+		_hayStackWorkingLength += _payloadLength;
+
+	if (!_final)
+		return;
+
+	_messageActive = false;
+	if (_messageTooBig)
+	{
+		close(CloseMessageTooBig);
+		return;
+	}
+
+	if (_onMessageReceived)
+		_onMessageReceived(_messageOpcode, reinterpret_cast<const uint8_t *>(_hayStack.data()), _hayStackWorkingLength);
+	_hayStackWorkingLength = 0;
 }
 
-void setConnection()
+void WebsocketPath::finishControl()
 {
+	const uint8_t length = static_cast<uint8_t>(_payloadLength);
+	switch (_opcode)
+	{
+	case WebsocketOpcode::Ping:
+		// while a pong is still owed the newer ping is answered by it
+		if ((_state == State::Accepting || _state == State::Open) && (_pendingReplies & ReplyPong) == 0)
+		{
+			memcpy(_pongPayload.data(), _control.data(), length);
+			_pongLength = length;
+			queueReply(ReplyPong);
+		}
+		break;
+
+	case WebsocketOpcode::Pong:
+		_pongPending = false;
+		break;
+
+	case WebsocketOpcode::Close:
+		// answer with the same status code, the connection is done once that is out
+		if (_state == State::Accepting || _state == State::Open)
+		{
+			queueClose(length >= 2 ? (_control[0] << 8) | _control[1] : CloseNone, State::Answering);
+			break;
+		}
+		_state = State::Closed;
+		_connection->Close();
+		break;
+
+	default:
+		break;
+	}
 }
 
-bool isTerminated()
+bool WebsocketPath::send(WebsocketOpcode opcode, const uint8_t *data, uint32_t length, bool reference)
 {
-    return false;
+	if (_connection == nullptr)
+		return false;
+
+	uint8_t header[MaxFrameHeader];
+	uint8_t headerLength = 0;
+	const uint8_t maskBit = _role == Role::Client ? 0x80 : 0x00;
+
+	header[headerLength++] = 0x80 | static_cast<uint8_t>(opcode);
+	if (length < 126)
+	{
+		header[headerLength++] = maskBit | length;
+	}
+	else if (length <= 0xFFFF)
+	{
+		header[headerLength++] = maskBit | 126;
+		header[headerLength++] = length >> 8;
+		header[headerLength++] = length;
+	}
+	else
+	{
+		header[headerLength++] = maskBit | 127;
+		for (uint8_t i = 0; i < 4; i++)
+			header[headerLength++] = 0;
+		for (int8_t shift = 24; shift >= 0; shift -= 8)
+			header[headerLength++] = length >> shift;
+	}
+
+	// control frames keep the connection alive and are never dropped, data frames are
+	// dropped as a whole while the budget is spent
+	const bool control = static_cast<uint8_t>(opcode) >= static_cast<uint8_t>(WebsocketOpcode::Close);
+	if (!control && !admit(headerLength + (maskBit ? sizeof(uint32_t) : 0) + length))
+		return false;
+
+	if (_role == Role::Server)
+	{
+		if (!sendRaw(header, headerLength))
+			return false;
+		if (!sendRaw(data, length, reference))
+		{
+			// the header is out already, the stream can not be framed any more
+			fail("send timed out");
+			return false;
+		}
+		return true;
+	}
+
+	uint32_t mask = Hardware::Instance()->GetRng().GetNumber();
+	memcpy(header + headerLength, &mask, sizeof(mask));
+	headerLength += sizeof(mask);
+	if (!sendRaw(header, headerLength))
+		return false;
+
+	for (uint32_t offset = 0; offset < length; offset += ScratchSize)
+	{
+		uint16_t chunk = length - offset < ScratchSize ? length - offset : ScratchSize;
+		memcpy(_scratch.data(), data + offset, chunk);
+		ApplyMask(_scratch.data(), chunk, mask, offset);
+		if (!sendRaw(_scratch.data(), chunk))
+		{
+			fail("send timed out");
+			return false;
+		}
+	}
+	return true;
 }
 
-bool start(BaseRouteHandler::ConnectionMode connectionMode, RemoteConnection *address, uint8_t processingIndex, uint8_t processingLogicalId)
+bool WebsocketPath::sendRaw(const uint8_t *data, uint32_t length, bool reference)
 {
-    return false;
+	// copies go through the connection's own buffer, keep them small
+	const uint32_t maxChunk = reference ? UINT16_MAX : ScratchSize;
+	while (length > 0)
+	{
+		uint16_t chunk = length > maxChunk ? maxChunk : length;
+
+		// the connection turns data away while its send queue is full, acknowledgements free it
+		// and give _sendReady, a give that came before the refusal only costs one more try
+		TimeLimit wait;
+		while (!(reference ? _connection->SendReference(data, chunk) : _connection->Send(data, chunk)))
+		{
+			const uint32_t elapsed = wait.ElapsedTime();
+			if (elapsed >= SendTimeout || !_sendReady.Take(pdMS_TO_TICKS(SendTimeout - elapsed)))
+				return false;
+		}
+		data += chunk;
+		length -= chunk;
+	}
+	return true;
 }
 
-void terminate()
+void WebsocketPath::close(uint16_t code)
 {
+	if (_state != State::Accepting && _state != State::Open)
+		return;
+
+	queueClose(code, State::Closing);
+}
+
+void WebsocketPath::queueClose(uint16_t code, State next)
+{
+	_closeCode = code;
+	_state = next;
+	_timer.Reset();
+	queueReply(ReplyClose);
+}
+
+void WebsocketPath::queueReply(PendingReply reply)
+{
+	_pendingReplies |= reply;
+}
+
+void WebsocketPath::sendPendingReplies()
+{
+	// the 101 goes first, pongs and a close answering frames sent behind the upgrade request follow it
+	const uint8_t pending = _pendingReplies;
+	if (pending & ReplyReject)
+	{
+		static constexpr char Reject[] = "HTTP/1.1 400 Bad Request\r\n"
+										 "Sec-WebSocket-Version: 13\r\n"
+										 "Content-Length: 0\r\n"
+										 "Connection: close\r\n\r\n";
+		sendRaw(reinterpret_cast<const uint8_t *>(Reject), sizeof(Reject) - 1);
+		_pendingReplies = 0;
+		_state = State::Closed;
+		_connection->Close();
+		return;
+	}
+
+	if (pending & ReplyHandshake)
+	{
+		bool sent = _role == Role::Server ? sendServerHandshake() : sendClientHandshake();
+		_pendingReplies &= ~ReplyHandshake;
+		if (!sent)
+		{
+			fail("handshake not sent");
+			return;
+		}
+
+		if (_role == Role::Server && _state == State::Accepting)
+		{
+			_state = State::Open;
+			_executionResult = ConnectionExecutionResult::Success;
+			_pingTimer.Reset();
+			Logger::LogInfo(Logger::LogSource::Gateway, "Websocket open as server");
+		}
+	}
+
+	// left queued if the connection is still full, the next call tries again
+	if ((pending & ReplyPong) && send(WebsocketOpcode::Pong, _pongPayload.data(), _pongLength))
+		_pendingReplies &= ~ReplyPong;
+
+	if (pending & ReplyClose)
+	{
+		const uint8_t payload[2] = {static_cast<uint8_t>(_closeCode >> 8), static_cast<uint8_t>(_closeCode)};
+		if (!send(WebsocketOpcode::Close, payload, _closeCode != CloseNone ? sizeof(payload) : 0))
+			return;
+
+		_pendingReplies &= ~ReplyClose;
+		if (_state == State::Answering)
+		{
+			_state = State::Closed;
+			_connection->Close();
+		}
+	}
+}
+
+void WebsocketPath::fail(const char *reason, uint16_t code)
+{
+	if (_state != State::Accepting && _state != State::Open)
+	{
+		fail(reason);
+		return;
+	}
+
+	// the peer is told why before the connection goes
+	Logger::LogError(Logger::LogSource::Gateway, "Websocket failed: %s", reason);
+	_executionResult = ConnectionExecutionResult::Error;
+	queueClose(code, State::Answering);
 }
 
-void process()
+void WebsocketPath::fail(const char *reason)
 {
+	Logger::LogError(Logger::LogSource::Gateway, "Websocket failed: %s", reason);
+	_executionResult = ConnectionExecutionResult::Error;
+	_state = State::Closed;
+	if (_connection != nullptr)
+		_connection->Close();
 }
 
-} // namespace Protocol
\ No newline at end of file
+} // namespace Protocol
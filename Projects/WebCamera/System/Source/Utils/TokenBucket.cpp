@@ -0,0 +1,88 @@
+#include "TokenBucket.h"
+
+using Hal::Hardware;
+
+namespace Utilities
+{
+
+void TokenBucket::Configure(uint32_t bytesPerSecond, uint32_t burst)
+{
+	LockGuard guard(_lock);
+	_bytesPerSecond = bytesPerSecond;
+	_burst = static_cast<int64_t>(burst != 0 ? burst : bytesPerSecond) * Scale;
+	_tokens = _burst;
+	_lastRefill = Hardware::Instance()->Milliseconds();
+}
+
+bool TokenBucket::Admit(uint32_t length)
+{
+	TokenBucket &device = Device();
+	uint32_t now = Hardware::Instance()->Milliseconds();
+
+	LockGuard guard(_lock);
+	if (this == &device)
+		return settle(now, length, available(now));
+
+	// always taken in this order, the device bucket never locks a connection's
+	LockGuard deviceGuard(device._lock);
+	bool admitted = available(now) && device.available(now);
+	device.settle(now, length, admitted);
+	return settle(now, length, admitted);
+}
+
+TokenBucket::Statistics TokenBucket::GetStatistics()
+{
+	LockGuard guard(_lock);
+	roll(Hardware::Instance()->Milliseconds());
+	return _statistics;
+}
+
+TokenBucket &TokenBucket::Device()
+{
+	static TokenBucket device;
+	return device;
+}
+
+bool TokenBucket::available(uint32_t now)
+{
+	if (_bytesPerSecond == 0)
+		return true;
+
+	uint32_t elapsed = now - _lastRefill;
+	_lastRefill = now;
+	_tokens += static_cast<int64_t>(_bytesPerSecond) * elapsed;
+	if (_tokens > _burst)
+		_tokens = _burst;
+	return _tokens >= 0;
+}
+
+bool TokenBucket::settle(uint32_t now, uint32_t length, bool admitted)
+{
+	roll(now);
+	if (admitted == false)
+	{
+		_statistics.Dropped++;
+		return false;
+	}
+
+	if (_bytesPerSecond != 0)
+		_tokens -= static_cast<int64_t>(length) * Scale;
+	_windowBytes += length;
+	_statistics.Passed++;
+	_statistics.Bytes += length;
+	return true;
+}
+
+void TokenBucket::roll(uint32_t now)
+{
+	uint32_t elapsed = now - _windowStart;
+	if (elapsed < RateWindow)
+		return;
+
+	// an idle gap is averaged in, the rate falls off instead of holding the last busy second
+	_statistics.Rate = static_cast<uint64_t>(_windowBytes) * 1000 / elapsed;
+	_windowBytes = 0;
+	_windowStart = now;
+}
+
+} // namespace Utilities
@@ -25,6 +25,8 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "rom/queue.h"
 
 #include "esp_log.h"
@@ -37,6 +39,17 @@
 
 #define HTTP_PARSE_BUF_MAX_LEN 256
 
+/* Persistent connections: how long an idle connection is kept, how often the
+ * single server task looks for other clients meanwhile, and how many requests
+ * one connection may make before it has to reconnect.
+ */
+#define HTTP_KEEPALIVE_IDLE_TIMEOUT_MS  5000
+#define HTTP_KEEPALIVE_POLL_MS          50
+#define HTTP_KEEPALIVE_MAX_REQUESTS     100
+
+/* How long an accepted connection may wait for a free worker before it gets a 503 */
+#define HTTP_DISPATCH_TIMEOUT_MS        1000
+
 typedef enum {
     HTTP_PARSING_URI,                //!< HTTP_PARSING_URI
     HTTP_PARSING_HEADER_NAME,        //!< HTTP_PARSING_HEADER_NAME
@@ -89,8 +102,16 @@ struct http_context_ {
     const char* data_ptr;
     size_t data_size;
     http_header_list_t request_args;
+    bool keep_alive;
+    bool detached;
 };
 
+typedef struct http_worker_ {
+    http_server_t server;
+    TaskHandle_t task;
+    struct http_context_ connection_context;
+} http_worker_t;
+
 
 struct http_server_context_ {
     int port;
@@ -100,7 +121,11 @@ struct http_server_context_ {
     EventGroupHandle_t start_done;
     SLIST_HEAD(, http_handler_t) handlers;
     _lock_t handlers_lock;
-    struct http_context_ connection_context;
+    http_server_options_t options;
+    QueueHandle_t connection_queue;     /* accepted netconns waiting for a worker */
+    SemaphoreHandle_t workers_done;     /* given by every worker that exits */
+    int worker_count;
+    http_worker_t* workers;
 };
 
 #define SERVER_STARTED_BIT BIT(0)
@@ -203,10 +228,15 @@ static bool invoke_handler(http_context_t ctx, int event)
 }
 
 
+static void uri_done(http_context_t ctx);
+
 static int http_headers_done_cb(http_parser* parser)
 {
     http_context_t ctx = (http_context_t) parser->data;
-    if (ctx->state == HTTP_PARSING_HEADER_VALUE) {
+    if (ctx->state == HTTP_PARSING_URI) {
+        /* request without any headers */
+        uri_done(ctx);
+    } else if (ctx->state == HTTP_PARSING_HEADER_VALUE) {
         header_value_done(ctx);
     }
     invoke_handler(ctx, HTTP_HANDLE_HEADERS);
@@ -356,6 +386,8 @@ static int http_message_done_cb(http_parser* parser)
     ESP_LOGV(TAG, "%s", __func__);
     http_context_t ctx = (http_context_t) parser->data;
     ctx->state = HTTP_REQUEST_DONE;
+    /* stop here, a pipelined request behind this one is parsed once this one is answered */
+    http_parser_pause(parser, 1);
     return 0;
 }
 
@@ -466,6 +498,13 @@ static esp_err_t http_send_response_headers(http_context_t http_ctx)
     /* response_code may be == 0, if we are sending headers for multipart
      * response part. In this case, don't send the response code line.
      */
+    if (http_ctx->response_code > 0) {
+        /* without a length the client only finds the end of the body when the connection closes */
+        if (http_ctx->expected_response_size == HTTP_RESPONSE_SIZE_UNKNOWN) {
+            http_ctx->keep_alive = false;
+        }
+        http_response_set_header(http_ctx, "Connection", http_ctx->keep_alive ? "keep-alive" : "close");
+    }
     if (http_ctx->response_code > 0) {
         total_headers_size += 16 /* HTTP/1.1, code, CRLF */
                 + strlen(http_response_code_to_str(http_ctx->response_code));
@@ -626,9 +665,11 @@ esp_err_t http_response_set_header(http_context_t http_ctx, const char* name, co
 
 static void http_send_not_found_response(http_context_t http_ctx)
 {
-    http_response_begin(http_ctx, 404, "text/plain", HTTP_RESPONSE_SIZE_UNKNOWN);
+    static const char body[] = "Not found";
+    http_response_begin(http_ctx, 404, "text/plain", sizeof(body) - 1);
     const http_buffer_t buf = {
-            .data = "Not found",
+            .data = body,
+            .size = sizeof(body) - 1,
             .data_is_persistent = true
     };
     http_response_write(http_ctx, &buf);
@@ -647,27 +688,92 @@ static const char* http_response_code_to_str(int code)
         case 404: return "Not Found";
         case 405: return "Method Not Allowed";
         case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
         default:  return "";
       }
 }
 
 
-static void http_handle_connection(http_server_t server, struct netconn *conn)
+static void http_request_reset(http_context_t ctx)
+{
+    ctx->state = HTTP_PARSING_URI;
+    clear_parse_buffer(ctx);
+    free(ctx->request_header_tmp);
+    ctx->request_header_tmp = NULL;
+    headers_list_clear(&ctx->request_headers);
+    headers_list_clear(&ctx->request_args);
+    headers_list_clear(&ctx->response_headers);
+    free(ctx->uri);
+    ctx->uri = NULL;
+    ctx->handler = NULL;
+    ctx->response_code = 0;
+    ctx->expected_response_size = 0;
+    ctx->accumulated_response_size = 0;
+}
+
+/* Answers the request the parser just completed.
+ * Returns true if the connection can carry another request.
+ */
+static bool http_respond(http_context_t ctx)
+{
+    ctx->keep_alive = http_should_keep_alive(&ctx->parser);
+    ctx->state = HTTP_COLLECTING_RESPONSE_HEADERS;
+    if (ctx->handler == NULL) {
+        http_send_not_found_response(ctx);
+    } else {
+        invoke_handler(ctx, HTTP_HANDLE_RESPONSE);
+    }
+    if (ctx->detached) {
+        return false;
+    }
+
+    /* a response that was not finished, or not as long as announced, leaves the stream unusable */
+    return ctx->keep_alive
+            && ctx->state == HTTP_DONE
+            && ctx->expected_response_size != HTTP_RESPONSE_SIZE_UNKNOWN
+            && ctx->expected_response_size == ctx->accumulated_response_size;
+}
+
+/* Waits for the next request on an idle persistent connection. Gives up after the
+ * idle timeout, or as soon as an accepted client waits for a worker: a browser
+ * may keep its connection open without using it.
+ */
+static err_t http_wait_next_request(http_server_t server, struct netconn *conn, struct netbuf **inbuf)
+{
+    TickType_t start = xTaskGetTickCount();
+    netconn_set_recvtimeout(conn, HTTP_KEEPALIVE_POLL_MS);
+    for (;;) {
+        err_t err = netconn_recv(conn, inbuf);
+        if (err != ERR_TIMEOUT) {
+            netconn_set_recvtimeout(conn, HTTP_KEEPALIVE_IDLE_TIMEOUT_MS);
+            return err;
+        }
+        if (xTaskGetTickCount() - start >= pdMS_TO_TICKS(HTTP_KEEPALIVE_IDLE_TIMEOUT_MS)
+                || uxQueueMessagesWaiting(server->connection_queue) > 0) {
+            return ERR_TIMEOUT;
+        }
+    }
+}
+
+/* Serves requests on conn until either side closes it.
+ * Returns false if a handler detached the connection, it must not be deleted then.
+ */
+static bool http_handle_connection(http_context_t ctx, struct netconn *conn)
 {
     struct netbuf *inbuf = NULL;
     char *buf;
     u16_t buflen;
     err_t err = ERR_OK;
-
-    /* Single threaded server, one context only */
-    http_context_t ctx = &server->connection_context;
+    int served = 0;
+    bool idle = false;
+    bool done = false;
 
     /* Initialize context */
-    ctx->state = HTTP_PARSING_URI;
     ctx->conn = conn;
+    ctx->detached = false;
     http_parser_init(&ctx->parser, HTTP_REQUEST);
     ctx->parser.data = ctx;
-    ctx->server = server;
+    http_request_reset(ctx);
 
     const http_parser_settings parser_settings = {
             .on_url = &http_url_cb,
@@ -678,46 +784,126 @@ static void http_handle_connection(http_server_t server, struct netconn *conn)
             .on_message_complete = &http_message_done_cb
     };
 
-    while (ctx->state != HTTP_REQUEST_DONE) {
-        err = netconn_recv(conn, &inbuf);
-        if (err != ERR_OK) {
-            break;
-        }
+    /* a client that connects and sends nothing does not hold the server forever */
+    netconn_set_recvtimeout(conn, HTTP_KEEPALIVE_IDLE_TIMEOUT_MS);
 
-        err = netbuf_data(inbuf, (void**) &buf, &buflen);
+    while (!done) {
+        if (idle) {
+            err = http_wait_next_request(ctx->server, conn, &inbuf);
+        } else {
+            err = netconn_recv(conn, &inbuf);
+        }
         if (err != ERR_OK) {
             break;
         }
 
-        size_t parsed_bytes = http_parser_execute(&ctx->parser, &parser_settings, buf, buflen);
-        if (parsed_bytes < buflen) {
-            break;
-        }
+        /* a netbuf may be a chain of fragments, and hold more than one request */
+        do {
+            netbuf_data(inbuf, (void**) &buf, &buflen);
+            while (buflen > 0 && !done) {
+                idle = false;
+                size_t parsed_bytes = http_parser_execute(&ctx->parser, &parser_settings, buf, buflen);
+                if (HTTP_PARSER_ERRNO(&ctx->parser) == HPE_PAUSED) {
+                    served++;
+                    done = !http_respond(ctx) || served >= HTTP_KEEPALIVE_MAX_REQUESTS;
+                    http_parser_pause(&ctx->parser, 0);
+                    http_request_reset(ctx);
+                    idle = true;
+                } else if (parsed_bytes < buflen) {
+                    ESP_LOGD(TAG, "parse error: %s", http_errno_name(HTTP_PARSER_ERRNO(&ctx->parser)));
+                    done = true;
+                }
+                buf += parsed_bytes;
+                buflen -= parsed_bytes;
+            }
+        } while (!done && netbuf_next(inbuf) >= 0);
+
+        netbuf_delete(inbuf);
+        inbuf = NULL;
     }
 
-    if (err == ERR_OK) {
-        ctx->state = HTTP_COLLECTING_RESPONSE_HEADERS;
-        if (ctx->handler == NULL) {
-            http_send_not_found_response(ctx);
-        } else {
-            invoke_handler(ctx, HTTP_HANDLE_RESPONSE);
+    http_request_reset(ctx);
+    if (ctx->detached) {
+        /* whatever else the client pipelined belongs to the new owner, or is lost */
+        return false;
+    }
+    if (err != ERR_CLSD) {
+        netconn_close(conn);
+    }
+    return true;
+}
+
+struct netconn* http_response_detach(http_context_t http_ctx)
+{
+    if (http_ctx->state == HTTP_COLLECTING_RESPONSE_HEADERS && http_ctx->response_code > 0) {
+        if (http_send_response_headers(http_ctx) != ESP_OK) {
+            return NULL;
         }
     }
+    struct netconn* conn = http_ctx->conn;
+    netconn_set_recvtimeout(conn, 0);
+    http_ctx->detached = true;
+    http_ctx->conn = NULL;
+    return conn;
+}
 
-    headers_list_clear(&ctx->request_headers);
-    headers_list_clear(&ctx->request_args);
+static void http_worker(void *arg)
+{
+    http_worker_t* worker = (http_worker_t*) arg;
+    http_server_t server = worker->server;
+    struct netconn *conn;
 
-    free(ctx->uri);
-    ctx->uri = NULL;
-    ctx->handler = NULL;
-    if (err != ERR_CLSD) {
-        netconn_close(conn);
+    /* a NULL connection tells the worker to exit */
+    while (xQueueReceive(server->connection_queue, &conn, portMAX_DELAY) == pdTRUE && conn != NULL) {
+        if (http_handle_connection(&worker->connection_context, conn)) {
+            netconn_delete(conn);
+        }
     }
-    if (inbuf) {
-        netbuf_delete(inbuf);
+    xSemaphoreGive(server->workers_done);
+    vTaskDelete(NULL);
+}
+
+static void http_stop_workers(http_server_t ctx, int count)
+{
+    struct netconn *stop = NULL;
+    for (int i = 0; i < count; ++i) {
+        xQueueSend(ctx->connection_queue, &stop, portMAX_DELAY);
+    }
+    for (int i = 0; i < count; ++i) {
+        xSemaphoreTake(ctx->workers_done, portMAX_DELAY);
     }
 }
 
+static int http_start_workers(http_server_t ctx)
+{
+    int started = 0;
+    for (; started < ctx->worker_count; ++started) {
+        http_worker_t* worker = &ctx->workers[started];
+        worker->server = ctx;
+        worker->connection_context.server = ctx;
+        int ret = xTaskCreatePinnedToCore(&http_worker, "httpd_worker",
+                ctx->options.task_stack_size, worker,
+                ctx->options.task_priority,
+                &worker->task,
+                ctx->options.task_affinity);
+        if (ret != pdPASS) {
+            break;
+        }
+    }
+    return started;
+}
+
+/* Sent when every worker stays busy, long running handlers should detach */
+static void http_reject_connection(struct netconn *conn)
+{
+    static const char response[] = "HTTP/1.1 503 Service Unavailable\r\n"
+            "Content-length: 0\r\n"
+            "Connection: close\r\n\r\n";
+    netconn_write(conn, response, sizeof(response) - 1, NETCONN_NOCOPY);
+    netconn_close(conn);
+    netconn_delete(conn);
+}
+
 
 static void http_server(void *arg)
 {
@@ -739,16 +925,27 @@ static void http_server(void *arg)
     if (err != ERR_OK) {
         goto out;
     }
+
+    int workers = http_start_workers(ctx);
+    if (workers < ctx->worker_count) {
+        http_stop_workers(ctx, workers);
+        err = ERR_MEM;
+        goto out;
+    }
     xEventGroupSetBits(ctx->start_done, SERVER_STARTED_BIT);
 
     do {
         err = netconn_accept(ctx->server_conn, &client_conn);
         if (err == ERR_OK) {
-            http_handle_connection(ctx, client_conn);
-            netconn_delete(client_conn);
+            if (xQueueSend(ctx->connection_queue, &client_conn, pdMS_TO_TICKS(HTTP_DISPATCH_TIMEOUT_MS)) != pdTRUE) {
+                ESP_LOGW(TAG, "all %d workers busy, connection rejected", ctx->worker_count);
+                http_reject_connection(client_conn);
+            }
         }
     } while (err == ERR_OK);
 
+    http_stop_workers(ctx, workers);
+
 out:
     if (ctx->server_conn) {
         netconn_close(ctx->server_conn);
@@ -761,6 +958,21 @@ out:
     vTaskDelete(NULL);
 }
 
+static void http_server_free(http_server_t ctx)
+{
+    if (ctx->connection_queue) {
+        vQueueDelete(ctx->connection_queue);
+    }
+    if (ctx->workers_done) {
+        vSemaphoreDelete(ctx->workers_done);
+    }
+    if (ctx->start_done) {
+        vEventGroupDelete(ctx->start_done);
+    }
+    free(ctx->workers);
+    free(ctx);
+}
+
 esp_err_t http_server_start(const http_server_options_t* options, http_server_t* out_server)
 {
     http_server_t ctx = calloc(1, sizeof(*ctx));
@@ -769,9 +981,15 @@ esp_err_t http_server_start(const http_server_options_t* options, http_server_t*
     }
 
     ctx->port = options->port;
+    ctx->options = *options;
+    ctx->worker_count = MAX(options->worker_count, 1);
+    ctx->workers = calloc(ctx->worker_count, sizeof(http_worker_t));
+    ctx->connection_queue = xQueueCreate(ctx->worker_count, sizeof(struct netconn*));
+    ctx->workers_done = xSemaphoreCreateCounting(ctx->worker_count, 0);
     ctx->start_done = xEventGroupCreate();
-    if (ctx->start_done == NULL) {
-        free(ctx);
+    if (ctx->workers == NULL || ctx->connection_queue == NULL
+            || ctx->workers_done == NULL || ctx->start_done == NULL) {
+        http_server_free(ctx);
         return ESP_ERR_NO_MEM;
     }
 
@@ -781,8 +999,7 @@ esp_err_t http_server_start(const http_server_options_t* options, http_server_t*
             &ctx->task,
             options->task_affinity);
     if (ret != pdPASS) {
-        vEventGroupDelete(ctx->start_done);
-        free(ctx);
+        http_server_free(ctx);
         return ESP_ERR_NO_MEM;
     }
 
@@ -790,8 +1007,7 @@ esp_err_t http_server_start(const http_server_options_t* options, http_server_t*
     if (bits & SERVER_DONE_BIT) {
         /* Error happened, task is deleted */
         esp_err_t err = lwip_err_to_esp_err(ctx->server_task_err);
-        vEventGroupDelete(ctx->start_done);
-        free(ctx);
+        http_server_free(ctx);
         return err;
     }
 
@@ -804,6 +1020,6 @@ esp_err_t http_server_stop(http_server_t server)
     /* FIXME: figure out a thread safe way to do this */
     netconn_close(server->server_conn);
     xEventGroupWaitBits(server->start_done, SERVER_DONE_BIT, 0, 0, portMAX_DELAY);
-    free(server);
+    http_server_free(server);
     return ESP_OK;
 }
@@ -56,6 +56,7 @@ typedef struct {
     int task_affinity;      /*!< Server task affinity (CPU number of tskNO_AFFINITY */
     int task_stack_size;    /*!< Server task stack size, in bytes */
     int task_priority;      /*!< Server task priority */
+    int worker_count;       /*!< Number of connections served at once, each by its own task with the settings above */
 } http_server_options_t;
 
 /** Default initializer for http_server_options_t */
@@ -64,6 +65,7 @@ typedef struct {
     .task_affinity = tskNO_AFFINITY, \
     .task_stack_size = 4096, \
     .task_priority = 1, \
+    .worker_count = 2, \
 }
 
 /**
@@ -286,6 +288,25 @@ esp_err_t http_response_write(http_context_t http_ctx, const http_buffer_t* buff
  */
 esp_err_t http_response_end(http_context_t http_ctx);
 
+struct netconn;
+
+/**
+ * @brief Take the connection away from the server, to keep streaming from another task
+ *
+ * Meant for long running responses such as MJPEG streams, which would otherwise
+ * occupy a worker for as long as the client watches. Response headers that were
+ * not sent yet are sent first. Once the handler returns, the worker goes on with
+ * the next connection and never touches this one again.
+ *
+ * The caller writes to the connection with netconn_write, and has to
+ * netconn_close and netconn_delete it when done. http_ctx must not be used
+ * after the handler returns.
+ *
+ * @param http_ctx  context passed to the handler
+ * @return the connection, or NULL if the headers could not be sent
+ */
+struct netconn* http_response_detach(http_context_t http_ctx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -13,6 +13,7 @@ COMPONENT_SRCDIRS           +=  ../../Esp32/Source/Hal
                                 ../../Esp32/Source/Hal/Camera/Conversions                  \
                                 ../../Esp32/Source/Hal/Camera/Driver                       \
                                 ../../Esp32/Source/Hal/Camera/Sensors                      \
+                                ../../Esp32/Source/Hal/Camera/Analytics                    \
                                 ../../Esp32/Source/Hal/Wifi                                \
                                 ../System/Source/Utils                                     \
                                 ../System/Source/Configuration                             \
@@ -25,6 +26,7 @@ COMPONENT_ADD_INCLUDEDIRS   +=  ${IDF_PATH}/components/
                                 ../../Esp32/Include/Hal/Camera/Conversions                 \
                                 ../../Esp32/Include/Hal/Camera/Driver                      \
                                 ../../Esp32/Include/Hal/Camera/Sensors                     \
+                                ../../Esp32/Include/Hal/Camera/Analytics                   \
                                 ../../Esp32/Include/Hal/Wifi                               \
                                 ../System/Include/Utils                                    \
                                 ../System/Include/Configuration                            \